@@ -0,0 +1,82 @@
+import glob
+import os
+import re
+import resource
+import subprocess
+import sys
+
+# 配置
+CompilerProgram = "./kbasic.exe"
+BenchmarkDir = "benchmarks"
+RepeatTimes = 7
+
+# 参与对比的虚拟机，第一个作为基准，flags 是编译字节码时的额外参数
+Variants = [
+  { "name": "switch",   "program": "./kbasic_switch.exe", "flags": [] },
+  { "name": "threaded", "program": "./kbasic.exe",        "flags": [] },
+  { "name": "register", "program": "./kbasic.exe",        "flags": ["-r"] },
+]
+
+# --stats 输出的统计信息
+StatsPattern = re.compile(r"\[stats\] opcodes: (\d+), allocs: (\d+)")
+
+def compileScript(scriptPath, flags):
+  binaryPath = os.path.splitext(scriptPath)[0] + "".join(flags) + ".kbn"
+  subprocess.check_call([CompilerProgram, "-c", scriptPath, "-o", binaryPath] + flags)
+  return binaryPath
+
+def childCpuTime():
+  usage = resource.getrusage(resource.RUSAGE_CHILDREN)
+  return usage.ru_utime + usage.ru_stime
+
+def runOnce(program, binaryPath):
+  # 统计子进程的 CPU 时间，包含进程启动和加载，脚本需要跑得足够久
+  startTime = childCpuTime()
+  result = subprocess.run(
+    [program, "-e", binaryPath, "-s"],
+    stdout=subprocess.DEVNULL,
+    stderr=subprocess.PIPE
+  )
+  elapsed = childCpuTime() - startTime
+  match = StatsPattern.search(result.stderr.decode("utf-8"))
+  if result.returncode != 0 or not match:
+    raise RuntimeError("{0} failed on {1}".format(program, binaryPath))
+  return elapsed, int(match.group(1)), int(match.group(2))
+
+def runBenchmark(scriptPath):
+  results = []
+  for variant in Variants:
+    binaryPath = compileScript(scriptPath, variant["flags"])
+    # 取多次运行的最短时间
+    bestTime = None
+    for i in range(RepeatTimes):
+      elapsed, numOpCodes, numAllocs = runOnce(variant["program"], binaryPath)
+      if bestTime is None or elapsed < bestTime:
+        bestTime = elapsed
+    results.append((bestTime, numOpCodes, numAllocs))
+    os.remove(binaryPath)
+  return results
+
+def main():
+  scripts = sorted(glob.glob(os.path.join(BenchmarkDir, "*.kbs")))
+  if len(sys.argv) > 1:
+    scripts = [s for s in scripts if any(name in s for name in sys.argv[1:])]
+
+  header = "{0:<20}".format("script")
+  for variant in Variants:
+    header += " {0:>12} {1:>12}".format(variant["name"] + " ops", variant["name"] + " ms")
+  header += " {0:>8}".format("speedup")
+  print(header)
+  print("-" * len(header))
+
+  for scriptPath in scripts:
+    results = runBenchmark(scriptPath)
+    line = "{0:<20}".format(os.path.basename(scriptPath))
+    for bestTime, numOpCodes, _ in results:
+      line += " {0:>12} {1:>12.1f}".format(numOpCodes, bestTime * 1000)
+    # 最后一个相对第一个虚拟机的加速比
+    line += " {0:>7.2f}x".format(results[0][0] / results[-1][0])
+    print(line)
+
+if __name__ == "__main__":
+  main()
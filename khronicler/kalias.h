@@ -30,6 +30,7 @@
 #define getAstTypeNameById  KAst_GetNameById
 #define destroyAst          KAstNode_Destroy
 #define parseAsAst          KSourceParser_Parse
+#define optimizeAst         KAstOptimizer_Optimize
 #define AstFuncParam        KbAstFuncParam
 #define AstNode             KbAstNode
 #define Parser              KbSourceParser
@@ -39,7 +40,10 @@
 #define createContext       KompilerContext_Create
 #define destroyContext      KompilerContext_Destroy
 #define buildContext        KompilerContext_Build
+#define optimizeContextOpCodes KompilerContext_OptimizeOpCodes
+#define fuseContextOpCodes  KompilerContext_FuseOpCodes
 #define serializeContext    KompilerContext_Serialize
+#define serializeContextReg KompilerContext_SerializeRegister
 #define Context             KbCompilerContext
 #define FuncDecl            KbFunctionDeclaration
 #define VarDecl             KbVariableDeclaration
@@ -48,23 +52,46 @@
 #define ExtFunc             KbExtensionFunction
 
 #define getOpCodeName           Kommon_GetOpCodeName
+#define getRegOpCodeName        Kommon_GetRegOpCodeName
 #define getOperatorPriorityById Kommon_GetOperatorPriorityById
 #define getOperatorNameById     Kommon_GetOperatorNameById
 #define getVarDeclTypeNameById  Kommon_GetVarDeclTypeName
+#define getFuncEndPositions     Kommon_GetFuncEndPositions
 #define getExtErrMsg            KExtensionError_GetMessageById
 #define BinHeader               KbBinaryHeader
 #define BinFuncInfo             KbBinaryFunctionInfo
+#define BinExtFuncInfo          KbBinaryExtFuncInfo
+#define RegOpCode               KbRegOpCode
 
 #define getRtValueTypeName  KRuntimeValue_GetTypeNameById
 #define stringifyRtValue    KRuntimeValue_Stringify
 #define getRuntimeErrMsg    KRuntimeError_GetMessageById
 #define getRuntimeErrName   KRuntimeError_GetNameById
 #define createMachine       KRuntime_CreateMachine
+#define createMachineEx     KRuntime_CreateMachineEx
+#define resetMachine        KRuntime_ResetMachine
 #define destroyMachine      KRuntime_DestroyMachine
 #define executeMachine      KRuntime_MachineExecute
+#define executeMachineBudget KRuntime_MachineExecuteBudget
+#define resumeMachine       KRuntime_MachineResume
+#define setStackDepthMax    KRuntime_SetStackDepthMax
+#define setRandSeed         KRuntime_SetRandSeed
+#define bindExtFunc         KRuntime_BindExtFunc
+#define enableProfile       KRuntime_EnableProfile
+#define setRtStringValue    KRuntime_SetStringValue
+#define saveSnapshot        KRuntime_SaveSnapshot
+#define restoreSnapshot     KRuntime_RestoreSnapshot
+#define setMemoryLimit      KRuntime_SetMemoryLimit
+#define getMemStats         KRuntime_GetMemStats
 #define Machine             KbVirtualMachine
 #define RtValue             KbRuntimeValue
 #define CallEnv             KbCallEnv
+#define FrameChunk          KbFrameChunk
+#define Arena               KbArena
+#define ArenaConfig         KbArenaConfig
+#define MemStats            KbMemStats
+#define ExtFuncBinding      KbExtFuncBinding
 #define RuntimeArray        KbRuntimeArray
+#define RtString            KbRuntimeString
 
 #endif
\ No newline at end of file
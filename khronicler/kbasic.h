@@ -3,6 +3,7 @@
 
 #include "klexer.h"
 #include "kparser.h"
+#include "koptimizer.h"
 #include "kompiler.h"
 #include "krt.h"
 
@@ -25,7 +25,8 @@ static const KeywordIdMapItem KeywordsIdMap[] = {
     { KB_KEYWORD_END,       KBKID_END       },
     { KB_KEYWORD_RETURN,    KBKID_RETURN    },
     { KB_KEYWORD_FUNC,      KBKID_FUNC      },
-    { KB_KEYWORD_EXIT,      KBKID_EXIT      }
+    { KB_KEYWORD_EXIT,      KBKID_EXIT      },
+    { KB_KEYWORD_YIELD,     KBKID_YIELD     }
 };
 
 static int getKeywordIdFromString(const char *szText) {
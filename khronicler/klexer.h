@@ -21,6 +21,7 @@
 #define KB_KEYWORD_RETURN   "return"
 #define KB_KEYWORD_FUNC     "func"
 #define KB_KEYWORD_EXIT     "exit"
+#define KB_KEYWORD_YIELD    "yield"
 
 typedef enum tagKbKeywordIdType {
     KBKID_NONE = 0,
@@ -41,7 +42,8 @@ typedef enum tagKbKeywordIdType {
     KBKID_END,
     KBKID_RETURN,
     KBKID_FUNC,
-    KBKID_EXIT
+    KBKID_EXIT,
+    KBKID_YIELD
 } KbKeywordIdType;
 
 typedef enum tagKbTokenType {
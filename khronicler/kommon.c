@@ -1,3 +1,4 @@
+#include <stdlib.h>
 #include "kommon.h"
 
 const struct {
@@ -40,16 +41,62 @@ const char* Kommon_GetOpCodeName(OpCodeId iOpCodeId) {
         "ARR_GET",
         "ARR_SET",
         "CALL_BUILT_IN",
+        "CALL_EXT",
         "GOTO",
         "IF_GOTO",
         "UNLESS_GOTO",
         "CALL_FUNC",
         "RETURN",
-        "STOP"
+        "STOP",
+        "YIELD",
+        "PUSH_INT",
+        "VAR_NUM_BINOP",
+        "NUM_VAR_BINOP",
+        "VAR_VAR_BINOP",
+        "VAR_NUM_CMP_UNLESS_GOTO",
+        "NUM_VAR_CMP_UNLESS_GOTO",
+        "VAR_VAR_CMP_UNLESS_GOTO",
+        "INC_VAR",
+        "INT_VAR_BINOP",
+        "INT_VAR_CMP_UNLESS_GOTO",
+        "INC_VAR_INT",
+        "ADD_NUM_NUM",
+        "SUB_NUM_NUM",
+        "MUL_NUM_NUM",
+        "DIV_NUM_NUM",
+        "EQ_NUM_NUM",
+        "NEQ_NUM_NUM",
+        "GT_NUM_NUM",
+        "LT_NUM_NUM",
+        "GTEQ_NUM_NUM",
+        "LTEQ_NUM_NUM"
     };
     return SZ_OPCODE_NAME[iOpCodeId];
 }
 
+const char* Kommon_GetRegOpCodeName(RegOpCodeId iRegOpCodeId) {
+    static const char* SZ_REG_OPCODE_NAME[] = {
+        "NONE",
+        "MOVE",
+        "BINARY_OPERATOR",
+        "UNARY_OPERATOR",
+        "SET_VAR_AS_ARRAY",
+        "ARR_GET",
+        "ARR_SET",
+        "CALL_BUILT_IN",
+        "CALL_EXT",
+        "GOTO",
+        "IF_GOTO",
+        "UNLESS_GOTO",
+        "CMP_UNLESS_GOTO",
+        "CALL_FUNC",
+        "RETURN",
+        "STOP",
+        "YIELD"
+    };
+    return SZ_REG_OPCODE_NAME[iRegOpCodeId];
+}
+
 int Kommon_GetOperatorPriorityById(OperatorId iOprId) {
     return OperatorIdMetaMap[iOprId].iPriority;
 }
@@ -84,3 +131,104 @@ const char* KExtensionError_GetMessageById(ExtensionErrorId iExtErrorId) {
     if (iExtErrorId < 0 || iExtErrorId > EXT_UNRECOGNIZED) return "N/A";
     return EXTENSION_ERROR_MSG[iExtErrorId];
 }
+
+#define K_FLOW_NEXT     0   /* 顺序执行下一条 */
+#define K_FLOW_BRANCH   1   /* 条件跳转，也可能执行下一条 */
+#define K_FLOW_JUMP     2   /* 无条件跳转 */
+#define K_FLOW_END      3   /* RETURN / STOP */
+
+/* 指令的控制流类型，跳转时写入跳转位置；超级指令后面的原始指令保持不变，按顺序执行处理即可 */
+static int getOpCodeFlow(const void* pOpCodeBlock, KBool bIsRegister, int iPos, int* pIntTarget) {
+    if (bIsRegister) {
+        const KbRegOpCode* pRegOp = (const KbRegOpCode *)pOpCodeBlock + iPos;
+        switch (pRegOp->bOpCodeId) {
+            case K_REG_OPCODE_GOTO:
+                *pIntTarget = (int)pRegOp->uImm.dwOpCodePos;
+                return K_FLOW_JUMP;
+            case K_REG_OPCODE_IF_GOTO:
+            case K_REG_OPCODE_UNLESS_GOTO:
+                *pIntTarget = (int)pRegOp->uImm.dwOpCodePos;
+                return K_FLOW_BRANCH;
+            case K_REG_OPCODE_CMP_UNLESS_GOTO:
+                *pIntTarget = (int)pRegOp->wDst;
+                return K_FLOW_BRANCH;
+            case K_REG_OPCODE_RETURN:
+            case K_REG_OPCODE_STOP:
+                return K_FLOW_END;
+        }
+    } else {
+        const OpCode* pOpCode = (const OpCode *)pOpCodeBlock + iPos;
+        switch (pOpCode->dwOpCodeId) {
+            case K_OPCODE_GOTO:
+                *pIntTarget = (int)pOpCode->uParam.dwOpCodePos;
+                return K_FLOW_JUMP;
+            case K_OPCODE_IF_GOTO:
+            case K_OPCODE_UNLESS_GOTO:
+                *pIntTarget = (int)pOpCode->uParam.dwOpCodePos;
+                return K_FLOW_BRANCH;
+            case K_OPCODE_RETURN:
+            case K_OPCODE_STOP:
+                return K_FLOW_END;
+        }
+    }
+    return K_FLOW_NEXT;
+}
+
+/*
+ * 计算每个函数体的结束位置 (不包含)
+ * 函数体从入口开始，到下一个函数的入口或者下一段主程序代码为止，
+ * 主程序代码是从 0 开始、不经过函数调用能执行到的指令
+ * 不依赖函数前跳过函数体的 GOTO，窥孔优化可能会删除它
+ */
+void Kommon_GetFuncEndPositions(
+    const void*                 pOpCodeBlock,
+    KBool                       bIsRegister,
+    int                         iNumOpCodes,
+    const KbBinaryFunctionInfo* pArrFuncInfo,
+    int                         iNumFunc,
+    int*                        pArrEndPos
+) {
+    KBool*  pArrIsMain  = (KBool *)calloc(iNumOpCodes + 1, sizeof(KBool));
+    int*    pArrWork    = (int *)malloc(sizeof(int) * (iNumOpCodes + 1));
+    int     iNumWork    = 0;
+    int     i, j;
+
+    /* 标记主程序能执行到的指令，每条指令只标记一次，工作表不会超过指令数量 */
+    pArrWork[iNumWork++] = 0;
+    while (iNumWork > 0) {
+        int iPos = pArrWork[--iNumWork];
+        while (iPos >= 0 && iPos < iNumOpCodes && !pArrIsMain[iPos]) {
+            int iTarget = -1;
+            int iFlow   = getOpCodeFlow(pOpCodeBlock, bIsRegister, iPos, &iTarget);
+            pArrIsMain[iPos] = KB_TRUE;
+            if ((iFlow == K_FLOW_BRANCH || iFlow == K_FLOW_JUMP) && iTarget >= 0 && iTarget < iNumOpCodes && !pArrIsMain[iTarget]) {
+                pArrWork[iNumWork++] = iTarget;
+            }
+            if (iFlow == K_FLOW_JUMP || iFlow == K_FLOW_END) {
+                break;
+            }
+            iPos++;
+        }
+    }
+
+    for (i = 0; i < iNumFunc; ++i) {
+        int iStart  = (int)pArrFuncInfo[i].dwOpCodePos;
+        int iEnd    = iNumOpCodes;
+        for (j = 0; j < iNumFunc; ++j) {
+            int iOtherStart = (int)pArrFuncInfo[j].dwOpCodePos;
+            if (iOtherStart > iStart && iOtherStart < iEnd) {
+                iEnd = iOtherStart;
+            }
+        }
+        for (j = iStart + 1; j < iEnd; ++j) {
+            if (pArrIsMain[j]) {
+                iEnd = j;
+                break;
+            }
+        }
+        pArrEndPos[i] = iEnd;
+    }
+
+    free(pArrWork);
+    free(pArrIsMain);
+}
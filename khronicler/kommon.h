@@ -40,12 +40,39 @@ typedef int             KLabelOpCodePos;
 /* 全局变量或者局部变量最大数值 */
 #define KB_CONTEXT_VAR_MAX              32
 
-/* 二进制文件中字符串常量池的最大长度 */
-#define KB_CONTEXT_STRING_POOL_MAX      500
+/* 二进制文件中字符串常量池的最大长度，编译时常量池按需扩容 */
+#define KB_CONTEXT_STRING_POOL_MAX      0x10000000
 
 /* 脚本使用的拓展 Id */
 #define KB_HEADER_EXT_ID_MAX_LENGTH     15
 
+/* 虚拟机操作数栈的初始容量 */
+#define KB_RT_STACK_INIT_SIZE           64
+
+/* 虚拟机操作数栈默认的最大深度 */
+#define KB_RT_STACK_DEPTH_MAX           4096
+
+/* 虚拟机调用帧栈的初始容量 */
+#define KB_RT_CALL_ENV_INIT_SIZE        16
+
+/* 局部变量分段的默认槽位数 */
+#define KB_RT_FRAME_CHUNK_SIZE          1024
+
+/* 性能分析按指令类型统计的数组大小，不小于栈指令和寄存器指令的数量 */
+#define KB_RT_PROFILE_NUM_OPCODE        48
+
+/* arena 最小的分级大小 (字节)，每一级翻倍 */
+#define KB_RT_ARENA_MIN_BLOCK           16
+
+/* arena 的分级数量，最大的分级是 KB_RT_ARENA_MIN_BLOCK << (KB_RT_ARENA_NUM_CLASS - 1) */
+#define KB_RT_ARENA_NUM_CLASS           10
+
+/* 新建的字符串缓冲区预留的追加空间 */
+#define KB_RT_STRING_RESERVE             16
+
+/* 虚拟机快照的格式版本，格式变化时递增，不同版本的快照不能恢复 */
+#define KB_RT_SNAPSHOT_VERSION          1
+
 /* 数字格式化为字符串的缓冲区大小 */
 #define K_NUMERIC_STRINGIFY_BUF_MAX     40
 
@@ -69,6 +96,7 @@ typedef struct tagKbExtensionFunction {
     char    szFuncName[KB_IDENTIFIER_LEN_MAX + 1];
     int     iNumParams;
     int     iCallId;
+    int     iIndex;     /* 在拓展函数表中的位置 */
 } KbExtensionFunction;
 
 typedef enum tagVarDeclTypeId {
@@ -125,12 +153,38 @@ typedef enum tagOpCodeId {
     K_OPCODE_ARR_GET,           /* [  is_local  ][  var_index  ] */
     K_OPCODE_ARR_SET,           /* [  is_local  ][  var_index  ] */
     K_OPCODE_CALL_BUILT_IN,     /* [     built_in_func_id      ] */
+    K_OPCODE_CALL_EXT,          /* [       ext_func_index      ] */
     K_OPCODE_GOTO,              /* [         opcode_pos        ] */
     K_OPCODE_IF_GOTO,           /* [         opcode_pos        ] */
     K_OPCODE_UNLESS_GOTO,       /* [         opcode_pos        ] */
     K_OPCODE_CALL_FUNC,         /* [       function_index      ] */
     K_OPCODE_RETURN,            /* [            n/a            ] */
     K_OPCODE_STOP,              /* [            n/a            ] */
+    K_OPCODE_YIELD,             /* [            n/a            ] */
+    K_OPCODE_PUSH_INT,          /* [      literal_integer      ] */
+    /* 超级指令: 只替换序列的第一条，参数从后续的原始指令读取 */
+    K_OPCODE_VAR_NUM_BINOP,             /* PUSH_VAR, PUSH_NUM, BINARY_OPERATOR */
+    K_OPCODE_NUM_VAR_BINOP,             /* PUSH_NUM, PUSH_VAR, BINARY_OPERATOR */
+    K_OPCODE_VAR_VAR_BINOP,             /* PUSH_VAR, PUSH_VAR, BINARY_OPERATOR */
+    K_OPCODE_VAR_NUM_CMP_UNLESS_GOTO,   /* PUSH_VAR, PUSH_NUM, BINARY_OPERATOR, UNLESS_GOTO */
+    K_OPCODE_NUM_VAR_CMP_UNLESS_GOTO,   /* PUSH_NUM, PUSH_VAR, BINARY_OPERATOR, UNLESS_GOTO */
+    K_OPCODE_VAR_VAR_CMP_UNLESS_GOTO,   /* PUSH_VAR, PUSH_VAR, BINARY_OPERATOR, UNLESS_GOTO */
+    K_OPCODE_INC_VAR,                   /* PUSH_NUM, PUSH_VAR v, ADD, SET_VAR v */
+    K_OPCODE_INT_VAR_BINOP,             /* PUSH_INT, PUSH_VAR, BINARY_OPERATOR */
+    K_OPCODE_INT_VAR_CMP_UNLESS_GOTO,   /* PUSH_INT, PUSH_VAR, BINARY_OPERATOR, UNLESS_GOTO */
+    K_OPCODE_INC_VAR_INT,               /* PUSH_INT, PUSH_VAR v, ADD, SET_VAR v */
+    /* 加速指令: 不出现在字节码文件中，虚拟机在自己的指令副本中由 BINARY_OPERATOR 改写而来 */
+    K_OPCODE_ADD_NUM_NUM,               /* [        operator_id        ] */
+    K_OPCODE_SUB_NUM_NUM,               /* [        operator_id        ] */
+    K_OPCODE_MUL_NUM_NUM,               /* [        operator_id        ] */
+    K_OPCODE_DIV_NUM_NUM,               /* [        operator_id        ] */
+    K_OPCODE_EQ_NUM_NUM,                /* [        operator_id        ] */
+    K_OPCODE_NEQ_NUM_NUM,               /* [        operator_id        ] */
+    K_OPCODE_GT_NUM_NUM,                /* [        operator_id        ] */
+    K_OPCODE_LT_NUM_NUM,                /* [        operator_id        ] */
+    K_OPCODE_GTEQ_NUM_NUM,              /* [        operator_id        ] */
+    K_OPCODE_LTEQ_NUM_NUM,              /* [        operator_id        ] */
+    K_NUM_OPCODE                /* opCode 的数量，不是有效的 opCode */
 } OpCodeId;
 
 typedef struct tagOpCode {
@@ -141,12 +195,13 @@ typedef struct tagOpCode {
             KWord wVarIndex;
         } sVarAccess;
         KFloat fLiteral;
+        int iLiteral;
         KDword dwOperatorId;
         KDword dwStringPoolPos;
         KDword dwBuiltFuncId;
+        KDword dwExtFuncIndex;
         KDword dwFuncIndex;
         KDword dwOpCodePos;
-        KLabelOpCodePos* pLabelOpCodePos;
     } uParam;
 } OpCode;
 
@@ -156,6 +211,59 @@ typedef struct tagOpCode {
 #define K_HEADER_MAGIC_BYTE_2       's'
 #define K_HEADER_MAGIC_BYTE_3       '3'
 
+/* 寄存器字节码的文件头魔法数字 'kbr3'，除了第三个字节外和栈字节码一致 */
+#define K_HEADER_REG_MAGIC_BYTE_2   'r'
+
+typedef enum tagRegOpCodeId {
+    /* RegOpCode 操作数        [  dst  ][  srcA  ][  srcB  ][  imm  ] */
+    K_REG_OPCODE_NONE = 0,
+    K_REG_OPCODE_MOVE,              /* [  dst  ][  src  ][  n/a  ][  imm  ] bOperatorId: src 是否是临时寄存器 */
+    K_REG_OPCODE_BINARY_OPERATOR,   /* [  dst  ][   a   ][   b   ][  imm  ] bOperatorId: 运算符 */
+    K_REG_OPCODE_UNARY_OPERATOR,    /* [  dst  ][   a   ][  n/a  ][  imm  ] bOperatorId: 运算符 */
+    K_REG_OPCODE_SET_VAR_AS_ARRAY,  /* [  var  ][ size  ][  n/a  ][  imm  ] */
+    K_REG_OPCODE_ARR_GET,           /* [  dst  ][  var  ][ index ][  imm  ] */
+    K_REG_OPCODE_ARR_SET,           /* [  var  ][ index ][ value ][  imm  ] bOperatorId: value 是否是临时寄存器 */
+    K_REG_OPCODE_CALL_BUILT_IN,     /* [  dst  ][  arg  ][  n/a  ][  imm  ] bOperatorId: 内置函数 Id */
+    K_REG_OPCODE_CALL_EXT,          /* [  dst  ][ args  ][  n/a  ][  ext  ] 参数在 args 开始的连续寄存器中 */
+    K_REG_OPCODE_GOTO,              /* [  n/a  ][  n/a  ][  n/a  ][  pos  ] */
+    K_REG_OPCODE_IF_GOTO,           /* [  n/a  ][ cond  ][  n/a  ][  pos  ] */
+    K_REG_OPCODE_UNLESS_GOTO,       /* [  n/a  ][ cond  ][  n/a  ][  pos  ] */
+    K_REG_OPCODE_CMP_UNLESS_GOTO,   /* [  pos  ][   a   ][   b   ][  imm  ] bOperatorId: 比较运算符 */
+    K_REG_OPCODE_CALL_FUNC,         /* [  dst  ][ args  ][  n/a  ][ func  ] 参数在 args 开始的连续寄存器中 */
+    K_REG_OPCODE_RETURN,            /* [  n/a  ][ value ][  n/a  ][  imm  ] */
+    K_REG_OPCODE_STOP,              /* [  n/a  ][ value ][  n/a  ][  imm  ] */
+    K_REG_OPCODE_YIELD,             /* [  n/a  ][ value ][  n/a  ][  imm  ] */
+    K_NUM_REG_OPCODE                /* RegOpCode 的数量，不是有效的 RegOpCode */
+} RegOpCodeId;
+
+/*
+ * 寄存器操作数: 高 2 位是类型，低 14 位是下标
+ * 立即数的值保存在指令的 uImm 中，每条指令最多一个立即数
+ */
+#define K_REG_KIND_MASK             0xC000
+#define K_REG_INDEX_MASK            0x3FFF
+#define K_REG_KIND_GLOBAL           0x0000  /* 全局变量 */
+#define K_REG_KIND_LOCAL            0x4000  /* 调用帧中的局部变量 */
+#define K_REG_KIND_IMM_NUM          0x8000  /* 数字立即数 */
+#define K_REG_KIND_IMM_STR          0xC000  /* 字符串常量池立即数 */
+#define K_REG_IMM_INTEGER           0x0001  /* 数字立即数的下标位: 立即数是整数 */
+
+typedef struct tagKbRegOpCode {
+    KByte   bOpCodeId;
+    KByte   bOperatorId;
+    KWord   wDst;
+    KWord   wSrcA;
+    KWord   wSrcB;
+    union {
+        KFloat fLiteral;
+        int iLiteral;
+        KDword dwStringPoolPos;
+        KDword dwOpCodePos;
+        KDword dwFuncIndex;
+        KDword dwExtFuncIndex;
+    } uImm;
+} KbRegOpCode;
+
 typedef struct tagKbBinaryFunctionInfo {
     char szName[KB_IDENTIFIER_LEN_MAX + 1];
     KDword dwNumParams;
@@ -163,6 +271,12 @@ typedef struct tagKbBinaryFunctionInfo {
     KDword dwOpCodePos;
 } KbBinaryFunctionInfo;
 
+/* 拓展函数表，CALL_EXT 指令的参数是表中的下标 */
+typedef struct tagKbBinaryExtFuncInfo {
+    KDword dwCallId;
+    KDword dwNumParams;
+} KbBinaryExtFuncInfo;
+
 typedef struct tagKbBinaryHeader {
     /* 文件头魔法数字，用于校验 */
     union {
@@ -183,6 +297,10 @@ typedef struct tagKbBinaryHeader {
     KDword dwFuncBlockStart;     /* 函数部分开始字节位置 */
     KDword dwNumFunc;            /* 函数数量 */
 
+    /* 拓展函数表 */
+    KDword dwExtFuncBlockStart;  /* 拓展函数表开始字节位置 */
+    KDword dwNumExtFunc;         /* 拓展函数数量 */
+
     /* opCode 部分 */
     KDword dwOpCodeBlockStart;  /* opCode 部分开始字节位置  */
     KDword dwNumOpCode;         /* opCode 数量 */
@@ -194,9 +312,14 @@ typedef struct tagKbBinaryHeader {
 
 } KbBinaryHeader;
 
+/* 是否是寄存器字节码 */
+#define K_IS_REG_BINARY(pHeader) ((pHeader)->uHeaderMagic.bVal[2] == K_HEADER_REG_MAGIC_BYTE_2)
+
 const char* Kommon_GetOpCodeName            (OpCodeId iOpCodeId);
+const char* Kommon_GetRegOpCodeName         (RegOpCodeId iRegOpCodeId);
 int         Kommon_GetOperatorPriorityById  (OperatorId iOprId);
 const char* Kommon_GetOperatorNameById      (OperatorId iOprId);
 const char* Kommon_GetVarDeclTypeName       (VarDeclTypeId iTypeId);
+void        Kommon_GetFuncEndPositions      (const void* pOpCodeBlock, KBool bIsRegister, int iNumOpCodes, const KbBinaryFunctionInfo* pArrFuncInfo, int iNumFunc, int* pArrEndPos);
 
 #endif
\ No newline at end of file
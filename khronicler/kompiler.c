@@ -42,16 +42,26 @@ static const BuiltInFunc* findBuiltInFunc(const char* szName) {
     return NULL;
 }
 
-static const ExtFunc* findExtFunc(Context* pContext, const char* szName) {
-    VlistNode* pNode;
-    /* 寻找拓展函数 */
-    for (pNode = pContext->pListExtFuncs->head; pNode; pNode = pNode->next) {
+/* 寻找拓展函数，下标是在拓展函数表中的位置 */
+static const ExtFunc* findExtFunc(Context* pContext, const char* szName, int* pIntIndex) {
+    const ExtFunc* pExtFunc = (const ExtFunc *)vhGet(pContext->pHashExtFuncs, szName);
+    if (pExtFunc) {
+        *pIntIndex = pExtFunc->iIndex;
+    }
+    return pExtFunc;
+}
+
+/* 拓展函数表由 KExtension_Parse 直接填入，编译前建立索引，重名时保留第一个 */
+static void indexExtFuncs(Context* pContext) {
+    VlistNode*  pNode;
+    int         i;
+    for (i = 0, pNode = pContext->pListExtFuncs->head; pNode; ++i, pNode = pNode->next) {
         ExtFunc* pExtFunc = (ExtFunc *)pNode->data;
-        if (IsStringEqual(pExtFunc->szFuncName, szName)) {
-            return pExtFunc;
+        pExtFunc->iIndex = i;
+        if (!vhGet(pContext->pHashExtFuncs, pExtFunc->szFuncName)) {
+            vhPut(pContext->pHashExtFuncs, pExtFunc->szFuncName, pExtFunc);
         }
     }
-    return NULL;
 }
 
 static const struct {
@@ -110,12 +120,14 @@ static FuncDecl* createFuncDecl(const char* szName, int iNumParams) {
     StringCopy(pFuncDecl->szFuncName, sizeof(pFuncDecl->szFuncName), szName);
     pFuncDecl->iNumParams       = iNumParams;
     pFuncDecl->pListVariables   = vlNewList();
+    pFuncDecl->pHashVariables   = vhNewHash();
     pFuncDecl->iOpCodeStartPos  = -1;
 
     return pFuncDecl;
 }
 
 static void destroyFuncDecl(FuncDecl* pFuncDecl) {
+    vhDestroy(pFuncDecl->pHashVariables);
     vlDestroy(pFuncDecl->pListVariables, destroyVarDeclVoidPtr);
     free(pFuncDecl);
 }
@@ -124,45 +136,60 @@ static void destroyFuncDeclVoidPtr(void* pVoidPtr) {
     destroyFuncDecl((FuncDecl *)pVoidPtr);
 }
 
-static void initControlFlowLabel(CtrlFlowLabel* pCtrlLabel, const AstNode* pAstNode) {
+/* 新建一个还没有确定位置的跳转标签，返回标签表的下标 */
+static KbLabelIndex newLabel(Context* pContext) {
+    if (pContext->iNumLabelPos >= pContext->iLabelPosCapacity) {
+        pContext->iLabelPosCapacity *= 2;
+        pContext->pArrLabelPos = (KLabelOpCodePos *)realloc(pContext->pArrLabelPos, sizeof(KLabelOpCodePos) * pContext->iLabelPosCapacity);
+    }
+    pContext->pArrLabelPos[pContext->iNumLabelPos] = -1;
+    return pContext->iNumLabelPos++;
+}
+
+/* 标签指向下一条要生成的 opCode */
+static void placeLabel(Context* pContext, KbLabelIndex iLabel) {
+    pContext->pArrLabelPos[iLabel] = pContext->iNumOpCodes;
+}
+
+static void initControlFlowLabel(Context* pContext, CtrlFlowLabel* pCtrlLabel, const AstNode* pAstNode) {
     switch (pAstNode->iType) {
         case AST_FUNCTION_DECLARE: {
             pCtrlLabel->iType = CF_FUNCTION;
-            pCtrlLabel->uData.sFunction.iEndPos = -1;
+            pCtrlLabel->uData.sFunction.iEndPos = newLabel(pContext);
             break;
         }
         case AST_IF: {
             int i, iNumElseIf = pAstNode->uData.sIf.pListElseIf->size;
             pCtrlLabel->iType = CF_IF;
             pCtrlLabel->uData.sIf.pArrElseIfEndPos = NULL;
-            pCtrlLabel->uData.sIf.iThenEndPos = -1;
-            pCtrlLabel->uData.sIf.iEndPos = -1;
+            pCtrlLabel->uData.sIf.iThenEndPos = newLabel(pContext);
+            pCtrlLabel->uData.sIf.iEndPos = newLabel(pContext);
             if (iNumElseIf > 0) {
-                pCtrlLabel->uData.sIf.pArrElseIfEndPos = (KLabelOpCodePos *)malloc(iNumElseIf * sizeof(KLabelOpCodePos));
+                pCtrlLabel->uData.sIf.pArrElseIfEndPos = (KbLabelIndex *)malloc(iNumElseIf * sizeof(KbLabelIndex));
                 for (i = 0; i < iNumElseIf; ++i) {
-                    pCtrlLabel->uData.sIf.pArrElseIfEndPos[i] = -1;
+                    pCtrlLabel->uData.sIf.pArrElseIfEndPos[i] = newLabel(pContext);
                 }
             }
             break;
         }
         case AST_WHILE: {
             pCtrlLabel->iType = CF_WHILE;
-            pCtrlLabel->uData.sWhile.iCondPos = -1;
-            pCtrlLabel->uData.sWhile.iEndPos = -1;
+            pCtrlLabel->uData.sWhile.iCondPos = newLabel(pContext);
+            pCtrlLabel->uData.sWhile.iEndPos = newLabel(pContext);
             break;
         }
         case AST_DO_WHILE: {
             pCtrlLabel->iType = CF_DO_WHILE;
-            pCtrlLabel->uData.sDoWhile.iStartPos = -1;
-            pCtrlLabel->uData.sDoWhile.iCondPos = -1;
-            pCtrlLabel->uData.sDoWhile.iEndPos = -1;
+            pCtrlLabel->uData.sDoWhile.iStartPos = newLabel(pContext);
+            pCtrlLabel->uData.sDoWhile.iCondPos = newLabel(pContext);
+            pCtrlLabel->uData.sDoWhile.iEndPos = newLabel(pContext);
             break;
         }
         case AST_FOR: {
             pCtrlLabel->iType = CF_FOR;
-            pCtrlLabel->uData.sFor.iCondPos = -1;
-            pCtrlLabel->uData.sFor.iIncreasePos = -1;
-            pCtrlLabel->uData.sFor.iEndPos = -1;
+            pCtrlLabel->uData.sFor.iCondPos = newLabel(pContext);
+            pCtrlLabel->uData.sFor.iIncreasePos = newLabel(pContext);
+            pCtrlLabel->uData.sFor.iEndPos = newLabel(pContext);
             break;
         }
         default: {
@@ -184,10 +211,25 @@ KbCompilerContext* KompilerContext_Create(const KbAstNode* pAstProgram) {
 
     pContext->pListGlobalVariables  = vlNewList();
     pContext->pListFunctions        = vlNewList();
-    pContext->pListOpCodes          = vlNewList();
+    pContext->pHashGlobalVariables  = vhNewHash();
+    pContext->pHashFunctions        = vhNewHash();
+    pContext->pHashLabels           = vhNewHash();
+    pContext->pHashExtFuncs         = vhNewHash();
+    pContext->iNumOpCodes           = 0;
+    pContext->iOpCodeCapacity       = 64;
+    pContext->pArrOpCodes           = (OpCode *)malloc(sizeof(OpCode) * pContext->iOpCodeCapacity);
+    pContext->iNumLabelPos          = 0;
+    pContext->iLabelPosCapacity     = 16;
+    pContext->pArrLabelPos          = (KLabelOpCodePos *)malloc(sizeof(KLabelOpCodePos) * pContext->iLabelPosCapacity);
     pContext->pListLabels           = vlNewList();
     pContext->pCurrentFunc          = NULL;
     pContext->iStringPoolSize       = 0;
+    pContext->iStringPoolCapacity   = 256;
+    pContext->szStringPool          = (char *)malloc(pContext->iStringPoolCapacity);
+    pContext->iNumStrings           = 0;
+    pContext->iStringSlotCapacity   = 64;
+    pContext->pArrStringSlots       = (int *)malloc(sizeof(int) * pContext->iStringSlotCapacity);
+    memset(pContext->pArrStringSlots, 0xFF, sizeof(int) * pContext->iStringSlotCapacity);
     pContext->iNumCtrlFlowLabels    = pAstProgram->uData.sProgram.iNumControl;
     if (pContext->iNumCtrlFlowLabels > 0) {
         pContext->pCtrlFlowLabels = (CtrlFlowLabel *)malloc(pContext->iNumCtrlFlowLabels * sizeof(CtrlFlowLabel));
@@ -203,7 +245,10 @@ KbCompilerContext* KompilerContext_Create(const KbAstNode* pAstProgram) {
 void KompilerContext_Destroy(KbCompilerContext* pContext) {
     vlDestroy(pContext->pListGlobalVariables, destroyVarDeclVoidPtr);
     vlDestroy(pContext->pListFunctions, destroyFuncDeclVoidPtr);
-    vlDestroy(pContext->pListOpCodes, free);
+    free(pContext->pArrOpCodes);
+    free(pContext->pArrLabelPos);
+    free(pContext->szStringPool);
+    free(pContext->pArrStringSlots);
     vlDestroy(pContext->pListLabels, free);
     if (pContext->pCtrlFlowLabels) {
         int i;
@@ -213,26 +258,22 @@ void KompilerContext_Destroy(KbCompilerContext* pContext) {
         free(pContext->pCtrlFlowLabels);
     }
     vlDestroy(pContext->pListExtFuncs, free);
+    vhDestroy(pContext->pHashGlobalVariables);
+    vhDestroy(pContext->pHashFunctions);
+    vhDestroy(pContext->pHashLabels);
+    vhDestroy(pContext->pHashExtFuncs);
     free(pContext);
 }
 
 static FuncDecl* findFunc(const Context* pContext, const char* szToFind) {
-    VlistNode* pListNode;
-
-    for (pListNode = pContext->pListFunctions->head; pListNode; pListNode = pListNode->next) {
-        FuncDecl* pFuncDecl = (FuncDecl *)pListNode->data;
-        if (IsStringEqual(pFuncDecl->szFuncName, szToFind)) {
-            return pFuncDecl;
-        }
-    }
-
-    return NULL;
+    return (FuncDecl *)vhGet(pContext->pHashFunctions, szToFind);
 }
 
 static FuncDecl* appendFunc(Context* pContext, const char* szName, int iNumParams) {
     FuncDecl* pFuncDecl = createFuncDecl(szName, iNumParams);
     pFuncDecl->iIndex = pContext->pListFunctions->size;
     vlPushBack(pContext->pListFunctions, pFuncDecl);
+    vhPut(pContext->pHashFunctions, pFuncDecl->szFuncName, pFuncDecl);
     return pFuncDecl;
 }
 
@@ -240,48 +281,34 @@ static KBool contextIsInFunc(Context* pContext) {
     return pContext->pCurrentFunc != NULL;
 }
 
-static int contextGetOpCodeListSize(const Context* pContext) {
-    return pContext->pListOpCodes->size;
-}
 
 static VarDecl* findVar(Context* pContext, KBool bIsLocal, const char* szName) {
-    Vlist*      pListVar    = bIsLocal ? pContext->pCurrentFunc->pListVariables : pContext->pListGlobalVariables;
-    VlistNode*  pListNode   = NULL;
-    for (pListNode = pListVar->head; pListNode; pListNode = pListNode->next) {
-        VarDecl* pVarDecl = (VarDecl *)pListNode->data;
-        if (IsStringEqual(pVarDecl->szVarName, szName)) {
-            return pVarDecl;
-        }
-    }
-    return NULL;
+    Vhash* pHashVar = bIsLocal ? pContext->pCurrentFunc->pHashVariables : pContext->pHashGlobalVariables;
+    return (VarDecl *)vhGet(pHashVar, szName);
 }
 
 static VarDecl* appendVar(Context* pContext, KBool bIsLocal, const char* szName, VarDeclTypeId iVarType) {
     Vlist* pListVar = bIsLocal ? pContext->pCurrentFunc->pListVariables : pContext->pListGlobalVariables;
+    Vhash* pHashVar = bIsLocal ? pContext->pCurrentFunc->pHashVariables : pContext->pHashGlobalVariables;
     VarDecl* pVarDecl = createVarDecl(szName, iVarType);
     pVarDecl->iIndex = pListVar->size;
     vlPushBack(pListVar, pVarDecl);
+    vhPut(pHashVar, pVarDecl->szVarName, pVarDecl);
     return pVarDecl;
 }
 
 static GotoLabel* findLabel(Context* pContext,const char* szLabel) {
-    VlistNode* pListNode = NULL;
-    for (pListNode = pContext->pListLabels->head; pListNode; pListNode = pListNode->next) {
-        GotoLabel* pLabel = (GotoLabel *)pListNode->data;
-        if (IsStringEqual(pLabel->szLabelName, szLabel)) {
-            return pLabel;
-        }
-    }
-    return NULL;
+    return (GotoLabel *)vhGet(pContext->pHashLabels, szLabel);
 }
 
 static GotoLabel* appendLabel(Context* pContext,const char* szLabel) {
     GotoLabel* pLabel = (GotoLabel *)malloc(sizeof(GotoLabel));
     
     StringCopy(pLabel->szLabelName, sizeof(pLabel->szLabelName), szLabel);
-    pLabel->iOpCodePos = -1;
+    pLabel->iLabelIndex = newLabel(pContext);
     pLabel->pFuncDeclScope = pContext->pCurrentFunc;
     vlPushBack(pContext->pListLabels, pLabel);
+    vhPut(pContext->pHashLabels, pLabel->szLabelName, pLabel);
 
     return pLabel;
 }
@@ -290,90 +317,145 @@ static CtrlFlowLabel* getCtrlLabel(Context* pContext, const AstNode* pAstNode) {
     return &pContext->pCtrlFlowLabels[pAstNode->iControlId - 1];
 }
 
-static OpCode* appendOpCodePushNum(Context* pContext, KFloat fLiteral) {
-    OpCode* pOpCode = (OpCode *)malloc(sizeof(OpCode));
+/* 查找字符串在去重表中的槽位，字符串不存在时返回应该插入的空槽位 */
+static int findStringSlot(const Context* pContext, const char* szValue, KDword dwHash) {
+    int iMask = pContext->iStringSlotCapacity - 1;
+    int i = (int)(dwHash & (KDword)iMask);
+    while (pContext->pArrStringSlots[i] >= 0) {
+        if (IsStringEqual(pContext->szStringPool + pContext->pArrStringSlots[i], szValue)) {
+            break;
+        }
+        i = (i + 1) & iMask;
+    }
+    return i;
+}
+
+/* 去重表保存字符串在池中的位置，常量池扩容不影响，装载率超过 3/4 时扩容 */
+static void growStringSlots(Context* pContext) {
+    int*    pArrOldSlots    = pContext->pArrStringSlots;
+    int     iOldCapacity    = pContext->iStringSlotCapacity;
+    int     i;
+
+    pContext->iStringSlotCapacity *= 2;
+    pContext->pArrStringSlots = (int *)malloc(sizeof(int) * pContext->iStringSlotCapacity);
+    memset(pContext->pArrStringSlots, 0xFF, sizeof(int) * pContext->iStringSlotCapacity);
+    for (i = 0; i < iOldCapacity; ++i) {
+        if (pArrOldSlots[i] >= 0) {
+            const char* szValue = pContext->szStringPool + pArrOldSlots[i];
+            pContext->pArrStringSlots[findStringSlot(pContext, szValue, vhStringHash(szValue))] = pArrOldSlots[i];
+        }
+    }
+    free(pArrOldSlots);
+}
+
+/* 把字符串写入常量池，返回字符串在池中的位置，超出常量池最大长度时返回 -1 */
+static int internString(Context* pContext, const char* szValue) {
+    KDword  dwHash  = vhStringHash(szValue);
+    int     iSlot   = findStringSlot(pContext, szValue, dwHash);
+    int     iLength = StringLength(szValue) + 1;
+    int     iPos;
+
+    if (pContext->pArrStringSlots[iSlot] >= 0) {
+        return pContext->pArrStringSlots[iSlot];
+    }
+    if (iLength > KB_CONTEXT_STRING_POOL_MAX - pContext->iStringPoolSize) {
+        return -1;
+    }
+    /* 常量池按需扩容 */
+    while (pContext->iStringPoolSize + iLength > pContext->iStringPoolCapacity) {
+        pContext->iStringPoolCapacity *= 2;
+        pContext->szStringPool = (char *)realloc(pContext->szStringPool, pContext->iStringPoolCapacity);
+    }
+    iPos = pContext->iStringPoolSize;
+    memcpy(pContext->szStringPool + iPos, szValue, iLength);
+    pContext->iStringPoolSize += iLength;
+    pContext->pArrStringSlots[iSlot] = iPos;
+    if (++pContext->iNumStrings * 4 > pContext->iStringSlotCapacity * 3) {
+        growStringSlots(pContext);
+    }
+    return iPos;
+}
+
+/* 在 opCode 数组末尾追加一条清零的 opCode，数组扩容后之前返回的指针失效 */
+static OpCode* appendOpCode(Context* pContext, OpCodeId iOpCodeId) {
+    OpCode* pOpCode;
+    if (pContext->iNumOpCodes >= pContext->iOpCodeCapacity) {
+        pContext->iOpCodeCapacity *= 2;
+        pContext->pArrOpCodes = (OpCode *)realloc(pContext->pArrOpCodes, sizeof(OpCode) * pContext->iOpCodeCapacity);
+    }
+    pOpCode = pContext->pArrOpCodes + pContext->iNumOpCodes++;
     memset(pOpCode, 0, sizeof(OpCode));
+    pOpCode->dwOpCodeId = iOpCodeId;
+    return pOpCode;
+}
 
-    pOpCode->dwOpCodeId         = K_OPCODE_PUSH_NUM;
+static OpCode* appendOpCodePushNum(Context* pContext, KFloat fLiteral) {
+    OpCode* pOpCode = appendOpCode(pContext, K_OPCODE_PUSH_NUM);
     pOpCode->uParam.fLiteral    = fLiteral;
-    vlPushBack(pContext->pListOpCodes, pOpCode);
 
     return pOpCode;
 }
 
-static OpCode* appendOpCodePushStr(Context* pContext, KDword dwStringPoolPos) {
-    OpCode* pOpCode = (OpCode *)malloc(sizeof(OpCode));
-    memset(pOpCode, 0, sizeof(OpCode));
+static OpCode* appendOpCodePushInt(Context* pContext, int iLiteral) {
+    OpCode* pOpCode = appendOpCode(pContext, K_OPCODE_PUSH_INT);
+    pOpCode->uParam.iLiteral    = iLiteral;
 
-    pOpCode->dwOpCodeId                 = K_OPCODE_PUSH_STR;
+    return pOpCode;
+}
+
+static OpCode* appendOpCodePushStr(Context* pContext, KDword dwStringPoolPos) {
+    OpCode* pOpCode = appendOpCode(pContext, K_OPCODE_PUSH_STR);
     pOpCode->uParam.dwStringPoolPos     = dwStringPoolPos;
-    vlPushBack(pContext->pListOpCodes, pOpCode);
     
     return pOpCode;
 }
 
 static OpCode* appendOpCodeOperator(Context* pContext, OpCodeId iOpCodeId, OperatorId iOperatorId) {
-    OpCode* pOpCode = (OpCode *)malloc(sizeof(OpCode));
-    memset(pOpCode, 0, sizeof(OpCode));
-
-    pOpCode->dwOpCodeId             = iOpCodeId;
+    OpCode* pOpCode = appendOpCode(pContext, iOpCodeId);
     pOpCode->uParam.dwOperatorId    = iOperatorId;
-    vlPushBack(pContext->pListOpCodes, pOpCode);
 
     return pOpCode;
 }
 
 static OpCode* appendOpCodeNoParam(Context* pContext, OpCodeId iOpCodeId) {
-    OpCode* pOpCode = (OpCode *)malloc(sizeof(OpCode));
-    memset(pOpCode, 0, sizeof(OpCode));
-
-    pOpCode->dwOpCodeId = iOpCodeId;
-    vlPushBack(pContext->pListOpCodes, pOpCode);
+    OpCode* pOpCode = appendOpCode(pContext, iOpCodeId);
 
     return pOpCode;
 }
 
 static OpCode* appendOpCodeVarReadOrWrite(Context* pContext, OpCodeId iOpCodeId, KBool bIsLocal, int iVarIndex) {
-    OpCode* pOpCode = (OpCode *)malloc(sizeof(OpCode));
-    memset(pOpCode, 0, sizeof(OpCode));
-
-    pOpCode->dwOpCodeId                  = iOpCodeId;
+    OpCode* pOpCode = appendOpCode(pContext, iOpCodeId);
     pOpCode->uParam.sVarAccess.wIsLocal  = bIsLocal ? 1 : 0;
     pOpCode->uParam.sVarAccess.wVarIndex = iVarIndex;
-    vlPushBack(pContext->pListOpCodes, pOpCode);
 
     return pOpCode;
 }
 
 static OpCode* appendOpCodeCallBuiltIn(Context* pContext, int iBuiltFuncId) {
-    OpCode* pOpCode = (OpCode *)malloc(sizeof(OpCode));
-    memset(pOpCode, 0, sizeof(OpCode));
-
-    pOpCode->dwOpCodeId             = K_OPCODE_CALL_BUILT_IN;
+    OpCode* pOpCode = appendOpCode(pContext, K_OPCODE_CALL_BUILT_IN);
     pOpCode->uParam.dwBuiltFuncId   = iBuiltFuncId;
-    vlPushBack(pContext->pListOpCodes, pOpCode);
 
     return pOpCode;
 }
 
-static OpCode* appendOpCodeCallFunction(Context* pContext, int iFuncIndex) {
-    OpCode* pOpCode = (OpCode *)malloc(sizeof(OpCode));
-    memset(pOpCode, 0, sizeof(OpCode));
+static OpCode* appendOpCodeCallExt(Context* pContext, int iExtFuncIndex) {
+    OpCode* pOpCode = appendOpCode(pContext, K_OPCODE_CALL_EXT);
+    pOpCode->uParam.dwExtFuncIndex  = iExtFuncIndex;
+
+    return pOpCode;
+}
 
-    pOpCode->dwOpCodeId         = K_OPCODE_CALL_FUNC;
+static OpCode* appendOpCodeCallFunction(Context* pContext, int iFuncIndex) {
+    OpCode* pOpCode = appendOpCode(pContext, K_OPCODE_CALL_FUNC);
     pOpCode->uParam.dwFuncIndex = iFuncIndex;
-    vlPushBack(pContext->pListOpCodes, pOpCode);
 
     return pOpCode;
 }
 
-static OpCode* appendOpCodeGoto(Context* pContext, OpCodeId iOpCodeId, KLabelOpCodePos* pIntOpCodePos) {
-    OpCode* pOpCode = (OpCode *)malloc(sizeof(OpCode));
-    memset(pOpCode, 0, sizeof(OpCode));
-
-    pOpCode->dwOpCodeId             = iOpCodeId;
-    pOpCode->uParam.pLabelOpCodePos = pIntOpCodePos;
-    vlPushBack(pContext->pListOpCodes, pOpCode);
+/* 跳转位置先记录标签下标，编译结束后替换为标签的 opCode 位置 */
+static OpCode* appendOpCodeGoto(Context* pContext, OpCodeId iOpCodeId, KbLabelIndex iLabel) {
+    OpCode* pOpCode = appendOpCode(pContext, iOpCodeId);
+    pOpCode->uParam.dwOpCodePos = iLabel;
 
     return pOpCode;
 }
@@ -411,19 +493,20 @@ static SemanticErrorId buildExpression(
             break;
         }
         case AST_LITERAL_NUMERIC: {
-            appendOpCodePushNum(pContext, pAstNode->uData.sLiteralNumeric.fValue);
+            if (pAstNode->uData.sLiteralNumeric.bIsInteger) {
+                appendOpCodePushInt(pContext, pAstNode->uData.sLiteralNumeric.iValue);
+            } else {
+                appendOpCodePushNum(pContext, pAstNode->uData.sLiteralNumeric.fValue);
+            }
             break;
         }
         case AST_LITERAL_STRING: {
-            int iDestLen = StringLength(pAstNode->uData.sLiteralString.szValue) + 1;
-            int iStringPoolPos = pContext->iStringPoolSize;
+            /* 写入字符串池，相同的字面值只保存一次 */
+            int iStringPoolPos = internString(pContext, pAstNode->uData.sLiteralString.szValue);
             /* 检查是否超出了字符串池的最大限制 */
-            if (iDestLen + iStringPoolPos >= KB_CONTEXT_STRING_POOL_MAX) {
+            if (iStringPoolPos < 0) {
                 return SEM_STR_POOL_EXCEED;
             }
-            /* 写入字符串池 */
-            StringCopy(pContext->szStringPool + iStringPoolPos, KB_CONTEXT_STRING_POOL_MAX - iStringPoolPos, pAstNode->uData.sLiteralString.szValue);
-            pContext->iStringPoolSize += iDestLen;
             /* 添加 opcode */
             appendOpCodePushStr(pContext, iStringPoolPos);
             break;
@@ -477,6 +560,7 @@ static SemanticErrorId buildExpression(
             int                 iNumArg     = pAstNode->uData.sFunctionCall.pListArguments->size;
             const BuiltInFunc*  pBuiltFunc  = NULL;
             const ExtFunc*      pExtFunc    = NULL;
+            int                 iExtIndex   = 0;
             FuncDecl*           pFuncDecl   = NULL;
             VlistNode*          pListNode   = NULL;
             /* 先查找是否为用户定义的函数 */
@@ -489,7 +573,7 @@ static SemanticErrorId buildExpression(
             }
             /* 查找是否是拓展函数 */
             else {
-                pExtFunc = findExtFunc(pContext, szFuncName);
+                pExtFunc = findExtFunc(pContext, szFuncName, &iExtIndex);
                 /* 找不到 */
                 if (!pExtFunc) {
                     /* 查找是否是硬编码内建函数 */
@@ -525,7 +609,7 @@ static SemanticErrorId buildExpression(
                 appendOpCodeCallFunction(pContext, pFuncDecl->iIndex);
             }
             else if (pExtFunc) {
-                appendOpCodeCallBuiltIn(pContext, pExtFunc->iCallId);
+                appendOpCodeCallExt(pContext, iExtIndex);
             }
             else {
                 appendOpCodeCallBuiltIn(pContext, pBuiltFunc->iFuncId);
@@ -573,9 +657,9 @@ KBool buildStatements(
                 pFuncDecl = findFunc(pContext, szFuncName);
                 pContext->pCurrentFunc = pFuncDecl;
                 /* 添加一个 GOTO 无条件跳转到函数结束 */
-                appendOpCodeGoto(pContext, K_OPCODE_GOTO, &pCtrlLabel->uData.sFunction.iEndPos);
+                appendOpCodeGoto(pContext, K_OPCODE_GOTO, pCtrlLabel->uData.sFunction.iEndPos);
                 /* 更新函数定义的 opCode 起点位置 */
-                pFuncDecl->iOpCodeStartPos = contextGetOpCodeListSize(pContext);
+                pFuncDecl->iOpCodeStartPos = pContext->iNumOpCodes;
                 /* 遍历每一个函数的参数 */
                 for (
                     pListVarNode = pAstNode->uData.sFunctionDeclare.pListParameters->head;
@@ -603,16 +687,16 @@ KBool buildStatements(
                 );
                 if (!bSuccess) return KB_FALSE;
                 /* 检查 opCode 最后一条是不是 RETURN */
-                pOpCodeTail = (OpCode *)pContext->pListOpCodes->tail->data;
+                pOpCodeTail = pContext->pArrOpCodes + pContext->iNumOpCodes - 1;
                 if (pOpCodeTail->dwOpCodeId != K_OPCODE_RETURN) {
                     /* 添加一个 return 0 */
-                    appendOpCodePushNum(pContext, 0);
+                    appendOpCodePushInt(pContext, 0);
                     appendOpCodeNoParam(pContext, K_OPCODE_RETURN);
                 }
                 /* 清除上下文的当前函数 */
                 pContext->pCurrentFunc = NULL;
                 /* 更新 end func 的位置 */
-                pCtrlLabel->uData.sFunction.iEndPos = contextGetOpCodeListSize(pContext);
+                placeLabel(pContext, pCtrlLabel->uData.sFunction.iEndPos);
                 break;
             }
             case AST_IF_GOTO: {
@@ -630,7 +714,7 @@ KBool buildStatements(
                     returnStatementError(iBuildExprErrorId, pAstNode);
                 }
                 /* 创建 goto opcode */
-                appendOpCodeGoto(pContext, K_OPCODE_IF_GOTO, &pLabel->iOpCodePos);
+                appendOpCodeGoto(pContext, K_OPCODE_IF_GOTO, pLabel->iLabelIndex);
                 break;
             }
             case AST_IF: {
@@ -645,7 +729,7 @@ KBool buildStatements(
                     returnStatementError(iBuildExprErrorId, pAstNode);
                 }
                 /* 添加一个 UNLESS_GOTO，不符合的条件跳过 then 部分 */
-                appendOpCodeGoto(pContext, K_OPCODE_UNLESS_GOTO, &pCtrlLabel->uData.sIf.iThenEndPos);
+                appendOpCodeGoto(pContext, K_OPCODE_UNLESS_GOTO, pCtrlLabel->uData.sIf.iThenEndPos);
                 /* 编译 then 部分 */
                 bSuccess = buildStatements(
                     pContext,
@@ -655,9 +739,9 @@ KBool buildStatements(
                 );
                 if (!bSuccess) return KB_FALSE;
                 /* 执行完 then 部分，跳转到 end if 标签 */
-                appendOpCodeGoto(pContext, K_OPCODE_GOTO, &pCtrlLabel->uData.sIf.iEndPos);
+                appendOpCodeGoto(pContext, K_OPCODE_GOTO, pCtrlLabel->uData.sIf.iEndPos);
                 /* 更新 then 的结束位置标签 */
-                pCtrlLabel->uData.sIf.iThenEndPos = contextGetOpCodeListSize(pContext);
+                placeLabel(pContext, pCtrlLabel->uData.sIf.iThenEndPos);
                 /* 编译 elseif 部分 */
                 for (
                     iElseIfIndex = 0, pListNodeElseIf = pAstNode->uData.sIf.pListElseIf->head;
@@ -671,7 +755,7 @@ KBool buildStatements(
                         returnStatementError(iBuildExprErrorId, pAstNode);
                     }
                     /* 添加一个 UNLESS_GOTO，不符合的条件跳过此 elseif 部分 */
-                    appendOpCodeGoto(pContext, K_OPCODE_UNLESS_GOTO, &pCtrlLabel->uData.sIf.pArrElseIfEndPos[iElseIfIndex]);
+                    appendOpCodeGoto(pContext, K_OPCODE_UNLESS_GOTO, pCtrlLabel->uData.sIf.pArrElseIfEndPos[iElseIfIndex]);
                     /* 编译 elseif 的语句 */
                     bSuccess = buildStatements(
                         pContext,
@@ -681,9 +765,9 @@ KBool buildStatements(
                     );
                     if (!bSuccess) return KB_FALSE;
                     /* 执行完 elseif 部分，跳转到 end if 标签 */
-                    appendOpCodeGoto(pContext, K_OPCODE_GOTO, &pCtrlLabel->uData.sIf.iEndPos);
+                    appendOpCodeGoto(pContext, K_OPCODE_GOTO, pCtrlLabel->uData.sIf.iEndPos);
                     /* 更新此 elseif 的结束位置标签 */
-                    pCtrlLabel->uData.sIf.pArrElseIfEndPos[iElseIfIndex] = contextGetOpCodeListSize(pContext);
+                    placeLabel(pContext, pCtrlLabel->uData.sIf.pArrElseIfEndPos[iElseIfIndex]);
                 }
                 /* 编译 else 部分 */
                 if (pAstNode->uData.sIf.pAstElse) {
@@ -696,7 +780,7 @@ KBool buildStatements(
                     if (!bSuccess) return KB_FALSE;
                 }
                 /* 更新 end if 的标签位置 */
-                pCtrlLabel->uData.sIf.iEndPos = contextGetOpCodeListSize(pContext);
+                placeLabel(pContext, pCtrlLabel->uData.sIf.iEndPos);
                 break;
             }
             case AST_THEN: {
@@ -716,14 +800,14 @@ KBool buildStatements(
                 CtrlFlowLabel*  pCtrlLabel = getCtrlLabel(pContext, pAstNode);
                 KBool           bSuccess;
                 /* 更新条件判断的位置 */
-                pCtrlLabel->uData.sWhile.iCondPos = contextGetOpCodeListSize(pContext);
+                placeLabel(pContext, pCtrlLabel->uData.sWhile.iCondPos);
                 /* 编译 while 条件 */
                 iBuildExprErrorId = buildExpression(pContext, pAstNode->uData.sWhile.pAstCondition);
                 if (iBuildExprErrorId != SEM_NO_ERROR) {
                     returnStatementError(iBuildExprErrorId, pAstNode);
                 }
                 /* 添加一个 UNLESS_GOTO，不符合的条件跳过 while */
-                appendOpCodeGoto(pContext, K_OPCODE_UNLESS_GOTO, &pCtrlLabel->uData.sWhile.iEndPos);
+                appendOpCodeGoto(pContext, K_OPCODE_UNLESS_GOTO, pCtrlLabel->uData.sWhile.iEndPos);
                 /* 编译 while 的所有语句 */
                 bSuccess = buildStatements(
                     pContext,
@@ -733,9 +817,9 @@ KBool buildStatements(
                 );
                 if (!bSuccess) return KB_FALSE;
                 /* 添加一个 opcode 跳转到 while 的条件 */
-                appendOpCodeGoto(pContext, K_OPCODE_GOTO, &pCtrlLabel->uData.sWhile.iCondPos);
+                appendOpCodeGoto(pContext, K_OPCODE_GOTO, pCtrlLabel->uData.sWhile.iCondPos);
                 /* 更新 end while 的标签位置 */
-                pCtrlLabel->uData.sWhile.iEndPos = contextGetOpCodeListSize(pContext);
+                placeLabel(pContext, pCtrlLabel->uData.sWhile.iEndPos);
                 break;
             }
             case AST_DO_WHILE: {
@@ -743,7 +827,7 @@ KBool buildStatements(
                 CtrlFlowLabel*  pCtrlLabel = getCtrlLabel(pContext, pAstNode);
                 KBool           bSuccess;
                 /* 更新循环开始的位置 */
-                pCtrlLabel->uData.sDoWhile.iStartPos = contextGetOpCodeListSize(pContext);
+                placeLabel(pContext, pCtrlLabel->uData.sDoWhile.iStartPos);
                 /* 编译 do...while 的所有语句 */
                 bSuccess = buildStatements(
                     pContext,
@@ -753,16 +837,16 @@ KBool buildStatements(
                 );
                 if (!bSuccess) return KB_FALSE;
                 /* 更新循环条件的位置 */
-                pCtrlLabel->uData.sDoWhile.iCondPos = contextGetOpCodeListSize(pContext);
+                placeLabel(pContext, pCtrlLabel->uData.sDoWhile.iCondPos);
                 /* 编译 do...while 条件 */
                 iBuildExprErrorId = buildExpression(pContext, pAstNode->uData.sDoWhile.pAstCondition);
                 if (iBuildExprErrorId != SEM_NO_ERROR) {
                     returnStatementError(iBuildExprErrorId, pAstNode);
                 }
                 /* 添加一个 IF_GOTO，条件为真，回到循环开头 */
-                appendOpCodeGoto(pContext, K_OPCODE_IF_GOTO, &pCtrlLabel->uData.sDoWhile.iStartPos);
+                appendOpCodeGoto(pContext, K_OPCODE_IF_GOTO, pCtrlLabel->uData.sDoWhile.iStartPos);
                 /* 更新 do..while 结束的标签位置 */
-                pCtrlLabel->uData.sDoWhile.iEndPos = contextGetOpCodeListSize(pContext);
+                placeLabel(pContext, pCtrlLabel->uData.sDoWhile.iEndPos);
                 break;
             }
             case AST_FOR: {
@@ -793,7 +877,7 @@ KBool buildStatements(
                 }
                 appendOpCodeVarReadOrWrite(pContext, K_OPCODE_SET_VAR, bIsLocal, pVarDecl->iIndex);
                 /* 更新标签循环条件的位置 */
-                pCtrlLabel->uData.sFor.iCondPos = contextGetOpCodeListSize(pContext);
+                placeLabel(pContext, pCtrlLabel->uData.sFor.iCondPos);
                 /* 编译 for 表达式 : 循环条件 */
                 iBuildExprErrorId = buildExpression(pContext, pAstNode->uData.sFor.pAstRangeTo);
                 if (iBuildExprErrorId != SEM_NO_ERROR) {
@@ -803,7 +887,7 @@ KBool buildStatements(
                 appendOpCodeVarReadOrWrite(pContext, K_OPCODE_PUSH_VAR, bIsLocal, pVarDecl->iIndex);
                 appendOpCodeOperator(pContext, K_OPCODE_BINARY_OPERATOR, OPR_GTEQ);
                 /* 添加条件失败跳转结束的指令 */
-                appendOpCodeGoto(pContext, K_OPCODE_UNLESS_GOTO, &pCtrlLabel->uData.sFor.iEndPos);
+                appendOpCodeGoto(pContext, K_OPCODE_UNLESS_GOTO, pCtrlLabel->uData.sFor.iEndPos);
                 /* 编译 for 的所有语句 */
                 bSuccess = buildStatements(
                     pContext,
@@ -813,7 +897,7 @@ KBool buildStatements(
                 );
                 if (!bSuccess) return KB_FALSE;
                 /* 更新变量增长的标签位置 */
-                pCtrlLabel->uData.sFor.iIncreasePos = contextGetOpCodeListSize(pContext);
+                placeLabel(pContext, pCtrlLabel->uData.sFor.iIncreasePos);
                 /* 编译 for 表达式 : 变量增长 */
                 if (pAstNode->uData.sFor.pAstStep) {
                     /* 有 step 表达式 */
@@ -824,15 +908,15 @@ KBool buildStatements(
                 }
                 else {
                     /* 无 step 表达式，变量增长 1 */
-                    appendOpCodePushNum(pContext, 1);
+                    appendOpCodePushInt(pContext, 1);
                 }
                 appendOpCodeVarReadOrWrite(pContext, K_OPCODE_PUSH_VAR, bIsLocal, pVarDecl->iIndex);
                 appendOpCodeOperator(pContext, K_OPCODE_BINARY_OPERATOR, OPR_ADD);
                 appendOpCodeVarReadOrWrite(pContext, K_OPCODE_SET_VAR, bIsLocal, pVarDecl->iIndex);
                 /* 添加 opcode 跳转到条件比较 */
-                appendOpCodeGoto(pContext, K_OPCODE_GOTO, &pCtrlLabel->uData.sFor.iCondPos);
+                appendOpCodeGoto(pContext, K_OPCODE_GOTO, pCtrlLabel->uData.sFor.iCondPos);
                 /* 更新 next 的标签位置 */
-                pCtrlLabel->uData.sFor.iEndPos = contextGetOpCodeListSize(pContext);
+                placeLabel(pContext, pCtrlLabel->uData.sFor.iEndPos);
                 break;
             }
             case AST_BREAK: {
@@ -852,13 +936,13 @@ KBool buildStatements(
                 /* 添加一个 GOTO 指令跳转到循环结束 */
                 switch (pCtrlLabel->iType) {
                     case CF_WHILE:
-                        appendOpCodeGoto(pContext, K_OPCODE_GOTO, &pCtrlLabel->uData.sWhile.iEndPos);
+                        appendOpCodeGoto(pContext, K_OPCODE_GOTO, pCtrlLabel->uData.sWhile.iEndPos);
                         break;
                     case CF_DO_WHILE:
-                        appendOpCodeGoto(pContext, K_OPCODE_GOTO, &pCtrlLabel->uData.sDoWhile.iEndPos);
+                        appendOpCodeGoto(pContext, K_OPCODE_GOTO, pCtrlLabel->uData.sDoWhile.iEndPos);
                         break;
                     case CF_FOR:
-                        appendOpCodeGoto(pContext, K_OPCODE_GOTO, &pCtrlLabel->uData.sFor.iEndPos);
+                        appendOpCodeGoto(pContext, K_OPCODE_GOTO, pCtrlLabel->uData.sFor.iEndPos);
                         break;
                     default:
                         break;
@@ -882,13 +966,13 @@ KBool buildStatements(
                 /* 添加一个 GOTO 指令跳转到下一次循环 */
                 switch (pCtrlLabel->iType) {
                     case CF_WHILE:
-                        appendOpCodeGoto(pContext, K_OPCODE_GOTO, &pCtrlLabel->uData.sWhile.iCondPos);
+                        appendOpCodeGoto(pContext, K_OPCODE_GOTO, pCtrlLabel->uData.sWhile.iCondPos);
                         break;
                     case CF_DO_WHILE:
-                        appendOpCodeGoto(pContext, K_OPCODE_GOTO, &pCtrlLabel->uData.sDoWhile.iCondPos);
+                        appendOpCodeGoto(pContext, K_OPCODE_GOTO, pCtrlLabel->uData.sDoWhile.iCondPos);
                         break;
                     case CF_FOR:
-                        appendOpCodeGoto(pContext, K_OPCODE_GOTO, &pCtrlLabel->uData.sFor.iIncreasePos);
+                        appendOpCodeGoto(pContext, K_OPCODE_GOTO, pCtrlLabel->uData.sFor.iIncreasePos);
                         break;
                     default:
                         break;
@@ -906,12 +990,28 @@ KBool buildStatements(
                 }
                 /* 不带返回值，返回 0 */
                 else {
-                    appendOpCodePushNum(pContext, 0);
+                    appendOpCodePushInt(pContext, 0);
                 }
                 /* 创建 return opcode */
                 appendOpCodeNoParam(pContext, K_OPCODE_STOP);
                 break;
             }
+            case AST_YIELD: {
+                SemanticErrorId iBuildExprErrorId;
+                /* 带值的情况，编译表达式 */
+                if (pAstNode->uData.sYield.pAstExpression) {
+                    iBuildExprErrorId = buildExpression(pContext, pAstNode->uData.sYield.pAstExpression);
+                    if (iBuildExprErrorId != SEM_NO_ERROR) {
+                        returnStatementError(iBuildExprErrorId, pAstNode);
+                    }
+                }
+                /* 不带值，交给宿主 0 */
+                else {
+                    appendOpCodePushInt(pContext, 0);
+                }
+                appendOpCodeNoParam(pContext, K_OPCODE_YIELD);
+                break;
+            }
             case AST_RETURN: {
                 SemanticErrorId iBuildExprErrorId;
                 /* 带返回值的情况，编译表达式 */
@@ -923,7 +1023,7 @@ KBool buildStatements(
                 }
                 /* 不带返回值，返回 0 */
                 else {
-                    appendOpCodePushNum(pContext, 0);
+                    appendOpCodePushInt(pContext, 0);
                 }
                 /* 创建 return opcode */
                 appendOpCodeNoParam(pContext, K_OPCODE_RETURN);
@@ -938,7 +1038,7 @@ KBool buildStatements(
                     returnStatementError(SEM_GOTO_LABEL_SCOPE_MISMATCH, pAstNode);
                 }
                 /* 创建 goto opcode */
-                appendOpCodeGoto(pContext, K_OPCODE_GOTO, &pLabel->iOpCodePos);
+                appendOpCodeGoto(pContext, K_OPCODE_GOTO, pLabel->iLabelIndex);
                 break;
             }
             case AST_DIM: {
@@ -1084,7 +1184,7 @@ KBool buildStatements(
             case AST_LABEL_DECLARE: {
                 /* 更新跳转标签的opCode位置 */
                 GotoLabel* pLabel = findLabel(pContext, pAstNode->uData.sLabel.szLabelName);
-                pLabel->iOpCodePos = contextGetOpCodeListSize(pContext);
+                placeLabel(pContext, pLabel->iLabelIndex);
                 break;
             }
             /* 以下是表达式 */
@@ -1141,7 +1241,7 @@ static KBool scanLabel(
             }
             case AST_FUNCTION_DECLARE: {
                 /* 初始化控制结构标签 */
-                initControlFlowLabel(getCtrlLabel(pContext, pAstNode), pAstNode);
+                initControlFlowLabel(pContext, getCtrlLabel(pContext, pAstNode), pAstNode);
                 /* 设置上下文的当前函数 */
                 pContext->pCurrentFunc = findFunc(pContext, pAstNode->uData.sFunctionDeclare.szFunction);
                 /* 扫描函数的所有语句 */
@@ -1158,7 +1258,7 @@ static KBool scanLabel(
             case AST_IF: {
                 const VlistNode* pListNodeElseIf;
                 /* 初始化控制结构标签 */
-                initControlFlowLabel(getCtrlLabel(pContext, pAstNode), pAstNode);
+                initControlFlowLabel(pContext, getCtrlLabel(pContext, pAstNode), pAstNode);
                 /* 扫描 then 部分 */
                 bSuccess = scanLabel(
                     pContext,
@@ -1196,7 +1296,7 @@ static KBool scanLabel(
             }
             case AST_WHILE: {
                 /* 初始化控制结构标签 */
-                initControlFlowLabel(getCtrlLabel(pContext, pAstNode), pAstNode);
+                initControlFlowLabel(pContext, getCtrlLabel(pContext, pAstNode), pAstNode);
                 /* 扫描 while 的所有语句 */
                 bSuccess = scanLabel(
                     pContext,
@@ -1209,7 +1309,7 @@ static KBool scanLabel(
             }
             case AST_DO_WHILE: {
                 /* 初始化控制结构标签 */
-                initControlFlowLabel(getCtrlLabel(pContext, pAstNode), pAstNode);
+                initControlFlowLabel(pContext, getCtrlLabel(pContext, pAstNode), pAstNode);
                 /* 扫描 while 的所有语句 */
                 bSuccess = scanLabel(
                     pContext,
@@ -1222,7 +1322,7 @@ static KBool scanLabel(
             }
             case AST_FOR: {
                 /* 初始化控制结构标签 */
-                initControlFlowLabel(getCtrlLabel(pContext, pAstNode), pAstNode);
+                initControlFlowLabel(pContext, getCtrlLabel(pContext, pAstNode), pAstNode);
                 /* 扫描 for 的所有语句 */
                 bSuccess = scanLabel(
                     pContext,
@@ -1247,6 +1347,104 @@ static KBool scanLabel(
     return KB_FALSE;                            \
 } NULL
 
+typedef struct {
+    const char* szValue;
+    int         iLength;
+    int         iPos;           /* 合并前在池中的位置 */
+    int         iRootPos;       /* 是后缀时，所在的保留字符串合并前的位置，否则为 -1 */
+    int         iRootLength;
+} PoolString;
+
+/* 按反转后的字符串排序，一个字符串总是排在以它结尾的字符串前面 */
+static int comparePoolStringReversed(const void* pA, const void* pB) {
+    const PoolString* pStrA = (const PoolString *)pA;
+    const PoolString* pStrB = (const PoolString *)pB;
+    int i = pStrA->iLength - 1, j = pStrB->iLength - 1;
+    while (i >= 0 && j >= 0) {
+        if (pStrA->szValue[i] != pStrB->szValue[j]) {
+            return (unsigned char)pStrA->szValue[i] < (unsigned char)pStrB->szValue[j] ? -1 : 1;
+        }
+        i--;
+        j--;
+    }
+    return i < 0 ? (j < 0 ? 0 : -1) : 1;
+}
+
+static int comparePoolStringPos(const void* pA, const void* pB) {
+    return ((const PoolString *)pA)->iPos - ((const PoolString *)pB)->iPos;
+}
+
+/*
+ * 常量池后缀合并: 一个字符串是另一个字符串的后缀时，直接指向较长字符串的尾部
+ * 在所有字符串写入之后调用，合并后更新 PUSH_STR 的位置并重建去重表
+ */
+static void shareStringSuffixes(Context* pContext) {
+    int             iNumStrings = pContext->iNumStrings;
+    PoolString*     pArrStrings;
+    int*            pArrNewPos;
+    int             i, n, iNewSize = 0;
+
+    if (iNumStrings < 2) {
+        return;
+    }
+    pArrStrings = (PoolString *)malloc(sizeof(PoolString) * iNumStrings);
+    pArrNewPos  = (int *)malloc(sizeof(int) * pContext->iStringPoolSize);
+    for (i = 0, n = 0; i < pContext->iStringSlotCapacity; ++i) {
+        if (pContext->pArrStringSlots[i] >= 0) {
+            PoolString* pStr = pArrStrings + n++;
+            pStr->iPos      = pContext->pArrStringSlots[i];
+            pStr->szValue   = pContext->szStringPool + pStr->iPos;
+            pStr->iLength   = StringLength(pStr->szValue);
+            pStr->iRootPos  = -1;
+        }
+    }
+    /* 以当前字符串结尾的字符串如果存在，排序后一定紧跟在它后面 */
+    qsort(pArrStrings, iNumStrings, sizeof(PoolString), comparePoolStringReversed);
+    for (i = iNumStrings - 2; i >= 0; --i) {
+        const PoolString*   pLonger = pArrStrings + i + 1;
+        PoolString*         pStr    = pArrStrings + i;
+        if (pStr->iLength <= pLonger->iLength &&
+            memcmp(pStr->szValue, pLonger->szValue + pLonger->iLength - pStr->iLength, pStr->iLength) == 0
+        ) {
+            pStr->iRootPos      = pLonger->iRootPos >= 0 ? pLonger->iRootPos : pLonger->iPos;
+            pStr->iRootLength   = pLonger->iRootPos >= 0 ? pLonger->iRootLength : pLonger->iLength;
+        }
+    }
+    /* 保留的字符串按原来的顺序前移，新位置不会超过原来的位置 */
+    qsort(pArrStrings, iNumStrings, sizeof(PoolString), comparePoolStringPos);
+    for (i = 0; i < iNumStrings; ++i) {
+        PoolString* pStr = pArrStrings + i;
+        if (pStr->iRootPos < 0) {
+            memmove(pContext->szStringPool + iNewSize, pStr->szValue, pStr->iLength + 1);
+            pArrNewPos[pStr->iPos] = iNewSize;
+            iNewSize += pStr->iLength + 1;
+        }
+    }
+    for (i = 0; i < iNumStrings; ++i) {
+        PoolString* pStr = pArrStrings + i;
+        if (pStr->iRootPos >= 0) {
+            pArrNewPos[pStr->iPos] = pArrNewPos[pStr->iRootPos] + pStr->iRootLength - pStr->iLength;
+        }
+    }
+    pContext->iStringPoolSize = iNewSize;
+
+    for (i = 0; i < pContext->iNumOpCodes; ++i) {
+        OpCode* pOpCode = pContext->pArrOpCodes + i;
+        if (pOpCode->dwOpCodeId == K_OPCODE_PUSH_STR) {
+            pOpCode->uParam.dwStringPoolPos = pArrNewPos[pOpCode->uParam.dwStringPoolPos];
+        }
+    }
+    memset(pContext->pArrStringSlots, 0xFF, sizeof(int) * pContext->iStringSlotCapacity);
+    for (i = 0; i < iNumStrings; ++i) {
+        int iPos = pArrNewPos[pArrStrings[i].iPos];
+        const char* szValue = pContext->szStringPool + iPos;
+        pContext->pArrStringSlots[findStringSlot(pContext, szValue, vhStringHash(szValue))] = iPos;
+    }
+
+    free(pArrNewPos);
+    free(pArrStrings);
+}
+
 KBool KompilerContext_Build(
     KbCompilerContext*  pContext,
     const KbAstNode*    pAstProgram,
@@ -1255,8 +1453,8 @@ KBool KompilerContext_Build(
 ) {
     
     const VlistNode*    pListNode   = NULL;
-    VlistNode*          pListNodeOp = NULL;
     KBool               bSuccess    = KB_TRUE;
+    int                 i;
 
     *pIntSemanticError = SEM_NO_ERROR;
 
@@ -1264,6 +1462,8 @@ KBool KompilerContext_Build(
         returnProgramError(SEM_NOT_A_PROGRAM, pAstProgram);
     }
 
+    indexExtFuncs(pContext);
+
     /* 扫描全部函数声明 */
     for (pListNode = pAstProgram->uData.sProgram.pListStatements->head; pListNode; pListNode = pListNode->next) {
         const AstNode* pAstNode = (const AstNode *)pListNode->data;
@@ -1304,31 +1504,363 @@ KBool KompilerContext_Build(
     if (!bSuccess) return KB_FALSE;
 
     /* 手动添加一个 STOP 命令 */
-    appendOpCodePushNum(pContext, 0);
+    appendOpCodePushInt(pContext, 0);
     appendOpCodeNoParam(pContext, K_OPCODE_STOP);
 
+    /* 字符串常量池合并后缀 */
+    shareStringSuffixes(pContext);
+
     /* 更新所有的 GOTO / IF_GOTO / UNLESS_GOTO opCode 的跳转位置 */
-    for (pListNodeOp = pContext->pListOpCodes->head; pListNodeOp != NULL; pListNodeOp = pListNodeOp->next) {
-        OpCode*     pOpCode = (OpCode *)pListNodeOp->data;
-        const int*  pLabelOpCodePos  = NULL;
+    for (i = 0; i < pContext->iNumOpCodes; ++i) {
+        OpCode* pOpCode = pContext->pArrOpCodes + i;
     
         switch (pOpCode->dwOpCodeId) {
             case K_OPCODE_GOTO:
             case K_OPCODE_IF_GOTO:
             case K_OPCODE_UNLESS_GOTO:
-                pLabelOpCodePos = pOpCode->uParam.pLabelOpCodePos;
-                pOpCode->uParam.dwOpCodePos = *pLabelOpCodePos;
+                pOpCode->uParam.dwOpCodePos = pContext->pArrLabelPos[pOpCode->uParam.dwOpCodePos];
         }
     }
 
     return KB_TRUE;
 }
 
-KBool KompilerContext_Serialize(
-    const KbCompilerContext*    pContext,
-    KByte**                     pPtrByteRaw,
-    KDword*                     pDwRawLength
-) {
+/* ------------------------------------------------------------ */
+/*                        窥孔优化                              */
+/* ------------------------------------------------------------ */
+
+#define isJumpOpCode(dwOpCodeId) \
+    ((dwOpCodeId) == K_OPCODE_GOTO || (dwOpCodeId) == K_OPCODE_IF_GOTO || (dwOpCodeId) == K_OPCODE_UNLESS_GOTO)
+
+#define isPushOpCode(dwOpCodeId) \
+    ((dwOpCodeId) == K_OPCODE_PUSH_NUM || (dwOpCodeId) == K_OPCODE_PUSH_INT || \
+     (dwOpCodeId) == K_OPCODE_PUSH_STR || (dwOpCodeId) == K_OPCODE_PUSH_VAR)
+
+/* 标记所有跳转目标和函数入口，这些位置可以从其他地方进入 */
+static void markOpCodeEntries(const KbCompilerContext* pContext, const OpCode* pArrOpCodes, int iNumOpCodes, KBool* pArrIsEntry) {
+    VlistNode*  pListNode;
+    int         i;
+
+    memset(pArrIsEntry, 0, sizeof(KBool) * (iNumOpCodes + 1));
+    pArrIsEntry[0] = KB_TRUE;
+    for (pListNode = pContext->pListFunctions->head; pListNode != NULL; pListNode = pListNode->next) {
+        pArrIsEntry[((FuncDecl *)pListNode->data)->iOpCodeStartPos] = KB_TRUE;
+    }
+    for (i = 0; i < iNumOpCodes; ++i) {
+        if (isJumpOpCode(pArrOpCodes[i].dwOpCodeId)) {
+            pArrIsEntry[pArrOpCodes[i].uParam.dwOpCodePos] = KB_TRUE;
+        }
+    }
+}
+
+/* 从入口出发标记所有能执行到的指令，返回能执行到的指令数量 */
+static int markReachableOpCodes(const KbCompilerContext* pContext, const OpCode* pArrOpCodes, int iNumOpCodes, KBool* pArrReachable, int* pArrWorkList) {
+    VlistNode*  pListNode;
+    int         iNumWork = 0;
+    int         iNumReachable = 0;
+
+    memset(pArrReachable, 0, sizeof(KBool) * (iNumOpCodes + 1));
+    pArrWorkList[iNumWork++] = 0;
+    for (pListNode = pContext->pListFunctions->head; pListNode != NULL; pListNode = pListNode->next) {
+        pArrWorkList[iNumWork++] = ((FuncDecl *)pListNode->data)->iOpCodeStartPos;
+    }
+    while (iNumWork > 0) {
+        int         iPos = pArrWorkList[--iNumWork];
+        KDword      dwOpCodeId;
+        /* 顺序执行直到遇到已经标记的指令或者无条件离开 */
+        while (iPos < iNumOpCodes && !pArrReachable[iPos]) {
+            pArrReachable[iPos] = KB_TRUE;
+            iNumReachable++;
+            dwOpCodeId = pArrOpCodes[iPos].dwOpCodeId;
+            if (isJumpOpCode(dwOpCodeId)) {
+                /* 每条指令只标记一次，工作表不会超过指令数量 */
+                pArrWorkList[iNumWork++] = pArrOpCodes[iPos].uParam.dwOpCodePos;
+            }
+            if (dwOpCodeId == K_OPCODE_GOTO || dwOpCodeId == K_OPCODE_RETURN || dwOpCodeId == K_OPCODE_STOP) {
+                break;
+            }
+            iPos++;
+        }
+    }
+    return iNumReachable;
+}
+
+/*
+ * 删除标记为 NONE 的指令，重新计算跳转位置和函数入口
+ * 跳到被删除指令的跳转改为跳到它后面第一条保留的指令
+ */
+static void compactOpCodes(KbCompilerContext* pContext, int* pArrNewPos) {
+    OpCode*     pArrOpCodes = pContext->pArrOpCodes;
+    int         iNumOpCodes = pContext->iNumOpCodes;
+    VlistNode*  pListNode;
+    int         i, iNumKept = 0;
+
+    for (i = 0; i < iNumOpCodes; ++i) {
+        pArrNewPos[i] = iNumKept;
+        if (pArrOpCodes[i].dwOpCodeId != K_OPCODE_NONE) {
+            iNumKept++;
+        }
+    }
+    pArrNewPos[iNumOpCodes] = iNumKept;
+    /* 重新计算跳转位置，保留的指令移动到数组前面 */
+    for (i = 0, iNumKept = 0; i < iNumOpCodes; ++i) {
+        OpCode* pOpCode = pArrOpCodes + i;
+        if (pOpCode->dwOpCodeId == K_OPCODE_NONE) {
+            continue;
+        }
+        if (isJumpOpCode(pOpCode->dwOpCodeId)) {
+            pOpCode->uParam.dwOpCodePos = pArrNewPos[pOpCode->uParam.dwOpCodePos];
+        }
+        pArrOpCodes[iNumKept++] = *pOpCode;
+    }
+    for (pListNode = pContext->pListFunctions->head; pListNode != NULL; pListNode = pListNode->next) {
+        FuncDecl* pFuncDecl = (FuncDecl *)pListNode->data;
+        pFuncDecl->iOpCodeStartPos = pArrNewPos[pFuncDecl->iOpCodeStartPos];
+    }
+    pContext->iNumOpCodes = iNumKept;
+}
+
+/* 一轮窥孔优化，返回是否有改动 */
+static KBool peepholeOpCodes(KbCompilerContext* pContext, OpCode* pArrOpCodes, int iNumOpCodes, KBool* pArrFlags, int* pArrPos) {
+    KBool   bChanged = KB_FALSE;
+    int     i, iHops;
+
+    /* 跳转到 GOTO 的跳转直接跳到最终目标，GOTO 成环时不改动 */
+    for (i = 0; i < iNumOpCodes; ++i) {
+        OpCode* pOpCode = pArrOpCodes + i;
+        KDword  dwTarget;
+        if (!isJumpOpCode(pOpCode->dwOpCodeId)) {
+            continue;
+        }
+        dwTarget = pOpCode->uParam.dwOpCodePos;
+        for (iHops = 0; iHops < iNumOpCodes && pArrOpCodes[dwTarget].dwOpCodeId == K_OPCODE_GOTO; ++iHops) {
+            dwTarget = pArrOpCodes[dwTarget].uParam.dwOpCodePos;
+        }
+        if (iHops < iNumOpCodes && dwTarget != pOpCode->uParam.dwOpCodePos) {
+            pOpCode->uParam.dwOpCodePos = dwTarget;
+            bChanged = KB_TRUE;
+        }
+    }
+
+    markOpCodeEntries(pContext, pArrOpCodes, iNumOpCodes, pArrFlags);
+    for (i = 0; i < iNumOpCodes; ++i) {
+        OpCode* pOpCode = pArrOpCodes + i;
+        OpCode* pOpCodeNext = i + 1 < iNumOpCodes ? pArrOpCodes + i + 1 : NULL;
+        switch (pOpCode->dwOpCodeId) {
+            case K_OPCODE_IF_GOTO:
+            case K_OPCODE_UNLESS_GOTO:
+                /* IF_GOTO L1, GOTO L2, L1: => UNLESS_GOTO L2, L1: */
+                if (pOpCode->uParam.dwOpCodePos == (KDword)(i + 2) && pOpCodeNext &&
+                    pOpCodeNext->dwOpCodeId == K_OPCODE_GOTO && !pArrFlags[i + 1]
+                ) {
+                    pOpCode->dwOpCodeId = pOpCode->dwOpCodeId == K_OPCODE_IF_GOTO ? K_OPCODE_UNLESS_GOTO : K_OPCODE_IF_GOTO;
+                    pOpCode->uParam.dwOpCodePos = pOpCodeNext->uParam.dwOpCodePos;
+                    pOpCodeNext->dwOpCodeId = K_OPCODE_NONE;
+                    bChanged = KB_TRUE;
+                    i++;
+                }
+                /* 条件跳转到下一条，只需要弹出条件 */
+                else if (pOpCode->uParam.dwOpCodePos == (KDword)(i + 1)) {
+                    pOpCode->dwOpCodeId = K_OPCODE_POP;
+                    bChanged = KB_TRUE;
+                }
+                break;
+            case K_OPCODE_GOTO:
+                /* 跳转到下一条 */
+                if (pOpCode->uParam.dwOpCodePos == (KDword)(i + 1)) {
+                    pOpCode->dwOpCodeId = K_OPCODE_NONE;
+                    bChanged = KB_TRUE;
+                }
+                break;
+            case K_OPCODE_PUSH_NUM:
+            case K_OPCODE_PUSH_INT:
+            case K_OPCODE_PUSH_STR:
+            case K_OPCODE_PUSH_VAR:
+                /* 压栈后立即弹出，POP 不是跳转目标时两条都删除 */
+                if (pOpCodeNext && pOpCodeNext->dwOpCodeId == K_OPCODE_POP && !pArrFlags[i + 1]) {
+                    pOpCode->dwOpCodeId = K_OPCODE_NONE;
+                    pOpCodeNext->dwOpCodeId = K_OPCODE_NONE;
+                    bChanged = KB_TRUE;
+                    i++;
+                }
+                break;
+        }
+    }
+
+    /* 删除执行不到的指令 (RETURN / GOTO / STOP 之后不是跳转目标的代码等) */
+    if (markReachableOpCodes(pContext, pArrOpCodes, iNumOpCodes, pArrFlags, pArrPos) < iNumOpCodes) {
+        for (i = 0; i < iNumOpCodes; ++i) {
+            if (!pArrFlags[i] && pArrOpCodes[i].dwOpCodeId != K_OPCODE_NONE) {
+                pArrOpCodes[i].dwOpCodeId = K_OPCODE_NONE;
+                bChanged = KB_TRUE;
+            }
+        }
+    }
+    return bChanged;
+}
+
+/*
+ * 窥孔优化: 合并连续的跳转、删除无用的压栈弹出、翻转跳过 GOTO 的条件跳转、删除执行不到的代码
+ * 在 KompilerContext_Build 之后、KompilerContext_FuseOpCodes 之前调用，跳转位置已经是指令下标
+ * 返回删除的指令数量
+ */
+int KompilerContext_OptimizeOpCodes(KbCompilerContext* pContext) {
+    int         iNumBefore  = pContext->iNumOpCodes;
+    KBool*      pArrFlags   = (KBool *)malloc(sizeof(KBool) * (iNumBefore + 1));
+    int*        pArrPos     = (int *)malloc(sizeof(int) * (iNumBefore + pContext->pListFunctions->size + 1));
+
+    while (pContext->iNumOpCodes > 0 && peepholeOpCodes(pContext, pContext->pArrOpCodes, pContext->iNumOpCodes, pArrFlags, pArrPos)) {
+        compactOpCodes(pContext, pArrPos);
+    }
+
+    free(pArrPos);
+    free(pArrFlags);
+    return iNumBefore - pContext->iNumOpCodes;
+}
+
+/* 可以融合的数值运算符，字符串拼接和逻辑运算不参与融合 */
+static KBool isFusibleOperator(KDword dwOperatorId) {
+    switch (dwOperatorId) {
+        case OPR_ADD: case OPR_SUB: case OPR_MUL: case OPR_DIV: case OPR_POW:
+        case OPR_INTDIV: case OPR_MOD:
+        case OPR_EQUAL: case OPR_NEQ: case OPR_GT: case OPR_LT: case OPR_GTEQ: case OPR_LTEQ:
+            return KB_TRUE;
+        default:
+            return KB_FALSE;
+    }
+}
+
+static KBool isCompareOperator(KDword dwOperatorId) {
+    switch (dwOperatorId) {
+        case OPR_EQUAL: case OPR_NEQ: case OPR_GT: case OPR_LT: case OPR_GTEQ: case OPR_LTEQ:
+            return KB_TRUE;
+        default:
+            return KB_FALSE;
+    }
+}
+
+static KBool isSameVarAccess(const OpCode* pOpCodeA, const OpCode* pOpCodeB) {
+    return pOpCodeA->uParam.sVarAccess.wIsLocal == pOpCodeB->uParam.sVarAccess.wIsLocal
+        && pOpCodeA->uParam.sVarAccess.wVarIndex == pOpCodeB->uParam.sVarAccess.wVarIndex;
+}
+
+/* 尝试融合从 pArrOpCodes[0] 开始的指令序列，返回融合的指令条数，不能融合返回 0 */
+static int fuseOpCodeSequence(OpCode* pArrOpCodes, int iNumOpCodes) {
+    KDword  dwFirst, dwSecond, dwOperatorId;
+    int     iFusedOpCodeId = K_OPCODE_NONE;
+
+    if (iNumOpCodes < 3 || pArrOpCodes[2].dwOpCodeId != K_OPCODE_BINARY_OPERATOR) {
+        return 0;
+    }
+    dwFirst         = pArrOpCodes[0].dwOpCodeId;
+    dwSecond        = pArrOpCodes[1].dwOpCodeId;
+    dwOperatorId    = pArrOpCodes[2].uParam.dwOperatorId;
+    if (!isFusibleOperator(dwOperatorId)) {
+        return 0;
+    }
+
+    /* PUSH_NUM / PUSH_INT, PUSH_VAR v, ADD, SET_VAR v => INC_VAR / INC_VAR_INT */
+    if (iNumOpCodes >= 4 &&
+        (dwFirst == K_OPCODE_PUSH_NUM || dwFirst == K_OPCODE_PUSH_INT) &&
+        dwSecond == K_OPCODE_PUSH_VAR &&
+        dwOperatorId == OPR_ADD &&
+        pArrOpCodes[3].dwOpCodeId == K_OPCODE_SET_VAR &&
+        isSameVarAccess(pArrOpCodes + 1, pArrOpCodes + 3)
+    ) {
+        pArrOpCodes[0].dwOpCodeId = dwFirst == K_OPCODE_PUSH_INT ? K_OPCODE_INC_VAR_INT : K_OPCODE_INC_VAR;
+        return 4;
+    }
+
+    /* 第二条的数字字面值由超级指令按原始指令的 Id 读取，整数和浮点数共用一条超级指令 */
+    if (dwSecond == K_OPCODE_PUSH_INT) {
+        dwSecond = K_OPCODE_PUSH_NUM;
+    }
+
+    /* 比较后条件跳转 */
+    if (iNumOpCodes >= 4 &&
+        isCompareOperator(dwOperatorId) &&
+        pArrOpCodes[3].dwOpCodeId == K_OPCODE_UNLESS_GOTO
+    ) {
+        if (dwFirst == K_OPCODE_PUSH_VAR && dwSecond == K_OPCODE_PUSH_NUM) {
+            iFusedOpCodeId = K_OPCODE_VAR_NUM_CMP_UNLESS_GOTO;
+        }
+        else if (dwFirst == K_OPCODE_PUSH_NUM && dwSecond == K_OPCODE_PUSH_VAR) {
+            iFusedOpCodeId = K_OPCODE_NUM_VAR_CMP_UNLESS_GOTO;
+        }
+        else if (dwFirst == K_OPCODE_PUSH_INT && dwSecond == K_OPCODE_PUSH_VAR) {
+            iFusedOpCodeId = K_OPCODE_INT_VAR_CMP_UNLESS_GOTO;
+        }
+        else if (dwFirst == K_OPCODE_PUSH_VAR && dwSecond == K_OPCODE_PUSH_VAR) {
+            iFusedOpCodeId = K_OPCODE_VAR_VAR_CMP_UNLESS_GOTO;
+        }
+        if (iFusedOpCodeId != K_OPCODE_NONE) {
+            pArrOpCodes[0].dwOpCodeId = iFusedOpCodeId;
+            return 4;
+        }
+    }
+
+    /* 两个操作数的运算 */
+    if (dwFirst == K_OPCODE_PUSH_VAR && dwSecond == K_OPCODE_PUSH_NUM) {
+        iFusedOpCodeId = K_OPCODE_VAR_NUM_BINOP;
+    }
+    else if (dwFirst == K_OPCODE_PUSH_NUM && dwSecond == K_OPCODE_PUSH_VAR) {
+        iFusedOpCodeId = K_OPCODE_NUM_VAR_BINOP;
+    }
+    else if (dwFirst == K_OPCODE_PUSH_INT && dwSecond == K_OPCODE_PUSH_VAR) {
+        iFusedOpCodeId = K_OPCODE_INT_VAR_BINOP;
+    }
+    else if (dwFirst == K_OPCODE_PUSH_VAR && dwSecond == K_OPCODE_PUSH_VAR) {
+        iFusedOpCodeId = K_OPCODE_VAR_VAR_BINOP;
+    }
+    if (iFusedOpCodeId != K_OPCODE_NONE) {
+        pArrOpCodes[0].dwOpCodeId = iFusedOpCodeId;
+        return 3;
+    }
+    return 0;
+}
+
+/*
+ * 把常见的指令序列融合为一条超级指令
+ * 融合后的指令只替换序列第一条指令的 Id，参数仍然从后续原始指令读取，
+ * 后续原始指令保持不变，所以跳转位置不需要重新计算，跳到序列中间也能正确执行
+ */
+int KompilerContext_FuseOpCodes(KbCompilerContext* pContext) {
+    int i = 0;
+    int iNumFused = 0;
+
+    while (i < pContext->iNumOpCodes) {
+        int iNumOpCodes = pContext->iNumOpCodes - i;
+        int iFusedLength;
+
+        iFusedLength = fuseOpCodeSequence(pContext->pArrOpCodes + i, iNumOpCodes < 4 ? iNumOpCodes : 4);
+        if (iFusedLength > 0) {
+            /* 跳过被融合的指令 */
+            iNumFused++;
+            i += iFusedLength;
+        }
+        else {
+            i++;
+        }
+    }
+
+    return iNumFused;
+}
+
+/* 拓展函数按声明顺序写入拓展函数表 */
+static void writeExtFuncInfo(BinExtFuncInfo* pArrExtFuncInfo, const KbCompilerContext* pContext) {
+    VlistNode*  pListNode;
+    int         i;
+    for (
+        i = 0, pListNode = pContext->pListExtFuncs->head;
+        pListNode != NULL;
+        ++i, pListNode = pListNode->next
+    ) {
+        const ExtFunc* pExtFunc = (const ExtFunc *)pListNode->data;
+        pArrExtFuncInfo[i].dwCallId     = pExtFunc->iCallId;
+        pArrExtFuncInfo[i].dwNumParams  = pExtFunc->iNumParams;
+    }
+}
+
 /*
           序列化后的内存布局
     ---------- layout ----------   <--- 0
@@ -1339,6 +1871,10 @@ KBool KompilerContext_Serialize(
     |                          |
     |         * func *         |      + dwByteLengthFunc
     |                          |
+    ----------------------------   <--- dwExtFuncBlockStart
+    |                          |
+    |       * ext func *       |      + dwByteLengthExtFunc
+    |                          |
     ----------------------------   <--- dwOpCodeBlockStart
     |                          |
     |        * opcode *        |      + dwByteLengthOpCode
@@ -1348,79 +1884,606 @@ KBool KompilerContext_Serialize(
     |     * string pool *      |      + dwStringAlignedLength
     |                          |
     ----------------------------
+    栈字节码和寄存器字节码的布局相同，只有魔法数字和 opCode 的结构不同
 */
-    VlistNode*  pListNode   = NULL;
-    int         i           = 0;
-
+static void serializeBinary(
+    const KbCompilerContext*    pContext,
+    KByte                       bMagicByte2,
+    KDword                      dwNumVariables,
+    const BinFuncInfo*          pArrFuncInfo,
+    const void*                 pOpCodeBlock,
+    KDword                      dwNumOpCode,
+    KDword                      dwOpCodeSize,
+    KByte**                     pPtrByteRaw,
+    KDword*                     pDwRawLength
+) {
     KDword dwHeaderSize         = sizeof(BinHeader);
     KDword dwFuncBlockStart     = dwHeaderSize;
     KDword dwByteLengthFunc     = pContext->pListFunctions->size * sizeof(BinFuncInfo);
-    KDword dwOpCodeBlockStart   = dwFuncBlockStart + dwByteLengthFunc;
-    KDword dwByteLengthOpCode   = pContext->pListOpCodes->size * sizeof(OpCode);
+    KDword dwExtFuncBlockStart  = dwFuncBlockStart + dwByteLengthFunc;
+    KDword dwByteLengthExtFunc  = pContext->pListExtFuncs->size * sizeof(BinExtFuncInfo);
+    KDword dwOpCodeBlockStart   = dwExtFuncBlockStart + dwByteLengthExtFunc;
+    KDword dwByteLengthOpCode   = dwNumOpCode * dwOpCodeSize;
     KDword dwStringPoolStart    = dwOpCodeBlockStart + dwByteLengthOpCode;
     KDword dwStringPoolLength   = pContext->iStringPoolSize;
     KDword dwStringAlignedSize  = dwStringPoolLength % 16 == 0 ? dwStringPoolLength : (dwStringPoolLength / 16 + 1) * 16;
-    KDword dwSizeTotal          = dwHeaderSize + dwByteLengthFunc + dwByteLengthOpCode + dwStringAlignedSize;
+    KDword dwSizeTotal          = dwHeaderSize + dwByteLengthFunc + dwByteLengthExtFunc + dwByteLengthOpCode + dwStringAlignedSize;
 
     KByte*          pByteRaw        = (KByte *)malloc(dwSizeTotal);
     BinHeader*      pHeader         = (BinHeader *)pByteRaw;
-    BinFuncInfo*    pWriterFunc     = NULL;
-    OpCode*         pWriterOpCode   = NULL;
-    char*           pWriterStrPool  = NULL;
 
     memset(pByteRaw, 0, dwSizeTotal);
 
     /* 写入文件头 */
     pHeader->uHeaderMagic.bVal[0]   = K_HEADER_MAGIC_BYTE_0;
     pHeader->uHeaderMagic.bVal[1]   = K_HEADER_MAGIC_BYTE_1;
-    pHeader->uHeaderMagic.bVal[2]   = K_HEADER_MAGIC_BYTE_2;
+    pHeader->uHeaderMagic.bVal[2]   = bMagicByte2;
     pHeader->uHeaderMagic.bVal[3]   = K_HEADER_MAGIC_BYTE_3;
     pHeader->dwIsLittleEndian       = isLittleEndian();
-    pHeader->dwNumVariables         = pContext->pListGlobalVariables->size;
+    pHeader->dwNumVariables         = dwNumVariables;
     pHeader->dwNumFunc              = pContext->pListFunctions->size;
     pHeader->dwFuncBlockStart       = dwFuncBlockStart;
+    pHeader->dwNumExtFunc           = pContext->pListExtFuncs->size;
+    pHeader->dwExtFuncBlockStart    = dwExtFuncBlockStart;
     pHeader->dwOpCodeBlockStart     = dwOpCodeBlockStart;
-    pHeader->dwNumOpCode            = pContext->pListOpCodes->size;
+    pHeader->dwNumOpCode            = dwNumOpCode;
     pHeader->dwStringPoolStart      = dwStringPoolStart;
     pHeader->dwStringPoolLength     = dwStringPoolLength;
     pHeader->dwStringAlignedSize    = dwStringAlignedSize;
+    StringCopy(pHeader->szExtensionId, sizeof(pHeader->szExtensionId), pContext->szExtensionId);
+
+    /* 写入函数、拓展函数表、OpCode 和 String Pool */
+    memcpy(pByteRaw + dwFuncBlockStart, pArrFuncInfo, dwByteLengthFunc);
+    writeExtFuncInfo((BinExtFuncInfo *)(pByteRaw + dwExtFuncBlockStart), pContext);
+    memcpy(pByteRaw + dwOpCodeBlockStart, pOpCodeBlock, dwByteLengthOpCode);
+    memcpy(pByteRaw + dwStringPoolStart, pContext->szStringPool, pContext->iStringPoolSize);
+
+    *pPtrByteRaw    = pByteRaw;
+    *pDwRawLength   = dwSizeTotal;
+}
 
-    /* 设置写入用的指针头 */
-    pWriterFunc     = (BinFuncInfo *)(pByteRaw + pHeader->dwFuncBlockStart);
-    pWriterOpCode   = (OpCode *)(pByteRaw + pHeader->dwOpCodeBlockStart);
-    pWriterStrPool  = (char *)(pByteRaw + pHeader->dwStringPoolStart);
+/* 函数信息写入数组，调用者负责释放 */
+static BinFuncInfo* createFuncInfoArray(const KbCompilerContext* pContext) {
+    BinFuncInfo*    pArrFuncInfo = (BinFuncInfo *)malloc(sizeof(BinFuncInfo) * (pContext->pListFunctions->size + 1));
+    VlistNode*      pListNode;
+    int             i;
 
-    /* 写入函数 */
     for (
         i = 0, pListNode = pContext->pListFunctions->head;
         pListNode != NULL;
         ++i, pListNode = pListNode->next
     ) {
         FuncDecl*       pFuncDecl   = (FuncDecl *)pListNode->data;
-        BinFuncInfo*    pBinFunc    = pWriterFunc + i;
+        BinFuncInfo*    pBinFunc    = pArrFuncInfo + i;
 
+        memset(pBinFunc, 0, sizeof(BinFuncInfo));
         pBinFunc->dwNumParams = pFuncDecl->iNumParams;
         pBinFunc->dwNumVars   = pFuncDecl->pListVariables->size;
         pBinFunc->dwOpCodePos = pFuncDecl->iOpCodeStartPos;
         StringCopy(pBinFunc->szName, sizeof(pBinFunc->szName), pFuncDecl->szFuncName);
     }
+    return pArrFuncInfo;
+}
 
-    /* 写入 OpCode */
-    for (
-        i = 0, pListNode = pContext->pListOpCodes->head;
-        pListNode != NULL;
-        ++i, pListNode = pListNode->next
-    ) {
-        OpCode* pOpReader   = (OpCode *)pListNode->data;
-        OpCode* pOpWriter   = pWriterOpCode + i;
-        memcpy(pOpWriter, pOpReader, sizeof(OpCode));
-    }
-    
-    /* 写入 String Pool */
-    memcpy(pWriterStrPool, pContext->szStringPool, pContext->iStringPoolSize);
+KBool KompilerContext_Serialize(
+    const KbCompilerContext*    pContext,
+    KByte**                     pPtrByteRaw,
+    KDword*                     pDwRawLength
+) {
+    BinFuncInfo*    pArrFuncInfo    = createFuncInfoArray(pContext);
 
-    *pPtrByteRaw    = pByteRaw;
-    *pDwRawLength   = dwSizeTotal;
+    /* opCode 本身连续存放，整块直接写入 */
+    serializeBinary(
+        pContext,
+        K_HEADER_MAGIC_BYTE_2,
+        pContext->pListGlobalVariables->size,
+        pArrFuncInfo,
+        pContext->pArrOpCodes,
+        pContext->iNumOpCodes,
+        sizeof(OpCode),
+        pPtrByteRaw,
+        pDwRawLength
+    );
+
+    free(pArrFuncInfo);
 
     return KB_TRUE;
-}
\ No newline at end of file
+}
+
+/* ------------------------------------------------------------ */
+/*                      寄存器字节码生成                        */
+/* ------------------------------------------------------------ */
+
+/*
+ * 寄存器字节码从栈字节码翻译得到:
+ * 用一个虚拟栈模拟栈字节码的执行，变量和立即数只记录在虚拟栈上，
+ * 被运算指令使用时直接作为操作数，运算结果写入虚拟栈位置对应的临时寄存器 T(i)
+ * 临时寄存器在函数中是额外的局部变量，在函数外是额外的全局变量
+ * 跳转和跳转目标处虚拟栈上的所有值都写入临时寄存器，保证各条路径上的状态一致
+ */
+
+#define REG_ITEM_TEMP   0   /* 值已经在对应位置的临时寄存器中 */
+#define REG_ITEM_VAR    1   /* 变量，还没有读取 */
+#define REG_ITEM_NUM    2   /* 数字立即数 */
+#define REG_ITEM_STR    3   /* 字符串立即数 */
+#define REG_ITEM_INT    4   /* 整数立即数 */
+
+typedef struct {
+    int     iKind;
+    KWord   wVar;
+    KFloat  fLiteral;
+    int     iLiteral;
+    KDword  dwStringPoolPos;
+} RegStackItem;
+
+typedef struct {
+    RegOpCode*      pArrRegOpCodes;
+    int             iNumRegOpCodes;
+    int             iCapacity;
+    RegStackItem*   pArrStack;
+    int             iStackTop;
+    KWord           wTempKind;      /* 临时寄存器是全局变量还是局部变量 */
+    int             iTempBase;      /* 临时寄存器 T(0) 的下标 */
+    int             iTempMax;       /* 当前作用域用到的临时寄存器数量 */
+} RegBuilder;
+
+static RegOpCode* regAppend(RegBuilder* pBuilder, RegOpCodeId iRegOpCodeId) {
+    RegOpCode* pRegOp;
+    if (pBuilder->iNumRegOpCodes >= pBuilder->iCapacity) {
+        pBuilder->iCapacity *= 2;
+        pBuilder->pArrRegOpCodes = (RegOpCode *)realloc(pBuilder->pArrRegOpCodes, sizeof(RegOpCode) * pBuilder->iCapacity);
+    }
+    pRegOp = pBuilder->pArrRegOpCodes + pBuilder->iNumRegOpCodes++;
+    memset(pRegOp, 0, sizeof(RegOpCode));
+    pRegOp->bOpCodeId = (KByte)iRegOpCodeId;
+    return pRegOp;
+}
+
+static KWord regTemp(RegBuilder* pBuilder, int iPos) {
+    if (iPos + 1 > pBuilder->iTempMax) {
+        pBuilder->iTempMax = iPos + 1;
+    }
+    return (KWord)(pBuilder->wTempKind | (pBuilder->iTempBase + iPos));
+}
+
+static KWord regVarOperand(const OpCode* pOpCode) {
+    return (KWord)(
+        (pOpCode->uParam.sVarAccess.wIsLocal ? K_REG_KIND_LOCAL : K_REG_KIND_GLOBAL) |
+        pOpCode->uParam.sVarAccess.wVarIndex
+    );
+}
+
+static KBool regItemIsImm(const RegStackItem* pItem) {
+    return pItem->iKind == REG_ITEM_NUM || pItem->iKind == REG_ITEM_INT || pItem->iKind == REG_ITEM_STR;
+}
+
+/* 虚拟栈位置 iPos 上的值作为操作数，立即数写入指令的 uImm */
+static KWord regItemOperand(RegBuilder* pBuilder, RegOpCode* pRegOp, int iPos) {
+    const RegStackItem* pItem = pBuilder->pArrStack + iPos;
+    switch (pItem->iKind) {
+        default:
+        case REG_ITEM_TEMP:
+            return regTemp(pBuilder, iPos);
+        case REG_ITEM_VAR:
+            return pItem->wVar;
+        case REG_ITEM_NUM:
+            pRegOp->uImm.fLiteral = pItem->fLiteral;
+            return K_REG_KIND_IMM_NUM;
+        case REG_ITEM_INT:
+            pRegOp->uImm.iLiteral = pItem->iLiteral;
+            return K_REG_KIND_IMM_NUM | K_REG_IMM_INTEGER;
+        case REG_ITEM_STR:
+            pRegOp->uImm.dwStringPoolPos = pItem->dwStringPoolPos;
+            return K_REG_KIND_IMM_STR;
+    }
+}
+
+/* 虚拟栈位置 iPos 上的值写入临时寄存器 */
+static void regMaterialize(RegBuilder* pBuilder, int iPos) {
+    RegOpCode* pRegOp;
+    if (pBuilder->pArrStack[iPos].iKind == REG_ITEM_TEMP) {
+        return;
+    }
+    pRegOp = regAppend(pBuilder, K_REG_OPCODE_MOVE);
+    pRegOp->wSrcA = regItemOperand(pBuilder, pRegOp, iPos);
+    pRegOp->wDst = regTemp(pBuilder, iPos);
+    pBuilder->pArrStack[iPos].iKind = REG_ITEM_TEMP;
+}
+
+static void regFlush(RegBuilder* pBuilder) {
+    int i;
+    for (i = 0; i < pBuilder->iStackTop; ++i) {
+        regMaterialize(pBuilder, i);
+    }
+}
+
+/* 变量被修改前，虚拟栈上还没有读取的这个变量需要先写入临时寄存器 */
+static void regFlushVar(RegBuilder* pBuilder, KWord wVar) {
+    int i;
+    for (i = 0; i < pBuilder->iStackTop; ++i) {
+        if (pBuilder->pArrStack[i].iKind == REG_ITEM_VAR && pBuilder->pArrStack[i].wVar == wVar) {
+            regMaterialize(pBuilder, i);
+        }
+    }
+}
+
+static RegStackItem* regPush(RegBuilder* pBuilder, int iKind) {
+    RegStackItem* pItem = pBuilder->pArrStack + pBuilder->iStackTop++;
+    pItem->iKind = iKind;
+    return pItem;
+}
+
+/* 超级指令还原为序列的第一条原始指令 */
+static KDword getUnfusedOpCodeId(KDword dwOpCodeId) {
+    switch (dwOpCodeId) {
+        case K_OPCODE_VAR_NUM_BINOP:
+        case K_OPCODE_VAR_VAR_BINOP:
+        case K_OPCODE_VAR_NUM_CMP_UNLESS_GOTO:
+        case K_OPCODE_VAR_VAR_CMP_UNLESS_GOTO:
+            return K_OPCODE_PUSH_VAR;
+        case K_OPCODE_NUM_VAR_BINOP:
+        case K_OPCODE_NUM_VAR_CMP_UNLESS_GOTO:
+        case K_OPCODE_INC_VAR:
+            return K_OPCODE_PUSH_NUM;
+        case K_OPCODE_INT_VAR_BINOP:
+        case K_OPCODE_INT_VAR_CMP_UNLESS_GOTO:
+        case K_OPCODE_INC_VAR_INT:
+            return K_OPCODE_PUSH_INT;
+        default:
+            return dwOpCodeId;
+    }
+}
+
+static int getBuiltInFuncNumParams(KDword dwBuiltFuncId) {
+    int i;
+    for (i = 0; i < sizeof(BuiltInFunctions) / sizeof(BuiltInFunctions[0]); ++i) {
+        if (BuiltInFunctions[i].iFuncId == dwBuiltFuncId) {
+            return BuiltInFunctions[i].iNumParams;
+        }
+    }
+    return 0;
+}
+
+KBool KompilerContext_SerializeRegister(
+    const KbCompilerContext*    pContext,
+    KByte**                     pPtrByteRaw,
+    KDword*                     pDwRawLength
+) {
+    int             iNumOpCodes     = pContext->iNumOpCodes;
+    int             iNumFuncs       = pContext->pListFunctions->size;
+    int             iNumGlobals     = pContext->pListGlobalVariables->size;
+    const OpCode*   pArrOpCodes     = pContext->pArrOpCodes;
+    KBool*          pArrIsLabel     = (KBool *)calloc(iNumOpCodes + 1, sizeof(KBool));
+    int*            pArrPosMap      = (int *)malloc(sizeof(int) * (iNumOpCodes + 1));
+    int*            pArrFuncAtPos   = (int *)malloc(sizeof(int) * (iNumOpCodes + 1));
+    int*            pArrFuncEndPos  = (int *)malloc(sizeof(int) * (iNumFuncs + 1));
+    int*            pArrFuncTemps   = (int *)calloc(iNumFuncs + 1, sizeof(int));
+    BinFuncInfo*    pArrFuncInfo    = createFuncInfoArray(pContext);
+    BinExtFuncInfo* pArrExtFuncInfo = (BinExtFuncInfo *)malloc(sizeof(BinExtFuncInfo) * (pContext->pListExtFuncs->size + 1));
+    /* 跳转位置保存在 KWord 中，指令过多时不生成比较跳转 */
+    KBool           bCanFuseCmpJump = iNumOpCodes * 2 < K_REG_INDEX_MASK;
+    KBool           bSuccess        = KB_TRUE;
+    int             iGlobalTempMax  = 0;
+    int             iCurrentFunc    = -1;
+    int             iFuncEndPos     = -1;
+    RegBuilder      sBuilder;
+    int             i, p;
+
+    sBuilder.iCapacity      = iNumOpCodes + 16;
+    sBuilder.iNumRegOpCodes = 0;
+    sBuilder.pArrRegOpCodes = (RegOpCode *)malloc(sizeof(RegOpCode) * sBuilder.iCapacity);
+    sBuilder.pArrStack      = (RegStackItem *)malloc(sizeof(RegStackItem) * (iNumOpCodes + 1));
+    sBuilder.iStackTop      = 0;
+    sBuilder.wTempKind      = K_REG_KIND_GLOBAL;
+    sBuilder.iTempBase      = iNumGlobals;
+    sBuilder.iTempMax       = 0;
+
+    writeExtFuncInfo(pArrExtFuncInfo, pContext);
+
+    /* 标记所有跳转目标 */
+    for (i = 0; i < iNumOpCodes; ++i) {
+        const OpCode* pOpCode = pArrOpCodes + i;
+        pArrFuncAtPos[i] = -1;
+        switch (pOpCode->dwOpCodeId) {
+            case K_OPCODE_GOTO:
+            case K_OPCODE_IF_GOTO:
+            case K_OPCODE_UNLESS_GOTO:
+                pArrIsLabel[pOpCode->uParam.dwOpCodePos] = KB_TRUE;
+                break;
+        }
+    }
+    pArrFuncAtPos[iNumOpCodes] = -1;
+
+    getFuncEndPositions(pArrOpCodes, KB_FALSE, iNumOpCodes, pArrFuncInfo, iNumFuncs, pArrFuncEndPos);
+
+    /* 函数的开始位置也是跳转目标 */
+    for (i = 0; i < iNumFuncs; ++i) {
+        pArrIsLabel[pArrFuncInfo[i].dwOpCodePos] = KB_TRUE;
+        pArrFuncAtPos[pArrFuncInfo[i].dwOpCodePos] = i;
+    }
+
+    for (p = 0; p < iNumOpCodes; ++p) {
+        const OpCode*   pOpCode = pArrOpCodes + p;
+        RegOpCode*      pRegOp;
+        RegStackItem*   pItem;
+        int             iPos;
+
+        /* 离开函数，临时寄存器切换回全局变量 */
+        if (p == iFuncEndPos) {
+            pArrFuncTemps[iCurrentFunc] = sBuilder.iTempMax;
+            sBuilder.wTempKind  = K_REG_KIND_GLOBAL;
+            sBuilder.iTempBase  = iNumGlobals;
+            sBuilder.iTempMax   = iGlobalTempMax;
+            sBuilder.iStackTop  = 0;
+            iCurrentFunc        = -1;
+            iFuncEndPos         = -1;
+        }
+        /* 跳转目标处虚拟栈全部写入临时寄存器 */
+        if (pArrIsLabel[p]) {
+            regFlush(&sBuilder);
+        }
+        /* 进入函数，临时寄存器是函数的额外局部变量 */
+        if (pArrFuncAtPos[p] >= 0) {
+            iCurrentFunc        = pArrFuncAtPos[p];
+            iFuncEndPos         = pArrFuncEndPos[iCurrentFunc];
+            iGlobalTempMax      = sBuilder.iTempMax;
+            sBuilder.wTempKind  = K_REG_KIND_LOCAL;
+            sBuilder.iTempBase  = pArrFuncInfo[iCurrentFunc].dwNumVars;
+            sBuilder.iTempMax   = 0;
+            sBuilder.iStackTop  = 0;
+        }
+        pArrPosMap[p] = sBuilder.iNumRegOpCodes;
+
+        switch (getUnfusedOpCodeId(pOpCode->dwOpCodeId)) {
+            default:
+                break;
+            case K_OPCODE_PUSH_NUM:
+                pItem = regPush(&sBuilder, REG_ITEM_NUM);
+                pItem->fLiteral = pOpCode->uParam.fLiteral;
+                break;
+            case K_OPCODE_PUSH_INT:
+                pItem = regPush(&sBuilder, REG_ITEM_INT);
+                pItem->iLiteral = pOpCode->uParam.iLiteral;
+                break;
+            case K_OPCODE_PUSH_STR:
+                pItem = regPush(&sBuilder, REG_ITEM_STR);
+                pItem->dwStringPoolPos = pOpCode->uParam.dwStringPoolPos;
+                break;
+            case K_OPCODE_PUSH_VAR:
+                pItem = regPush(&sBuilder, REG_ITEM_VAR);
+                pItem->wVar = regVarOperand(pOpCode);
+                break;
+            case K_OPCODE_POP:
+                sBuilder.iStackTop--;
+                break;
+            case K_OPCODE_BINARY_OPERATOR: {
+                const OpCode* pOpCodeNext = p + 1 < iNumOpCodes ? pArrOpCodes + p + 1 : NULL;
+                iPos = sBuilder.iStackTop - 2;
+                /* 两个操作数都是立即数时，左操作数先写入临时寄存器 */
+                if (regItemIsImm(sBuilder.pArrStack + iPos) && regItemIsImm(sBuilder.pArrStack + iPos + 1)) {
+                    regMaterialize(&sBuilder, iPos);
+                }
+                sBuilder.iStackTop -= 2;
+                /* 比较之后紧跟 UNLESS_GOTO，合并为一条比较跳转 */
+                if (bCanFuseCmpJump &&
+                    pOpCodeNext &&
+                    !pArrIsLabel[p + 1] &&
+                    pOpCodeNext->dwOpCodeId == K_OPCODE_UNLESS_GOTO &&
+                    isCompareOperator(pOpCode->uParam.dwOperatorId)
+                ) {
+                    regFlush(&sBuilder);
+                    pRegOp = regAppend(&sBuilder, K_REG_OPCODE_CMP_UNLESS_GOTO);
+                    pRegOp->wSrcA       = regItemOperand(&sBuilder, pRegOp, iPos);
+                    pRegOp->wSrcB       = regItemOperand(&sBuilder, pRegOp, iPos + 1);
+                    pRegOp->bOperatorId = (KByte)pOpCode->uParam.dwOperatorId;
+                    pRegOp->wDst        = (KWord)pOpCodeNext->uParam.dwOpCodePos;
+                    pArrPosMap[++p]     = sBuilder.iNumRegOpCodes;
+                    break;
+                }
+                pRegOp = regAppend(&sBuilder, K_REG_OPCODE_BINARY_OPERATOR);
+                pRegOp->wSrcA       = regItemOperand(&sBuilder, pRegOp, iPos);
+                pRegOp->wSrcB       = regItemOperand(&sBuilder, pRegOp, iPos + 1);
+                pRegOp->bOperatorId = (KByte)pOpCode->uParam.dwOperatorId;
+                pRegOp->wDst        = regTemp(&sBuilder, iPos);
+                regPush(&sBuilder, REG_ITEM_TEMP);
+                break;
+            }
+            case K_OPCODE_UNARY_OPERATOR:
+                iPos = --sBuilder.iStackTop;
+                pRegOp = regAppend(&sBuilder, K_REG_OPCODE_UNARY_OPERATOR);
+                pRegOp->wSrcA       = regItemOperand(&sBuilder, pRegOp, iPos);
+                pRegOp->bOperatorId = (KByte)pOpCode->uParam.dwOperatorId;
+                pRegOp->wDst        = regTemp(&sBuilder, iPos);
+                regPush(&sBuilder, REG_ITEM_TEMP);
+                break;
+            case K_OPCODE_SET_VAR: {
+                KWord       wVar        = regVarOperand(pOpCode);
+                RegOpCode*  pRegOpLast  = sBuilder.iNumRegOpCodes > 0 ? sBuilder.pArrRegOpCodes + sBuilder.iNumRegOpCodes - 1 : NULL;
+                iPos = --sBuilder.iStackTop;
+                pItem = sBuilder.pArrStack + iPos;
+                /* 运算结果直接写入变量，省去一次 MOVE */
+                if (pItem->iKind == REG_ITEM_TEMP &&
+                    !pArrIsLabel[p] &&
+                    pRegOpLast &&
+                    pRegOpLast->wDst == regTemp(&sBuilder, iPos) &&
+                    (pRegOpLast->bOpCodeId == K_REG_OPCODE_BINARY_OPERATOR ||
+                     pRegOpLast->bOpCodeId == K_REG_OPCODE_UNARY_OPERATOR ||
+                     pRegOpLast->bOpCodeId == K_REG_OPCODE_CALL_BUILT_IN ||
+                     pRegOpLast->bOpCodeId == K_REG_OPCODE_CALL_EXT)
+                ) {
+                    int iNumRegOpCodesBefore = sBuilder.iNumRegOpCodes;
+                    regFlushVar(&sBuilder, wVar);
+                    if (iNumRegOpCodesBefore == sBuilder.iNumRegOpCodes) {
+                        pRegOpLast->wDst = wVar;
+                        break;
+                    }
+                }
+                regFlushVar(&sBuilder, wVar);
+                /* 自己赋值给自己 */
+                if (pItem->iKind == REG_ITEM_VAR && pItem->wVar == wVar) {
+                    break;
+                }
+                pRegOp = regAppend(&sBuilder, K_REG_OPCODE_MOVE);
+                pRegOp->bOperatorId = pItem->iKind == REG_ITEM_TEMP;
+                pRegOp->wSrcA       = regItemOperand(&sBuilder, pRegOp, iPos);
+                pRegOp->wDst        = wVar;
+                break;
+            }
+            case K_OPCODE_SET_VAR_AS_ARRAY: {
+                KWord wVar = regVarOperand(pOpCode);
+                iPos = --sBuilder.iStackTop;
+                regFlushVar(&sBuilder, wVar);
+                pRegOp = regAppend(&sBuilder, K_REG_OPCODE_SET_VAR_AS_ARRAY);
+                pRegOp->wSrcA   = regItemOperand(&sBuilder, pRegOp, iPos);
+                pRegOp->wDst    = wVar;
+                break;
+            }
+            case K_OPCODE_ARR_GET:
+                iPos = --sBuilder.iStackTop;
+                pRegOp = regAppend(&sBuilder, K_REG_OPCODE_ARR_GET);
+                pRegOp->wSrcA   = regVarOperand(pOpCode);
+                pRegOp->wSrcB   = regItemOperand(&sBuilder, pRegOp, iPos);
+                pRegOp->wDst    = regTemp(&sBuilder, iPos);
+                regPush(&sBuilder, REG_ITEM_TEMP);
+                break;
+            case K_OPCODE_ARR_SET:
+                iPos = sBuilder.iStackTop - 2;
+                if (regItemIsImm(sBuilder.pArrStack + iPos) && regItemIsImm(sBuilder.pArrStack + iPos + 1)) {
+                    regMaterialize(&sBuilder, iPos);
+                }
+                sBuilder.iStackTop -= 2;
+                pRegOp = regAppend(&sBuilder, K_REG_OPCODE_ARR_SET);
+                pRegOp->bOperatorId = sBuilder.pArrStack[iPos + 1].iKind == REG_ITEM_TEMP;
+                pRegOp->wSrcA       = regItemOperand(&sBuilder, pRegOp, iPos);
+                pRegOp->wSrcB       = regItemOperand(&sBuilder, pRegOp, iPos + 1);
+                pRegOp->wDst        = regVarOperand(pOpCode);
+                break;
+            case K_OPCODE_CALL_BUILT_IN:
+                iPos = sBuilder.iStackTop - getBuiltInFuncNumParams(pOpCode->uParam.dwBuiltFuncId);
+                sBuilder.iStackTop = iPos;
+                pRegOp = regAppend(&sBuilder, K_REG_OPCODE_CALL_BUILT_IN);
+                if (getBuiltInFuncNumParams(pOpCode->uParam.dwBuiltFuncId) > 0) {
+                    pRegOp->wSrcA = regItemOperand(&sBuilder, pRegOp, iPos);
+                }
+                pRegOp->bOperatorId = (KByte)pOpCode->uParam.dwBuiltFuncId;
+                pRegOp->wDst        = regTemp(&sBuilder, iPos);
+                regPush(&sBuilder, REG_ITEM_TEMP);
+                break;
+            case K_OPCODE_CALL_EXT:
+                /* 和调用用户函数一样，参数在从 T(iPos) 开始的连续临时寄存器中 */
+                regFlush(&sBuilder);
+                iPos = sBuilder.iStackTop - pArrExtFuncInfo[pOpCode->uParam.dwExtFuncIndex].dwNumParams;
+                sBuilder.iStackTop = iPos;
+                pRegOp = regAppend(&sBuilder, K_REG_OPCODE_CALL_EXT);
+                pRegOp->wSrcA                   = regTemp(&sBuilder, iPos);
+                pRegOp->wDst                    = regTemp(&sBuilder, iPos);
+                pRegOp->uImm.dwExtFuncIndex     = pOpCode->uParam.dwExtFuncIndex;
+                regPush(&sBuilder, REG_ITEM_TEMP);
+                break;
+            case K_OPCODE_GOTO:
+                regFlush(&sBuilder);
+                pRegOp = regAppend(&sBuilder, K_REG_OPCODE_GOTO);
+                pRegOp->uImm.dwOpCodePos = pOpCode->uParam.dwOpCodePos;
+                break;
+            case K_OPCODE_IF_GOTO:
+            case K_OPCODE_UNLESS_GOTO:
+                /* 跳转位置占用了 uImm，条件不能是立即数 */
+                iPos = sBuilder.iStackTop - 1;
+                regMaterialize(&sBuilder, iPos);
+                sBuilder.iStackTop--;
+                regFlush(&sBuilder);
+                pRegOp = regAppend(
+                    &sBuilder,
+                    pOpCode->dwOpCodeId == K_OPCODE_IF_GOTO ? K_REG_OPCODE_IF_GOTO : K_REG_OPCODE_UNLESS_GOTO
+                );
+                pRegOp->wSrcA = regTemp(&sBuilder, iPos);
+                pRegOp->uImm.dwOpCodePos = pOpCode->uParam.dwOpCodePos;
+                break;
+            case K_OPCODE_CALL_FUNC:
+                /* 参数写入从 T(iPos) 开始的连续临时寄存器，返回值写入 T(iPos) */
+                regFlush(&sBuilder);
+                iPos = sBuilder.iStackTop - pArrFuncInfo[pOpCode->uParam.dwFuncIndex].dwNumParams;
+                sBuilder.iStackTop = iPos;
+                pRegOp = regAppend(&sBuilder, K_REG_OPCODE_CALL_FUNC);
+                pRegOp->wSrcA               = regTemp(&sBuilder, iPos);
+                pRegOp->wDst                = regTemp(&sBuilder, iPos);
+                pRegOp->uImm.dwFuncIndex    = pOpCode->uParam.dwFuncIndex;
+                regPush(&sBuilder, REG_ITEM_TEMP);
+                break;
+            case K_OPCODE_YIELD:
+                /* yield 在语句末尾，恢复后顺序执行，不需要保存其他的临时寄存器 */
+                iPos = --sBuilder.iStackTop;
+                pRegOp = regAppend(&sBuilder, K_REG_OPCODE_YIELD);
+                pRegOp->wSrcA = regItemOperand(&sBuilder, pRegOp, iPos);
+                break;
+            case K_OPCODE_RETURN:
+            case K_OPCODE_STOP:
+                iPos = --sBuilder.iStackTop;
+                pRegOp = regAppend(
+                    &sBuilder,
+                    pOpCode->dwOpCodeId == K_OPCODE_RETURN ? K_REG_OPCODE_RETURN : K_REG_OPCODE_STOP
+                );
+                pRegOp->wSrcA = regItemOperand(&sBuilder, pRegOp, iPos);
+                break;
+        }
+    }
+    pArrPosMap[iNumOpCodes] = sBuilder.iNumRegOpCodes;
+
+    /* 顶层代码的临时寄存器数量 */
+    if (iCurrentFunc < 0 && sBuilder.iTempMax > iGlobalTempMax) {
+        iGlobalTempMax = sBuilder.iTempMax;
+    }
+
+    /* 更新跳转位置 */
+    for (i = 0; i < sBuilder.iNumRegOpCodes; ++i) {
+        RegOpCode* pRegOp = sBuilder.pArrRegOpCodes + i;
+        switch (pRegOp->bOpCodeId) {
+            case K_REG_OPCODE_GOTO:
+            case K_REG_OPCODE_IF_GOTO:
+            case K_REG_OPCODE_UNLESS_GOTO:
+                pRegOp->uImm.dwOpCodePos = pArrPosMap[pRegOp->uImm.dwOpCodePos];
+                break;
+            case K_REG_OPCODE_CMP_UNLESS_GOTO:
+                pRegOp->wDst = (KWord)pArrPosMap[pRegOp->wDst];
+                break;
+        }
+    }
+
+    /* 更新函数的开始位置，临时寄存器作为额外的局部变量 */
+    for (i = 0; i < iNumFuncs; ++i) {
+        pArrFuncInfo[i].dwOpCodePos = pArrPosMap[pArrFuncInfo[i].dwOpCodePos];
+        pArrFuncInfo[i].dwNumVars  += pArrFuncTemps[i];
+        if (pArrFuncInfo[i].dwNumVars > K_REG_INDEX_MASK) {
+            bSuccess = KB_FALSE;
+        }
+    }
+    if (iNumGlobals + iGlobalTempMax > K_REG_INDEX_MASK) {
+        bSuccess = KB_FALSE;
+    }
+
+    if (bSuccess) {
+        serializeBinary(
+            pContext,
+            K_HEADER_REG_MAGIC_BYTE_2,
+            iNumGlobals + iGlobalTempMax,
+            pArrFuncInfo,
+            sBuilder.pArrRegOpCodes,
+            sBuilder.iNumRegOpCodes,
+            sizeof(RegOpCode),
+            pPtrByteRaw,
+            pDwRawLength
+        );
+    }
+
+    free(sBuilder.pArrRegOpCodes);
+    free(sBuilder.pArrStack);
+    free(pArrFuncInfo);
+    free(pArrExtFuncInfo);
+    free(pArrFuncTemps);
+    free(pArrFuncAtPos);
+    free(pArrFuncEndPos);
+    free(pArrPosMap);
+    free(pArrIsLabel);
+
+    return bSuccess;
+}
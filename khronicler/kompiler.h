@@ -3,6 +3,9 @@
 
 #include "kparser.h"
 
+/* 跳转标签在 KbCompilerContext::pArrLabelPos 中的下标 */
+typedef int KbLabelIndex;
+
 typedef struct tagKbVariableDeclaration {
     char            szVarName[KB_IDENTIFIER_LEN_MAX + 1];
     int             iIndex;
@@ -15,11 +18,12 @@ typedef struct tagKbFunctionDeclaration {
     int     iIndex;
     int     iOpCodeStartPos;
     Vlist*  pListVariables; /* <KbVariableDeclaration> */
+    Vhash*  pHashVariables; /* 变量名 => <KbVariableDeclaration> */
 } KbFunctionDeclaration;
 
 typedef struct tagKbGotoLabel {
     char szLabelName[KB_IDENTIFIER_LEN_MAX + 1];
-    KLabelOpCodePos iOpCodePos; 
+    KbLabelIndex iLabelIndex;
     KbFunctionDeclaration* pFuncDeclScope;
 } KbGotoLabel;
 
@@ -36,26 +40,26 @@ typedef struct tagControlFlowLabel {
     ControlFlowTypeId iType;
     union {
         struct {
-            KLabelOpCodePos iEndPos;
+            KbLabelIndex iEndPos;
         } sFunction;
         struct {
-            KLabelOpCodePos iThenEndPos;
-            KLabelOpCodePos* pArrElseIfEndPos;
-            KLabelOpCodePos iEndPos;
+            KbLabelIndex iThenEndPos;
+            KbLabelIndex* pArrElseIfEndPos;
+            KbLabelIndex iEndPos;
         } sIf;
         struct {
-            KLabelOpCodePos iCondPos;
-            KLabelOpCodePos iEndPos;
+            KbLabelIndex iCondPos;
+            KbLabelIndex iEndPos;
         } sWhile;
         struct {
-            KLabelOpCodePos iStartPos;
-            KLabelOpCodePos iCondPos;
-            KLabelOpCodePos iEndPos;
+            KbLabelIndex iStartPos;
+            KbLabelIndex iCondPos;
+            KbLabelIndex iEndPos;
         } sDoWhile;
         struct {
-            KLabelOpCodePos iCondPos;
-            KLabelOpCodePos iIncreasePos;
-            KLabelOpCodePos iEndPos;
+            KbLabelIndex iCondPos;
+            KbLabelIndex iIncreasePos;
+            KbLabelIndex iEndPos;
         } sFor;
     } uData;
 } KbControlFlowLabel;
@@ -63,15 +67,28 @@ typedef struct tagControlFlowLabel {
 typedef struct tagKbCompilerContext {
     Vlist*  pListGlobalVariables;   /* <KbVariableDeclaration> */
     Vlist*  pListFunctions;         /* <KbFunctionDeclaration> */
-    char    szStringPool[KB_CONTEXT_STRING_POOL_MAX];
+    Vhash*  pHashGlobalVariables;   /* 变量名 => <KbVariableDeclaration> */
+    Vhash*  pHashFunctions;         /* 函数名 => <KbFunctionDeclaration> */
+    char*   szStringPool;           /* 字符串常量池，按需扩容 */
     int     iStringPoolSize;
-    Vlist*  pListOpCodes;           /* <OpCode> */
+    int     iStringPoolCapacity;
+    int*    pArrStringSlots;        /* 字符串去重表，保存字符串在池中的位置，-1 表示空 */
+    int     iNumStrings;
+    int     iStringSlotCapacity;
+    OpCode* pArrOpCodes;            /* 连续存放的 opCode，序列化时整块复制 */
+    int     iNumOpCodes;
+    int     iOpCodeCapacity;
+    KLabelOpCodePos* pArrLabelPos;  /* 标签下标 => opCode 位置，-1 表示还没有确定 */
+    int     iNumLabelPos;
+    int     iLabelPosCapacity;
     Vlist*  pListLabels;            /* <KbGotoLabel> */
+    Vhash*  pHashLabels;            /* 标签名 => <KbGotoLabel> */
     KbFunctionDeclaration* pCurrentFunc;
     int     iNumCtrlFlowLabels;
     KbControlFlowLabel* pCtrlFlowLabels;
     char    szExtensionId[KB_IDENTIFIER_LEN_MAX + 1];
     Vlist*  pListExtFuncs;          /* <KbExtensionFunction> */
+    Vhash*  pHashExtFuncs;          /* 函数名 => <KbExtensionFunction> */
 } KbCompilerContext;
 
 typedef enum {
@@ -100,6 +117,9 @@ const char*         KExtensionError_GetMessageById  (ExtensionErrorId iExtErrorI
 void                KompilerContext_Destroy         (KbCompilerContext* pContext);
 KbCompilerContext*  KompilerContext_Create          (const KbAstNode* pAstProgram);
 KBool               KompilerContext_Build           (KbCompilerContext* pContext, const KbAstNode* pAstProgram, SemanticErrorId* pIntSemanticError, const KbAstNode** pPtrAstStop);
+int                 KompilerContext_OptimizeOpCodes (KbCompilerContext* pContext);
+int                 KompilerContext_FuseOpCodes     (KbCompilerContext* pContext);
 KBool               KompilerContext_Serialize       (const KbCompilerContext* pContext, KByte** pPtrByteRaw, KDword* pDwRawLength);
+KBool               KompilerContext_SerializeRegister(const KbCompilerContext* pContext, KByte** pPtrByteRaw, KDword* pDwRawLength);
 
 #endif
\ No newline at end of file
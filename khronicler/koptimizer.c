@@ -0,0 +1,572 @@
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <math.h>
+#include "koptimizer.h"
+#include "kalias.h"
+
+/*
+ * AST 优化: 在编译之前折叠常量表达式、去掉括号节点、化简恒等式
+ * 折叠的结果必须和运行时的计算完全相同 (见 krt.c 的 calcNumericOperator 等)，
+ * 运行时会报错的表达式 (除数为 0、类型不符) 保持原样，错误留给运行时报告
+ */
+
+/* 浮点数在 int 范围内，运行时转换为 int 时没有未定义行为 */
+#define isFloatInIntRange(f) \
+    ((f) > -2147483648.0f && (f) < 2147483648.0f)
+
+#define isNumericLiteral(pAstNode) \
+    ((pAstNode)->iType == AST_LITERAL_NUMERIC)
+#define isIntegerLiteral(pAstNode) \
+    ((pAstNode)->iType == AST_LITERAL_NUMERIC && (pAstNode)->uData.sLiteralNumeric.bIsInteger)
+#define isStringLiteral(pAstNode) \
+    ((pAstNode)->iType == AST_LITERAL_STRING)
+#define isIntegerLiteralOf(pAstNode, iNumber) \
+    (isIntegerLiteral(pAstNode) && (pAstNode)->uData.sLiteralNumeric.iValue == (iNumber))
+
+/* 和运行时的 getRtValueAsFloat、getRtValueAsDouble 相同 */
+#define getLiteralAsFloat(pAstNode) \
+    ((pAstNode)->uData.sLiteralNumeric.bIsInteger ? (KFloat)(pAstNode)->uData.sLiteralNumeric.iValue : (pAstNode)->uData.sLiteralNumeric.fValue)
+#define getLiteralAsDouble(pAstNode) \
+    ((pAstNode)->uData.sLiteralNumeric.bIsInteger ? (double)(pAstNode)->uData.sLiteralNumeric.iValue : (double)(pAstNode)->uData.sLiteralNumeric.fValue)
+
+/* 和运行时的 addIntegerChecked、subIntegerChecked 相同，溢出时返回 KB_FALSE */
+#define addIntegerChecked(iLeft, iRight, iResult) (                             \
+    (iResult) = (int)((KDword)(iLeft) + (KDword)(iRight)),                      \
+    (((iLeft) ^ (iResult)) & ((iRight) ^ (iResult))) >= 0                       \
+)
+#define subIntegerChecked(iLeft, iRight, iResult) (                             \
+    (iResult) = (int)((KDword)(iLeft) - (KDword)(iRight)),                      \
+    (((iLeft) ^ (iRight)) & ((iLeft) ^ (iResult))) >= 0                         \
+)
+
+static KBool mulIntegerChecked(int iLeft, int iRight, int* pIntResult) {
+    int iResult = (int)((KDword)iLeft * (KDword)iRight);
+    if ((iLeft > 46340 || iLeft < -46340 || iRight > 46340 || iRight < -46340) &&
+        iLeft != 0 &&
+        ((iLeft == -1 && iRight == INT_MIN) || iResult / iLeft != iRight)
+    ) {
+        return KB_FALSE;
+    }
+    *pIntResult = iResult;
+    return KB_TRUE;
+}
+
+/* 常量的真假，和运行时的 canBeConsideredAsTrue 相同，不能确定时返回 KB_FALSE */
+static KBool getLiteralTruth(const AstNode* pAstNode, KBool* pBoolTruth) {
+    if (isStringLiteral(pAstNode)) {
+        *pBoolTruth = pAstNode->uData.sLiteralString.szValue[0] != '\0';
+        return KB_TRUE;
+    }
+    if (isIntegerLiteral(pAstNode)) {
+        *pBoolTruth = pAstNode->uData.sLiteralNumeric.iValue != 0;
+        return KB_TRUE;
+    }
+    if (isNumericLiteral(pAstNode) && isFloatInIntRange(pAstNode->uData.sLiteralNumeric.fValue)) {
+        *pBoolTruth = (int)pAstNode->uData.sLiteralNumeric.fValue != 0;
+        return KB_TRUE;
+    }
+    return KB_FALSE;
+}
+
+/* 常量的字符串形式，和运行时的字符串拼接相同，不能确定时返回 NULL */
+static const char* stringifyLiteral(const AstNode* pAstNode, char* szBuf) {
+    if (isStringLiteral(pAstNode)) {
+        return pAstNode->uData.sLiteralString.szValue;
+    }
+    if (isIntegerLiteral(pAstNode)) {
+        return Itoa(pAstNode->uData.sLiteralNumeric.iValue, szBuf, 10);
+    }
+    /* Ftoa 只能处理整数部分在 long 范围内的数 */
+    if (isNumericLiteral(pAstNode) && isFloatInIntRange(pAstNode->uData.sLiteralNumeric.fValue)) {
+        return Ftoa(pAstNode->uData.sLiteralNumeric.fValue, szBuf, K_DEFAULT_FTOA_PRECISION);
+    }
+    return NULL;
+}
+
+/* 释放运算符节点的操作数，节点本身改写为常量 */
+static void setIntegerLiteral(AstNode* pAstNode, int iValue) {
+    if (pAstNode->iType == AST_UNARY_OPERATOR) {
+        destroyAst(pAstNode->uData.sUnaryOperator.pAstOperand);
+    } else {
+        destroyAst(pAstNode->uData.sBinaryOperator.pAstLeftOperand);
+        destroyAst(pAstNode->uData.sBinaryOperator.pAstRightOperand);
+    }
+    pAstNode->iType = AST_LITERAL_NUMERIC;
+    pAstNode->uData.sLiteralNumeric.bIsInteger = KB_TRUE;
+    pAstNode->uData.sLiteralNumeric.iValue = iValue;
+    pAstNode->uData.sLiteralNumeric.fValue = (KFloat)iValue;
+}
+
+static void setFloatLiteral(AstNode* pAstNode, KFloat fValue) {
+    setIntegerLiteral(pAstNode, 0);
+    pAstNode->uData.sLiteralNumeric.bIsInteger = KB_FALSE;
+    pAstNode->uData.sLiteralNumeric.fValue = fValue;
+}
+
+/* 和运行时的 setIntegralRtValue 相同 */
+static void setIntegralLiteral(AstNode* pAstNode, KFloat fValue) {
+    if (isFloatInIntRange(fValue)) {
+        setIntegerLiteral(pAstNode, (int)fValue);
+    } else {
+        setFloatLiteral(pAstNode, fValue);
+    }
+}
+
+/* 接管字符串 szValue */
+static void setStringLiteral(AstNode* pAstNode, char* szValue) {
+    setIntegerLiteral(pAstNode, 0);
+    pAstNode->iType = AST_LITERAL_STRING;
+    pAstNode->uData.sLiteralString.szValue = szValue;
+}
+
+/* 用子节点 pAstChild 替换 *ppAstNode，子节点必须已经从原节点上摘下 */
+static void replaceAst(AstNode** ppAstNode, AstNode* pAstChild) {
+    AstNode* pAstNode = *ppAstNode;
+    pAstChild->iLineNumber = pAstNode->iLineNumber;
+    pAstChild->pAstParent = pAstNode->pAstParent;
+    destroyAst(pAstNode);
+    *ppAstNode = pAstChild;
+}
+
+static AstNode* takeAst(AstNode** ppAstField) {
+    AstNode* pAstNode = *ppAstField;
+    *ppAstField = NULL;
+    return pAstNode;
+}
+
+/* 表达式的结果一定是数字 (或者运行时报错) */
+static KBool isNumericExpression(const AstNode* pAstNode) {
+    switch (pAstNode->iType) {
+        case AST_LITERAL_NUMERIC:
+        case AST_UNARY_OPERATOR:
+            return KB_TRUE;
+        case AST_BINARY_OPERATOR:
+            return pAstNode->uData.sBinaryOperator.iOperatorId != OPR_CONCAT;
+        default:
+            return KB_FALSE;
+    }
+}
+
+/* 表达式的结果一定是整数 (或者运行时报错)，加减乘等运算溢出时会提升为浮点数 */
+static KBool isIntegerExpression(const AstNode* pAstNode) {
+    switch (pAstNode->iType) {
+        case AST_LITERAL_NUMERIC:
+            return pAstNode->uData.sLiteralNumeric.bIsInteger;
+        case AST_UNARY_OPERATOR:
+            return pAstNode->uData.sUnaryOperator.iOperatorId == OPR_NOT;
+        case AST_BINARY_OPERATOR:
+            switch (pAstNode->uData.sBinaryOperator.iOperatorId) {
+                case OPR_MOD:
+                case OPR_AND:
+                case OPR_OR:
+                case OPR_EQUAL:
+                case OPR_APPROX_EQ:
+                case OPR_NEQ:
+                case OPR_GT:
+                case OPR_LT:
+                case OPR_GTEQ:
+                case OPR_LTEQ:
+                    return KB_TRUE;
+                default:
+                    return KB_FALSE;
+            }
+        default:
+            return KB_FALSE;
+    }
+}
+
+/* 两边都是整数常量，和运行时相同：溢出、不能整除时交给浮点数运算 */
+static KBool foldIntegerOperator(AstNode* pAstNode, int iLeft, int iRight) {
+    int iResult;
+    switch (pAstNode->uData.sBinaryOperator.iOperatorId) {
+        case OPR_ADD:
+            if (!addIntegerChecked(iLeft, iRight, iResult)) return KB_FALSE;
+            break;
+        case OPR_SUB:
+            if (!subIntegerChecked(iLeft, iRight, iResult)) return KB_FALSE;
+            break;
+        case OPR_MUL:
+            if (!mulIntegerChecked(iLeft, iRight, &iResult)) return KB_FALSE;
+            break;
+        case OPR_DIV:
+            if (iRight == 0 || (iRight == -1 && iLeft == INT_MIN) || iLeft % iRight != 0) return KB_FALSE;
+            iResult = iLeft / iRight;
+            break;
+        case OPR_INTDIV:
+            if (iRight == 0 || (iRight == -1 && iLeft == INT_MIN)) return KB_FALSE;
+            iResult = iLeft / iRight;
+            break;
+        case OPR_MOD:
+            if (iRight == 0) return KB_FALSE;
+            iResult = iRight == -1 ? 0 : iLeft % iRight;
+            break;
+        case OPR_EQUAL:     iResult = iLeft == iRight; break;
+        case OPR_NEQ:       iResult = iLeft != iRight; break;
+        case OPR_GT:        iResult = iLeft > iRight; break;
+        case OPR_LT:        iResult = iLeft < iRight; break;
+        case OPR_GTEQ:      iResult = iLeft >= iRight; break;
+        case OPR_LTEQ:      iResult = iLeft <= iRight; break;
+        default:
+            return KB_FALSE;
+    }
+    setIntegerLiteral(pAstNode, iResult);
+    return KB_TRUE;
+}
+
+/* 两边都是数字常量，除数为 0 等运行时会报错的情况不折叠 */
+static KBool foldNumericOperator(AstNode* pAstNode) {
+    AstNode*    pAstLeft    = pAstNode->uData.sBinaryOperator.pAstLeftOperand;
+    AstNode*    pAstRight   = pAstNode->uData.sBinaryOperator.pAstRightOperand;
+    KFloat      fLeft       = getLiteralAsFloat(pAstLeft);
+    KFloat      fRight      = getLiteralAsFloat(pAstRight);
+    double      dLeft       = getLiteralAsDouble(pAstLeft);
+    double      dRight      = getLiteralAsDouble(pAstRight);
+
+    if (isIntegerLiteral(pAstLeft) && isIntegerLiteral(pAstRight) &&
+        foldIntegerOperator(pAstNode, pAstLeft->uData.sLiteralNumeric.iValue, pAstRight->uData.sLiteralNumeric.iValue)
+    ) {
+        return KB_TRUE;
+    }
+    switch (pAstNode->uData.sBinaryOperator.iOperatorId) {
+        case OPR_ADD:   setFloatLiteral(pAstNode, fLeft + fRight); break;
+        case OPR_SUB:   setFloatLiteral(pAstNode, fLeft - fRight); break;
+        case OPR_MUL:   setFloatLiteral(pAstNode, fLeft * fRight); break;
+        case OPR_POW:   setFloatLiteral(pAstNode, (KFloat)pow(fLeft, fRight)); break;
+        case OPR_EQUAL: setIntegerLiteral(pAstNode, dLeft == dRight); break;
+        case OPR_NEQ:   setIntegerLiteral(pAstNode, dLeft != dRight); break;
+        case OPR_GT:    setIntegerLiteral(pAstNode, dLeft > dRight); break;
+        case OPR_LT:    setIntegerLiteral(pAstNode, dLeft < dRight); break;
+        case OPR_GTEQ:  setIntegerLiteral(pAstNode, dLeft >= dRight); break;
+        case OPR_LTEQ:  setIntegerLiteral(pAstNode, dLeft <= dRight); break;
+        case OPR_APPROX_EQ:
+            setIntegerLiteral(pAstNode, FloatEqualRel(fLeft, fRight));
+            break;
+        case OPR_DIV:
+            if (fRight == 0) return KB_FALSE;
+            setFloatLiteral(pAstNode, fLeft / fRight);
+            break;
+        case OPR_INTDIV:
+            if (fRight == 0) return KB_FALSE;
+            setIntegralLiteral(pAstNode, fLeft / fRight);
+            break;
+        case OPR_MOD:
+            if (!isFloatInIntRange(fLeft) || !isFloatInIntRange(fRight) || (int)fRight == 0) return KB_FALSE;
+            if ((int)fLeft == INT_MIN && (int)fRight == -1) return KB_FALSE;
+            setIntegerLiteral(pAstNode, ((int)fLeft) % ((int)fRight));
+            break;
+        default:
+            return KB_FALSE;
+    }
+    return KB_TRUE;
+}
+
+/* 两边都是常量，至少有一边是字符串：只有拼接、相等比较和逻辑运算不会报错 */
+static KBool foldStringOperator(AstNode* pAstNode) {
+    AstNode*    pAstLeft    = pAstNode->uData.sBinaryOperator.pAstLeftOperand;
+    AstNode*    pAstRight   = pAstNode->uData.sBinaryOperator.pAstRightOperand;
+    KBool       bLeft, bRight;
+
+    switch (pAstNode->uData.sBinaryOperator.iOperatorId) {
+        case OPR_EQUAL:
+        case OPR_NEQ: {
+            KBool bEqual = isStringLiteral(pAstLeft) && isStringLiteral(pAstRight) &&
+                IsStringEqual(pAstLeft->uData.sLiteralString.szValue, pAstRight->uData.sLiteralString.szValue);
+            setIntegerLiteral(pAstNode, pAstNode->uData.sBinaryOperator.iOperatorId == OPR_EQUAL ? bEqual : !bEqual);
+            return KB_TRUE;
+        }
+        case OPR_AND:
+        case OPR_OR:
+            if (!getLiteralTruth(pAstLeft, &bLeft) || !getLiteralTruth(pAstRight, &bRight)) return KB_FALSE;
+            setIntegerLiteral(pAstNode, pAstNode->uData.sBinaryOperator.iOperatorId == OPR_AND ? bLeft && bRight : bLeft || bRight);
+            return KB_TRUE;
+        default:
+            return KB_FALSE;
+    }
+}
+
+static KBool foldConcatOperator(AstNode* pAstNode) {
+    char        szLeftBuf[K_NUMERIC_STRINGIFY_BUF_MAX];
+    char        szRightBuf[K_NUMERIC_STRINGIFY_BUF_MAX];
+    const char* szLeft  = stringifyLiteral(pAstNode->uData.sBinaryOperator.pAstLeftOperand, szLeftBuf);
+    const char* szRight = stringifyLiteral(pAstNode->uData.sBinaryOperator.pAstRightOperand, szRightBuf);
+
+    if (!szLeft || !szRight) {
+        return KB_FALSE;
+    }
+    setStringLiteral(pAstNode, StringConcat(szLeft, szRight));
+    return KB_TRUE;
+}
+
+static KBool foldBinaryOperator(AstNode* pAstNode) {
+    AstNode* pAstLeft   = pAstNode->uData.sBinaryOperator.pAstLeftOperand;
+    AstNode* pAstRight  = pAstNode->uData.sBinaryOperator.pAstRightOperand;
+    KBool    bLeft, bRight;
+
+    if (!(isNumericLiteral(pAstLeft) || isStringLiteral(pAstLeft)) ||
+        !(isNumericLiteral(pAstRight) || isStringLiteral(pAstRight))
+    ) {
+        return KB_FALSE;
+    }
+    if (pAstNode->uData.sBinaryOperator.iOperatorId == OPR_CONCAT) {
+        return foldConcatOperator(pAstNode);
+    }
+    if (isStringLiteral(pAstLeft) || isStringLiteral(pAstRight)) {
+        return foldStringOperator(pAstNode);
+    }
+    /* 逻辑运算不走数值运算的快速路径 */
+    switch (pAstNode->uData.sBinaryOperator.iOperatorId) {
+        case OPR_AND:
+        case OPR_OR:
+            if (!getLiteralTruth(pAstLeft, &bLeft) || !getLiteralTruth(pAstRight, &bRight)) return KB_FALSE;
+            setIntegerLiteral(pAstNode, pAstNode->uData.sBinaryOperator.iOperatorId == OPR_AND ? bLeft && bRight : bLeft || bRight);
+            return KB_TRUE;
+        default:
+            return foldNumericOperator(pAstNode);
+    }
+}
+
+static KBool foldUnaryOperator(AstNode* pAstNode) {
+    AstNode* pAstOperand = pAstNode->uData.sUnaryOperator.pAstOperand;
+    KBool    bTruth;
+
+    switch (pAstNode->uData.sUnaryOperator.iOperatorId) {
+        case OPR_NEG:
+            /* -INT_MIN 超出范围，提升为浮点数 */
+            if (isIntegerLiteral(pAstOperand) && pAstOperand->uData.sLiteralNumeric.iValue != INT_MIN) {
+                setIntegerLiteral(pAstNode, -pAstOperand->uData.sLiteralNumeric.iValue);
+                return KB_TRUE;
+            }
+            if (isNumericLiteral(pAstOperand)) {
+                setFloatLiteral(pAstNode, -getLiteralAsFloat(pAstOperand));
+                return KB_TRUE;
+            }
+            return KB_FALSE;
+        case OPR_NOT:
+            if (!getLiteralTruth(pAstOperand, &bTruth)) return KB_FALSE;
+            setIntegerLiteral(pAstNode, !bTruth);
+            return KB_TRUE;
+        default:
+            return KB_FALSE;
+    }
+}
+
+/*
+ * 恒等式化简，表达式 x 本身保留，它的副作用和运行时错误都不变:
+ * x * 1, 1 * x, x / 1, x - 0 要求 x 一定是数字；x + 0, 0 + x 要求 x 一定是整数 (浮点数 -0 + 0 = +0)
+ */
+static KBool simplifyBinaryOperator(AstNode** ppAstNode) {
+    AstNode* pAstNode   = *ppAstNode;
+    AstNode* pAstLeft   = pAstNode->uData.sBinaryOperator.pAstLeftOperand;
+    AstNode* pAstRight  = pAstNode->uData.sBinaryOperator.pAstRightOperand;
+
+    switch (pAstNode->uData.sBinaryOperator.iOperatorId) {
+        case OPR_MUL:
+            if (isIntegerLiteralOf(pAstRight, 1) && isNumericExpression(pAstLeft)) break;
+            if (isIntegerLiteralOf(pAstLeft, 1) && isNumericExpression(pAstRight)) {
+                replaceAst(ppAstNode, takeAst(&pAstNode->uData.sBinaryOperator.pAstRightOperand));
+                return KB_TRUE;
+            }
+            return KB_FALSE;
+        case OPR_DIV:
+            if (isIntegerLiteralOf(pAstRight, 1) && isNumericExpression(pAstLeft)) break;
+            return KB_FALSE;
+        case OPR_SUB:
+            if (isIntegerLiteralOf(pAstRight, 0) && isNumericExpression(pAstLeft)) break;
+            return KB_FALSE;
+        case OPR_ADD:
+            if (isIntegerLiteralOf(pAstRight, 0) && isIntegerExpression(pAstLeft)) break;
+            if (isIntegerLiteralOf(pAstLeft, 0) && isIntegerExpression(pAstRight)) {
+                replaceAst(ppAstNode, takeAst(&pAstNode->uData.sBinaryOperator.pAstRightOperand));
+                return KB_TRUE;
+            }
+            return KB_FALSE;
+        default:
+            return KB_FALSE;
+    }
+    replaceAst(ppAstNode, takeAst(&pAstNode->uData.sBinaryOperator.pAstLeftOperand));
+    return KB_TRUE;
+}
+
+static void optimizeExpression(AstNode** ppAstNode, int* pIntNumOptimized);
+
+/* 条件表达式只关心真假: !!x 和 x 的真假相同 */
+static void optimizeCondition(AstNode** ppAstNode, int* pIntNumOptimized) {
+    AstNode* pAstNode;
+    optimizeExpression(ppAstNode, pIntNumOptimized);
+    pAstNode = *ppAstNode;
+    while (pAstNode && pAstNode->iType == AST_UNARY_OPERATOR &&
+        pAstNode->uData.sUnaryOperator.iOperatorId == OPR_NOT &&
+        pAstNode->uData.sUnaryOperator.pAstOperand->iType == AST_UNARY_OPERATOR &&
+        pAstNode->uData.sUnaryOperator.pAstOperand->uData.sUnaryOperator.iOperatorId == OPR_NOT
+    ) {
+        AstNode* pAstInner = pAstNode->uData.sUnaryOperator.pAstOperand;
+        replaceAst(ppAstNode, takeAst(&pAstInner->uData.sUnaryOperator.pAstOperand));
+        pAstNode = *ppAstNode;
+        (*pIntNumOptimized)++;
+    }
+}
+
+static void optimizeExpression(AstNode** ppAstNode, int* pIntNumOptimized) {
+    AstNode*    pAstNode = *ppAstNode;
+    VlistNode*  pListNode;
+
+    if (!pAstNode) {
+        return;
+    }
+    switch (pAstNode->iType) {
+        default:
+            break;
+        case AST_PAREN:
+            replaceAst(ppAstNode, takeAst(&pAstNode->uData.sParen.pAstExpr));
+            (*pIntNumOptimized)++;
+            optimizeExpression(ppAstNode, pIntNumOptimized);
+            break;
+        case AST_UNARY_OPERATOR:
+            /* NOT 的操作数也只关心真假 */
+            if (pAstNode->uData.sUnaryOperator.iOperatorId == OPR_NOT) {
+                optimizeCondition(&pAstNode->uData.sUnaryOperator.pAstOperand, pIntNumOptimized);
+            } else {
+                optimizeExpression(&pAstNode->uData.sUnaryOperator.pAstOperand, pIntNumOptimized);
+            }
+            if (foldUnaryOperator(pAstNode)) {
+                (*pIntNumOptimized)++;
+            }
+            break;
+        case AST_BINARY_OPERATOR:
+            /* AND 和 OR 的操作数也只关心真假 */
+            if (pAstNode->uData.sBinaryOperator.iOperatorId == OPR_AND ||
+                pAstNode->uData.sBinaryOperator.iOperatorId == OPR_OR
+            ) {
+                optimizeCondition(&pAstNode->uData.sBinaryOperator.pAstLeftOperand, pIntNumOptimized);
+                optimizeCondition(&pAstNode->uData.sBinaryOperator.pAstRightOperand, pIntNumOptimized);
+            } else {
+                optimizeExpression(&pAstNode->uData.sBinaryOperator.pAstLeftOperand, pIntNumOptimized);
+                optimizeExpression(&pAstNode->uData.sBinaryOperator.pAstRightOperand, pIntNumOptimized);
+            }
+            if (foldBinaryOperator(pAstNode) || simplifyBinaryOperator(ppAstNode)) {
+                (*pIntNumOptimized)++;
+            }
+            break;
+        case AST_ARRAY_ACCESS:
+            optimizeExpression(&pAstNode->uData.sArrayAccess.pAstSubscript, pIntNumOptimized);
+            break;
+        case AST_FUNCTION_CALL:
+            for (
+                pListNode = pAstNode->uData.sFunctionCall.pListArguments->head;
+                pListNode != NULL;
+                pListNode = pListNode->next
+            ) {
+                AstNode* pAstArg = (AstNode *)pListNode->data;
+                optimizeExpression(&pAstArg, pIntNumOptimized);
+                pListNode->data = pAstArg;
+            }
+            break;
+    }
+}
+
+static void optimizeStatements(Vlist* pListStatements, int* pIntNumOptimized);
+
+static void optimizeStatement(AstNode** ppAstNode, int* pIntNumOptimized) {
+    AstNode*    pAstNode = *ppAstNode;
+    VlistNode*  pListNode;
+
+    if (!pAstNode) {
+        return;
+    }
+    switch (pAstNode->iType) {
+        default:
+            break;
+        case AST_PROGRAM:
+            optimizeStatements(pAstNode->uData.sProgram.pListStatements, pIntNumOptimized);
+            break;
+        case AST_FUNCTION_DECLARE:
+            optimizeStatements(pAstNode->uData.sFunctionDeclare.pListStatements, pIntNumOptimized);
+            break;
+        case AST_IF_GOTO:
+            optimizeCondition(&pAstNode->uData.sIfGoto.pAstCondition, pIntNumOptimized);
+            break;
+        case AST_IF:
+            optimizeCondition(&pAstNode->uData.sIf.pAstCondition, pIntNumOptimized);
+            optimizeStatement(&pAstNode->uData.sIf.pAstThen, pIntNumOptimized);
+            for (pListNode = pAstNode->uData.sIf.pListElseIf->head; pListNode != NULL; pListNode = pListNode->next) {
+                AstNode* pAstElseIf = (AstNode *)pListNode->data;
+                optimizeStatement(&pAstElseIf, pIntNumOptimized);
+            }
+            optimizeStatement(&pAstNode->uData.sIf.pAstElse, pIntNumOptimized);
+            break;
+        case AST_THEN:
+            optimizeStatements(pAstNode->uData.sThen.pListStatements, pIntNumOptimized);
+            break;
+        case AST_ELSEIF:
+            optimizeCondition(&pAstNode->uData.sElseIf.pAstCondition, pIntNumOptimized);
+            optimizeStatements(pAstNode->uData.sElseIf.pListStatements, pIntNumOptimized);
+            break;
+        case AST_ELSE:
+            optimizeStatements(pAstNode->uData.sElse.pListStatements, pIntNumOptimized);
+            break;
+        case AST_WHILE:
+            optimizeCondition(&pAstNode->uData.sWhile.pAstCondition, pIntNumOptimized);
+            optimizeStatements(pAstNode->uData.sWhile.pListStatements, pIntNumOptimized);
+            break;
+        case AST_DO_WHILE:
+            optimizeCondition(&pAstNode->uData.sDoWhile.pAstCondition, pIntNumOptimized);
+            optimizeStatements(pAstNode->uData.sDoWhile.pListStatements, pIntNumOptimized);
+            break;
+        case AST_FOR:
+            optimizeExpression(&pAstNode->uData.sFor.pAstRangeFrom, pIntNumOptimized);
+            optimizeExpression(&pAstNode->uData.sFor.pAstRangeTo, pIntNumOptimized);
+            optimizeExpression(&pAstNode->uData.sFor.pAstStep, pIntNumOptimized);
+            optimizeStatements(pAstNode->uData.sFor.pListStatements, pIntNumOptimized);
+            break;
+        case AST_EXIT:
+            optimizeExpression(&pAstNode->uData.sExit.pAstExpression, pIntNumOptimized);
+            break;
+        case AST_YIELD:
+            optimizeExpression(&pAstNode->uData.sYield.pAstExpression, pIntNumOptimized);
+            break;
+        case AST_RETURN:
+            optimizeExpression(&pAstNode->uData.sReturn.pAstExpression, pIntNumOptimized);
+            break;
+        case AST_DIM:
+            optimizeExpression(&pAstNode->uData.sDim.pAstInitializer, pIntNumOptimized);
+            break;
+        case AST_DIM_ARRAY:
+            optimizeExpression(&pAstNode->uData.sDimArray.pAstDimension, pIntNumOptimized);
+            break;
+        case AST_REDIM:
+            optimizeExpression(&pAstNode->uData.sRedim.pAstDimension, pIntNumOptimized);
+            break;
+        case AST_ASSIGN:
+            optimizeExpression(&pAstNode->uData.sAssign.pAstValue, pIntNumOptimized);
+            break;
+        case AST_ASSIGN_ARRAY:
+            optimizeExpression(&pAstNode->uData.sAssignArray.pAstSubscript, pIntNumOptimized);
+            optimizeExpression(&pAstNode->uData.sAssignArray.pAstValue, pIntNumOptimized);
+            break;
+        /* 表达式语句 */
+        case AST_UNARY_OPERATOR:
+        case AST_BINARY_OPERATOR:
+        case AST_PAREN:
+        case AST_ARRAY_ACCESS:
+        case AST_FUNCTION_CALL:
+            optimizeExpression(ppAstNode, pIntNumOptimized);
+            break;
+    }
+}
+
+static void optimizeStatements(Vlist* pListStatements, int* pIntNumOptimized) {
+    VlistNode* pListNode;
+    for (pListNode = pListStatements->head; pListNode != NULL; pListNode = pListNode->next) {
+        AstNode* pAstStatement = (AstNode *)pListNode->data;
+        optimizeStatement(&pAstStatement, pIntNumOptimized);
+        pListNode->data = pAstStatement;
+    }
+}
+
+/* 就地优化整个程序的 AST，返回折叠和化简的次数 */
+int KAstOptimizer_Optimize(KbAstNode* pAstProgram) {
+    int iNumOptimized = 0;
+    optimizeStatement(&pAstProgram, &iNumOptimized);
+    return iNumOptimized;
+}
@@ -0,0 +1,8 @@
+#ifndef _KOPTIMIZER_H_
+#define _KOPTIMIZER_H_
+
+#include "kparser.h"
+
+int KAstOptimizer_Optimize (KbAstNode* pAstProgram);
+
+#endif
@@ -1,5 +1,6 @@
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
 #include "klexer.h"
 #include "kparser.h"
 #include "kalias.h"
@@ -55,6 +56,7 @@ const char* KStatement_GetNameById(StatementId iStatement) {
         "continue",
         "end",
         "exit",
+        "yield",
         "return",
         "goto",
         "dim",
@@ -84,6 +86,7 @@ const char* KAst_GetNameById(AstNodeType iType) {
         "Break",
         "Continue",
         "Exit",
+        "Yield",
         "Return",
         "Goto",
         "Dim",
@@ -211,6 +214,9 @@ static AstNode* createAst(AstNodeType iAstType, KbAstNode* pAstParent) {
         case AST_EXIT:
             pAstNode->uData.sExit.pAstExpression = NULL;
             break;
+        case AST_YIELD:
+            pAstNode->uData.sYield.pAstExpression = NULL;
+            break;
         case AST_RETURN:
             pAstNode->uData.sReturn.pAstExpression = NULL;
             break;
@@ -255,6 +261,8 @@ static AstNode* createAst(AstNodeType iAstType, KbAstNode* pAstParent) {
             break;
         case AST_LITERAL_NUMERIC:
             pAstNode->uData.sLiteralNumeric.fValue = 0;
+            pAstNode->uData.sLiteralNumeric.bIsInteger = KB_FALSE;
+            pAstNode->uData.sLiteralNumeric.iValue = 0;
             break;
         case AST_LITERAL_STRING:
             pAstNode->uData.sLiteralString.szValue = NULL;
@@ -349,6 +357,9 @@ void KAstNode_Destroy(KbAstNode* pAstNode) {
         case AST_EXIT:
             destroyAst(pAstNode->uData.sExit.pAstExpression);
             break;
+        case AST_YIELD:
+            destroyAst(pAstNode->uData.sYield.pAstExpression);
+            break;
         case AST_RETURN:
             destroyAst(pAstNode->uData.sReturn.pAstExpression);
             break;
@@ -580,6 +591,20 @@ void buildExprAstTryOperator(Analyzer* pAnalyzer, Vlist* pStackOperand, Vlist* p
     }
 }
 
+/* 只有数字、不超过 INT_MAX 的字面值是整数 */
+static KBool parseIntegerLiteral(const char* szContent, int* pIntValue) {
+    int iValue = 0;
+    for (; *szContent; ++szContent) {
+        int iDigit = *szContent - '0';
+        if (iDigit < 0 || iDigit > 9 || iValue > (INT_MAX - iDigit) / 10) {
+            return KB_FALSE;
+        }
+        iValue = iValue * 10 + iDigit;
+    }
+    *pIntValue = iValue;
+    return KB_TRUE;
+}
+
 void buildExprAstTryOperand(Analyzer *pAnalyzer, Vlist* pStackOperand, Vlist* pStackOperator) {
     Token* pToken = &pAnalyzer->token;
 
@@ -589,6 +614,9 @@ void buildExprAstTryOperand(Analyzer *pAnalyzer, Vlist* pStackOperand, Vlist* pS
     if (tokenTypeIs(TOKEN_NUMERIC)) {
         AstNode *pAstLiteral = createAst(AST_LITERAL_NUMERIC, NULL);
         pAstLiteral->uData.sLiteralNumeric.fValue = Atof(pToken->szContent);
+        pAstLiteral->uData.sLiteralNumeric.bIsInteger = parseIntegerLiteral(
+            pToken->szContent, &pAstLiteral->uData.sLiteralNumeric.iValue
+        );
         /* 直接入运算数栈 */
         vlPushBack(pStackOperand, pAstLiteral);
         /* 尝试下一个 token 是否是运算符 */
@@ -1250,6 +1278,32 @@ static SyntaxErrorId parseLineAsAst(
         pushAstNodeUnderCurrent(pParser, pAstCurrentLine);
         return SYN_NO_ERROR;
     }
+    /* yield 语句，交还控制权给宿主，值可以用来告诉宿主等待的条件 */
+    else if (tokenIsKeyword(KB_KEYWORD_YIELD)) {
+        StatementId iStatement = STATEMENT_YIELD;
+
+        pAstCurrentLine = createAstWithLineNumber(AST_YIELD, NULL, pParser->iLineNumber);
+        nextToken(pAnalyzer);
+        /* 无值 */
+        if (tokenTypeIs(TOKEN_LINE_END)) {
+            pAstCurrentLine->uData.sYield.pAstExpression = NULL;
+        }
+        else {
+            const char* pExprYield;
+            rewindToken(pAnalyzer);
+            pExprYield = getCurrentPtr(pAnalyzer);
+            /* 匹配表达式 */
+            matchValidExpr(iStatement);
+            /* 匹配行结束 */
+            matchTokenType(TOKEN_LINE_END, SYN_EXPECT_LINE_END, iStatement);
+            /* 构建表达式 ast */
+            setCurrentPtr(pAnalyzer, pExprYield);
+            pAstCurrentLine->uData.sYield.pAstExpression = buildExprAst(pAnalyzer);
+        }
+        /* 本行节点插入到上级节点的 statement 列表中 */
+        pushAstNodeUnderCurrent(pParser, pAstCurrentLine);
+        return SYN_NO_ERROR;
+    }
     /* return 语句 */
     else if (tokenIsKeyword(KB_KEYWORD_RETURN)) {
         StatementId     iStatement  = STATEMENT_RETURN;
@@ -1613,7 +1667,7 @@ KBool KExtension_Parse(
                 if (StringLength(pToken->szContent) > KB_IDENTIFIER_LEN_MAX) {
                     extReturnError(EXT_ID_TOO_LONG);
                 }
-                StringCopy(szExtensionId, sizeof(szExtensionId), pToken->szContent);
+                StringCopy(szExtensionId, KB_IDENTIFIER_LEN_MAX + 1, pToken->szContent);
                 /* 匹配行结束 */
                 extMatchType(TOKEN_LINE_END, EXT_EXPECT_LINE_END);
             }
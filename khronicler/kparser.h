@@ -18,6 +18,7 @@ typedef enum tagStatementId {
     STATEMENT_CONTINUE,
     STATEMENT_END,
     STATEMENT_EXIT,
+    STATEMENT_YIELD,
     STATEMENT_RETURN,
     STATEMENT_GOTO,
     STATEMENT_DIM,
@@ -44,6 +45,7 @@ typedef enum tagAstNodeType {
     AST_BREAK,
     AST_CONTINUE,
     AST_EXIT,
+    AST_YIELD,
     AST_RETURN,
     AST_GOTO,
     AST_DIM,
@@ -120,6 +122,9 @@ typedef struct tagAstNode {
         struct {
             struct tagAstNode* pAstExpression;
         } sExit;
+        struct {
+            struct tagAstNode* pAstExpression;
+        } sYield;
         struct {
             struct tagAstNode* pAstExpression;
         } sReturn;
@@ -164,6 +169,8 @@ typedef struct tagAstNode {
         } sBinaryOperator;
         struct {
             KFloat fValue;
+            KBool bIsInteger;   /* 不带小数点并且在 int 范围内，iValue 有效 */
+            int iValue;
         } sLiteralNumeric;
         struct {
             char* szValue;
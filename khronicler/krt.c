@@ -2,10 +2,24 @@
 #include <stdio.h>
 #include <math.h>
 #include <string.h>
+#include <limits.h>
 #include <time.h>
 #include "krt.h"
 #include "kalias.h"
 
+/* 严格 C89 模式下 math.h 只声明了 double 版本的数学函数 */
+#ifdef __STRICT_ANSI__
+#   define sinf(x)      ((float)sin(x))
+#   define cosf(x)      ((float)cos(x))
+#   define tanf(x)      ((float)tan(x))
+#   define sqrtf(x)     ((float)sqrt(x))
+#   define expf(x)      ((float)exp(x))
+#   define fabsf(x)     ((float)fabs(x))
+#   define logf(x)      ((float)log(x))
+#   define floorf(x)    ((float)floor(x))
+#   define ceilf(x)     ((float)ceil(x))
+#endif
+
 static const struct {
     const char* szName;
     const char* szMessage;
@@ -21,159 +35,496 @@ static const struct {
     { "RUNTIME_NOT_IN_USER_FUNC",       "Return statement encountered outside of a function context" },
     { "RUNTIME_ARRAY_INVALID_SIZE",     "Invalid array size specified during allocation" },
     { "RUNTIME_ARRAY_OUT_OF_BOUNDS",    "Array index out of bounds" },
-    { "RUNTIME_NOT_ARRAY",              "Attempted to perform array operation on a non-array value" }
+    { "RUNTIME_NOT_ARRAY",              "Attempted to perform array operation on a non-array value" },
+    { "RUNTIME_STACK_OVERFLOW",         "Stack overflow: operand stack exceeded its maximum depth" },
+    { "RUNTIME_EXT_FUNC_UNBOUND",       "Attempted to call an extension function with no host callback bound" },
+    { "RUNTIME_MEMORY_LIMIT",           "Out of memory: allocation exceeded the virtual machine's memory limit" }
 };
 
 const char* KRuntimeError_GetNameById(RuntimeErrorId iRuntimeErrorId) {
-    if (iRuntimeErrorId < 0 || iRuntimeErrorId > RUNTIME_NOT_ARRAY) return "n/a";
+    if (iRuntimeErrorId < 0 || iRuntimeErrorId > RUNTIME_MEMORY_LIMIT) return "n/a";
     return RUNTIME_ERROR_DETAIL[iRuntimeErrorId].szName;
 }
 
 const char* KRuntimeError_GetMessageById(RuntimeErrorId iRuntimeErrorId) {
-    if (iRuntimeErrorId < 0 || iRuntimeErrorId > RUNTIME_NOT_ARRAY) return "n/a";
+    if (iRuntimeErrorId < 0 || iRuntimeErrorId > RUNTIME_MEMORY_LIMIT) return "n/a";
     return RUNTIME_ERROR_DETAIL[iRuntimeErrorId].szMessage;
 }
 
 const char* KRuntimeValue_GetTypeNameById(RuntimeValueTypeId iRtTypeId) {
     static const char * SZ_RT_VALUE_NAME[] = {
-        "nil", "number", "string", "array", "array_ref"
+        "nil", "number", "string", "array", "integer"
     };
     return SZ_RT_VALUE_NAME[iRtTypeId];
 }
 
-static void destroyRtValue(RtValue* pRtValue) {
+/* 运行时的堆分配都经过这里，用于统计分配次数 */
+#define rtCountAlloc()      (pMachine->dwStatAllocs++)
+
+/* 计入一次分配，设置了上限并且会超过上限时不计入，返回 KB_FALSE */
+static KBool memAcquire(Machine* pMachine, int iKind, KDword dwSize) {
+    MemStats* pMem = &pMachine->sMem;
+    if (pMem->dwLimit && (pMem->dwTotal > pMem->dwLimit || dwSize > pMem->dwLimit - pMem->dwTotal)) {
+        return KB_FALSE;
+    }
+    pMem->arrBytes[iKind]  += dwSize;
+    pMem->dwTotal          += dwSize;
+    if (pMem->dwTotal > pMem->dwPeak) {
+        pMem->dwPeak = pMem->dwTotal;
+    }
+    return KB_TRUE;
+}
+
+static void memRelease(Machine* pMachine, int iKind, KDword dwSize) {
+    pMachine->sMem.arrBytes[iKind] -= dwSize;
+    pMachine->sMem.dwTotal         -= dwSize;
+}
+
+/* 不经过 arena 的分配，超过内存上限或者 malloc 失败时返回 NULL */
+static void* rtMalloc(Machine* pMachine, int iKind, KDword dwSize) {
+    void* pBlock;
+    if (!memAcquire(pMachine, iKind, dwSize)) {
+        return NULL;
+    }
+    pBlock = malloc(dwSize);
+    if (!pBlock) {
+        memRelease(pMachine, iKind, dwSize);
+        return NULL;
+    }
+    rtCountAlloc();
+    return pBlock;
+}
+
+/* 扩容到 dwNewSize，失败时原来的块保持不变，返回 NULL */
+static void* rtRealloc(Machine* pMachine, int iKind, void* pBlock, KDword dwOldSize, KDword dwNewSize) {
+    void* pBlockNew;
+    if (!memAcquire(pMachine, iKind, dwNewSize - dwOldSize)) {
+        return NULL;
+    }
+    pBlockNew = realloc(pBlock, dwNewSize);
+    if (!pBlockNew) {
+        memRelease(pMachine, iKind, dwNewSize - dwOldSize);
+        return NULL;
+    }
+    rtCountAlloc();
+    return pBlockNew;
+}
+
+/* 分配大小所在的分级，超过最大分级时返回 KB_RT_ARENA_NUM_CLASS */
+static int getArenaClass(KDword dwSize) {
+    int iClass = 0;
+    while (iClass < KB_RT_ARENA_NUM_CLASS && ((KDword)KB_RT_ARENA_MIN_BLOCK << iClass) < dwSize) {
+        iClass++;
+    }
+    return iClass;
+}
+
+/*
+ * 值的分配: 优先复用同级空闲块，其次从 arena 未分配的部分切出，都不行时退回 malloc
+ * 超过内存上限或者 malloc 失败时返回 NULL
+ */
+static void* rtAlloc(Machine* pMachine, int iKind, KDword dwSize) {
+    Arena*  pArena = &pMachine->sArena;
+    void*   pBlock;
+    int     iClass;
+
+    if (!pArena->pBase) {
+        return rtMalloc(pMachine, iKind, dwSize);
+    }
+    if (!memAcquire(pMachine, iKind, dwSize)) {
+        return NULL;
+    }
+    pMachine->dwStatAllocs++;
+    iClass = getArenaClass(dwSize);
+    if (iClass < KB_RT_ARENA_NUM_CLASS) {
+        KDword  dwBlock = (KDword)KB_RT_ARENA_MIN_BLOCK << iClass;
+        pBlock = pArena->arrFreeList[iClass];
+        if (pBlock) {
+            pArena->arrFreeList[iClass] = *(void **)pBlock;
+        } else if ((KDword)(pArena->pEnd - pArena->pTop) >= dwBlock) {
+            pBlock = pArena->pTop;
+            pArena->pTop += dwBlock;
+        }
+        if (pBlock) {
+            pArena->dwUsed += dwBlock;
+            if (pArena->dwUsed > pArena->dwPeak) {
+                pArena->dwPeak = pArena->dwUsed;
+            }
+            return pBlock;
+        }
+    }
+    pBlock = malloc(dwSize);
+    if (!pBlock) {
+        memRelease(pMachine, iKind, dwSize);
+        return NULL;
+    }
+    pArena->dwNumFallback++;
+    pArena->iNumLiveFallback++;
+    return pBlock;
+}
+
+/* 释放时由调用者提供分配时的类别和大小，arena 中的块不需要额外的头部 */
+static void rtFree(Machine* pMachine, int iKind, void* pBlock, KDword dwSize) {
+    Arena* pArena = &pMachine->sArena;
+    memRelease(pMachine, iKind, dwSize);
+    if (!pArena->pBase) {
+        free(pBlock);
+    }
+    else if ((KByte *)pBlock >= pArena->pBase && (KByte *)pBlock < pArena->pEnd) {
+        int iClass = getArenaClass(dwSize);
+        *(void **)pBlock = pArena->arrFreeList[iClass];
+        pArena->arrFreeList[iClass] = pBlock;
+        pArena->dwUsed -= (KDword)KB_RT_ARENA_MIN_BLOCK << iClass;
+    }
+    else {
+        pArena->iNumLiveFallback--;
+        free(pBlock);
+    }
+}
+
+/* 新的字符串缓冲区，引用计数为 1，超过内存上限时返回 NULL */
+static RtString* createRtString(Machine* pMachine, int iCapacity) {
+    RtString* pRtString = (RtString *)rtAlloc(pMachine, RT_MEM_STRING, sizeof(RtString) + iCapacity);
+    if (!pRtString) {
+        return NULL;
+    }
+    pMachine->sMem.arrObjects[RT_MEM_STRING]++;
+    pRtString->iRefCount    = 1;
+    pRtString->iLength      = 0;
+    pRtString->iCapacity    = iCapacity;
+    pRtString->szBuf[0]     = '\0';
+    return pRtString;
+}
+
+static void releaseRtString(Machine* pMachine, RtString* pRtString) {
+    if (--pRtString->iRefCount <= 0) {
+        pMachine->sMem.arrObjects[RT_MEM_STRING]--;
+        rtFree(pMachine, RT_MEM_STRING, pRtString, sizeof(RtString) + pRtString->iCapacity);
+    }
+}
+
+static void releaseRtValue(Machine* pMachine, RtValue* pRtValue);
+static int  getBuiltInFuncNumParams(KDword dwBuiltFuncId);
+
+/* 最后一个引用释放时，释放所有元素和数组本身 */
+static void releaseRtArray(Machine* pMachine, RuntimeArray* pArray) {
+    int i;
+    if (--pArray->iRefCount > 0) {
+        return;
+    }
+    if (pArray->pArrIntegers) {
+        rtFree(pMachine, RT_MEM_ARRAY, pArray->pArrIntegers, sizeof(int) * pArray->iSize);
+    } else if (pArray->pArrNumbers) {
+        rtFree(pMachine, RT_MEM_ARRAY, pArray->pArrNumbers, sizeof(KFloat) * pArray->iSize);
+    } else {
+        for (i = 0; i < pArray->iSize; ++i) {
+            releaseRtValue(pMachine, pArray->pArrElements + i);
+        }
+        rtFree(pMachine, RT_MEM_ARRAY, pArray->pArrElements, sizeof(RtValue) * pArray->iSize);
+    }
+    pMachine->sMem.arrObjects[RT_MEM_ARRAY]--;
+    rtFree(pMachine, RT_MEM_ARRAY, pArray, sizeof(RuntimeArray));
+}
+
+static void releaseRtValue(Machine* pMachine, RtValue* pRtValue) {
     switch (pRtValue->iType) {
         /* 不需要释放值 */
         case RT_VALUE_NIL:
         case RT_VALUE_NUMBER:
-        case RT_VALUE_ARRAY_REF:
         default:
             break;
-        /* 释放字符串 */
+        /* 释放字符串缓冲区的引用，常量池中的字符串不需要释放 */
         case RT_VALUE_STRING:
-            if (!pRtValue->uData.sString.bIsRef) {
-                free(pRtValue->uData.sString.uContent.pReadWrite);
+            if (pRtValue->uData.sString.pRtString) {
+                releaseRtString(pMachine, pRtValue->uData.sString.pRtString);
             }
             break;
-        /* 释放数组 */
+        /* 释放数组的引用 */
         case RT_VALUE_ARRAY:
-            free(pRtValue->uData.sArray.pArrPtrElements);
-            pRtValue->uData.sArray.iSize = 0;
+            releaseRtArray(pMachine, pRtValue->uData.pArray);
             break;
     }
-    free(pRtValue);
+    pRtValue->iType = RT_VALUE_NIL;
 }
 
-static void destroyRtValueVoidPtr(void* pVoidPtr) {
-    destroyRtValue((RtValue *)pVoidPtr);
-}
+#define setNumericRtValue(pRtValue, fValue) {   \
+    (pRtValue)->iType = RT_VALUE_NUMBER;        \
+    (pRtValue)->uData.fNumber = (fValue);       \
+} NULL
+
+#define setIntegerRtValue(pRtValue, iValue) {   \
+    (pRtValue)->iType = RT_VALUE_INTEGER;       \
+    (pRtValue)->uData.iNumber = (iValue);       \
+} NULL
 
-static RtValue* createNumericRtValue(KFloat fValue) {
-    RtValue* pRtValue = (RtValue *)malloc(sizeof(RtValue));
-    pRtValue->iType = RT_VALUE_NUMBER;
-    pRtValue->uData.fNumber = fValue;
-    return pRtValue;
+/* 整数和浮点数都是数字，需要浮点数的地方整数自动提升 */
+#define isNumericRtValue(pRtValue) \
+    ((pRtValue)->iType == RT_VALUE_INTEGER || (pRtValue)->iType == RT_VALUE_NUMBER)
+
+/* 数字转换为浮点数或者截断为整数，调用者保证是数字 */
+#define getRtValueAsFloat(pRtValue) \
+    ((pRtValue)->iType == RT_VALUE_INTEGER ? (KFloat)(pRtValue)->uData.iNumber : (pRtValue)->uData.fNumber)
+#define getRtValueAsInt(pRtValue) \
+    ((pRtValue)->iType == RT_VALUE_INTEGER ? (pRtValue)->uData.iNumber : (int)(pRtValue)->uData.fNumber)
+
+/* 比较整数和浮点数时用 double，避免大整数转换为 KFloat 后丢失精度 */
+#define getRtValueAsDouble(pRtValue) \
+    ((pRtValue)->iType == RT_VALUE_INTEGER ? (double)(pRtValue)->uData.iNumber : (double)(pRtValue)->uData.fNumber)
+
+/* 结果一定是整数值的运算 (取整、整除等)，在 int 范围内时保存为整数 */
+static void setIntegralRtValue(RtValue* pRtValue, KFloat fValue) {
+    if (fValue > -2147483648.0f && fValue < 2147483648.0f) {
+        setIntegerRtValue(pRtValue, (int)fValue);
+    } else {
+        setNumericRtValue(pRtValue, fValue);
+    }
 }
 
-static RtValue* createStringRtValue(char* szValue) {
-    RtValue* pRtValue = (RtValue *)malloc(sizeof(RtValue));
+/* 字符串值是缓冲区的前 iLength 个字符，接管调用者持有的引用 */
+static void setStringRtValue(RtValue* pRtValue, RtString* pRtString, int iLength) {
     pRtValue->iType = RT_VALUE_STRING;
-    pRtValue->uData.sString.bIsRef = KB_FALSE;
-    pRtValue->uData.sString.uContent.pReadWrite = szValue;
-    return pRtValue;
+    pRtValue->uData.sString.szContent = pRtString->szBuf;
+    pRtValue->uData.sString.pRtString = pRtString;
+    pRtValue->uData.sString.iLength = iLength;
 }
 
-static RtValue* createStringRefRtValue(const char* szValue) {
-    RtValue* pRtValue = (RtValue *)malloc(sizeof(RtValue));
+/* 常量池中的字符串，生命周期和字节码相同，不需要引用计数 */
+static void setStaticStringRtValue(RtValue* pRtValue, const char* szValue) {
     pRtValue->iType = RT_VALUE_STRING;
-    pRtValue->uData.sString.bIsRef = KB_TRUE;
-    pRtValue->uData.sString.uContent.pReadOnly = szValue;
-    return pRtValue;
+    pRtValue->uData.sString.szContent = szValue;
+    pRtValue->uData.sString.pRtString = NULL;
+    pRtValue->uData.sString.iLength = StringLength(szValue);
 }
 
-static RtValue* createArrayRtValue(int iArraySize) {
-    RtValue* pRtValue = (RtValue *)malloc(sizeof(RtValue));
-    int i;
-    pRtValue->iType = RT_VALUE_ARRAY;
-    pRtValue->uData.sArray.iSize = iArraySize;
-    pRtValue->uData.sArray.pArrPtrElements = (RtValue **)malloc(sizeof(RtValue* ) * iArraySize);
+/* 新数组的元素都是整数 0，先使用紧凑的整数存储，引用计数为 1；超过内存上限时返回 KB_FALSE，pRtValue 不变 */
+static KBool setArrayRtValue(Machine* pMachine, RtValue* pRtValue, int iArraySize) {
+    RuntimeArray*   pArray = (RuntimeArray *)rtAlloc(pMachine, RT_MEM_ARRAY, sizeof(RuntimeArray));
+    int             i;
+    if (!pArray) {
+        return KB_FALSE;
+    }
+    pArray->pArrIntegers = (int *)rtAlloc(pMachine, RT_MEM_ARRAY, sizeof(int) * iArraySize);
+    if (!pArray->pArrIntegers) {
+        rtFree(pMachine, RT_MEM_ARRAY, pArray, sizeof(RuntimeArray));
+        return KB_FALSE;
+    }
+    pMachine->sMem.arrObjects[RT_MEM_ARRAY]++;
+    pArray->iRefCount       = 1;
+    pArray->iSize           = iArraySize;
+    pArray->pArrElements    = NULL;
+    pArray->pArrNumbers     = NULL;
     for (i = 0; i < iArraySize; ++i) {
-        pRtValue->uData.sArray.pArrPtrElements[i] = createNumericRtValue(0);
+        pArray->pArrIntegers[i] = 0;
     }
-    return pRtValue;
+    pRtValue->iType = RT_VALUE_ARRAY;
+    pRtValue->uData.pArray = pArray;
+    return KB_TRUE;
 }
 
-const char* KRuntimeValue_Stringify(KbRuntimeValue* pRtValue, KBool *pBoolNeedDispose) {
-    *pBoolNeedDispose = KB_FALSE;
+/* 紧凑的整数数组转换为紧凑的浮点数数组，两者大小相同，原地转换 */
+static void floatifyRtArray(RuntimeArray* pArray) {
+    int i;
+    pArray->pArrNumbers = (KFloat *)pArray->pArrIntegers;
+    for (i = 0; i < pArray->iSize; ++i) {
+        pArray->pArrNumbers[i] = (KFloat)pArray->pArrIntegers[i];
+    }
+    pArray->pArrIntegers = NULL;
+}
+
+/* 紧凑的数组转换为通用的值数组，数组结构本身不移动，所有引用仍然有效；超过内存上限时返回 KB_FALSE，数组不变 */
+static KBool unpackRtArray(Machine* pMachine, RuntimeArray* pArray) {
+    RtValue*    pArrElements = (RtValue *)rtAlloc(pMachine, RT_MEM_ARRAY, sizeof(RtValue) * pArray->iSize);
+    int         i;
+    if (!pArrElements) {
+        return KB_FALSE;
+    }
+    if (pArray->pArrIntegers) {
+        for (i = 0; i < pArray->iSize; ++i) {
+            setIntegerRtValue(pArrElements + i, pArray->pArrIntegers[i]);
+        }
+        rtFree(pMachine, RT_MEM_ARRAY, pArray->pArrIntegers, sizeof(int) * pArray->iSize);
+        pArray->pArrIntegers = NULL;
+    } else {
+        for (i = 0; i < pArray->iSize; ++i) {
+            setNumericRtValue(pArrElements + i, pArray->pArrNumbers[i]);
+        }
+        rtFree(pMachine, RT_MEM_ARRAY, pArray->pArrNumbers, sizeof(KFloat) * pArray->iSize);
+        pArray->pArrNumbers = NULL;
+    }
+    pArray->pArrElements = pArrElements;
+    return KB_TRUE;
+}
+
+/*
+ * 字符串化，数字写入调用者提供的缓冲区，不产生堆分配
+ * 共享缓冲区的字符串不一定以 '\0' 结尾，长度写入 pIntLength
+ */
+static const char* stringifyRtValueToBuf(const RtValue* pRtValue, char* szBuf, int* pIntLength) {
+    const char* szResult;
     switch (pRtValue->iType) {
         default:
-            return "![n/a]";
+            szResult = "![n/a]";
+            break;
         case RT_VALUE_NIL:
-            return "![nil]";
-        case RT_VALUE_NUMBER: {
-            char szBuf[K_NUMERIC_STRINGIFY_BUF_MAX];
-            Ftoa(pRtValue->uData.fNumber, szBuf, K_DEFAULT_FTOA_PRECISION);
-            *pBoolNeedDispose = KB_TRUE;
-            return StringDump(szBuf);
-        }
-        case RT_VALUE_STRING: {
-            if (pRtValue->uData.sString.bIsRef) {
-                return pRtValue->uData.sString.uContent.pReadOnly;
-            }
-            else {
-                return pRtValue->uData.sString.uContent.pReadWrite;
-            }
-        }
-        case RT_VALUE_ARRAY: {
-            return "![array]";
-        }
-        case RT_VALUE_ARRAY_REF: {
-            return "![arrayRef]";
-        }
+            szResult = "![nil]";
+            break;
+        case RT_VALUE_NUMBER:
+            szResult = Ftoa(pRtValue->uData.fNumber, szBuf, K_DEFAULT_FTOA_PRECISION);
+            break;
+        case RT_VALUE_INTEGER:
+            szResult = Itoa(pRtValue->uData.iNumber, szBuf, 10);
+            break;
+        case RT_VALUE_STRING:
+            *pIntLength = pRtValue->uData.sString.iLength;
+            return pRtValue->uData.sString.szContent;
+        case RT_VALUE_ARRAY:
+            szResult = "![array]";
+            break;
     }
+    *pIntLength = StringLength(szResult);
+    return szResult;
 }
 
-static RtValue* createStringRtValueFromConcat(RtValue* pRtLeft, RtValue* pRtRight) {
-    RtValue*    pRtValue = (RtValue *)malloc(sizeof(RtValue));
-    const char  *szLeft, *szRight;
-    KBool       bLeftNeedDispose, bRightNeedDispose;
+const char* KRuntimeValue_Stringify(KbRuntimeValue* pRtValue, KBool *pBoolNeedDispose) {
+    char        szBuf[K_NUMERIC_STRINGIFY_BUF_MAX];
+    int         iLength;
+    const char* szResult = stringifyRtValueToBuf(pRtValue, szBuf, &iLength);
+    /* 结果写在了栈上的缓冲区，或者没有以 '\0' 结尾，需要复制一份 */
+    if (szResult == szBuf || szResult[iLength] != '\0') {
+        char* szCopy = (char *)malloc(iLength + 1);
+        memcpy(szCopy, szResult, iLength);
+        szCopy[iLength] = '\0';
+        *pBoolNeedDispose = KB_TRUE;
+        return szCopy;
+    }
+    *pBoolNeedDispose = KB_FALSE;
+    return szResult;
+}
 
-    szLeft = stringifyRtValue(pRtLeft, &bLeftNeedDispose);
-    szRight = stringifyRtValue(pRtRight, &bRightNeedDispose);
+/*
+ * 字符串连接
+ * 左边的字符串正好是缓冲区的全部内容并且还有空间时，右边直接追加到缓冲区末尾，
+ * 新旧两个字符串共享同一个缓冲区，旧的字符串只是变成了缓冲区的前缀。
+ * 左边已经是连接的结果时，新缓冲区预留一倍的空间，循环中 s = s & x 均摊 O(1)
+ * 超过内存上限或者 malloc 失败时返回 KB_FALSE，pRtValue 不变
+ */
+static KBool setStringRtValueFromConcat(Machine* pMachine, RtValue* pRtValue, const RtValue* pRtLeft, const RtValue* pRtRight) {
+    char        szLeftBuf[K_NUMERIC_STRINGIFY_BUF_MAX];
+    char        szRightBuf[K_NUMERIC_STRINGIFY_BUF_MAX];
+    int         iLeftLength, iRightLength, iLength;
+    const char* szLeft      = stringifyRtValueToBuf(pRtLeft, szLeftBuf, &iLeftLength);
+    const char* szRight     = stringifyRtValueToBuf(pRtRight, szRightBuf, &iRightLength);
+    RtString*   pRtString   = pRtLeft->iType == RT_VALUE_STRING ? pRtLeft->uData.sString.pRtString : NULL;
 
-    pRtValue->iType = RT_VALUE_STRING;
-    pRtValue->uData.sString.bIsRef = KB_FALSE;
-    pRtValue->uData.sString.uContent.pReadWrite = StringConcat(szLeft, szRight);
+    /* 预留空间后的容量超过 int 的范围时，同样按超过内存上限处理 */
+    if (iRightLength > INT_MAX / 2 - iLeftLength) {
+        return KB_FALSE;
+    }
+    iLength = iLeftLength + iRightLength;
+
+    if (pRtString && pRtString->iLength == iLeftLength && pRtString->iCapacity >= iLength) {
+        pRtString->iRefCount++;
+    } else {
+        pRtString = createRtString(pMachine, pRtString ? iLength * 2 : iLength + KB_RT_STRING_RESERVE);
+        if (!pRtString) {
+            return KB_FALSE;
+        }
+        memcpy(pRtString->szBuf, szLeft, iLeftLength);
+        pRtString->iLength = iLeftLength;
+    }
+    /* 右边和左边共享缓冲区时，读取的范围在写入位置之前，不会重叠 */
+    memcpy(pRtString->szBuf + pRtString->iLength, szRight, iRightLength);
+    pRtString->iLength = iLength;
+    pRtString->szBuf[iLength] = '\0';
 
-    if (bLeftNeedDispose) free((void *)szLeft);
-    if (bRightNeedDispose) free((void *)szRight);
-    
-    return pRtValue;
+    setStringRtValue(pRtValue, pRtString, iLength);
+    return KB_TRUE;
 }
 
-static RtValue* createRefRtValue(RtValue* pRtValue) {
-    switch (pRtValue->iType) {
+/* 需要以 '\0' 结尾的字符串时，被追加过的共享缓冲区复制一份自己的，超过内存上限时返回 NULL */
+static const char* getTerminatedString(Machine* pMachine, RtValue* pRtValue) {
+    int iLength = pRtValue->uData.sString.iLength;
+    if (pRtValue->uData.sString.szContent[iLength] != '\0') {
+        RtString* pRtString = createRtString(pMachine, iLength);
+        if (!pRtString) {
+            return NULL;
+        }
+        memcpy(pRtString->szBuf, pRtValue->uData.sString.szContent, iLength);
+        pRtString->szBuf[iLength] = '\0';
+        pRtString->iLength = iLength;
+        releaseRtValue(pMachine, pRtValue);
+        setStringRtValue(pRtValue, pRtString, iLength);
+    }
+    return pRtValue->uData.sString.szContent;
+}
+
+/* 引用一个值: 数字直接复制，字符串和数组增加引用计数，不复制内容 */
+static void setRefRtValue(RtValue* pRtValue, const RtValue* pRtSource) {
+    switch (pRtSource->iType) {
         default:
         case RT_VALUE_NIL:
-            return createNumericRtValue(0);
-        case RT_VALUE_NUMBER: 
-            return createNumericRtValue(pRtValue->uData.fNumber);
+            setIntegerRtValue(pRtValue, 0);
+            break;
+        case RT_VALUE_NUMBER:
+        case RT_VALUE_INTEGER:
+            *pRtValue = *pRtSource;
+            break;
         case RT_VALUE_STRING:
-            return createStringRefRtValue(pRtValue->uData.sString.uContent.pReadOnly);
-        case RT_VALUE_ARRAY: {
-            RtValue* pRtNew = (RtValue *)malloc(sizeof(RtValue));
-            pRtNew->iType = RT_VALUE_ARRAY_REF;
-            pRtNew->uData.pArrRef = &pRtValue->uData.sArray;
-            return pRtNew;
+            *pRtValue = *pRtSource;
+            if (pRtValue->uData.sString.pRtString) {
+                pRtValue->uData.sString.pRtString->iRefCount++;
+            }
+            break;
+        case RT_VALUE_ARRAY:
+            *pRtValue = *pRtSource;
+            pRtValue->uData.pArray->iRefCount++;
+            break;
+    }
+}
+
+/* 读取数组元素到 pRtDst，数字直接复制，其他类型的值是共享的引用 */
+static void getRtArrayElement(RtValue* pRtDst, const RuntimeArray* pArray, int iSubscript) {
+    if (pArray->pArrIntegers) {
+        setIntegerRtValue(pRtDst, pArray->pArrIntegers[iSubscript]);
+    } else if (pArray->pArrNumbers) {
+        setNumericRtValue(pRtDst, pArray->pArrNumbers[iSubscript]);
+    } else {
+        setRefRtValue(pRtDst, pArray->pArrElements + iSubscript);
+    }
+}
+
+/*
+ * 值移动到数组元素中，pRtValue 置为 nil
+ * 整数数组存入浮点数时转换为浮点数数组，紧凑数组存入非数字的值时转换为通用数组
+ * 转换为通用数组超过内存上限时返回 KB_FALSE，值仍然由调用者持有
+ */
+static KBool moveRtValueToArray(Machine* pMachine, RuntimeArray* pArray, int iSubscript, RtValue* pRtValue) {
+    RtValue* pElement;
+    if (pArray->pArrIntegers) {
+        if (pRtValue->iType == RT_VALUE_INTEGER) {
+            pArray->pArrIntegers[iSubscript] = pRtValue->uData.iNumber;
+            pRtValue->iType = RT_VALUE_NIL;
+            return KB_TRUE;
         }
-        case RT_VALUE_ARRAY_REF: {
-            RtValue* pRtNew = (RtValue *)malloc(sizeof(RtValue));
-            pRtNew->iType = RT_VALUE_ARRAY_REF;
-            pRtNew->uData.pArrRef = pRtValue->uData.pArrRef;
-            return pRtNew;
+        if (pRtValue->iType == RT_VALUE_NUMBER) {
+            floatifyRtArray(pArray);
+        }
+    }
+    if (pArray->pArrNumbers) {
+        if (isNumericRtValue(pRtValue)) {
+            pArray->pArrNumbers[iSubscript] = getRtValueAsFloat(pRtValue);
+            pRtValue->iType = RT_VALUE_NIL;
+            return KB_TRUE;
         }
     }
-    return NULL;
+    if (!pArray->pArrElements && !unpackRtArray(pMachine, pArray)) {
+        return KB_FALSE;
+    }
+    pElement = pArray->pArrElements + iSubscript;
+    releaseRtValue(pMachine, pElement);
+    *pElement = *pRtValue;
+    pRtValue->iType = RT_VALUE_NIL;
+    return KB_TRUE;
 }
 
 static KBool canBeConsideredAsTrue(RtValue* pRtValue) {
@@ -183,16 +534,14 @@ static KBool canBeConsideredAsTrue(RtValue* pRtValue) {
             return KB_FALSE;
         case RT_VALUE_NUMBER:
             return !!(int)pRtValue->uData.fNumber;
+        case RT_VALUE_INTEGER:
+            return pRtValue->uData.iNumber != 0;
         case RT_VALUE_STRING: {
-            const char* szValue = pRtValue->uData.sString.uContent.pReadOnly;
-            return szValue && StringLength(szValue) > 0;
+            return pRtValue->uData.sString.iLength > 0;
         }
         case RT_VALUE_ARRAY: {
             return KB_TRUE;
         }
-        case RT_VALUE_ARRAY_REF: {
-            return KB_TRUE;
-        }
     }
 }
 
@@ -200,678 +549,2388 @@ static KBool canBeConsideredEqual(RtValue* pRtLeft, RtValue* pRtRight) {
     if (pRtLeft->iType == RT_VALUE_NIL && pRtRight->iType == RT_VALUE_NIL) {
         return KB_TRUE;
     }
-    else if (pRtLeft->iType == RT_VALUE_NUMBER && pRtRight->iType == RT_VALUE_NUMBER) {
-        return pRtLeft->uData.fNumber == pRtRight->uData.fNumber;
+    else if (pRtLeft->iType == RT_VALUE_INTEGER && pRtRight->iType == RT_VALUE_INTEGER) {
+        return pRtLeft->uData.iNumber == pRtRight->uData.iNumber;
+    }
+    else if (isNumericRtValue(pRtLeft) && isNumericRtValue(pRtRight)) {
+        return getRtValueAsDouble(pRtLeft) == getRtValueAsDouble(pRtRight);
     }
     else if (pRtLeft->iType == RT_VALUE_STRING && pRtRight->iType == RT_VALUE_STRING) {
-        const char* szLeft = pRtLeft->uData.sString.uContent.pReadOnly;
-        const char* szRight = pRtRight->uData.sString.uContent.pReadOnly;
-        return IsStringEqual(szLeft, szRight);
+        return pRtLeft->uData.sString.iLength == pRtRight->uData.sString.iLength &&
+            memcmp(pRtLeft->uData.sString.szContent, pRtRight->uData.sString.szContent, pRtLeft->uData.sString.iLength) == 0;
     }
     return KB_FALSE;
 }
 
-CallEnv* createCallEnv(int iPrevPos, const BinFuncInfo* pFuncInfo) {
-    CallEnv* pEnv = (CallEnv *)malloc(sizeof(CallEnv));
-    int i;
+/* 新的局部变量分段，容量至少能放下一个调用帧，超过内存上限时返回 NULL */
+static FrameChunk* createFrameChunk(Machine* pMachine, int iMinCapacity) {
+    int         iCapacity   = iMinCapacity > KB_RT_FRAME_CHUNK_SIZE ? iMinCapacity : KB_RT_FRAME_CHUNK_SIZE;
+    FrameChunk* pChunk      = (FrameChunk *)rtMalloc(pMachine, RT_MEM_FRAME, sizeof(FrameChunk) + sizeof(RtValue) * (iCapacity - 1));
+    if (!pChunk) {
+        return NULL;
+    }
+    pMachine->sMem.arrObjects[RT_MEM_FRAME]++;
+    pChunk->pNext       = NULL;
+    pChunk->iCapacity   = iCapacity;
+    pChunk->iTop        = 0;
+    return pChunk;
+}
+
+/*
+ * 新调用帧入栈，局部变量在当前分段的栈顶分配，放不下时切换到下一个分段
+ * 帧栈和分段只增长不释放，超过最大深度或者内存上限时返回 NULL，错误写入 pIntRtErrId
+ */
+static CallEnv* pushCallEnv(Machine* pMachine, int iPrevPos, const BinFuncInfo* pFuncInfo, RuntimeErrorId* pIntRtErrId) {
+    CallEnv*    pEnv;
+    FrameChunk* pChunk = pMachine->pFrameChunkCur;
+    int         iNumVar = pFuncInfo->dwNumVars;
+    int         i;
+
+    if (pMachine->iNumCallEnv >= pMachine->iCallEnvCapacity) {
+        int         iNewCapacity = pMachine->iCallEnvCapacity * 2;
+        CallEnv*    pArrCallEnvNew;
+        if (pMachine->iNumCallEnv >= pMachine->iStackDepthMax) {
+            *pIntRtErrId = RUNTIME_STACK_OVERFLOW;
+            return NULL;
+        }
+        if (iNewCapacity > pMachine->iStackDepthMax) {
+            iNewCapacity = pMachine->iStackDepthMax;
+        }
+        pArrCallEnvNew = (CallEnv *)rtRealloc(
+            pMachine, RT_MEM_FRAME, pMachine->pArrCallEnv,
+            sizeof(CallEnv) * pMachine->iCallEnvCapacity, sizeof(CallEnv) * iNewCapacity
+        );
+        if (!pArrCallEnvNew) {
+            *pIntRtErrId = RUNTIME_MEMORY_LIMIT;
+            return NULL;
+        }
+        pMachine->pArrCallEnv = pArrCallEnvNew;
+        pMachine->iCallEnvCapacity = iNewCapacity;
+    }
+
+    /* 当前分段放不下，使用下一个分段 (后面的分段一定是空的) */
+    if (pChunk->iTop + iNumVar > pChunk->iCapacity) {
+        if (!pChunk->pNext || pChunk->pNext->iCapacity < iNumVar) {
+            FrameChunk* pChunkNew = createFrameChunk(pMachine, iNumVar);
+            if (!pChunkNew) {
+                *pIntRtErrId = RUNTIME_MEMORY_LIMIT;
+                return NULL;
+            }
+            pChunkNew->pNext = pChunk->pNext;
+            pChunk->pNext = pChunkNew;
+        }
+        pChunk = pChunk->pNext;
+        pMachine->pFrameChunkCur = pChunk;
+    }
 
+    pEnv = pMachine->pArrCallEnv + pMachine->iNumCallEnv++;
     pEnv->iNumParams        = pFuncInfo->dwNumParams;
-    pEnv->iNumVar           = pFuncInfo->dwNumVars;
+    pEnv->iNumVar           = iNumVar;
     pEnv->iPrevOpCodePos    = iPrevPos;
-    pEnv->pArrPtrLocalVars  = (RtValue **)malloc(sizeof(RtValue *) * pEnv->iNumVar);
+    pEnv->pArrLocalVars     = pChunk->arrSlots + pChunk->iTop;
+    pEnv->pChunk            = pChunk;
+    pChunk->iTop           += iNumVar;
 
-    /* 前 numArg 个变量从栈上取得，不需要初始化, 其他的初始化为0 */
-    for (i = pEnv->iNumParams; i < pEnv->iNumVar; ++i) {
-        pEnv->pArrPtrLocalVars[i] = createNumericRtValue(0);
+    /* 前 numArg 个变量从栈上取得，先置为 nil, 其他的初始化为0 */
+    for (i = 0; i < pEnv->iNumParams; ++i) {
+        pEnv->pArrLocalVars[i].iType = RT_VALUE_NIL;
+    }
+    for (i = pEnv->iNumParams; i < iNumVar; ++i) {
+        setIntegerRtValue(pEnv->pArrLocalVars + i, 0);
     }
     return pEnv;
 }
 
-void destroyCallEnv(CallEnv * pEnv) {
-    int i;
-    for (i = 0; i < pEnv->iNumParams; ++i) {
-        destroyRtValue(pEnv->pArrPtrLocalVars[i]);
+/* 栈顶调用帧出栈，释放局部变量的值，槽位留给下一次调用 */
+static void popCallEnv(Machine* pMachine) {
+    CallEnv*    pEnv = pMachine->pArrCallEnv + (--pMachine->iNumCallEnv);
+    int         i;
+    for (i = 0; i < pEnv->iNumVar; ++i) {
+        releaseRtValue(pMachine, pEnv->pArrLocalVars + i);
     }
-    free(pEnv->pArrPtrLocalVars);
-    free(pEnv);
+    pEnv->pChunk->iTop -= pEnv->iNumVar;
+    pMachine->pFrameChunkCur = pEnv->pChunk;
 }
 
-void destroyCallEnvVoidPtr(void* pEnv) {
-    destroyCallEnv((CallEnv *)pEnv);
-}
+#define getTopCallEnv() (pMachine->iNumCallEnv > 0 ? pMachine->pArrCallEnv + pMachine->iNumCallEnv - 1 : NULL)
 
-KbVirtualMachine* KRuntime_CreateMachine(const KByte* pSerializedRaw) {
-    Machine* pMachine = (Machine *)malloc(sizeof(Machine));
-    int iNumVar, i;
+/*
+ * 性能分析: 每条指令分派时记录上一条指令的耗时
+ * 只在定义了 KB_RT_PROFILE 时编译，否则所有钩子都是空语句
+ */
+#ifdef KB_RT_PROFILE
 
-    pMachine->pByteRaw      = pSerializedRaw;
-    pMachine->pBinHeader    = (const BinHeader *)pSerializedRaw;
-    pMachine->pArrFuncInfo  = (const BinFuncInfo *)(pSerializedRaw + pMachine->pBinHeader->dwFuncBlockStart);
-    pMachine->pStackOperand = vlNewList();
-    pMachine->pStackCallEnv = vlNewList();
-    pMachine->iStopValue    = 0;
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define profileTick()   ((double)__builtin_ia32_rdtsc())
+#else
+#define profileTick()   ((double)clock())
+#endif
 
-    /* 全部以数字0初始化全局变量 */
-    iNumVar = pMachine->pBinHeader->dwNumVariables;
-    pMachine->pArrPtrGlobalVars = (RtValue **)malloc(sizeof(RtValue *) * iNumVar);
-    for (i = 0; i < iNumVar; ++i) {
-       pMachine->pArrPtrGlobalVars[i] = createNumericRtValue(0);
+static void profileRecord(KbProfile* pProfile, int iPos, int iOpCodeId) {
+    double fNow = profileTick();
+    if (pProfile->iLastPos >= 0) {
+        pProfile->pArrPosTicks[pProfile->iLastPos] += fNow - pProfile->fLastTick;
+        pProfile->pArrOpCodeTicks[pProfile->iLastOpCodeId] += fNow - pProfile->fLastTick;
     }
+    if (iOpCodeId < 0 || iOpCodeId >= KB_RT_PROFILE_NUM_OPCODE) {
+        iOpCodeId = 0;
+    }
+    pProfile->pArrPosCount[iPos]++;
+    pProfile->pArrOpCodeCount[iOpCodeId]++;
+    pProfile->iLastPos      = iPos;
+    pProfile->iLastOpCodeId = iOpCodeId;
+    pProfile->fLastTick     = fNow;
+}
 
-    return pMachine;
+/* 执行结束或挂起，结束最后一条指令的计时 */
+static void profileStop(KbProfile* pProfile) {
+    if (pProfile->iLastPos >= 0) {
+        double fNow = profileTick();
+        pProfile->pArrPosTicks[pProfile->iLastPos] += fNow - pProfile->fLastTick;
+        pProfile->pArrOpCodeTicks[pProfile->iLastOpCodeId] += fNow - pProfile->fLastTick;
+        pProfile->iLastPos = -1;
+    }
 }
 
-void KRuntime_DestroyMachine(KbVirtualMachine* pMachine) {
-    int i, iNumVar = pMachine->pBinHeader->dwNumVariables;
-    for (i = 0; i < iNumVar; ++i) {
-        destroyRtValue(pMachine->pArrPtrGlobalVars[i]);
+#define profileOpCode(iPos, iOpCodeId) {                            \
+    if (pMachine->pProfile) {                                       \
+        profileRecord(pMachine->pProfile, (iPos), (iOpCodeId));     \
+    }                                                               \
+} NULL
+
+#define profileCall(dwFuncIndex) {                                  \
+    if (pMachine->pProfile) {                                       \
+        pMachine->pProfile->pArrFuncCalls[dwFuncIndex]++;           \
+    }                                                               \
+} NULL
+
+#define profileFinish() {                                           \
+    if (pMachine->pProfile) {                                       \
+        profileStop(pMachine->pProfile);                            \
+    }                                                               \
+} NULL
+
+#else
+
+#define profileOpCode(iPos, iOpCodeId)  NULL
+#define profileCall(dwFuncIndex)        NULL
+#define profileFinish()                 NULL
+
+#endif
+
+/* 开启性能分析，运行时编译时没有定义 KB_RT_PROFILE 则返回 KB_FALSE */
+KBool KRuntime_EnableProfile(KbVirtualMachine* pMachine) {
+#ifdef KB_RT_PROFILE
+    KbProfile* pProfile;
+    if (pMachine->pProfile) {
+        return KB_TRUE;
     }
-    free(pMachine->pArrPtrGlobalVars);
-    vlDestroy(pMachine->pStackOperand, destroyRtValueVoidPtr);
-    vlDestroy(pMachine->pStackCallEnv, destroyCallEnvVoidPtr);
-    free(pMachine);
+    pProfile = (KbProfile *)malloc(sizeof(KbProfile));
+    pProfile->pArrOpCodeCount   = (KDword *)calloc(KB_RT_PROFILE_NUM_OPCODE, sizeof(KDword));
+    pProfile->pArrOpCodeTicks   = (double *)calloc(KB_RT_PROFILE_NUM_OPCODE, sizeof(double));
+    pProfile->pArrPosCount      = (KDword *)calloc(pMachine->pBinHeader->dwNumOpCode + 1, sizeof(KDword));
+    pProfile->pArrPosTicks      = (double *)calloc(pMachine->pBinHeader->dwNumOpCode + 1, sizeof(double));
+    pProfile->pArrFuncCalls     = (KDword *)calloc(pMachine->pBinHeader->dwNumFunc + 1, sizeof(KDword));
+    pProfile->iLastPos          = -1;
+    pProfile->iLastOpCodeId     = 0;
+    pProfile->fLastTick         = 0;
+    pMachine->pProfile = pProfile;
+    return KB_TRUE;
+#else
+    return KB_FALSE;
+#endif
 }
 
-static void machineOpCodePosReset(Machine* pMachine) {
-    pMachine->pOpCodeCur = (OpCode *)(pMachine->pByteRaw + pMachine->pBinHeader->dwOpCodeBlockStart);
+KbVirtualMachine* KRuntime_CreateMachine(const KByte* pSerializedRaw) {
+    return KRuntime_CreateMachineEx(pSerializedRaw, NULL);
 }
 
-static void cleanUpOperandsWithArraySize(RtValue** pArrPtrOperands, int iSize) {
+/* 按配置准备 arena，宿主提供的内存按 8 字节对齐 */
+static void initArena(Arena* pArena, const ArenaConfig* pArenaConfig) {
     int i;
-    for (i = 0; i < iSize; ++i) {
-        if (pArrPtrOperands[i]) {
-            destroyRtValue(pArrPtrOperands[i]);
+    memset(pArena, 0, sizeof(Arena));
+    if (!pArenaConfig || pArenaConfig->dwSize < KB_RT_ARENA_MIN_BLOCK) {
+        return;
+    }
+    if (pArenaConfig->pBuffer) {
+        KByte*  pBuffer = (KByte *)pArenaConfig->pBuffer;
+        KDword  dwSkip  = (KDword)((8 - ((size_t)pBuffer & 7)) & 7);
+        if (pArenaConfig->dwSize <= dwSkip) {
+            return;
         }
-        pArrPtrOperands[i] = NULL;
+        pArena->pBase   = pBuffer + dwSkip;
+        pArena->pEnd    = pBuffer + pArenaConfig->dwSize;
+        pArena->bOwned  = KB_FALSE;
+    } else {
+        pArena->pBase   = (KByte *)malloc(pArenaConfig->dwSize);
+        pArena->pEnd    = pArena->pBase + pArenaConfig->dwSize;
+        pArena->bOwned  = KB_TRUE;
+    }
+    pArena->pTop = pArena->pBase;
+    for (i = 0; i < KB_RT_ARENA_NUM_CLASS; ++i) {
+        pArena->arrFreeList[i] = NULL;
     }
 }
 
-#define popRtValue(toStore) {                       \
-    (toStore) = NULL;                               \
-    if (pMachine->pStackOperand->size <= 0) {       \
-        returnExecError(RUNTIME_STACK_UNDERFLOW);   \
-    }                                               \
-    toStore = vlPopBack(pMachine->pStackOperand);   \
-} NULL
-
-#define checkRtValueTypeIs(pRtValue, iTypExptd) {   \
-    if (pRtValue->iType != iTypExptd) {             \
-        returnExecError(RUNTIME_TYPE_MISMATCH);     \
-    }                                               \
-} NULL
+/* ------------------------------------------------------------ */
+/*                       加载时的字节码校验                      */
+/* ------------------------------------------------------------ */
 
-#define pushNumericOperand(num) \
-    vlPushBack(pMachine->pStackOperand, createNumericRtValue(num));
+typedef struct {
+    const Machine*  pMachine;
+    int             iNumOpCode;
+    int*            pArrDepth;      /* 每个位置执行前的栈深度 (相对所在函数的入口)，-1 为还没有到达 */
+    int*            pArrOwner;      /* 每个位置所属的函数，-1 为主程序 */
+    int*            pArrWork;       /* 待检查的位置，每个位置只入队一次 */
+    int             iNumWork;
+} VerifyContext;
 
-#define getCurrentCallEnv(pCallEnv)  {                          \
-    if (pMachine->pStackCallEnv->size <= 0) {                   \
-        returnExecError(RUNTIME_NOT_IN_USER_FUNC);              \
-    }                                                           \
-    pCallEnv = (KbCallEnv *)pMachine->pStackCallEnv->tail->data;\
-} NULL
+/* 到达 iPos 时的状态，和之前到达时的状态不一致则校验失败 */
+static KBool verifyReach(VerifyContext* pVerify, int iPos, int iDepth, int iOwner) {
+    if (iPos < 0 || iPos >= pVerify->iNumOpCode) {
+        return KB_FALSE;
+    }
+    if (pVerify->pArrDepth[iPos] < 0) {
+        pVerify->pArrDepth[iPos] = iDepth;
+        pVerify->pArrOwner[iPos] = iOwner;
+        pVerify->pArrWork[pVerify->iNumWork++] = iPos;
+        return KB_TRUE;
+    }
+    return pVerify->pArrDepth[iPos] == iDepth && pVerify->pArrOwner[iPos] == iOwner;
+}
 
-#define getVariable(pPtrVar) {                          \
-    if (pOpCode->uParam.sVarAccess.wIsLocal) {          \
-        CallEnv* pCallEnv;                              \
-        getCurrentCallEnv(pCallEnv);                    \
-        pPtrVar = (pCallEnv->pArrPtrLocalVars         \
-             + pOpCode->uParam.sVarAccess.wVarIndex);   \
-    } else {                                            \
-        pPtrVar = (pMachine->pArrPtrGlobalVars        \
-             + pOpCode->uParam.sVarAccess.wVarIndex);   \
-    }                                                   \
-} NULL
+/* 局部变量只能在函数中访问，下标不能越过变量表 */
+static KBool verifyVarAccess(const VerifyContext* pVerify, const OpCode* pOpCode, int iOwner) {
+    if (pOpCode->uParam.sVarAccess.wIsLocal) {
+        return iOwner >= 0 && pOpCode->uParam.sVarAccess.wVarIndex < pVerify->pMachine->pArrFuncInfo[iOwner].dwNumVars;
+    }
+    return pOpCode->uParam.sVarAccess.wVarIndex < pVerify->pMachine->pBinHeader->dwNumVariables;
+}
 
-#define cleanUpOperands() (cleanUpOperandsWithArraySize(pArrPtrOperands, sizeof(pArrPtrOperands) / sizeof(pArrPtrOperands[0])))
-#define pRtOperandLeft      (pArrPtrOperands[0])
-#define pRtOperandRight     (pArrPtrOperands[1])
+/*
+ * 超级指令按序列的第一条原始指令校验，后续指令按顺序执行到达，各自校验
+ * 加速指令只出现在执行过的副本中，和 BINARY_OPERATOR 相同
+ */
+static KDword getVerifiedOpCodeId(KDword dwOpCodeId) {
+    switch (dwOpCodeId) {
+        case K_OPCODE_ADD_NUM_NUM:
+        case K_OPCODE_SUB_NUM_NUM:
+        case K_OPCODE_MUL_NUM_NUM:
+        case K_OPCODE_DIV_NUM_NUM:
+        case K_OPCODE_EQ_NUM_NUM:
+        case K_OPCODE_NEQ_NUM_NUM:
+        case K_OPCODE_GT_NUM_NUM:
+        case K_OPCODE_LT_NUM_NUM:
+        case K_OPCODE_GTEQ_NUM_NUM:
+        case K_OPCODE_LTEQ_NUM_NUM:
+            return K_OPCODE_BINARY_OPERATOR;
+        case K_OPCODE_VAR_NUM_BINOP:
+        case K_OPCODE_VAR_VAR_BINOP:
+        case K_OPCODE_VAR_NUM_CMP_UNLESS_GOTO:
+        case K_OPCODE_VAR_VAR_CMP_UNLESS_GOTO:
+            return K_OPCODE_PUSH_VAR;
+        case K_OPCODE_NUM_VAR_BINOP:
+        case K_OPCODE_NUM_VAR_CMP_UNLESS_GOTO:
+        case K_OPCODE_INC_VAR:
+            return K_OPCODE_PUSH_NUM;
+        case K_OPCODE_INT_VAR_BINOP:
+        case K_OPCODE_INT_VAR_CMP_UNLESS_GOTO:
+        case K_OPCODE_INC_VAR_INT:
+            return K_OPCODE_PUSH_INT;
+        default:
+            return dwOpCodeId;
+    }
+}
 
-#define callMathFunc(mathFunc) {                        \
-    popRtValue(pRtOperandLeft);                         \
-    fResult = mathFunc(pRtOperandLeft->uData.fNumber);  \
-    cleanUpOperands();                                  \
-    pushNumericOperand(fResult);                        \
-} NULL
+/* 超级指令执行时直接读取后续的原始指令，后续指令必须是融合前的序列 */
+static KBool verifyFusedSequence(const VerifyContext* pVerify, int iPos) {
+    const OpCode*   pOpCode     = pVerify->pMachine->pArrOpCodes + iPos;
+    KDword          dwSecond    = K_OPCODE_PUSH_VAR;
+    int             iLength     = 3;
+    switch (pOpCode->dwOpCodeId) {
+        case K_OPCODE_VAR_NUM_CMP_UNLESS_GOTO:
+            iLength = 4;
+            /* 继续设置第二条指令 */
+        case K_OPCODE_VAR_NUM_BINOP:
+            dwSecond = K_OPCODE_PUSH_NUM;
+            break;
+        case K_OPCODE_NUM_VAR_CMP_UNLESS_GOTO:
+        case K_OPCODE_VAR_VAR_CMP_UNLESS_GOTO:
+        case K_OPCODE_INT_VAR_CMP_UNLESS_GOTO:
+        case K_OPCODE_INC_VAR:
+        case K_OPCODE_INC_VAR_INT:
+            iLength = 4;
+            break;
+    }
+    if (iPos + iLength > pVerify->iNumOpCode || getVerifiedOpCodeId(pOpCode[2].dwOpCodeId) != K_OPCODE_BINARY_OPERATOR) {
+        return KB_FALSE;
+    }
+    /* VAR_NUM 的第二条可以是 PUSH_NUM 或 PUSH_INT */
+    if (pOpCode[1].dwOpCodeId != dwSecond &&
+        !(dwSecond == K_OPCODE_PUSH_NUM && pOpCode[1].dwOpCodeId == K_OPCODE_PUSH_INT)
+    ) {
+        return KB_FALSE;
+    }
+    switch (pOpCode->dwOpCodeId) {
+        case K_OPCODE_INC_VAR:
+        case K_OPCODE_INC_VAR_INT:
+            return pOpCode[2].uParam.dwOperatorId == OPR_ADD
+                && pOpCode[3].dwOpCodeId == K_OPCODE_SET_VAR
+                && pOpCode[3].uParam.sVarAccess.wIsLocal == pOpCode[1].uParam.sVarAccess.wIsLocal
+                && pOpCode[3].uParam.sVarAccess.wVarIndex == pOpCode[1].uParam.sVarAccess.wVarIndex;
+        default:
+            return iLength == 3 || pOpCode[3].dwOpCodeId == K_OPCODE_UNLESS_GOTO;
+    }
+}
 
-#define returnExecError(rtErrId) {                  \
-    *pIntRtErrId = (rtErrId);                       \
-    *ppStopOpCode = pOpCode;                        \
-    cleanUpOperands();                              \
-    return KB_FALSE;                                \
-} NULL
+/*
+ * 从主程序入口开始沿所有可能的执行路径校验栈字节码，证明:
+ *  - 每个位置的栈深度是固定的，出栈不会越过当前函数的入口
+ *  - 变量、字符串、函数和拓展函数的下标都在各自的表内
+ *  - 跳转目标和顺序执行的下一条都在指令范围内，RETURN 只出现在函数中
+ * 到达不了的指令不校验，也不会被执行
+ * 每个位置的栈深度和所属函数留在 pVerify 中，由调用者用 freeVerifyContext 释放
+ */
+static KBool verifyStackOpCodes(const Machine* pMachine, VerifyContext* pVerify) {
+    const BinHeader*    pHeader = pMachine->pBinHeader;
+    KBool               bValid  = KB_TRUE;
+    int                 i;
 
-KBool KRuntime_MachineExecute(
-    KbVirtualMachine*   pMachine,
-    int                 iStartPos,
-    RuntimeErrorId*     pIntRtErrId,
-    const OpCode**      ppStopOpCode
-) {
-    int             iNumOpCode          = pMachine->pBinHeader->dwNumOpCode;
-    const OpCode*   pOpCodeStart        = (OpCode *)(pMachine->pByteRaw + pMachine->pBinHeader->dwOpCodeBlockStart);
-    KFloat          fResult             = 0;
-    RtValue*        pArrPtrOperands[]   = { NULL, NULL };
+    pVerify->pMachine       = pMachine;
+    pVerify->iNumOpCode     = pHeader->dwNumOpCode;
+    pVerify->pArrDepth      = (int *)malloc(sizeof(int) * (pVerify->iNumOpCode + 1));
+    pVerify->pArrOwner      = (int *)malloc(sizeof(int) * (pVerify->iNumOpCode + 1));
+    pVerify->pArrWork       = (int *)malloc(sizeof(int) * (pVerify->iNumOpCode + 1));
+    pVerify->iNumWork       = 0;
+    for (i = 0; i < pVerify->iNumOpCode; ++i) {
+        pVerify->pArrDepth[i] = -1;
+        pVerify->pArrOwner[i] = -1;
+    }
+    bValid = verifyReach(pVerify, 0, 0, -1);
 
-    srand(time(NULL));
+    while (bValid && pVerify->iNumWork > 0) {
+        int             iPos        = pVerify->pArrWork[--pVerify->iNumWork];
+        int             iDepth      = pVerify->pArrDepth[iPos];
+        int             iOwner      = pVerify->pArrOwner[iPos];
+        const OpCode*   pOpCode     = pVerify->pMachine->pArrOpCodes + iPos;
+        KDword          dwOpCodeId  = getVerifiedOpCodeId(pOpCode->dwOpCodeId);
+        int             iNumPop     = 0;    /* 需要的操作数个数 */
+        int             iNumPush    = 0;
+        KBool           bJump       = KB_FALSE;
+        KBool           bFallThrough = KB_TRUE;
 
-    *pIntRtErrId = RUNTIME_NONE;
-    pMachine->iStopValue = 0;
-    
-    machineOpCodePosReset(pMachine);
-    pMachine->pOpCodeCur += iStartPos;
-    
-    while (pMachine->pOpCodeCur - pOpCodeStart < iNumOpCode) {
-        const OpCode* pOpCode = pMachine->pOpCodeCur;
-        /* 
-        printf("%03d | %-18s \n", pMachine->pOpCodeCur - pOpCodeStart, getOpCodeName(pOpCode->dwOpCodeId));
-         */
-        switch(pOpCode->dwOpCodeId) {
-            default: {
-                returnExecError(RUNTIME_UNKNOWN_OPCODE);
+        if (pOpCode->dwOpCodeId >= K_OPCODE_VAR_NUM_BINOP && pOpCode->dwOpCodeId <= K_OPCODE_INC_VAR_INT) {
+            bValid = verifyFusedSequence(pVerify, iPos);
+        }
+        switch (dwOpCodeId) {
+            case K_OPCODE_PUSH_NUM:
+            case K_OPCODE_PUSH_INT:
+                iNumPush = 1;
                 break;
-            }
-            case K_OPCODE_PUSH_NUM: {
-                pushNumericOperand(pOpCode->uParam.fLiteral);
+            case K_OPCODE_PUSH_STR:
+                iNumPush = 1;
+                bValid = bValid && pOpCode->uParam.dwStringPoolPos < pHeader->dwStringPoolLength;
                 break;
-            }
-            case K_OPCODE_PUSH_STR: {
-                vlPushBack(
-                    pMachine->pStackOperand,
-                    createStringRefRtValue(
-                        (const char *)pMachine->pBinHeader + 
-                        pMachine->pBinHeader->dwStringPoolStart + 
-                        pOpCode->uParam.dwStringPoolPos
-                    )
-                );
+            case K_OPCODE_PUSH_VAR:
+                iNumPush = 1;
+                bValid = bValid && verifyVarAccess(pVerify, pOpCode, iOwner);
+                break;
+            case K_OPCODE_BINARY_OPERATOR:
+                iNumPop = 2;
+                iNumPush = 1;
+                break;
+            case K_OPCODE_UNARY_OPERATOR:
+                iNumPop = 1;
+                iNumPush = 1;
+                break;
+            case K_OPCODE_POP:
+            case K_OPCODE_YIELD:
+                iNumPop = 1;
+                break;
+            case K_OPCODE_SET_VAR:
+            case K_OPCODE_SET_VAR_AS_ARRAY:
+                iNumPop = 1;
+                bValid = bValid && verifyVarAccess(pVerify, pOpCode, iOwner);
+                break;
+            case K_OPCODE_ARR_GET:
+                iNumPop = 1;
+                iNumPush = 1;
+                bValid = bValid && verifyVarAccess(pVerify, pOpCode, iOwner);
+                break;
+            case K_OPCODE_ARR_SET:
+                iNumPop = 2;
+                bValid = bValid && verifyVarAccess(pVerify, pOpCode, iOwner);
+                break;
+            case K_OPCODE_CALL_BUILT_IN:
+                bValid = bValid
+                    && pOpCode->uParam.dwBuiltFuncId > KBUILT_IN_FUNC_NONE
+                    && pOpCode->uParam.dwBuiltFuncId <= KBUILT_IN_FUNC_ASC;
+                iNumPop = getBuiltInFuncNumParams(pOpCode->uParam.dwBuiltFuncId);
+                iNumPush = 1;
+                break;
+            case K_OPCODE_CALL_EXT:
+                bValid = bValid && pOpCode->uParam.dwExtFuncIndex < pHeader->dwNumExtFunc;
+                if (bValid) {
+                    iNumPop = pMachine->pArrExtFuncInfo[pOpCode->uParam.dwExtFuncIndex].dwNumParams;
+                }
+                iNumPush = 1;
+                break;
+            case K_OPCODE_GOTO:
+                bJump = KB_TRUE;
+                bFallThrough = KB_FALSE;
+                break;
+            case K_OPCODE_IF_GOTO:
+            case K_OPCODE_UNLESS_GOTO:
+                iNumPop = 1;
+                bJump = KB_TRUE;
+                break;
+            case K_OPCODE_CALL_FUNC: {
+                const BinFuncInfo* pFuncInfo;
+                /* 下标通过检查后才计算函数信息的地址 */
+                bValid = bValid && pOpCode->uParam.dwFuncIndex < pHeader->dwNumFunc;
+                if (bValid) {
+                    pFuncInfo = pMachine->pArrFuncInfo + pOpCode->uParam.dwFuncIndex;
+                    bValid = pFuncInfo->dwNumParams <= pFuncInfo->dwNumVars
+                        && verifyReach(pVerify, pFuncInfo->dwOpCodePos, 0, pOpCode->uParam.dwFuncIndex);
+                }
+                if (bValid) {
+                    iNumPop = pFuncInfo->dwNumParams;
+                }
+                iNumPush = 1;
                 break;
             }
-            case K_OPCODE_BINARY_OPERATOR: {
-                popRtValue(pRtOperandRight);
-                popRtValue(pRtOperandLeft);
+            case K_OPCODE_RETURN:
+                /* 栈上只剩返回值，返回后由调用处的下一条继续 */
+                bValid = bValid && iOwner >= 0 && iDepth == 1;
+                bFallThrough = KB_FALSE;
+                break;
+            case K_OPCODE_STOP:
+                iNumPop = 1;
+                bFallThrough = KB_FALSE;
+                break;
+            default:
+                bValid = KB_FALSE;
+                break;
+        }
+        bValid = bValid && iDepth >= iNumPop;
+        if (bValid && bJump) {
+            bValid = verifyReach(pVerify, pOpCode->uParam.dwOpCodePos, iDepth - iNumPop + iNumPush, iOwner);
+        }
+        if (bValid && bFallThrough) {
+            bValid = verifyReach(pVerify, iPos + 1, iDepth - iNumPop + iNumPush, iOwner);
+        }
+    }
 
-                switch (pOpCode->uParam.dwOperatorId) {
-                    default: {
-                        returnExecError(RUNTIME_UNKNOWN_OPERATOR);
-                        break;
-                    }
-                    case OPR_CONCAT: {
-                        vlPushBack(pMachine->pStackOperand, createStringRtValueFromConcat(pRtOperandLeft, pRtOperandRight));
-                        break;
-                    }
-                    case OPR_ADD: {
-                        checkRtValueTypeIs(pRtOperandLeft, RT_VALUE_NUMBER);
-                        checkRtValueTypeIs(pRtOperandRight, RT_VALUE_NUMBER);
-                        fResult = pRtOperandLeft->uData.fNumber + pRtOperandRight->uData.fNumber;
-                        pushNumericOperand(fResult);
-                        break;
-                    }
-                    case OPR_SUB: {
-                        checkRtValueTypeIs(pRtOperandLeft, RT_VALUE_NUMBER);
-                        checkRtValueTypeIs(pRtOperandRight, RT_VALUE_NUMBER);
-                        fResult = pRtOperandLeft->uData.fNumber - pRtOperandRight->uData.fNumber;
-                        pushNumericOperand(fResult);
-                        break;
-                    }
-                    case OPR_MUL: {
-                        checkRtValueTypeIs(pRtOperandLeft, RT_VALUE_NUMBER);
-                        checkRtValueTypeIs(pRtOperandRight, RT_VALUE_NUMBER);
-                        fResult = pRtOperandLeft->uData.fNumber * pRtOperandRight->uData.fNumber;
-                        pushNumericOperand(fResult);
-                        break;
-                    }
-                    case OPR_DIV: {
-                        checkRtValueTypeIs(pRtOperandLeft, RT_VALUE_NUMBER);
-                        checkRtValueTypeIs(pRtOperandRight, RT_VALUE_NUMBER);
+    return bValid;
+}
 
-                        if (pRtOperandRight->uData.fNumber == 0) {
-                            returnExecError(RUNTIME_DIVISION_BY_ZERO);
-                        }
+static void freeVerifyContext(VerifyContext* pVerify) {
+    free(pVerify->pArrDepth);
+    free(pVerify->pArrOwner);
+    free(pVerify->pArrWork);
+}
 
-                        fResult = pRtOperandLeft->uData.fNumber / pRtOperandRight->uData.fNumber;
-                        pushNumericOperand(fResult);
-                        break;
-                    }
-                    case OPR_POW: {
-                        checkRtValueTypeIs(pRtOperandLeft, RT_VALUE_NUMBER);
-                        checkRtValueTypeIs(pRtOperandRight, RT_VALUE_NUMBER);
-                        fResult = pow(pRtOperandLeft->uData.fNumber, pRtOperandRight->uData.fNumber);
-                        pushNumericOperand(fResult);
-                        break;
-                    }
-                    case OPR_INTDIV: {
-                        checkRtValueTypeIs(pRtOperandLeft, RT_VALUE_NUMBER);
-                        checkRtValueTypeIs(pRtOperandRight, RT_VALUE_NUMBER);
+KbVirtualMachine* KRuntime_CreateMachineEx(const KByte* pSerializedRaw, const KbArenaConfig* pArenaConfig) {
+    Machine* pMachine = (Machine *)malloc(sizeof(Machine));
+    int iNumVar, i;
 
-                        if (pRtOperandRight->uData.fNumber == 0) {
-                            returnExecError(RUNTIME_DIVISION_BY_ZERO);
-                        }
+    initArena(&pMachine->sArena, pArenaConfig);
+    memset(&pMachine->sMem, 0, sizeof(MemStats));
 
-                        fResult = (int)(pRtOperandLeft->uData.fNumber / pRtOperandRight->uData.fNumber);
-                        pushNumericOperand(fResult);
-                        break;
-                    }
-                    case OPR_MOD: {
-                        checkRtValueTypeIs(pRtOperandLeft, RT_VALUE_NUMBER);
-                        checkRtValueTypeIs(pRtOperandRight, RT_VALUE_NUMBER);
-                        fResult = ((int)pRtOperandLeft->uData.fNumber) % ((int)pRtOperandRight->uData.fNumber);
-                        pushNumericOperand(fResult);
-                        break;
-                    }
-                    case OPR_AND: {
-                        fResult = canBeConsideredAsTrue(pRtOperandLeft) && canBeConsideredAsTrue(pRtOperandRight);
-                        pushNumericOperand(fResult);
-                        break;
-                    }
-                    case OPR_OR: {
-                        fResult = canBeConsideredAsTrue(pRtOperandLeft) || canBeConsideredAsTrue(pRtOperandRight);
-                        pushNumericOperand(fResult);
-                        break;
-                    }
-                    case OPR_EQUAL: {
-                        fResult = canBeConsideredEqual(pRtOperandLeft, pRtOperandRight);
-                        pushNumericOperand(fResult);
-                        break;
-                    }
-                    case OPR_APPROX_EQ: {
-                        checkRtValueTypeIs(pRtOperandLeft, RT_VALUE_NUMBER);
-                        checkRtValueTypeIs(pRtOperandRight, RT_VALUE_NUMBER);
-                        fResult = FloatEqualRel(pRtOperandLeft->uData.fNumber, pRtOperandRight->uData.fNumber);
-                        pushNumericOperand(fResult);
-                        break;
-                    }
-                    case OPR_NEQ: {
-                        fResult = !canBeConsideredEqual(pRtOperandLeft, pRtOperandRight);
-                        pushNumericOperand(fResult);
-                        break;
-                    }
-                    case OPR_GT: {
-                        checkRtValueTypeIs(pRtOperandLeft, RT_VALUE_NUMBER);
-                        checkRtValueTypeIs(pRtOperandRight, RT_VALUE_NUMBER);
-                        fResult = pRtOperandLeft->uData.fNumber > pRtOperandRight->uData.fNumber;
-                        pushNumericOperand(fResult);
-                        break;
-                    }
-                    case OPR_LT: {
-                        checkRtValueTypeIs(pRtOperandLeft, RT_VALUE_NUMBER);
-                        checkRtValueTypeIs(pRtOperandRight, RT_VALUE_NUMBER);
-                        fResult = pRtOperandLeft->uData.fNumber < pRtOperandRight->uData.fNumber;
-                        pushNumericOperand(fResult);
-                        break;
-                    }
-                    case OPR_GTEQ: {
-                        checkRtValueTypeIs(pRtOperandLeft, RT_VALUE_NUMBER);
-                        checkRtValueTypeIs(pRtOperandRight, RT_VALUE_NUMBER);
-                        fResult = pRtOperandLeft->uData.fNumber >= pRtOperandRight->uData.fNumber;
-                        pushNumericOperand(fResult);
-                        break;
-                    }
-                    case OPR_LTEQ: {
-                        checkRtValueTypeIs(pRtOperandLeft, RT_VALUE_NUMBER);
-                        checkRtValueTypeIs(pRtOperandRight, RT_VALUE_NUMBER);
-                        fResult = pRtOperandLeft->uData.fNumber <= pRtOperandRight->uData.fNumber;
-                        pushNumericOperand(fResult);
-                        break;
-                    }
-                }
+    /* 没有指定种子时混入实例地址，同时创建的虚拟机得到不同的序列 */
+    KRuntime_SetRandSeed(pMachine, (KDword)time(NULL) ^ (KDword)(size_t)pMachine);
+
+    pMachine->pByteRaw      = pSerializedRaw;
+    pMachine->pBinHeader    = (const BinHeader *)pSerializedRaw;
+    pMachine->pArrFuncInfo  = (const BinFuncInfo *)(pSerializedRaw + pMachine->pBinHeader->dwFuncBlockStart);
+    pMachine->pArrExtFuncInfo = (const BinExtFuncInfo *)(pSerializedRaw + pMachine->pBinHeader->dwExtFuncBlockStart);
+    pMachine->iStopValue    = 0;
+    pMachine->iYieldValue   = 0;
+    pMachine->bSuspended    = KB_FALSE;
+    pMachine->dwStatOpCodes = 0;
+    pMachine->dwStatAllocs  = 0;
+    pMachine->pProfile      = NULL;
+    pMachine->pRegOpCodeCur = NULL;
+    pMachine->pArrOpCodes   = NULL;
+
+    /* 字节码可以被多个虚拟机共享，栈字节码复制一份指令，加速时只改写自己的副本 */
+    if (!K_IS_REG_BINARY(pMachine->pBinHeader)) {
+        KDword dwSize = sizeof(OpCode) * pMachine->pBinHeader->dwNumOpCode;
+        pMachine->pArrOpCodes = (OpCode *)malloc(dwSize);
+        memcpy(pMachine->pArrOpCodes, pSerializedRaw + pMachine->pBinHeader->dwOpCodeBlockStart, dwSize);
+    }
+
+    /* 栈字节码加载时校验一次，通过校验的在执行时去掉逐条指令的检查 */
+    pMachine->bVerified     = KB_FALSE;
+    pMachine->bRunUnchecked = KB_FALSE;
+    if (pMachine->pArrOpCodes) {
+        VerifyContext sVerify;
+        pMachine->bVerified = verifyStackOpCodes(pMachine, &sVerify);
+        freeVerifyContext(&sVerify);
+    }
+
+    /* 预分配操作数栈 */
+    pMachine->iStackTop         = 0;
+    pMachine->iStackCapacity    = KB_RT_STACK_INIT_SIZE;
+    pMachine->iStackDepthMax    = KB_RT_STACK_DEPTH_MAX;
+    pMachine->pStackOperand     = (RtValue *)malloc(sizeof(RtValue) * pMachine->iStackCapacity);
+    memAcquire(pMachine, RT_MEM_VALUE, sizeof(RtValue) * pMachine->iStackCapacity);
+
+    /* 预分配调用帧栈和第一个局部变量分段 */
+    pMachine->iNumCallEnv       = 0;
+    pMachine->iCallEnvCapacity  = KB_RT_CALL_ENV_INIT_SIZE;
+    pMachine->pArrCallEnv       = (CallEnv *)malloc(sizeof(CallEnv) * pMachine->iCallEnvCapacity);
+    memAcquire(pMachine, RT_MEM_FRAME, sizeof(CallEnv) * pMachine->iCallEnvCapacity);
+    pMachine->pFrameChunkHead   = createFrameChunk(pMachine, 0);
+    pMachine->pFrameChunkCur    = pMachine->pFrameChunkHead;
+
+    /* 拓展函数的回调表，下标和拓展函数表一致，调用时直接定位 */
+    pMachine->pArrExtFuncBindings = (ExtFuncBinding *)calloc(pMachine->pBinHeader->dwNumExtFunc + 1, sizeof(ExtFuncBinding));
+
+    /* 全部以数字0初始化全局变量 */
+    iNumVar = pMachine->pBinHeader->dwNumVariables;
+    pMachine->pArrGlobalVars = (RtValue *)malloc(sizeof(RtValue) * iNumVar);
+    memAcquire(pMachine, RT_MEM_VALUE, sizeof(RtValue) * iNumVar);
+    pMachine->sMem.arrObjects[RT_MEM_VALUE] = 2;
+    pMachine->sMem.arrObjects[RT_MEM_FRAME]++;
+    for (i = 0; i < iNumVar; ++i) {
+       setIntegerRtValue(pMachine->pArrGlobalVars + i, 0);
+    }
+
+    return pMachine;
+}
+
+/*
+ * 释放全局变量、操作数栈和调用帧中的值，之后全局变量的值不再有效
+ * 所有的值都在 arena 中时不需要逐个释放，整块丢弃即可
+ */
+static void releaseMachineValues(Machine* pMachine) {
+    int i, iNumVar = pMachine->pBinHeader->dwNumVariables;
+    if (pMachine->sArena.pBase && pMachine->sArena.iNumLiveFallback == 0) {
+        FrameChunk* pChunk;
+        for (pChunk = pMachine->pFrameChunkHead; pChunk; pChunk = pChunk->pNext) {
+            pChunk->iTop = 0;
+        }
+        pMachine->pFrameChunkCur    = pMachine->pFrameChunkHead;
+        pMachine->iNumCallEnv       = 0;
+        pMachine->iStackTop         = 0;
+        pMachine->sMem.dwTotal     -= pMachine->sMem.arrBytes[RT_MEM_STRING] + pMachine->sMem.arrBytes[RT_MEM_ARRAY];
+        pMachine->sMem.arrBytes[RT_MEM_STRING]      = 0;
+        pMachine->sMem.arrBytes[RT_MEM_ARRAY]       = 0;
+        pMachine->sMem.arrObjects[RT_MEM_STRING]    = 0;
+        pMachine->sMem.arrObjects[RT_MEM_ARRAY]     = 0;
+        return;
+    }
+    for (i = 0; i < iNumVar; ++i) {
+        releaseRtValue(pMachine, pMachine->pArrGlobalVars + i);
+    }
+    while (pMachine->iStackTop > 0) {
+        releaseRtValue(pMachine, pMachine->pStackOperand + (--pMachine->iStackTop));
+    }
+    while (pMachine->iNumCallEnv > 0) {
+        popCallEnv(pMachine);
+    }
+}
+
+/* 丢弃所有的值，回到刚创建时的状态，保留已分配的栈、调用帧和 arena 的统计 */
+void KRuntime_ResetMachine(KbVirtualMachine* pMachine) {
+    Arena*  pArena = &pMachine->sArena;
+    int     i, iNumVar = pMachine->pBinHeader->dwNumVariables;
+
+    releaseMachineValues(pMachine);
+    for (i = 0; i < iNumVar; ++i) {
+        setIntegerRtValue(pMachine->pArrGlobalVars + i, 0);
+    }
+    if (pArena->pBase) {
+        pArena->pTop    = pArena->pBase;
+        pArena->dwUsed  = 0;
+        for (i = 0; i < KB_RT_ARENA_NUM_CLASS; ++i) {
+            pArena->arrFreeList[i] = NULL;
+        }
+    }
+    pMachine->iStopValue    = 0;
+    pMachine->iYieldValue   = 0;
+    pMachine->bSuspended    = KB_FALSE;
+    pMachine->pOpCodeCur    = NULL;
+    pMachine->pRegOpCodeCur = NULL;
+}
+
+void KRuntime_DestroyMachine(KbVirtualMachine* pMachine) {
+    releaseMachineValues(pMachine);
+    if (pMachine->sArena.bOwned) {
+        free(pMachine->sArena.pBase);
+    }
+    free(pMachine->pArrGlobalVars);
+    free(pMachine->pStackOperand);
+    free(pMachine->pArrCallEnv);
+    free(pMachine->pArrExtFuncBindings);
+    free(pMachine->pArrOpCodes);
+    if (pMachine->pProfile) {
+        free(pMachine->pProfile->pArrOpCodeCount);
+        free(pMachine->pProfile->pArrOpCodeTicks);
+        free(pMachine->pProfile->pArrPosCount);
+        free(pMachine->pProfile->pArrPosTicks);
+        free(pMachine->pProfile->pArrFuncCalls);
+        free(pMachine->pProfile);
+    }
+    while (pMachine->pFrameChunkHead) {
+        FrameChunk* pChunk = pMachine->pFrameChunkHead;
+        pMachine->pFrameChunkHead = pChunk->pNext;
+        free(pChunk);
+    }
+    free(pMachine);
+}
+
+void KRuntime_SetStackDepthMax(KbVirtualMachine* pMachine, int iDepthMax) {
+    /* 不允许小于已经使用的深度 */
+    if (iDepthMax < pMachine->iStackTop) {
+        iDepthMax = pMachine->iStackTop;
+    }
+    pMachine->iStackDepthMax = iDepthMax;
+}
+
+/* 为脚本声明的拓展函数绑定回调，字节码中没有这个 callId 时返回 KB_FALSE */
+KBool KRuntime_BindExtFunc(KbVirtualMachine* pMachine, int iCallId, KbExtFuncCallback fnCallback, void* pUserData) {
+    int i;
+    for (i = 0; i < (int)pMachine->pBinHeader->dwNumExtFunc; ++i) {
+        if ((int)pMachine->pArrExtFuncInfo[i].dwCallId == iCallId) {
+            pMachine->pArrExtFuncBindings[i].fnCallback = fnCallback;
+            pMachine->pArrExtFuncBindings[i].pUserData  = pUserData;
+            return KB_TRUE;
+        }
+    }
+    return KB_FALSE;
+}
+
+/* 复制一段字符串作为值，供拓展函数的回调返回字符串；超过内存上限时返回 KB_FALSE，值保持不变 */
+KBool KRuntime_SetStringValue(KbVirtualMachine* pMachine, KbRuntimeValue* pRtValue, const char* szContent, int iLength) {
+    RtString* pRtString = createRtString(pMachine, iLength);
+    if (!pRtString) {
+        return KB_FALSE;
+    }
+    memcpy(pRtString->szBuf, szContent, iLength);
+    pRtString->szBuf[iLength] = '\0';
+    pRtString->iLength = iLength;
+    releaseRtValue(pMachine, pRtValue);
+    setStringRtValue(pRtValue, pRtString, iLength);
+    return KB_TRUE;
+}
+
+void KRuntime_SetMemoryLimit(KbVirtualMachine* pMachine, KDword dwLimit) {
+    pMachine->sMem.dwLimit = dwLimit;
+}
+
+const KbMemStats* KRuntime_GetMemStats(const KbVirtualMachine* pMachine) {
+    return &pMachine->sMem;
+}
+
+/*
+ * 调用拓展函数，参数和返回值的位置由调用者提供
+ * 参数是调用者的临时值，整数参数原地转换为浮点数，拓展函数只需要处理 number 类型
+ */
+static RuntimeErrorId callExtFunc(Machine* pMachine, KDword dwExtFuncIndex, RtValue* pArrArgs, RtValue* pRtResult) {
+    const ExtFuncBinding*   pBinding = pMachine->pArrExtFuncBindings + dwExtFuncIndex;
+    KDword                  dwNumParams = pMachine->pArrExtFuncInfo[dwExtFuncIndex].dwNumParams;
+    KDword                  i;
+    if (!pBinding->fnCallback) {
+        return RUNTIME_EXT_FUNC_UNBOUND;
+    }
+    for (i = 0; i < dwNumParams; i++) {
+        if (pArrArgs[i].iType == RT_VALUE_INTEGER) {
+            setNumericRtValue(pArrArgs + i, (KFloat)pArrArgs[i].uData.iNumber);
+        }
+    }
+    setNumericRtValue(pRtResult, 0);
+    return pBinding->fnCallback(
+        pMachine,
+        pArrArgs,
+        dwNumParams,
+        pRtResult,
+        pBinding->pUserData
+    );
+}
+
+/* 操作数栈扩容，达到最大深度或者内存上限时返回对应的错误 */
+static RuntimeErrorId machineGrowStack(Machine* pMachine) {
+    RtValue*    pStackNew;
+    int         iNewCapacity;
+    /* 已经达到最大深度 */
+    if (pMachine->iStackCapacity >= pMachine->iStackDepthMax) {
+        return RUNTIME_STACK_OVERFLOW;
+    }
+    /* 容量翻倍，不超过最大深度 */
+    iNewCapacity = pMachine->iStackCapacity * 2;
+    if (iNewCapacity > pMachine->iStackDepthMax) {
+        iNewCapacity = pMachine->iStackDepthMax;
+    }
+    pStackNew = (RtValue *)rtRealloc(
+        pMachine, RT_MEM_VALUE, pMachine->pStackOperand,
+        sizeof(RtValue) * pMachine->iStackCapacity, sizeof(RtValue) * iNewCapacity
+    );
+    if (!pStackNew) {
+        return RUNTIME_MEMORY_LIMIT;
+    }
+    pMachine->pStackOperand     = pStackNew;
+    pMachine->iStackCapacity    = iNewCapacity;
+    return RUNTIME_NONE;
+}
+
+/*
+ * 整数加减法，结果溢出时返回 KB_FALSE (按无符号数运算，不触发有符号溢出的未定义行为)
+ * 参数会被多次求值，只能传入变量
+ */
+#define addIntegerChecked(iLeft, iRight, iResult) (                             \
+    (iResult) = (int)((KDword)(iLeft) + (KDword)(iRight)),                      \
+    (((iLeft) ^ (iResult)) & ((iRight) ^ (iResult))) >= 0                       \
+)
+#define subIntegerChecked(iLeft, iRight, iResult) (                             \
+    (iResult) = (int)((KDword)(iLeft) - (KDword)(iRight)),                      \
+    (((iLeft) ^ (iRight)) & ((iLeft) ^ (iResult))) >= 0                         \
+)
+
+/* 整数乘法，两边都不超过 46340 时一定不会溢出，否则用除法验证 */
+static KBool mulIntegerChecked(int iLeft, int iRight, int* pIntResult) {
+    int iResult = (int)((KDword)iLeft * (KDword)iRight);
+    if ((iLeft > 46340 || iLeft < -46340 || iRight > 46340 || iRight < -46340) &&
+        iLeft != 0 &&
+        ((iLeft == -1 && iRight == INT_MIN) || iResult / iLeft != iRight)
+    ) {
+        return KB_FALSE;
+    }
+    *pIntResult = iResult;
+    return KB_TRUE;
+}
+
+/* 整数除法，除数为 0 或者 INT_MIN / -1 时返回 KB_FALSE */
+#define isIntegerDivisible(iLeft, iRight) \
+    ((iRight) != 0 && !((iRight) == -1 && (iLeft) == INT_MIN))
+
+/*
+ * 数值运算的快速路径，超级指令和寄存器虚拟机共用，结果写入 pRtResult (可以和操作数相同)
+ * 两边都是整数时先按整数运算，溢出、不能整除等情况再提升为浮点数；比较、整除和取模的结果是整数
+ * 不是数字或者需要报错时返回 KB_FALSE，交给通用的实现处理
+ */
+/* 有一边是浮点数的比较 */
+#define compareNumeric(opr) \
+    setIntegerRtValue(pRtResult, getRtValueAsDouble(pRtLeft) opr getRtValueAsDouble(pRtRight))
+
+static KBool calcNumericOperator(KDword dwOperatorId, const RtValue* pRtLeft, const RtValue* pRtRight, RtValue* pRtResult) {
+    KFloat  fLeft, fRight;
+    int     iLeft, iRight, iResult;
+
+    if (pRtLeft->iType == RT_VALUE_INTEGER && pRtRight->iType == RT_VALUE_INTEGER) {
+        iLeft = pRtLeft->uData.iNumber;
+        iRight = pRtRight->uData.iNumber;
+        switch (dwOperatorId) {
+            case OPR_ADD:
+                if (!addIntegerChecked(iLeft, iRight, iResult)) break;
+                setIntegerRtValue(pRtResult, iResult);
+                return KB_TRUE;
+            case OPR_SUB:
+                if (!subIntegerChecked(iLeft, iRight, iResult)) break;
+                setIntegerRtValue(pRtResult, iResult);
+                return KB_TRUE;
+            case OPR_MUL:
+                if (!mulIntegerChecked(iLeft, iRight, &iResult)) break;
+                setIntegerRtValue(pRtResult, iResult);
+                return KB_TRUE;
+            case OPR_DIV:
+                if (!isIntegerDivisible(iLeft, iRight) || iLeft % iRight != 0) break;
+                setIntegerRtValue(pRtResult, iLeft / iRight);
+                return KB_TRUE;
+            case OPR_INTDIV:
+                if (!isIntegerDivisible(iLeft, iRight)) break;
+                setIntegerRtValue(pRtResult, iLeft / iRight);
+                return KB_TRUE;
+            case OPR_MOD:
+                if (iRight == 0) return KB_FALSE;
+                setIntegerRtValue(pRtResult, iRight == -1 ? 0 : iLeft % iRight);
+                return KB_TRUE;
+            case OPR_EQUAL: setIntegerRtValue(pRtResult, iLeft == iRight); return KB_TRUE;
+            case OPR_NEQ:   setIntegerRtValue(pRtResult, iLeft != iRight); return KB_TRUE;
+            case OPR_GT:    setIntegerRtValue(pRtResult, iLeft > iRight); return KB_TRUE;
+            case OPR_LT:    setIntegerRtValue(pRtResult, iLeft < iRight); return KB_TRUE;
+            case OPR_GTEQ:  setIntegerRtValue(pRtResult, iLeft >= iRight); return KB_TRUE;
+            case OPR_LTEQ:  setIntegerRtValue(pRtResult, iLeft <= iRight); return KB_TRUE;
+        }
+    }
+    else if (!isNumericRtValue(pRtLeft) || !isNumericRtValue(pRtRight)) {
+        return KB_FALSE;
+    }
+    fLeft = getRtValueAsFloat(pRtLeft);
+    fRight = getRtValueAsFloat(pRtRight);
+
+    switch (dwOperatorId) {
+        default:        return KB_FALSE;
+        case OPR_ADD:   setNumericRtValue(pRtResult, fLeft + fRight); break;
+        case OPR_SUB:   setNumericRtValue(pRtResult, fLeft - fRight); break;
+        case OPR_MUL:   setNumericRtValue(pRtResult, fLeft * fRight); break;
+        case OPR_POW:   setNumericRtValue(pRtResult, pow(fLeft, fRight)); break;
+        case OPR_EQUAL: compareNumeric(==); break;
+        case OPR_NEQ:   compareNumeric(!=); break;
+        case OPR_GT:    compareNumeric(>); break;
+        case OPR_LT:    compareNumeric(<); break;
+        case OPR_GTEQ:  compareNumeric(>=); break;
+        case OPR_LTEQ:  compareNumeric(<=); break;
+        case OPR_DIV:
+            if (fRight == 0) return KB_FALSE;
+            setNumericRtValue(pRtResult, fLeft / fRight);
+            break;
+        case OPR_INTDIV:
+            if (fRight == 0) return KB_FALSE;
+            setIntegralRtValue(pRtResult, fLeft / fRight);
+            break;
+        case OPR_MOD:
+            if ((int)fRight == 0) return KB_FALSE;
+            setIntegerRtValue(pRtResult, ((int)fLeft) % ((int)fRight));
+            break;
+    }
+    return KB_TRUE;
+}
+
+#undef compareNumeric
+
+/* 数值运算的结果是否为真，调用者保证是数字 */
+#define isNumericRtValueTrue(pRtValue) \
+    ((pRtValue)->iType == RT_VALUE_INTEGER ? (pRtValue)->uData.iNumber != 0 : (int)(pRtValue)->uData.fNumber != 0)
+
+static void machineOpCodePosReset(Machine* pMachine) {
+    if (pMachine->pArrOpCodes) {
+        pMachine->pOpCodeCur = pMachine->pArrOpCodes;
+    } else {
+        pMachine->pOpCodeCur = (const OpCode *)(pMachine->pByteRaw + pMachine->pBinHeader->dwOpCodeBlockStart);
+    }
+}
+
+/* 数字运算对应的加速指令，没有对应的加速指令时不改写 */
+static KDword getQuickenedOpCodeId(KDword dwOperatorId) {
+    switch (dwOperatorId) {
+        case OPR_ADD:   return K_OPCODE_ADD_NUM_NUM;
+        case OPR_SUB:   return K_OPCODE_SUB_NUM_NUM;
+        case OPR_MUL:   return K_OPCODE_MUL_NUM_NUM;
+        case OPR_DIV:   return K_OPCODE_DIV_NUM_NUM;
+        case OPR_EQUAL: return K_OPCODE_EQ_NUM_NUM;
+        case OPR_NEQ:   return K_OPCODE_NEQ_NUM_NUM;
+        case OPR_GT:    return K_OPCODE_GT_NUM_NUM;
+        case OPR_LT:    return K_OPCODE_LT_NUM_NUM;
+        case OPR_GTEQ:  return K_OPCODE_GTEQ_NUM_NUM;
+        case OPR_LTEQ:  return K_OPCODE_LTEQ_NUM_NUM;
+        default:        return K_OPCODE_BINARY_OPERATOR;
+    }
+}
+
+/*
+ * 以下运算由栈虚拟机和寄存器虚拟机共用:
+ * 操作数只读，结果写入 pRtResult，返回运行时错误 ID
+ */
+
+#define checkOperandTypeIs(pRtValue, iTypExptd) {   \
+    if ((pRtValue)->iType != (iTypExptd)) {         \
+        return RUNTIME_TYPE_MISMATCH;               \
+    }                                               \
+} NULL
+
+#define checkOperandIsNumber(pRtValue) {    \
+    if (!isNumericRtValue(pRtValue)) {          \
+        return RUNTIME_TYPE_MISMATCH;           \
+    }                                           \
+} NULL
+
+#define checkOperandsAreNumbers() {                         \
+    if (!isNumericRtValue(pRtLeft) || !isNumericRtValue(pRtRight)) {   \
+        return RUNTIME_TYPE_MISMATCH;                       \
+    }                                                       \
+    fLeft = getRtValueAsFloat(pRtLeft);                     \
+    fRight = getRtValueAsFloat(pRtRight);                   \
+} NULL
+
+static RuntimeErrorId calcBinaryOperator(
+    Machine*    pMachine,
+    KDword      dwOperatorId,
+    RtValue*    pRtLeft,
+    RtValue*    pRtRight,
+    RtValue*    pRtResult
+) {
+    KFloat fLeft, fRight;
+
+    /* 数值运算先走快速路径，剩下的是其他类型的运算、类型不符和除数为 0 */
+    if (calcNumericOperator(dwOperatorId, pRtLeft, pRtRight, pRtResult)) {
+        return RUNTIME_NONE;
+    }
+    switch (dwOperatorId) {
+        default:
+            return RUNTIME_UNKNOWN_OPERATOR;
+        case OPR_CONCAT:
+            if (!setStringRtValueFromConcat(pMachine, pRtResult, pRtLeft, pRtRight)) {
+                return RUNTIME_MEMORY_LIMIT;
+            }
+            break;
+        case OPR_ADD:
+        case OPR_SUB:
+        case OPR_MUL:
+        case OPR_POW:
+        case OPR_GT:
+        case OPR_LT:
+        case OPR_GTEQ:
+        case OPR_LTEQ:
+            return RUNTIME_TYPE_MISMATCH;
+        case OPR_DIV:
+        case OPR_INTDIV:
+        case OPR_MOD:
+            checkOperandsAreNumbers();
+            return RUNTIME_DIVISION_BY_ZERO;
+        case OPR_AND:
+            setIntegerRtValue(pRtResult, canBeConsideredAsTrue(pRtLeft) && canBeConsideredAsTrue(pRtRight));
+            break;
+        case OPR_OR:
+            setIntegerRtValue(pRtResult, canBeConsideredAsTrue(pRtLeft) || canBeConsideredAsTrue(pRtRight));
+            break;
+        case OPR_EQUAL:
+            setIntegerRtValue(pRtResult, canBeConsideredEqual(pRtLeft, pRtRight));
+            break;
+        case OPR_APPROX_EQ:
+            checkOperandsAreNumbers();
+            setIntegerRtValue(pRtResult, FloatEqualRel(fLeft, fRight));
+            break;
+        case OPR_NEQ:
+            setIntegerRtValue(pRtResult, !canBeConsideredEqual(pRtLeft, pRtRight));
+            break;
+    }
+    return RUNTIME_NONE;
+}
 
-                cleanUpOperands();
+static RuntimeErrorId calcUnaryOperator(KDword dwOperatorId, RtValue* pRtOperand, RtValue* pRtResult) {
+    switch (dwOperatorId) {
+        default:
+            return RUNTIME_UNKNOWN_OPERATOR;
+        case OPR_NEG:
+            /* -INT_MIN 超出范围，提升为浮点数 */
+            if (pRtOperand->iType == RT_VALUE_INTEGER && pRtOperand->uData.iNumber != INT_MIN) {
+                setIntegerRtValue(pRtResult, -pRtOperand->uData.iNumber);
                 break;
             }
-            case K_OPCODE_UNARY_OPERATOR: {
-                popRtValue(pRtOperandLeft);
-                
-                switch (pOpCode->uParam.dwOperatorId) {
-                    default: {
-                        returnExecError(RUNTIME_UNKNOWN_OPERATOR);
-                        break;
-                    }
-                    case OPR_NEG: {
-                        checkRtValueTypeIs(pRtOperandLeft, RT_VALUE_NUMBER);
-                        pushNumericOperand(-pRtOperandLeft->uData.fNumber);
-                        break;
-                    }
-                    case OPR_NOT: {
-                        pushNumericOperand(!canBeConsideredAsTrue(pRtOperandLeft));
-                        break;
+            checkOperandIsNumber(pRtOperand);
+            setNumericRtValue(pRtResult, -getRtValueAsFloat(pRtOperand));
+            break;
+        case OPR_NOT:
+            setIntegerRtValue(pRtResult, !canBeConsideredAsTrue(pRtOperand));
+            break;
+    }
+    return RUNTIME_NONE;
+}
+
+/* 每个虚拟机独立的随机数 (xorshift32)，不依赖全局的 rand()，多个虚拟机可以并发执行 */
+static KDword nextRandom(Machine* pMachine) {
+    KDword dwState = pMachine->dwRandState;
+    dwState ^= dwState << 13;
+    dwState ^= dwState >> 17;
+    dwState ^= dwState << 5;
+    pMachine->dwRandState = dwState;
+    return pMachine->dwRandState;
+}
+
+/* 设置随机数种子，相同的种子得到相同的随机数序列 */
+void KRuntime_SetRandSeed(KbVirtualMachine* pMachine, KDword dwSeed) {
+    /* 打散种子的每一位，相邻的种子不会得到相近的序列 */
+    dwSeed ^= dwSeed >> 16;
+    dwSeed *= 0x85EBCA6BUL;
+    dwSeed ^= dwSeed >> 13;
+    dwSeed *= 0xC2B2AE35UL;
+    dwSeed ^= dwSeed >> 16;
+    /* xorshift 的状态不能为 0 */
+    pMachine->dwRandState = dwSeed ? dwSeed : 0x9E3779B9UL;
+}
+
+/* 内置函数的参数个数，除了 rand 都只有一个参数 */
+static int getBuiltInFuncNumParams(KDword dwBuiltFuncId) {
+    return dwBuiltFuncId == KBUILT_IN_FUNC_RAND ? 0 : 1;
+}
+
+#define callMathFunc(mathFunc) {                                        \
+    checkOperandIsNumber(pRtArg);                                       \
+    setNumericRtValue(pRtResult, mathFunc(getRtValueAsFloat(pRtArg)));  \
+} NULL
+
+/* 取整函数的结果保存为整数 */
+#define callRoundFunc(mathFunc) {                                       \
+    checkOperandIsNumber(pRtArg);                                       \
+    setIntegralRtValue(pRtResult, mathFunc(getRtValueAsFloat(pRtArg))); \
+} NULL
+
+static RuntimeErrorId callBuiltInFunc(
+    Machine*    pMachine,
+    KDword      dwBuiltFuncId,
+    RtValue*    pRtArg,
+    RtValue*    pRtResult
+) {
+    switch (dwBuiltFuncId) {
+        default:
+            return RUNTIME_UNKNOWN_BUILT_IN_FUNC;
+        case KBUILT_IN_FUNC_P: {
+            char        szBuf[K_NUMERIC_STRINGIFY_BUF_MAX];
+            int         iLength;
+            const char* szStringified = stringifyRtValueToBuf(pRtArg, szBuf, &iLength);
+            printf("%.*s", iLength, szStringified);
+            /* 返回值 0 */
+            setIntegerRtValue(pRtResult, 0);
+            break;
+        }
+        case KBUILT_IN_FUNC_SIN:    callMathFunc(sinf);     break;
+        case KBUILT_IN_FUNC_COS:    callMathFunc(cosf);     break;
+        case KBUILT_IN_FUNC_TAN:    callMathFunc(tanf);     break;
+        case KBUILT_IN_FUNC_SQRT:   callMathFunc(sqrtf);    break;
+        case KBUILT_IN_FUNC_EXP:    callMathFunc(expf);     break;
+        case KBUILT_IN_FUNC_ABS:    callMathFunc(fabsf);    break;
+        case KBUILT_IN_FUNC_LOG:    callMathFunc(logf);     break;
+        case KBUILT_IN_FUNC_FLOOR:  callRoundFunc(floorf);  break;
+        case KBUILT_IN_FUNC_CEIL:   callRoundFunc(ceilf);   break;
+        case KBUILT_IN_FUNC_RAND: {
+            const int iMax = 10000;
+            const int iRandVal = (int)((nextRandom(pMachine) >> 8) % iMax);
+            setNumericRtValue(pRtResult, ((KFloat)iRandVal) / ((KFloat) iMax));
+            break;
+        }
+        case KBUILT_IN_FUNC_LEN: {
+            /* 根据不同类型计算长度 */
+            switch (pRtArg->iType) {
+                default:
+                    return RUNTIME_TYPE_MISMATCH;
+                case RT_VALUE_ARRAY:
+                    setIntegerRtValue(pRtResult, pRtArg->uData.pArray->iSize);
+                    break;
+                case RT_VALUE_STRING:
+                    setIntegerRtValue(pRtResult, pRtArg->uData.sString.iLength);
+                    break;
+            }
+            break;
+        }
+        case KBUILT_IN_FUNC_VAL: {
+            const char* szArg;
+            checkOperandTypeIs(pRtArg, RT_VALUE_STRING);
+            szArg = getTerminatedString(pMachine, pRtArg);
+            if (!szArg) {
+                return RUNTIME_MEMORY_LIMIT;
+            }
+            setNumericRtValue(pRtResult, (KFloat)Atof(szArg));
+            break;
+        }
+        case KBUILT_IN_FUNC_CHR: {
+            RtString* pRtString;
+            checkOperandIsNumber(pRtArg);
+            /* 生成的字符串作为返回值 */
+            pRtString = createRtString(pMachine, 1);
+            if (!pRtString) {
+                return RUNTIME_MEMORY_LIMIT;
+            }
+            pRtString->szBuf[0] = getRtValueAsInt(pRtArg);
+            pRtString->szBuf[1] = '\0';
+            pRtString->iLength = 1;
+            setStringRtValue(pRtResult, pRtString, 1);
+            break;
+        }
+        case KBUILT_IN_FUNC_ASC: {
+            checkOperandTypeIs(pRtArg, RT_VALUE_STRING);
+            /* 字符串第一个字符转数字 */
+            setIntegerRtValue(pRtResult, pRtArg->uData.sString.iLength > 0 ? pRtArg->uData.sString.szContent[0] : 0);
+            break;
+        }
+    }
+    return RUNTIME_NONE;
+}
+
+#undef callMathFunc
+#undef callRoundFunc
+#undef checkOperandsAreNumbers
+#undef checkOperandIsNumber
+#undef checkOperandTypeIs
+
+static void cleanUpOperandsWithArraySize(Machine* pMachine, RtValue* pArrOperands, int iSize) {
+    int i;
+    for (i = 0; i < iSize; ++i) {
+        releaseRtValue(pMachine, pArrOperands + i);
+    }
+}
+
+#define popRtValue(pRtStore) {                                      \
+    if (vmUnverified(pMachine->iStackTop <= 0)) {                   \
+        returnExecError(RUNTIME_STACK_UNDERFLOW);                   \
+    }                                                               \
+    *(pRtStore) = pMachine->pStackOperand[--pMachine->iStackTop];   \
+} NULL
+
+/* 保证栈顶还有一个空位 */
+#define reserveRtValue() {                                          \
+    if (pMachine->iStackTop >= pMachine->iStackCapacity) {          \
+        RuntimeErrorId iGrowErrId = machineGrowStack(pMachine);     \
+        if (iGrowErrId != RUNTIME_NONE) {                           \
+            returnExecError(iGrowErrId);                            \
+        }                                                           \
+    }                                                               \
+} NULL
+
+/* 值移动到栈顶，原位置置为 nil */
+#define pushRtValue(pRtValue) {                                     \
+    reserveRtValue();                                               \
+    pMachine->pStackOperand[pMachine->iStackTop++] = *(pRtValue);   \
+    (pRtValue)->iType = RT_VALUE_NIL;                               \
+} NULL
+
+#define checkRtValueIsNumeric(pRtValue) {            \
+    if (!isNumericRtValue(pRtValue)) {              \
+        returnExecError(RUNTIME_TYPE_MISMATCH);     \
+    }                                               \
+} NULL
+
+#define pushNumericOperand(num) {                                               \
+    reserveRtValue();                                                           \
+    setNumericRtValue(pMachine->pStackOperand + pMachine->iStackTop, (num));    \
+    pMachine->iStackTop++;                                                      \
+} NULL
+
+#define pushIntegerOperand(num) {                                               \
+    reserveRtValue();                                                           \
+    setIntegerRtValue(pMachine->pStackOperand + pMachine->iStackTop, (num));    \
+    pMachine->iStackTop++;                                                      \
+} NULL
+
+/* 超级指令中的字面量，bIsInteger 时是 PUSH_INT 的整数，否则是 PUSH_NUM 的浮点数 */
+#define setLiteralRtValue(pRtValue, pOpCodeLiteral, bIsInteger) {              \
+    if (bIsInteger) {                                                           \
+        setIntegerRtValue(pRtValue, (pOpCodeLiteral)->uParam.iLiteral);         \
+    } else {                                                                    \
+        setNumericRtValue(pRtValue, (pOpCodeLiteral)->uParam.fLiteral);         \
+    }                                                                           \
+} NULL
+
+#define getCurrentCallEnv(pCallEnv)  {                          \
+    if (vmUnverified(pMachine->iNumCallEnv <= 0)) {             \
+        returnExecError(RUNTIME_NOT_IN_USER_FUNC);              \
+    }                                                           \
+    pCallEnv = pMachine->pArrCallEnv + pMachine->iNumCallEnv - 1;\
+} NULL
+
+/* 获取 pOpCodeVar 参数指定的变量 */
+#define getVariableOf(pVar, pOpCodeVar) {                   \
+    if ((pOpCodeVar)->uParam.sVarAccess.wIsLocal) {         \
+        CallEnv* pCallEnv;                                  \
+        getCurrentCallEnv(pCallEnv);                        \
+        pVar = (pCallEnv->pArrLocalVars                     \
+             + (pOpCodeVar)->uParam.sVarAccess.wVarIndex);  \
+    } else {                                                \
+        pVar = (pMachine->pArrGlobalVars                    \
+             + (pOpCodeVar)->uParam.sVarAccess.wVarIndex);  \
+    }                                                       \
+} NULL
+
+#define getVariable(pVar) getVariableOf(pVar, pOpCode)
+
+/* 变量的引用入栈 */
+#define pushVarRef(pVar) {                                              \
+    reserveRtValue();                                                   \
+    setRefRtValue(pMachine->pStackOperand + pMachine->iStackTop++, pVar);\
+} NULL
+
+#define cleanUpOperands() (cleanUpOperandsWithArraySize(pMachine, sArrOperands, sizeof(sArrOperands) / sizeof(sArrOperands[0])))
+#define pRtOperandLeft      (sArrOperands + 0)
+#define pRtOperandRight     (sArrOperands + 1)
+#define pRtOperandResult    (sArrOperands + 2)
+
+#define returnExecError(rtErrId) {                  \
+    *pIntRtErrId = (rtErrId);                       \
+    *ppStopOpCode = pOpCode;                        \
+    cleanUpOperands();                              \
+    return RT_EXEC_ERROR;                           \
+} NULL
+
+/* ------------------------------------------------------------ */
+/*                        寄存器虚拟机                          */
+/* ------------------------------------------------------------ */
+
+#define returnRegExecError(rtErrId) {               \
+    *pIntRtErrId = (rtErrId);                       \
+    *ppStopOpCode = NULL;                           \
+    pMachine->pRegOpCodeCur = pRegOp;               \
+    releaseRtValue(pMachine, &sRtTemp);                       \
+    return RT_EXEC_ERROR;                           \
+} NULL
+
+/*
+ * 跳转到 pRegOpTarget，并检查指令预算，用完则保存位置挂起
+ * 只在跳转时检查，顺序执行的一段指令不会被打断
+ */
+#define regJumpTo(pRegOpTarget) {                                       \
+    pRegOp = (pRegOpTarget);                                            \
+    if (dwBudget && pMachine->dwStatOpCodes - dwStatStart >= dwBudget) {\
+        pMachine->pRegOpCodeCur = pRegOp;                               \
+        pMachine->bSuspended = KB_TRUE;                                 \
+        return RT_EXEC_SUSPENDED;                                       \
+    }                                                                   \
+    continue;                                                           \
+} NULL
+
+/*
+ * 获取操作数 wOperand 指向的值，立即数写入 sRtImm
+ * 变量通过 pArrRegBase[种类] 直接定位，不在函数中时局部变量的基址为 NULL
+ */
+#define getRegOperand(pRtValue, wOperand) {                                     \
+    KWord wOperandCur = (wOperand);                                             \
+    if (wOperandCur < K_REG_KIND_IMM_NUM) {                                     \
+        pRtValue = pArrRegBase[wOperandCur >> 14];                              \
+        if (!pRtValue) {                                                        \
+            returnRegExecError(RUNTIME_NOT_IN_USER_FUNC);                       \
+        }                                                                       \
+        pRtValue += wOperandCur & K_REG_INDEX_MASK;                             \
+    }                                                                           \
+    else if ((wOperandCur & K_REG_KIND_MASK) == K_REG_KIND_IMM_NUM) {           \
+        pRtValue = &sRtImm;                                                     \
+        if (wOperandCur & K_REG_IMM_INTEGER) {                                  \
+            setIntegerRtValue(pRtValue, pRegOp->uImm.iLiteral);                 \
+        } else {                                                                \
+            setNumericRtValue(pRtValue, pRegOp->uImm.fLiteral);                 \
+        }                                                                       \
+    }                                                                           \
+    else {                                                                      \
+        pRtValue = &sRtImm;                                                     \
+        setStaticStringRtValue(pRtValue, szStringPool + pRegOp->uImm.dwStringPoolPos); \
+    }                                                                           \
+} NULL
+
+/* 切换调用环境，更新局部变量的基址 */
+#define setRegCallEnv(pEnv) {                                           \
+    pCallEnv = (pEnv);                                                  \
+    pArrRegBase[1] = pCallEnv ? pCallEnv->pArrLocalVars : NULL;         \
+} NULL
+
+/* 获取变量中的数组 */
+#define getRegArray(pArray, pVar) {                 \
+    if ((pVar)->iType == RT_VALUE_ARRAY) {          \
+        pArray = (pVar)->uData.pArray;              \
+    }                                               \
+    else {                                          \
+        returnRegExecError(RUNTIME_NOT_ARRAY);      \
+    }                                               \
+} NULL
+
+/* 值移动到 pRtDst，原位置置为 nil */
+#define moveRtValueTo(pRtDst, pRtSrc) {             \
+    releaseRtValue(pMachine, pRtDst);                         \
+    *(pRtDst) = *(pRtSrc);                          \
+    (pRtSrc)->iType = RT_VALUE_NIL;                 \
+} NULL
+
+/*
+ * 寄存器字节码的执行循环，从 pRegOpCodeCur 开始执行
+ * 没有操作数栈，指令直接读写变量和临时寄存器，
+ * 临时寄存器中的值在被 MOVE / ARR_SET / CALL_FUNC 使用时直接转移所有权
+ */
+static RuntimeExecStatus machineExecuteRegister(
+    KbVirtualMachine*   pMachine,
+    KDword              dwBudget,
+    RuntimeErrorId*     pIntRtErrId,
+    const OpCode**      ppStopOpCode
+) {
+    int                 iNumOpCode      = pMachine->pBinHeader->dwNumOpCode;
+    const RegOpCode*    pRegOpStart     = (const RegOpCode *)(pMachine->pByteRaw + pMachine->pBinHeader->dwOpCodeBlockStart);
+    const RegOpCode*    pRegOpEnd       = pRegOpStart + iNumOpCode;
+    const RegOpCode*    pRegOp          = pMachine->pRegOpCodeCur;
+    KDword              dwStatStart     = pMachine->dwStatOpCodes;
+    const char*         szStringPool    = (const char *)pMachine->pByteRaw + pMachine->pBinHeader->dwStringPoolStart;
+    CallEnv*            pCallEnv        = NULL;
+    RtValue*            pArrRegBase[2];     /* 全局变量和局部变量的基址，下标为操作数种类 */
+    RtValue             sRtImm;
+    RtValue             sRtTemp;
+    RtValue             sRtNumeric;         /* 数值运算的结果，不持有资源 */
+
+    sRtImm.iType = sRtTemp.iType = RT_VALUE_NIL;
+    pArrRegBase[0] = pMachine->pArrGlobalVars;
+
+    setRegCallEnv(getTopCallEnv());
+
+    while (pRegOp >= pRegOpStart && pRegOp < pRegOpEnd) {
+        pMachine->dwStatOpCodes++;
+        profileOpCode(pRegOp - pRegOpStart, pRegOp->bOpCodeId);
+        switch (pRegOp->bOpCodeId) {
+            default: {
+                returnRegExecError(RUNTIME_UNKNOWN_OPCODE);
+            }
+            case K_REG_OPCODE_MOVE: {
+                RtValue* pRtSrc;
+                RtValue* pRtDst;
+                getRegOperand(pRtSrc, pRegOp->wSrcA);
+                getRegOperand(pRtDst, pRegOp->wDst);
+                /* 临时寄存器的值直接转移，其他值取引用 */
+                if (pRegOp->bOperatorId) {
+                    moveRtValueTo(&sRtTemp, pRtSrc);
+                } else {
+                    setRefRtValue(&sRtTemp, pRtSrc);
+                }
+                moveRtValueTo(pRtDst, &sRtTemp);
+                break;
+            }
+            case K_REG_OPCODE_BINARY_OPERATOR: {
+                RtValue*        pRtLeft;
+                RtValue*        pRtRight;
+                RtValue*        pRtDst;
+                RuntimeErrorId  iRtErrId;
+                getRegOperand(pRtLeft, pRegOp->wSrcA);
+                getRegOperand(pRtRight, pRegOp->wSrcB);
+                getRegOperand(pRtDst, pRegOp->wDst);
+                /* 数值运算的结果不需要释放，算完直接覆盖目标 */
+                if (calcNumericOperator(pRegOp->bOperatorId, pRtLeft, pRtRight, &sRtNumeric)) {
+                    if (!isNumericRtValue(pRtDst)) {
+                        releaseRtValue(pMachine, pRtDst);
                     }
+                    *pRtDst = sRtNumeric;
+                    break;
+                }
+                iRtErrId = calcBinaryOperator(pMachine, pRegOp->bOperatorId, pRtLeft, pRtRight, &sRtTemp);
+                if (iRtErrId != RUNTIME_NONE) {
+                    returnRegExecError(iRtErrId);
+                }
+                moveRtValueTo(pRtDst, &sRtTemp);
+                break;
+            }
+            case K_REG_OPCODE_UNARY_OPERATOR: {
+                RtValue*        pRtOperand;
+                RtValue*        pRtDst;
+                RuntimeErrorId  iRtErrId;
+                getRegOperand(pRtOperand, pRegOp->wSrcA);
+                getRegOperand(pRtDst, pRegOp->wDst);
+                iRtErrId = calcUnaryOperator(pRegOp->bOperatorId, pRtOperand, &sRtTemp);
+                if (iRtErrId != RUNTIME_NONE) {
+                    returnRegExecError(iRtErrId);
+                }
+                moveRtValueTo(pRtDst, &sRtTemp);
+                break;
+            }
+            case K_REG_OPCODE_SET_VAR_AS_ARRAY: {
+                RtValue*    pRtSize;
+                RtValue*    pVar;
+                int         iArraySize;
+                getRegOperand(pRtSize, pRegOp->wSrcA);
+                getRegOperand(pVar, pRegOp->wDst);
+                if (!isNumericRtValue(pRtSize)) {
+                    returnRegExecError(RUNTIME_TYPE_MISMATCH);
+                }
+                iArraySize = getRtValueAsInt(pRtSize);
+                if (iArraySize <= 0) {
+                    returnRegExecError(RUNTIME_ARRAY_INVALID_SIZE);
+                }
+                releaseRtValue(pMachine, pVar);
+                if (!setArrayRtValue(pMachine, pVar, iArraySize)) {
+                    returnRegExecError(RUNTIME_MEMORY_LIMIT);
+                }
+                break;
+            }
+            case K_REG_OPCODE_ARR_GET: {
+                RtValue*        pVar;
+                RtValue*        pRtIndex;
+                RtValue*        pRtDst;
+                RuntimeArray*   pArray;
+                int             iSubscript;
+                getRegOperand(pVar, pRegOp->wSrcA);
+                getRegArray(pArray, pVar);
+                getRegOperand(pRtIndex, pRegOp->wSrcB);
+                if (!isNumericRtValue(pRtIndex)) {
+                    returnRegExecError(RUNTIME_TYPE_MISMATCH);
+                }
+                iSubscript = getRtValueAsInt(pRtIndex);
+                if (iSubscript < 0 || iSubscript >= pArray->iSize) {
+                    returnRegExecError(RUNTIME_ARRAY_OUT_OF_BOUNDS);
+                }
+                getRegOperand(pRtDst, pRegOp->wDst);
+                /* 和栈虚拟机一样，读取的是数组元素的引用 */
+                getRtArrayElement(&sRtTemp, pArray, iSubscript);
+                moveRtValueTo(pRtDst, &sRtTemp);
+                break;
+            }
+            case K_REG_OPCODE_ARR_SET: {
+                RtValue*        pVar;
+                RtValue*        pRtIndex;
+                RtValue*        pRtValue;
+                RuntimeArray*   pArray;
+                int             iSubscript;
+                getRegOperand(pVar, pRegOp->wDst);
+                getRegArray(pArray, pVar);
+                getRegOperand(pRtIndex, pRegOp->wSrcA);
+                if (!isNumericRtValue(pRtIndex)) {
+                    returnRegExecError(RUNTIME_TYPE_MISMATCH);
+                }
+                iSubscript = getRtValueAsInt(pRtIndex);
+                if (iSubscript < 0 || iSubscript >= pArray->iSize) {
+                    returnRegExecError(RUNTIME_ARRAY_OUT_OF_BOUNDS);
+                }
+                getRegOperand(pRtValue, pRegOp->wSrcB);
+                /* 类型相同的数字直接写入紧凑数组 */
+                if (pArray->pArrIntegers && pRtValue->iType == RT_VALUE_INTEGER) {
+                    pArray->pArrIntegers[iSubscript] = pRtValue->uData.iNumber;
+                    break;
+                }
+                if (pArray->pArrNumbers && pRtValue->iType == RT_VALUE_NUMBER) {
+                    pArray->pArrNumbers[iSubscript] = pRtValue->uData.fNumber;
+                    break;
+                }
+                if (pRegOp->bOperatorId) {
+                    moveRtValueTo(&sRtTemp, pRtValue);
+                } else {
+                    setRefRtValue(&sRtTemp, pRtValue);
+                }
+                if (!moveRtValueToArray(pMachine, pArray, iSubscript, &sRtTemp)) {
+                    returnRegExecError(RUNTIME_MEMORY_LIMIT);
                 }
-
-                cleanUpOperands();
                 break;
             }
-            case K_OPCODE_POP: {
-                if (pMachine->pStackOperand->size <= 0) {
-                    returnExecError(RUNTIME_STACK_UNDERFLOW);
+            case K_REG_OPCODE_CALL_BUILT_IN: {
+                RtValue*        pRtArg = &sRtImm;
+                RtValue*        pRtDst;
+                RuntimeErrorId  iRtErrId;
+                if (getBuiltInFuncNumParams(pRegOp->bOperatorId) > 0) {
+                    getRegOperand(pRtArg, pRegOp->wSrcA);
                 }
-                destroyRtValue(vlPopBack(pMachine->pStackOperand));
+                iRtErrId = callBuiltInFunc(pMachine, pRegOp->bOperatorId, pRtArg, &sRtTemp);
+                if (iRtErrId != RUNTIME_NONE) {
+                    returnRegExecError(iRtErrId);
+                }
+                getRegOperand(pRtDst, pRegOp->wDst);
+                moveRtValueTo(pRtDst, &sRtTemp);
                 break;
             }
-            case K_OPCODE_PUSH_VAR: {
-                RtValue** pPtrVar = NULL;
-                getVariable(pPtrVar);
-                vlPushBack(pMachine->pStackOperand, createRefRtValue(*pPtrVar));
+            case K_REG_OPCODE_CALL_EXT: {
+                RtValue*        pArrArgs;
+                RtValue*        pRtDst;
+                RuntimeErrorId  iRtErrId;
+                int             i;
+                /* 参数在连续的临时寄存器中，回调直接读取 */
+                getRegOperand(pArrArgs, pRegOp->wSrcA);
+                iRtErrId = callExtFunc(pMachine, pRegOp->uImm.dwExtFuncIndex, pArrArgs, &sRtTemp);
+                if (iRtErrId != RUNTIME_NONE) {
+                    returnRegExecError(iRtErrId);
+                }
+                for (i = 0; i < (int)pMachine->pArrExtFuncInfo[pRegOp->uImm.dwExtFuncIndex].dwNumParams; ++i) {
+                    releaseRtValue(pMachine, pArrArgs + i);
+                }
+                getRegOperand(pRtDst, pRegOp->wDst);
+                moveRtValueTo(pRtDst, &sRtTemp);
                 break;
             }
-            case K_OPCODE_SET_VAR: {
-                RtValue** pPtrVar = NULL;
-                /* 获取变量指针 */
-                getVariable(pPtrVar);
-                /* 弹出栈顶的值 */
-                popRtValue(pRtOperandLeft);
-                /* 释放变量旧值 */
-                destroyRtValue(*pPtrVar);
-                /* 出栈的值写入变量位置 */
-                *pPtrVar = pRtOperandLeft;
-                /* 不释放弹出的值 */
-                pRtOperandLeft = NULL;
-                break;
+            case K_REG_OPCODE_GOTO: {
+                regJumpTo(pRegOpStart + pRegOp->uImm.dwOpCodePos);
             }
-            case K_OPCODE_SET_VAR_AS_ARRAY: {
-                RtValue** pPtrVar = NULL;
-                int iArraySize = 0;
-                /* 获取变量指针 */
-                getVariable(pPtrVar);
-                /* 弹出数组尺寸 */
-                popRtValue(pRtOperandLeft);
-                /* 检查尺寸是否是数值 */
-                checkRtValueTypeIs(pRtOperandLeft, RT_VALUE_NUMBER);
-                /* 检查尺寸是否合法 */
-                iArraySize = (int)pRtOperandLeft->uData.fNumber;
-                if (iArraySize <= 0) {
-                    returnExecError(RUNTIME_ARRAY_INVALID_SIZE);
+            case K_REG_OPCODE_IF_GOTO:
+            case K_REG_OPCODE_UNLESS_GOTO: {
+                RtValue*    pRtCondition;
+                KBool       bCondition;
+                getRegOperand(pRtCondition, pRegOp->wSrcA);
+                bCondition = canBeConsideredAsTrue(pRtCondition);
+                if (bCondition == (pRegOp->bOpCodeId == K_REG_OPCODE_IF_GOTO)) {
+                    regJumpTo(pRegOpStart + pRegOp->uImm.dwOpCodePos);
                 }
-                /* 释放弹出的值 */
-                cleanUpOperands();
-                /* 创建的数组写入变量 */
-                *pPtrVar = createArrayRtValue(iArraySize);
                 break;
             }
-            case K_OPCODE_ARR_GET: {
-                RtValue**       pPtrVar = NULL;
-                int             iSubscript;
-                RuntimeArray*   pArray;
-                /* 获取变量指针 */
-                getVariable(pPtrVar);
-                /* 变量是数组 */
-                if ((*pPtrVar)->iType == RT_VALUE_ARRAY) {
-                    pArray = &(*pPtrVar)->uData.sArray;
-                }
-                /* 变量是数组引用 */
-                else if ((*pPtrVar)->iType == RT_VALUE_ARRAY_REF) {
-                    pArray = (*pPtrVar)->uData.pArrRef;
-                }
-                /* 变量不是数组 */
-                else {
-                    returnExecError(RUNTIME_NOT_ARRAY);
-                }
-                /* 弹出下标 */
-                popRtValue(pRtOperandLeft);
-                /* 检查下标是否是数值 */
-                checkRtValueTypeIs(pRtOperandLeft, RT_VALUE_NUMBER);
-                /* 检查下标是否合法 */
-                iSubscript = (int)pRtOperandLeft->uData.fNumber;
-                if (iSubscript < 0 || iSubscript >= pArray->iSize) {
-                    returnExecError(RUNTIME_ARRAY_OUT_OF_BOUNDS);
+            case K_REG_OPCODE_CMP_UNLESS_GOTO: {
+                RtValue*        pRtLeft;
+                RtValue*        pRtRight;
+                RuntimeErrorId  iRtErrId;
+                KBool           bCondition;
+                getRegOperand(pRtLeft, pRegOp->wSrcA);
+                getRegOperand(pRtRight, pRegOp->wSrcB);
+                if (calcNumericOperator(pRegOp->bOperatorId, pRtLeft, pRtRight, &sRtNumeric)) {
+                    if (!isNumericRtValueTrue(&sRtNumeric)) {
+                        regJumpTo(pRegOpStart + pRegOp->wDst);
+                    }
+                    break;
+                }
+                iRtErrId = calcBinaryOperator(pMachine, pRegOp->bOperatorId, pRtLeft, pRtRight, &sRtTemp);
+                if (iRtErrId != RUNTIME_NONE) {
+                    returnRegExecError(iRtErrId);
+                }
+                bCondition = canBeConsideredAsTrue(&sRtTemp);
+                releaseRtValue(pMachine, &sRtTemp);
+                if (!bCondition) {
+                    regJumpTo(pRegOpStart + pRegOp->wDst);
                 }
-                /* 释放弹出的值 */
-                cleanUpOperands();
-                /* 数组元素入栈 */
-                vlPushBack(pMachine->pStackOperand, createRefRtValue(pArray->pArrPtrElements[iSubscript]));
                 break;
             }
-            case K_OPCODE_ARR_SET: {
-                RtValue**       pPtrVar = NULL;
-                int             iSubscript;
-                RuntimeArray*   pArray;
-                /* 获取变量指针 */
-                getVariable(pPtrVar);
-                /* 变量是数组 */
-                if ((*pPtrVar)->iType == RT_VALUE_ARRAY) {
-                    pArray = &(*pPtrVar)->uData.sArray;
-                }
-                /* 变量是数组引用 */
-                else if ((*pPtrVar)->iType == RT_VALUE_ARRAY_REF) {
-                    pArray = (*pPtrVar)->uData.pArrRef;
-                }
-                /* 变量不是数组 */
-                else {
-                    returnExecError(RUNTIME_NOT_ARRAY);
-                }
-                /* 弹出右值 */
-                popRtValue(pRtOperandRight);
-                /* 弹出下标 */
-                popRtValue(pRtOperandLeft);
-                /* 检查下标是否是数值 */
-                checkRtValueTypeIs(pRtOperandLeft, RT_VALUE_NUMBER);
-                /* 检查下标是否合法 */
-                iSubscript = (int)pRtOperandLeft->uData.fNumber;
-                if (iSubscript < 0 || iSubscript >= pArray->iSize) {
-                    returnExecError(RUNTIME_ARRAY_OUT_OF_BOUNDS);
-                }
-                /* 释放数组元素旧值 */
-                destroyRtValue(pArray->pArrPtrElements[iSubscript]);
-                /* 出栈的值赋值给数组元素 */
-                pArray->pArrPtrElements[iSubscript] = pRtOperandRight;
-                /* 不释放右值，已经赋值给元素了 */
-                pRtOperandRight = NULL;
-                /* 释放弹出的值 */
-                cleanUpOperands();
-                break;
+            case K_REG_OPCODE_CALL_FUNC: {
+                const BinFuncInfo*  pFuncInfo = pMachine->pArrFuncInfo + pRegOp->uImm.dwFuncIndex;
+                RuntimeErrorId      iRtErrId;
+                CallEnv*            pCallEnvNew = pushCallEnv(pMachine, pRegOp - pRegOpStart, pFuncInfo, &iRtErrId);
+                int                 i;
+                if (!pCallEnvNew) {
+                    returnRegExecError(iRtErrId);
+                }
+                /* 参数从调用者的连续临时寄存器转移到新的调用环境，调用者的局部变量基址不受帧栈扩容影响 */
+                for (i = 0; i < pCallEnvNew->iNumParams; ++i) {
+                    RtValue* pRtArg;
+                    getRegOperand(pRtArg, pRegOp->wSrcA + i);
+                    moveRtValueTo(pCallEnvNew->pArrLocalVars + i, pRtArg);
+                }
+                profileCall(pRegOp->uImm.dwFuncIndex);
+                setRegCallEnv(pCallEnvNew);
+                regJumpTo(pRegOpStart + pFuncInfo->dwOpCodePos);
             }
-            case K_OPCODE_CALL_BUILT_IN: {
-                switch (pOpCode->uParam.dwBuiltFuncId) {
-                    default: {
-                        returnExecError(RUNTIME_UNKNOWN_BUILT_IN_FUNC);
-                    }
-                    case KBUILT_IN_FUNC_P: {
-                        const char* szStringified;
-                        KBool bNeedDispose;
-                        /* 弹出要打印的值 */
-                        popRtValue(pRtOperandLeft);
-                        /* 字符串化 */
-                        szStringified = stringifyRtValue(pRtOperandLeft, &bNeedDispose);
-                        printf("%s", szStringified);
-                        /* 释放临时字符串 */
-                        if (bNeedDispose) free((void *)szStringified);
-                        /* 释放弹出的值 */
-                        cleanUpOperands();
-                        /* 添加返回值 0 */
-                        pushNumericOperand(0);
-                        break; 
-                    }
-                    case KBUILT_IN_FUNC_SIN: {
-                        callMathFunc(sinf);
-                        break;
-                    }
-                    case KBUILT_IN_FUNC_COS: {
-                        callMathFunc(cosf);
-                        break;
-                    }
-                    case KBUILT_IN_FUNC_TAN: {
-                        callMathFunc(tanf);
-                        break;
-                    }
-                    case KBUILT_IN_FUNC_SQRT: {
-                        callMathFunc(sqrtf);
-                        break;
-                    }
-                    case KBUILT_IN_FUNC_EXP: {
-                        callMathFunc(expf);
-                        break;
-                    }
-                    case KBUILT_IN_FUNC_ABS: {
-                        callMathFunc(fabsf);
-                        break;
-                    }
-                    case KBUILT_IN_FUNC_LOG: {
-                        callMathFunc(logf);
-                        break;
-                    }
-                    case KBUILT_IN_FUNC_FLOOR: {
-                        callMathFunc(floorf);
-                        break;
-                    }
-                    case KBUILT_IN_FUNC_CEIL: {
-                        callMathFunc(ceilf);
-                        break;
-                    }
-                    case KBUILT_IN_FUNC_RAND: {
-                        const int iMax = 10000;
-                        const int iRandVal = rand() % iMax;
-                        fResult = ((KFloat)iRandVal) / ((KFloat) iMax);
-                        pushNumericOperand(fResult);
-                        break;
-                    }
-                    case KBUILT_IN_FUNC_LEN: {
-                        int iLength = 0;
-                        /* 弹出需要求长度的值 */
-                        popRtValue(pRtOperandLeft);
-                        /* 根据不同类型计算长度 */
-                        switch (pRtOperandLeft->iType) {
-                            default:
-                                returnExecError(RUNTIME_TYPE_MISMATCH);
-                                break;
-                            case RT_VALUE_ARRAY:
-                                iLength = pRtOperandLeft->uData.sArray.iSize;
-                                break;
-                            case RT_VALUE_ARRAY_REF:
-                                iLength = pRtOperandLeft->uData.pArrRef->iSize;
-                                break;
-                            case RT_VALUE_STRING:
-                                iLength = strlen(pRtOperandLeft->uData.sString.uContent.pReadOnly);
-                                break;
-                        }
-                        /* 清理弹出的值 */
-                        cleanUpOperands(); 
-                        /* 长度入栈 */
-                        pushNumericOperand(iLength);
-                        break;
-                    }
-                    case KBUILT_IN_FUNC_VAL: {
-                        /* 弹出字符串 */
-                        popRtValue(pRtOperandLeft);
-                        /* 检查是不是字符串 */
-                        checkRtValueTypeIs(pRtOperandLeft, RT_VALUE_STRING);
-                        /* 转换为数值 */
-                        fResult = (KFloat)Atof(pRtOperandLeft->uData.sString.uContent.pReadOnly);
-                        /* 释放弹出的值 */
-                        cleanUpOperands();
-                        /* 转换的数值入栈 */
-                        pushNumericOperand(fResult);
-                        break;
-                    }
-                    case KBUILT_IN_FUNC_CHR: {
-                        char szAscStr[] = { 0, 0 };
-                        /* 弹出要要转为字符串的 ASCII 值 */
-                        popRtValue(pRtOperandLeft);
-                        /* 检查是否是数值 */
-                        checkRtValueTypeIs(pRtOperandLeft, RT_VALUE_NUMBER);
-                        /* 转为字符串 */
-                        szAscStr[0] = (int)pRtOperandLeft->uData.fNumber;
-                        /* 释放弹出的值 */
-                        cleanUpOperands();
-                        /* 生成的字符串作为返回值 */
-                        vlPushBack(pMachine->pStackOperand, createStringRtValue(StringDump(szAscStr)));
-                        break; 
-                    }
-                    case KBUILT_IN_FUNC_ASC: {
-                        /* 弹出字符串 */
-                        popRtValue(pRtOperandLeft);
-                        /* 检查是否是字符串 */
-                        checkRtValueTypeIs(pRtOperandLeft, RT_VALUE_STRING);
-                        /* 字符串第一个字符转数字 */
-                        fResult = pRtOperandLeft->uData.sString.uContent.pReadOnly[0];
-                        /* 释放弹出的值 */
-                        cleanUpOperands();
-                        /* 生成的字符串作为返回值 */
-                        pushNumericOperand(fResult);
-                        break; 
-                    }
+            case K_REG_OPCODE_RETURN: {
+                const RegOpCode*    pRegOpCall;
+                RtValue*            pRtValue;
+                RtValue*            pRtDst;
+                if (!pCallEnv) {
+                    returnRegExecError(RUNTIME_NOT_IN_USER_FUNC);
                 }
+                getRegOperand(pRtValue, pRegOp->wSrcA);
+                /* 返回值持有自己的引用，局部变量销毁后仍然有效 */
+                setRefRtValue(&sRtTemp, pRtValue);
+                /* 调用帧出栈，回到调用者 */
+                pRegOpCall = pRegOpStart + pCallEnv->iPrevOpCodePos;
+                popCallEnv(pMachine);
+                setRegCallEnv(getTopCallEnv());
+                /* 返回值写入调用指令的目标寄存器 */
+                pRegOp = pRegOpCall;
+                getRegOperand(pRtDst, pRegOpCall->wDst);
+                moveRtValueTo(pRtDst, &sRtTemp);
                 break;
             }
-            case K_OPCODE_GOTO: {
-                pMachine->pOpCodeCur = pOpCodeStart + pOpCode->uParam.dwOpCodePos;
-                continue;
-            }
-            case K_OPCODE_IF_GOTO: {
-                KBool bCondition = KB_FALSE;
-                /* 弹出条件值 */
-                popRtValue(pRtOperandLeft);
-                /* 条件值能否被视为 True */
-                bCondition = canBeConsideredAsTrue(pRtOperandLeft);
-                /* 释放条件值 */
-                cleanUpOperands();
-                /* 跳转 */
-                if (bCondition) {
-                    pMachine->pOpCodeCur = pOpCodeStart + pOpCode->uParam.dwOpCodePos;
-                    continue;
+            case K_REG_OPCODE_STOP: {
+                RtValue* pRtValue;
+                getRegOperand(pRtValue, pRegOp->wSrcA);
+                if (!isNumericRtValue(pRtValue)) {
+                    returnRegExecError(RUNTIME_TYPE_MISMATCH);
+                }
+                pMachine->iStopValue = getRtValueAsInt(pRtValue);
+                return RT_EXEC_DONE;
+            }
+            case K_REG_OPCODE_YIELD: {
+                RtValue* pRtValue;
+                getRegOperand(pRtValue, pRegOp->wSrcA);
+                if (!isNumericRtValue(pRtValue)) {
+                    returnRegExecError(RUNTIME_TYPE_MISMATCH);
+                }
+                pMachine->iYieldValue = getRtValueAsInt(pRtValue);
+                pMachine->pRegOpCodeCur = pRegOp + 1;
+                pMachine->bSuspended = KB_TRUE;
+                return RT_EXEC_YIELDED;
+            }
+        }
+        pRegOp++;
+    }
+
+    return RT_EXEC_DONE;
+}
+
+/*
+ * 指令分派方式:
+ *  - GCC / Clang 下使用标签地址表 (computed goto)，每条指令执行完直接跳到下一条指令的处理代码
+ *  - 严格 C89 的平台 (如 _FX_9860_) 或定义了 KB_NO_COMPUTED_GOTO 时使用 switch 分派
+ */
+#if defined(__GNUC__) && !defined(_FX_9860_) && !defined(KB_NO_COMPUTED_GOTO)
+#define KB_RT_COMPUTED_GOTO
+#endif
+
+#ifdef KB_RT_COMPUTED_GOTO
+
+/* 和 switch 分派一样，带检查的执行循环在每次分派前检查 opCode 位置 */
+#define vmDispatch() {                                          \
+    if (vmUnverified(pMachine->pOpCodeCur - pOpCodeStart >= iNumOpCode)) { \
+        goto vm_end;                                            \
+    }                                                           \
+    pOpCode = pMachine->pOpCodeCur;                             \
+    pMachine->dwStatOpCodes++;                                  \
+    profileOpCode(pOpCode - pOpCodeStart, pOpCode->dwOpCodeId); \
+    if (vmUnverified(pOpCode->dwOpCodeId >= K_NUM_OPCODE)) {    \
+        goto vm_default;                                        \
+    }                                                           \
+    goto *pArrOpCodeLabels[pOpCode->dwOpCodeId];                \
+} NULL
+
+#define vmLoopBegin     vmDispatch(); {
+#define vmLoopEnd       } vm_end:
+#define vmCase(id)      vm_##id:
+#define vmDefault       vm_default:
+#define vmNext          { pMachine->pOpCodeCur++; vmDispatch(); } NULL
+#define vmJump          vmDispatch()
+
+#else
+
+#define vmLoopBegin                                                     \
+    while (!vmUnverified(pMachine->pOpCodeCur - pOpCodeStart >= iNumOpCode)) {\
+        pOpCode = pMachine->pOpCodeCur;                                 \
+        pMachine->dwStatOpCodes++;                                      \
+        profileOpCode(pOpCode - pOpCodeStart, pOpCode->dwOpCodeId);     \
+        switch (pOpCode->dwOpCodeId) {
+#define vmLoopEnd       } pMachine->pOpCodeCur++; }
+#define vmCase(id)      case id:
+#define vmDefault       default:
+#define vmNext          break
+#define vmJump          continue
+
+#endif
+
+/*
+ * 跳转后检查指令预算，用完则挂起，下次从 pOpCodeCur 继续
+ * 只在跳转时检查，顺序执行的一段指令不会被打断
+ * 挂起统一跳到循环后面处理，各处的分派代码保持精简
+ */
+#define vmJumpChecked {                                                 \
+    if (dwBudget && pMachine->dwStatOpCodes - dwStatStart >= dwBudget) {\
+        goto vm_suspend;                                                \
+    }                                                                   \
+    vmJump;                                                             \
+} NULL
+
+/*
+ * 加速指令: 栈顶两个值是同一种数字并且对应的条件成立时，直接在栈上计算，结果写入 pRtTop[-2]
+ * 否则还原为 BINARY_OPERATOR 重新分派，由通用实现处理混合类型、其他类型、整数溢出和报错
+ */
+#define vmQuickBinary(bIntValid, intResult, bFloatValid, floatResult) {    \
+    RtValue* pRtTop = pMachine->pStackOperand + pMachine->iStackTop;    \
+    if (!vmUnverified(pMachine->iStackTop < 2) && pRtTop[-2].iType == pRtTop[-1].iType) { \
+        if (pRtTop[-1].iType == RT_VALUE_INTEGER) {                     \
+            iLeft = pRtTop[-2].uData.iNumber;                           \
+            iRight = pRtTop[-1].uData.iNumber;                          \
+            if (bIntValid) {                                            \
+                intResult;                                              \
+                pMachine->iStackTop--;                                  \
+                vmNext;                                                 \
+            }                                                           \
+        }                                                               \
+        else if (pRtTop[-1].iType == RT_VALUE_NUMBER) {                 \
+            fLeft = pRtTop[-2].uData.fNumber;                           \
+            fRight = pRtTop[-1].uData.fNumber;                          \
+            if (bFloatValid) {                                          \
+                floatResult;                                            \
+                pMachine->iStackTop--;                                  \
+                vmNext;                                                 \
+            }                                                           \
+        }                                                               \
+    }                                                                   \
+    ((OpCode *)pOpCode)->dwOpCodeId = K_OPCODE_BINARY_OPERATOR;         \
+    vmJump;                                                             \
+} NULL
+
+/* 结果类型和操作数相同的算术运算 */
+#define vmQuickArith(bIntValid, iExpr, bFloatValid, fExpr)             \
+    vmQuickBinary(bIntValid, pRtTop[-2].uData.iNumber = (iExpr), bFloatValid, pRtTop[-2].uData.fNumber = (fExpr))
+
+/* 比较的结果总是整数 */
+#define vmQuickCompare(opr)                                             \
+    vmQuickBinary(KB_TRUE, pRtTop[-2].uData.iNumber = iLeft opr iRight, KB_TRUE, setIntegerRtValue(pRtTop - 2, fLeft opr fRight))
+
+/* 整数除法不能整除时结果是浮点数 */
+#define setQuickQuotient(pRtResult) {                                   \
+    if (iLeft % iRight == 0) {                                          \
+        (pRtResult)->uData.iNumber = iLeft / iRight;                    \
+    } else {                                                            \
+        setNumericRtValue(pRtResult, (KFloat)iLeft / (KFloat)iRight);   \
+    }                                                                   \
+} NULL
+
+/* 栈字节码的执行循环，校验过的字节码使用去掉检查的实例 */
+#include "krt_loop.h"
+#define KB_RT_LOOP_UNCHECKED
+#include "krt_loop.h"
+#undef KB_RT_LOOP_UNCHECKED
+
+/* 从当前位置继续执行，dwBudget 为 0 时不限制指令数 */
+static RuntimeExecStatus machineContinue(
+    KbVirtualMachine*   pMachine,
+    KDword              dwBudget,
+    RuntimeErrorId*     pIntRtErrId,
+    const OpCode**      ppStopOpCode
+) {
+    RuntimeExecStatus iStatus;
+
+    *pIntRtErrId = RUNTIME_NONE;
+    *ppStopOpCode = NULL;
+    pMachine->bSuspended = KB_FALSE;
+
+    /* 寄存器字节码由寄存器虚拟机执行 */
+    if (K_IS_REG_BINARY(pMachine->pBinHeader)) {
+        iStatus = machineExecuteRegister(pMachine, dwBudget, pIntRtErrId, ppStopOpCode);
+    } else if (pMachine->bRunUnchecked) {
+        iStatus = machineExecuteStackUnchecked(pMachine, dwBudget, pIntRtErrId, ppStopOpCode);
+    } else {
+        iStatus = machineExecuteStack(pMachine, dwBudget, pIntRtErrId, ppStopOpCode);
+    }
+    profileFinish();
+    return iStatus;
+}
+
+/*
+ * 从 iStartPos 开始执行，执行的指令数达到 dwBudget 后在下一次跳转时挂起
+ * 挂起后用 KRuntime_MachineResume 继续，dwBudget 为 0 时不限制指令数
+ */
+RuntimeExecStatus KRuntime_MachineExecuteBudget(
+    KbVirtualMachine*   pMachine,
+    int                 iStartPos,
+    KDword              dwBudget,
+    RuntimeErrorId*     pIntRtErrId,
+    const OpCode**      ppStopOpCode
+) {
+    *pIntRtErrId = RUNTIME_NONE;
+    *ppStopOpCode = NULL;
+    pMachine->iStopValue = 0;
+    pMachine->iYieldValue = 0;
+    pMachine->bSuspended = KB_FALSE;
+
+    if (iStartPos < 0 || iStartPos >= (int)pMachine->pBinHeader->dwNumOpCode) {
+        return RT_EXEC_DONE;
+    }
+
+    /* 校验从主程序入口开始，只有从 0 开始执行时校验的结论才成立，挂起后恢复沿用同一个执行循环 */
+    pMachine->bRunUnchecked = pMachine->bVerified && iStartPos == 0;
+
+    machineOpCodePosReset(pMachine);
+    if (K_IS_REG_BINARY(pMachine->pBinHeader)) {
+        pMachine->pRegOpCodeCur = (const RegOpCode *)pMachine->pOpCodeCur + iStartPos;
+    } else {
+        pMachine->pOpCodeCur += iStartPos;
+    }
+    return machineContinue(pMachine, dwBudget, pIntRtErrId, ppStopOpCode);
+}
+
+/* 继续执行挂起或 yield 的虚拟机，没有挂起时直接返回 RT_EXEC_DONE */
+RuntimeExecStatus KRuntime_MachineResume(
+    KbVirtualMachine*   pMachine,
+    KDword              dwBudget,
+    RuntimeErrorId*     pIntRtErrId,
+    const OpCode**      ppStopOpCode
+) {
+    if (!pMachine->bSuspended) {
+        *pIntRtErrId = RUNTIME_NONE;
+        *ppStopOpCode = NULL;
+        return RT_EXEC_DONE;
+    }
+    return machineContinue(pMachine, dwBudget, pIntRtErrId, ppStopOpCode);
+}
+
+KBool KRuntime_MachineExecute(
+    KbVirtualMachine*   pMachine,
+    int                 iStartPos,
+    RuntimeErrorId*     pIntRtErrId,
+    const OpCode**      ppStopOpCode
+) {
+    RuntimeExecStatus iStatus = KRuntime_MachineExecuteBudget(pMachine, iStartPos, 0, pIntRtErrId, ppStopOpCode);
+    /* 一次执行到结束，yield 不交还控制权 */
+    while (iStatus == RT_EXEC_YIELDED) {
+        iStatus = machineContinue(pMachine, 0, pIntRtErrId, ppStopOpCode);
+    }
+    return iStatus != RT_EXEC_ERROR;
+}
+
+/* ------------------------------------------------------------ */
+/*                            快照                              */
+/* ------------------------------------------------------------ */
+
+/*
+ * 快照的布局: 文件头、字符串缓冲区表、根值 (全局变量、操作数栈、调用帧)、数组表
+ * 字符串和数组按编号引用，共享和循环引用恢复后保持不变；数字按本机字节序保存
+ */
+typedef struct {
+    KByte   bMagic[4];
+    KDword  dwVersion;
+    KDword  dwImageHash;        /* 字节码的哈希值，只能恢复到同一份字节码创建的虚拟机 */
+    KDword  dwFlags;
+    KDword  dwOpCodePos;        /* 挂起时下一条要执行的指令 */
+    int     iStopValue;
+    int     iYieldValue;
+    KDword  dwRandState;
+    KDword  dwNumGlobals;
+    KDword  dwStackTop;
+    KDword  dwNumCallEnv;
+    KDword  dwNumStrings;
+    KDword  dwNumArrays;
+} SnapshotHeader;
+
+#define SNAPSHOT_FLAG_SUSPENDED     0x1
+#define SNAPSHOT_FLAG_UNCHECKED     0x2
+
+/* 字符串值的缓冲区编号为 0 表示常量池中的字符串，否则是字符串表中的下标 + 1 */
+#define SNAPSHOT_STATIC_STRING      0
+
+/* 数组的存储方式 */
+#define SNAPSHOT_ARRAY_INTEGERS     0
+#define SNAPSHOT_ARRAY_NUMBERS      1
+#define SNAPSHOT_ARRAY_ELEMENTS     2
+
+static const KByte SNAPSHOT_MAGIC[4] = { 'k', 'b', 's', 'n' };
+
+/* 字节码的 FNV-1a 哈希值，范围是文件头到字符串常量池的末尾 */
+static KDword getImageHash(const Machine* pMachine) {
+    const KByte*    pByte   = pMachine->pByteRaw;
+    const KByte*    pEnd    = pByte + pMachine->pBinHeader->dwStringPoolStart + pMachine->pBinHeader->dwStringPoolLength;
+    KDword          dwHash  = 2166136261u;
+    while (pByte < pEnd) {
+        dwHash = (dwHash ^ *pByte++) * 16777619u;
+    }
+    return dwHash;
+}
+
+/* 只追加的缓冲区 */
+typedef struct {
+    KByte*  pBuf;
+    KDword  dwSize;
+    KDword  dwCapacity;
+} SnapshotBuffer;
+
+static void snapshotWrite(SnapshotBuffer* pBuffer, const void* pData, KDword dwSize) {
+    if (dwSize == 0) {
+        return;
+    }
+    if (pBuffer->dwSize + dwSize > pBuffer->dwCapacity) {
+        KDword dwNewCapacity = pBuffer->dwCapacity ? pBuffer->dwCapacity * 2 : 256;
+        while (dwNewCapacity < pBuffer->dwSize + dwSize) {
+            dwNewCapacity *= 2;
+        }
+        pBuffer->pBuf = (KByte *)realloc(pBuffer->pBuf, dwNewCapacity);
+        pBuffer->dwCapacity = dwNewCapacity;
+    }
+    memcpy(pBuffer->pBuf + pBuffer->dwSize, pData, dwSize);
+    pBuffer->dwSize += dwSize;
+}
+
+#define snapshotWriteDword(pBuffer, dwValue) {              \
+    KDword dwWritten = (KDword)(dwValue);                   \
+    snapshotWrite(pBuffer, &dwWritten, sizeof(KDword));     \
+} NULL
+
+#define snapshotWriteByte(pBuffer, bValue) {                \
+    KByte bWritten = (KByte)(bValue);                       \
+    snapshotWrite(pBuffer, &bWritten, 1);                   \
+} NULL
+
+/* 指针到编号的映射，开放寻址，pArrOrder 按编号保存指针 */
+typedef struct {
+    const void**    pArrKeys;
+    int*            pArrIds;
+    int             iCapacity;      /* 2 的幂 */
+    int             iCount;
+    const void**    pArrOrder;
+} SnapshotPtrMap;
+
+static void initSnapshotPtrMap(SnapshotPtrMap* pMap) {
+    pMap->iCapacity = 64;
+    pMap->iCount    = 0;
+    pMap->pArrKeys  = (const void **)calloc(pMap->iCapacity, sizeof(void *));
+    pMap->pArrIds   = (int *)malloc(sizeof(int) * pMap->iCapacity);
+    pMap->pArrOrder = (const void **)malloc(sizeof(void *) * pMap->iCapacity);
+}
+
+static void freeSnapshotPtrMap(SnapshotPtrMap* pMap) {
+    free((void *)pMap->pArrKeys);
+    free(pMap->pArrIds);
+    free((void *)pMap->pArrOrder);
+}
+
+static int getSnapshotPtrSlot(const SnapshotPtrMap* pMap, const void* pPointer) {
+    int iSlot = (int)(((size_t)pPointer >> 4) * 2654435761u) & (pMap->iCapacity - 1);
+    while (pMap->pArrKeys[iSlot] && pMap->pArrKeys[iSlot] != pPointer) {
+        iSlot = (iSlot + 1) & (pMap->iCapacity - 1);
+    }
+    return iSlot;
+}
+
+/* 返回指针的编号，第一次出现时分配新编号 */
+static int mapSnapshotPointer(SnapshotPtrMap* pMap, const void* pPointer) {
+    int iSlot = getSnapshotPtrSlot(pMap, pPointer);
+    if (pMap->pArrKeys[iSlot]) {
+        return pMap->pArrIds[iSlot];
+    }
+    /* 负载超过一半时扩容，按编号顺序重新插入 */
+    if ((pMap->iCount + 1) * 2 > pMap->iCapacity) {
+        int i;
+        free((void *)pMap->pArrKeys);
+        free(pMap->pArrIds);
+        pMap->iCapacity *= 2;
+        pMap->pArrKeys  = (const void **)calloc(pMap->iCapacity, sizeof(void *));
+        pMap->pArrIds   = (int *)malloc(sizeof(int) * pMap->iCapacity);
+        pMap->pArrOrder = (const void **)realloc((void *)pMap->pArrOrder, sizeof(void *) * pMap->iCapacity);
+        for (i = 0; i < pMap->iCount; ++i) {
+            iSlot = getSnapshotPtrSlot(pMap, pMap->pArrOrder[i]);
+            pMap->pArrKeys[iSlot] = pMap->pArrOrder[i];
+            pMap->pArrIds[iSlot] = i;
+        }
+        iSlot = getSnapshotPtrSlot(pMap, pPointer);
+    }
+    pMap->pArrKeys[iSlot] = pPointer;
+    pMap->pArrIds[iSlot] = pMap->iCount;
+    pMap->pArrOrder[pMap->iCount] = pPointer;
+    return pMap->iCount++;
+}
+
+typedef struct {
+    const Machine*  pMachine;
+    SnapshotPtrMap  sStringMap;
+    SnapshotPtrMap  sArrayMap;
+} SnapshotWriter;
+
+static void writeSnapshotValue(SnapshotWriter* pWriter, SnapshotBuffer* pBuffer, const RtValue* pRtValue) {
+    snapshotWriteByte(pBuffer, pRtValue->iType);
+    switch (pRtValue->iType) {
+        case RT_VALUE_NUMBER:
+            snapshotWrite(pBuffer, &pRtValue->uData.fNumber, sizeof(KFloat));
+            break;
+        case RT_VALUE_INTEGER:
+            snapshotWrite(pBuffer, &pRtValue->uData.iNumber, sizeof(int));
+            break;
+        case RT_VALUE_STRING:
+            if (pRtValue->uData.sString.pRtString) {
+                snapshotWriteDword(pBuffer, mapSnapshotPointer(&pWriter->sStringMap, pRtValue->uData.sString.pRtString) + 1);
+            } else {
+                const char* szStringPool = (const char *)pWriter->pMachine->pByteRaw + pWriter->pMachine->pBinHeader->dwStringPoolStart;
+                snapshotWriteDword(pBuffer, SNAPSHOT_STATIC_STRING);
+                snapshotWriteDword(pBuffer, pRtValue->uData.sString.szContent - szStringPool);
+            }
+            snapshotWriteDword(pBuffer, pRtValue->uData.sString.iLength);
+            break;
+        case RT_VALUE_ARRAY:
+            snapshotWriteDword(pBuffer, mapSnapshotPointer(&pWriter->sArrayMap, pRtValue->uData.pArray));
+            break;
+        default:
+            break;
+    }
+}
+
+/*
+ * 保存虚拟机的快照，返回 malloc 分配的数据，由调用者 free
+ * 只能在虚拟机没有执行时 (创建后、挂起、yield 或结束后) 调用
+ */
+KByte* KRuntime_SaveSnapshot(KbVirtualMachine* pMachine, KDword* pDwSize) {
+    SnapshotHeader  sHeader;
+    SnapshotWriter  sWriter;
+    SnapshotBuffer  sValues     = { NULL, 0, 0 };
+    SnapshotBuffer  sArrays     = { NULL, 0, 0 };
+    SnapshotBuffer  sSnapshot   = { NULL, 0, 0 };
+    int             i, j;
+
+    sWriter.pMachine = pMachine;
+    initSnapshotPtrMap(&sWriter.sStringMap);
+    initSnapshotPtrMap(&sWriter.sArrayMap);
+
+    /* 根值 */
+    for (i = 0; i < (int)pMachine->pBinHeader->dwNumVariables; ++i) {
+        writeSnapshotValue(&sWriter, &sValues, pMachine->pArrGlobalVars + i);
+    }
+    for (i = 0; i < pMachine->iStackTop; ++i) {
+        writeSnapshotValue(&sWriter, &sValues, pMachine->pStackOperand + i);
+    }
+    for (i = 0; i < pMachine->iNumCallEnv; ++i) {
+        const CallEnv* pEnv = pMachine->pArrCallEnv + i;
+        snapshotWriteDword(&sValues, pEnv->iPrevOpCodePos);
+        for (j = 0; j < pEnv->iNumVar; ++j) {
+            writeSnapshotValue(&sWriter, &sValues, pEnv->pArrLocalVars + j);
+        }
+    }
+
+    /* 数组按编号写入，元素中新出现的数组追加到后面 */
+    for (i = 0; i < sWriter.sArrayMap.iCount; ++i) {
+        const RuntimeArray* pArray = (const RuntimeArray *)sWriter.sArrayMap.pArrOrder[i];
+        if (pArray->pArrIntegers) {
+            snapshotWriteByte(&sArrays, SNAPSHOT_ARRAY_INTEGERS);
+            snapshotWriteDword(&sArrays, pArray->iSize);
+            snapshotWrite(&sArrays, pArray->pArrIntegers, sizeof(int) * pArray->iSize);
+        } else if (pArray->pArrNumbers) {
+            snapshotWriteByte(&sArrays, SNAPSHOT_ARRAY_NUMBERS);
+            snapshotWriteDword(&sArrays, pArray->iSize);
+            snapshotWrite(&sArrays, pArray->pArrNumbers, sizeof(KFloat) * pArray->iSize);
+        } else {
+            snapshotWriteByte(&sArrays, SNAPSHOT_ARRAY_ELEMENTS);
+            snapshotWriteDword(&sArrays, pArray->iSize);
+            for (j = 0; j < pArray->iSize; ++j) {
+                writeSnapshotValue(&sWriter, &sArrays, pArray->pArrElements + j);
+            }
+        }
+    }
+
+    memcpy(sHeader.bMagic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+    sHeader.dwVersion       = KB_RT_SNAPSHOT_VERSION;
+    sHeader.dwImageHash     = getImageHash(pMachine);
+    sHeader.dwFlags         = (pMachine->bSuspended ? SNAPSHOT_FLAG_SUSPENDED : 0)
+                            | (pMachine->bRunUnchecked ? SNAPSHOT_FLAG_UNCHECKED : 0);
+    sHeader.dwOpCodePos     = 0;
+    if (pMachine->bSuspended) {
+        sHeader.dwOpCodePos = K_IS_REG_BINARY(pMachine->pBinHeader)
+            ? pMachine->pRegOpCodeCur - (const RegOpCode *)(pMachine->pByteRaw + pMachine->pBinHeader->dwOpCodeBlockStart)
+            : pMachine->pOpCodeCur - pMachine->pArrOpCodes;
+    }
+    sHeader.iStopValue      = pMachine->iStopValue;
+    sHeader.iYieldValue     = pMachine->iYieldValue;
+    sHeader.dwRandState     = pMachine->dwRandState;
+    sHeader.dwNumGlobals    = pMachine->pBinHeader->dwNumVariables;
+    sHeader.dwStackTop      = pMachine->iStackTop;
+    sHeader.dwNumCallEnv    = pMachine->iNumCallEnv;
+    sHeader.dwNumStrings    = sWriter.sStringMap.iCount;
+    sHeader.dwNumArrays     = sWriter.sArrayMap.iCount;
+    snapshotWrite(&sSnapshot, &sHeader, sizeof(SnapshotHeader));
+
+    /* 字符串缓冲区只保存已写入的部分，容量保留，恢复后仍然可以原地追加 */
+    for (i = 0; i < sWriter.sStringMap.iCount; ++i) {
+        const RtString* pRtString = (const RtString *)sWriter.sStringMap.pArrOrder[i];
+        snapshotWriteDword(&sSnapshot, pRtString->iCapacity);
+        snapshotWriteDword(&sSnapshot, pRtString->iLength);
+        snapshotWrite(&sSnapshot, pRtString->szBuf, pRtString->iLength);
+    }
+    snapshotWrite(&sSnapshot, sValues.pBuf, sValues.dwSize);
+    snapshotWrite(&sSnapshot, sArrays.pBuf, sArrays.dwSize);
+
+    free(sValues.pBuf);
+    free(sArrays.pBuf);
+    freeSnapshotPtrMap(&sWriter.sStringMap);
+    freeSnapshotPtrMap(&sWriter.sArrayMap);
+
+    *pDwSize = sSnapshot.dwSize;
+    return sSnapshot.pBuf;
+}
+
+/*
+ * 读取快照，pMachine 为 NULL 时只检查格式，不创建任何值
+ * 检查通过后再用同一份代码恢复，恢复的过程不会失败，虚拟机不会停在恢复了一半的状态
+ */
+typedef struct {
+    Machine*        pMachine;
+    const Machine*  pMachineTarget;
+    const KByte*    pCur;
+    const KByte*    pEnd;
+    KBool           bFailed;
+    SnapshotHeader  sHeader;
+    KDword*         pArrStringLengths;  /* 字符串缓冲区已写入的长度，检查字符串值的长度 */
+    RtString**      pArrStrings;
+    RuntimeArray**  pArrArrays;
+} SnapshotReader;
+
+static void snapshotRead(SnapshotReader* pReader, void* pData, KDword dwSize) {
+    if (pReader->bFailed || (KDword)(pReader->pEnd - pReader->pCur) < dwSize) {
+        pReader->bFailed = KB_TRUE;
+        memset(pData, 0, dwSize);
+        return;
+    }
+    memcpy(pData, pReader->pCur, dwSize);
+    pReader->pCur += dwSize;
+}
+
+static KDword snapshotReadDword(SnapshotReader* pReader) {
+    KDword dwValue;
+    snapshotRead(pReader, &dwValue, sizeof(KDword));
+    return dwValue;
+}
+
+/* 读取一个值，引用的字符串和数组增加引用计数 */
+static void readSnapshotValue(SnapshotReader* pReader, RtValue* pRtValue) {
+    const BinHeader*    pHeader = pReader->pMachineTarget->pBinHeader;
+    KByte               bType;
+    RtValue             sRtValue;
+
+    snapshotRead(pReader, &bType, 1);
+    sRtValue.iType = bType;
+    switch (bType) {
+        case RT_VALUE_NIL:
+            break;
+        case RT_VALUE_NUMBER:
+            snapshotRead(pReader, &sRtValue.uData.fNumber, sizeof(KFloat));
+            break;
+        case RT_VALUE_INTEGER:
+            snapshotRead(pReader, &sRtValue.uData.iNumber, sizeof(int));
+            break;
+        case RT_VALUE_STRING: {
+            KDword dwStringId = snapshotReadDword(pReader);
+            KDword dwPoolPos, dwLength;
+            if (dwStringId == SNAPSHOT_STATIC_STRING) {
+                dwPoolPos = snapshotReadDword(pReader);
+                dwLength = snapshotReadDword(pReader);
+                pReader->bFailed |= dwPoolPos >= pHeader->dwStringPoolLength
+                    || dwLength > pHeader->dwStringPoolLength - dwPoolPos;
+                sRtValue.uData.sString.pRtString = NULL;
+                sRtValue.uData.sString.szContent = (const char *)pReader->pMachineTarget->pByteRaw + pHeader->dwStringPoolStart + dwPoolPos;
+            } else {
+                dwLength = snapshotReadDword(pReader);
+                pReader->bFailed |= dwStringId > pReader->sHeader.dwNumStrings
+                    || dwLength > pReader->pArrStringLengths[dwStringId - 1];
+                if (pReader->pMachine && !pReader->bFailed) {
+                    sRtValue.uData.sString.pRtString = pReader->pArrStrings[dwStringId - 1];
+                    sRtValue.uData.sString.szContent = sRtValue.uData.sString.pRtString->szBuf;
                 }
+            }
+            sRtValue.uData.sString.iLength = dwLength;
+            break;
+        }
+        case RT_VALUE_ARRAY: {
+            KDword dwArrayId = snapshotReadDword(pReader);
+            pReader->bFailed |= dwArrayId >= pReader->sHeader.dwNumArrays;
+            if (pReader->pMachine && !pReader->bFailed) {
+                sRtValue.uData.pArray = pReader->pArrArrays[dwArrayId];
+            }
+            break;
+        }
+        default:
+            pReader->bFailed = KB_TRUE;
+            break;
+    }
+    if (!pReader->pMachine || pReader->bFailed) {
+        return;
+    }
+    *pRtValue = sRtValue;
+    if (bType == RT_VALUE_STRING && sRtValue.uData.sString.pRtString) {
+        sRtValue.uData.sString.pRtString->iRefCount++;
+    }
+    else if (bType == RT_VALUE_ARRAY) {
+        sRtValue.uData.pArray->iRefCount++;
+    }
+}
+
+/* 调用帧的返回位置必须是 CALL_FUNC 指令，返回被调用的函数，不是时返回 NULL */
+static const BinFuncInfo* getSnapshotCallee(const Machine* pMachine, KDword dwCallPos) {
+    KDword dwFuncIndex;
+    if (dwCallPos >= pMachine->pBinHeader->dwNumOpCode) {
+        return NULL;
+    }
+    if (K_IS_REG_BINARY(pMachine->pBinHeader)) {
+        const RegOpCode* pRegOp = (const RegOpCode *)(pMachine->pByteRaw + pMachine->pBinHeader->dwOpCodeBlockStart) + dwCallPos;
+        if (pRegOp->bOpCodeId != K_REG_OPCODE_CALL_FUNC) {
+            return NULL;
+        }
+        dwFuncIndex = pRegOp->uImm.dwFuncIndex;
+    } else {
+        if (pMachine->pArrOpCodes[dwCallPos].dwOpCodeId != K_OPCODE_CALL_FUNC) {
+            return NULL;
+        }
+        dwFuncIndex = pMachine->pArrOpCodes[dwCallPos].uParam.dwFuncIndex;
+    }
+    return dwFuncIndex < pMachine->pBinHeader->dwNumFunc ? pMachine->pArrFuncInfo + dwFuncIndex : NULL;
+}
+
+/*
+ * 读取快照的全部内容，文件头已经读入 pReader->sHeader
+ * 恢复时字符串和数组先按编号创建，读取值时增加引用计数，最后填入数组的内容
+ */
+static void readSnapshotBody(SnapshotReader* pReader) {
+    Machine*            pMachine    = pReader->pMachine;
+    const Machine*      pTarget     = pReader->pMachineTarget;
+    KDword              i, j;
+
+    /* 字符串缓冲区 */
+    for (i = 0; i < pReader->sHeader.dwNumStrings && !pReader->bFailed; ++i) {
+        KDword dwCapacity   = snapshotReadDword(pReader);
+        KDword dwLength     = snapshotReadDword(pReader);
+        pReader->bFailed |= dwLength > dwCapacity || dwCapacity > (KDword)INT_MAX - sizeof(RtString)
+            || dwLength > (KDword)(pReader->pEnd - pReader->pCur);
+        if (pReader->bFailed) {
+            break;
+        }
+        pReader->pArrStringLengths[i] = dwLength;
+        if (pMachine) {
+            RtString* pRtString = createRtString(pMachine, dwCapacity);
+            snapshotRead(pReader, pRtString->szBuf, dwLength);
+            pRtString->szBuf[dwLength] = '\0';
+            pRtString->iLength = dwLength;
+            pRtString->iRefCount = 0;
+            pReader->pArrStrings[i] = pRtString;
+        } else {
+            pReader->pCur += dwLength;
+        }
+    }
+
+    /* 数组先创建空的结构，引用计数由读取到的引用累计 */
+    if (pMachine) {
+        for (i = 0; i < pReader->sHeader.dwNumArrays; ++i) {
+            RuntimeArray* pArray = (RuntimeArray *)rtAlloc(pMachine, RT_MEM_ARRAY, sizeof(RuntimeArray));
+            pMachine->sMem.arrObjects[RT_MEM_ARRAY]++;
+            pArray->iRefCount       = 0;
+            pArray->iSize           = 0;
+            pArray->pArrIntegers    = NULL;
+            pArray->pArrNumbers     = NULL;
+            pArray->pArrElements    = NULL;
+            pReader->pArrArrays[i]  = pArray;
+        }
+    }
+
+    /* 全局变量和操作数栈 */
+    for (i = 0; i < pReader->sHeader.dwNumGlobals; ++i) {
+        readSnapshotValue(pReader, pMachine ? pMachine->pArrGlobalVars + i : NULL);
+    }
+    for (i = 0; i < pReader->sHeader.dwStackTop; ++i) {
+        readSnapshotValue(pReader, pMachine ? pMachine->pStackOperand + i : NULL);
+    }
+    if (pMachine) {
+        pMachine->iStackTop = pReader->sHeader.dwStackTop;
+    }
+
+    /* 调用帧，局部变量的个数由调用的函数决定 */
+    for (i = 0; i < pReader->sHeader.dwNumCallEnv && !pReader->bFailed; ++i) {
+        KDword              dwCallPos   = snapshotReadDword(pReader);
+        const BinFuncInfo*  pFuncInfo   = getSnapshotCallee(pTarget, dwCallPos);
+        CallEnv*            pEnv        = NULL;
+        RuntimeErrorId      iRtErrId;
+        if (!pFuncInfo) {
+            pReader->bFailed = KB_TRUE;
+            break;
+        }
+        if (pMachine) {
+            pEnv = pushCallEnv(pMachine, dwCallPos, pFuncInfo, &iRtErrId);
+        }
+        for (j = 0; j < pFuncInfo->dwNumVars; ++j) {
+            readSnapshotValue(pReader, pEnv ? pEnv->pArrLocalVars + j : NULL);
+        }
+    }
+
+    /* 数组的内容 */
+    for (i = 0; i < pReader->sHeader.dwNumArrays && !pReader->bFailed; ++i) {
+        RuntimeArray*   pArray  = pMachine ? pReader->pArrArrays[i] : NULL;
+        KByte           bKind;
+        KDword          dwSize;
+        snapshotRead(pReader, &bKind, 1);
+        dwSize = snapshotReadDword(pReader);
+        pReader->bFailed |= dwSize == 0 || dwSize > (KDword)INT_MAX / sizeof(RtValue);
+        if (pReader->bFailed) {
+            break;
+        }
+        if (bKind == SNAPSHOT_ARRAY_INTEGERS || bKind == SNAPSHOT_ARRAY_NUMBERS) {
+            /* 整数和浮点数都是 4 字节 */
+            KDword dwBytes = dwSize * sizeof(int);
+            if (dwBytes > (KDword)(pReader->pEnd - pReader->pCur)) {
+                pReader->bFailed = KB_TRUE;
                 break;
             }
-            case K_OPCODE_UNLESS_GOTO: {
-                KBool bCondition = KB_FALSE;
-                /* 弹出条件值 */
-                popRtValue(pRtOperandLeft);
-                /* 条件值能否被视为 True */
-                bCondition = canBeConsideredAsTrue(pRtOperandLeft);
-                /* 释放条件值 */
-                cleanUpOperands();
-                /* 跳转 */
-                if (!bCondition) {
-                    pMachine->pOpCodeCur = pOpCodeStart + pOpCode->uParam.dwOpCodePos;
-                    continue;
+            if (pArray) {
+                void* pStorage = rtAlloc(pMachine, RT_MEM_ARRAY, dwBytes);
+                snapshotRead(pReader, pStorage, dwBytes);
+                if (bKind == SNAPSHOT_ARRAY_INTEGERS) {
+                    pArray->pArrIntegers = (int *)pStorage;
+                } else {
+                    pArray->pArrNumbers = (KFloat *)pStorage;
                 }
+                pArray->iSize = dwSize;
+            } else {
+                pReader->pCur += dwBytes;
+            }
+        }
+        else if (bKind == SNAPSHOT_ARRAY_ELEMENTS) {
+            /* 每个元素至少占 1 字节，先检查剩余长度，避免按损坏的尺寸分配 */
+            if (dwSize > (KDword)(pReader->pEnd - pReader->pCur)) {
+                pReader->bFailed = KB_TRUE;
                 break;
             }
-            case K_OPCODE_CALL_FUNC: {
-                int                 i;
-                int                 iCurrentPos = pMachine->pOpCodeCur - pOpCodeStart;
-                const BinFuncInfo*  pFuncInfo   = pMachine->pArrFuncInfo + pOpCode->uParam.dwFuncIndex;
-                CallEnv*            pCallEnv    = createCallEnv(iCurrentPos, pFuncInfo);
-                
-                /* 新调用环境入调用环境栈 */
-                vlPushBack(pMachine->pStackCallEnv, pCallEnv);
-                
-                /* 操作数出栈作为函数调用的参数 */
-                for (i = 0; i < pCallEnv->iNumParams; ++i) {
-                    RtValue* pRtValue;
-                    popRtValue(pRtValue);
-                    pCallEnv->pArrPtrLocalVars[pCallEnv->iNumParams - 1 - i] = pRtValue;
-                }
-                
-                /* opCode 跳转 */
-                pMachine->pOpCodeCur = pOpCodeStart + pFuncInfo->dwOpCodePos;
-                continue;
-            }
-            case K_OPCODE_RETURN: {
-                CallEnv* pCallEnv;
-                if (pMachine->pStackCallEnv->size <= 0) {
-                    returnExecError(RUNTIME_NOT_IN_USER_FUNC);
-                }
-                pCallEnv = (CallEnv *)vlPopBack(pMachine->pStackCallEnv);
-
-                /* 回去原来的位置 */
-                pMachine->pOpCodeCur = pOpCodeStart + pCallEnv->iPrevOpCodePos + 1;
-
-                /* 销毁调用环境 */
-                destroyCallEnv(pCallEnv);
-                continue;
-            }
-            case K_OPCODE_STOP: {
-                /* 弹出停止数值 */
-                popRtValue(pRtOperandLeft);
-                /* 检查类型是否是数字 */
-                checkRtValueTypeIs(pRtOperandLeft, RT_VALUE_NUMBER);
-                /* 停止数值写入机器 */
-                pMachine->iStopValue = (int)pRtOperandLeft->uData.fNumber;
-                /* 释放弹出的值 */
-                cleanUpOperands();
-                /* 结束运行 */
-                return KB_TRUE;
+            if (pArray) {
+                pArray->pArrElements = (RtValue *)rtAlloc(pMachine, RT_MEM_ARRAY, sizeof(RtValue) * dwSize);
+                pArray->iSize = dwSize;
             }
+            for (j = 0; j < dwSize; ++j) {
+                readSnapshotValue(pReader, pArray ? pArray->pArrElements + j : NULL);
+            }
+        }
+        else {
+            pReader->bFailed = KB_TRUE;
+        }
+    }
+
+    pReader->bFailed |= pReader->pCur != pReader->pEnd;
+}
+
+/*
+ * 恢复的状态在校验过的字节码中是可以到达的状态时，才能继续使用去掉检查的执行循环:
+ * 每个调用帧的调用位置和当前位置属于正确的函数，操作数栈不少于各层调用累计的深度
+ */
+static KBool isRestoredStateVerified(const Machine* pMachine, int iPos) {
+    VerifyContext   sVerify;
+    int             iOwner = -1, iDepth = 0, i;
+    KBool           bValid = verifyStackOpCodes(pMachine, &sVerify);
+
+    for (i = 0; bValid && i < pMachine->iNumCallEnv; ++i) {
+        const CallEnv*  pEnv        = pMachine->pArrCallEnv + i;
+        int             iCallPos    = pEnv->iPrevOpCodePos;
+        bValid = sVerify.pArrDepth[iCallPos] >= 0 && sVerify.pArrOwner[iCallPos] == iOwner;
+        iDepth += sVerify.pArrDepth[iCallPos] - pEnv->iNumParams;
+        iOwner = pMachine->pArrOpCodes[iCallPos].uParam.dwFuncIndex;
+    }
+    bValid = bValid
+        && sVerify.pArrDepth[iPos] >= 0
+        && sVerify.pArrOwner[iPos] == iOwner
+        && pMachine->iStackTop >= iDepth + sVerify.pArrDepth[iPos];
+
+    freeVerifyContext(&sVerify);
+    return bValid;
+}
+
+/*
+ * 从快照恢复虚拟机的状态，不需要重新执行初始化代码
+ * 快照的版本或字节码的哈希值不一致、数据损坏时返回 KB_FALSE，虚拟机保持原样
+ * 拓展函数的绑定、栈深度限制、内存上限、arena 和统计数据不属于快照，保持虚拟机当前的设置
+ * 恢复时不检查内存上限，快照中的状态总是完整恢复，超过上限时之后的分配失败
+ */
+KBool KRuntime_RestoreSnapshot(KbVirtualMachine* pMachine, const KByte* pSnapshot, KDword dwSize) {
+    SnapshotReader  sReader;
+    KBool           bIsReg  = K_IS_REG_BINARY(pMachine->pBinHeader);
+    KDword          dwMemLimit = pMachine->sMem.dwLimit;
+    KDword          i;
+
+    sReader.pMachine        = NULL;
+    sReader.pMachineTarget  = pMachine;
+    sReader.pCur            = pSnapshot;
+    sReader.pEnd            = pSnapshot + dwSize;
+    sReader.bFailed         = KB_FALSE;
+    sReader.pArrStringLengths = NULL;
+    sReader.pArrStrings     = NULL;
+    sReader.pArrArrays      = NULL;
+    snapshotRead(&sReader, &sReader.sHeader, sizeof(SnapshotHeader));
+    if (sReader.bFailed ||
+        memcmp(sReader.sHeader.bMagic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0 ||
+        sReader.sHeader.dwVersion != KB_RT_SNAPSHOT_VERSION ||
+        sReader.sHeader.dwImageHash != getImageHash(pMachine) ||
+        sReader.sHeader.dwNumGlobals != pMachine->pBinHeader->dwNumVariables ||
+        sReader.sHeader.dwStackTop > (KDword)pMachine->iStackDepthMax ||
+        sReader.sHeader.dwNumCallEnv > (KDword)pMachine->iStackDepthMax ||
+        sReader.sHeader.dwOpCodePos >= pMachine->pBinHeader->dwNumOpCode ||
+        sReader.sHeader.dwNumStrings > dwSize / (2 * sizeof(KDword)) ||
+        sReader.sHeader.dwNumArrays > dwSize
+    ) {
+        return KB_FALSE;
+    }
+
+    /* 第一遍只检查格式，不改动虚拟机 */
+    sReader.pArrStringLengths = (KDword *)malloc(sizeof(KDword) * (sReader.sHeader.dwNumStrings + 1));
+    readSnapshotBody(&sReader);
+    if (sReader.bFailed) {
+        free(sReader.pArrStringLengths);
+        return KB_FALSE;
+    }
+
+    /* 第二遍丢弃当前的状态，按快照创建值 */
+    KRuntime_ResetMachine(pMachine);
+    pMachine->sMem.dwLimit = 0;
+    while (pMachine->iStackCapacity < (int)sReader.sHeader.dwStackTop && machineGrowStack(pMachine) == RUNTIME_NONE) {
+        /* 栈深度已经检查过不超过最大深度 */
+    }
+    sReader.pMachine    = pMachine;
+    sReader.pCur        = pSnapshot + sizeof(SnapshotHeader);
+    sReader.pArrStrings = (RtString **)malloc(sizeof(RtString *) * (sReader.sHeader.dwNumStrings + 1));
+    sReader.pArrArrays  = (RuntimeArray **)malloc(sizeof(RuntimeArray *) * (sReader.sHeader.dwNumArrays + 1));
+    readSnapshotBody(&sReader);
+
+    /* 没有被引用的字符串和数组直接释放 */
+    for (i = 0; i < sReader.sHeader.dwNumStrings; ++i) {
+        if (sReader.pArrStrings[i]->iRefCount == 0) {
+            releaseRtString(pMachine, sReader.pArrStrings[i]);
+        }
+    }
+    for (i = 0; i < sReader.sHeader.dwNumArrays; ++i) {
+        if (sReader.pArrArrays[i]->iRefCount == 0) {
+            releaseRtArray(pMachine, sReader.pArrArrays[i]);
         }
-        pMachine->pOpCodeCur++;
     }
+    free(sReader.pArrStringLengths);
+    free(sReader.pArrStrings);
+    free(sReader.pArrArrays);
+    pMachine->sMem.dwLimit = dwMemLimit;
 
+    pMachine->iStopValue    = sReader.sHeader.iStopValue;
+    pMachine->iYieldValue   = sReader.sHeader.iYieldValue;
+    pMachine->dwRandState   = sReader.sHeader.dwRandState;
+    pMachine->bSuspended    = (sReader.sHeader.dwFlags & SNAPSHOT_FLAG_SUSPENDED) != 0;
+    machineOpCodePosReset(pMachine);
+    if (bIsReg) {
+        pMachine->pRegOpCodeCur = (const RegOpCode *)pMachine->pOpCodeCur + sReader.sHeader.dwOpCodePos;
+    } else {
+        pMachine->pOpCodeCur += sReader.sHeader.dwOpCodePos;
+    }
+    pMachine->bRunUnchecked = pMachine->bVerified
+        && (sReader.sHeader.dwFlags & SNAPSHOT_FLAG_UNCHECKED)
+        && isRestoredStateVerified(pMachine, sReader.sHeader.dwOpCodePos);
     return KB_TRUE;
-}
\ No newline at end of file
+}
@@ -16,56 +16,193 @@ typedef enum tagRuntimeErrorId {
     RUNTIME_NOT_IN_USER_FUNC,
     RUNTIME_ARRAY_INVALID_SIZE,
     RUNTIME_ARRAY_OUT_OF_BOUNDS,
-    RUNTIME_NOT_ARRAY
+    RUNTIME_NOT_ARRAY,
+    RUNTIME_STACK_OVERFLOW,
+    RUNTIME_EXT_FUNC_UNBOUND,
+    RUNTIME_MEMORY_LIMIT
 } RuntimeErrorId;
 
+/* 虚拟机执行结果 */
+typedef enum tagRuntimeExecStatus {
+    RT_EXEC_ERROR = 0,      /* 运行时错误 */
+    RT_EXEC_DONE,           /* 正常结束 */
+    RT_EXEC_SUSPENDED,      /* 指令预算用完，可以继续执行 */
+    RT_EXEC_YIELDED         /* 脚本执行了 yield，可以继续执行 */
+} RuntimeExecStatus;
+
 typedef enum tagRuntimeValueTypeId {
     RT_VALUE_NIL = 0,
     RT_VALUE_NUMBER,
     RT_VALUE_STRING,
     RT_VALUE_ARRAY,
-    RT_VALUE_ARRAY_REF
+    RT_VALUE_INTEGER
 } RuntimeValueTypeId;
 
 struct tagKbRuntimeValue;
 
+/*
+ * 引用计数的数组，读取变量只增加引用计数，所有引用看到的是同一个数组
+ * 新数组使用紧凑的整数存储 pArrIntegers，存入浮点数时转换为 pArrNumbers，
+ * 存入其他类型的值时转换为 pArrElements，之后不再转换回去；三者同时只有一个不为 NULL
+ */
 typedef struct {
-    struct tagKbRuntimeValue** pArrPtrElements;
+    struct tagKbRuntimeValue* pArrElements;
+    KFloat* pArrNumbers;
+    int* pArrIntegers;
     int iSize;
+    int iRefCount;
 } KbRuntimeArray;
 
+/* 引用计数的字符串缓冲区，内容只追加不修改，多个字符串可以共享同一个缓冲区的不同前缀 */
+typedef struct tagKbRuntimeString {
+    int     iRefCount;
+    int     iLength;        /* 缓冲区中已写入的长度 */
+    int     iCapacity;      /* 缓冲区容量，不含结尾的 '\0' */
+    char    szBuf[1];       /* 实际分配 iCapacity + 1 字节 */
+} KbRuntimeString;
+
 typedef struct tagKbRuntimeValue {
     int iType;
     union {
         struct {
-            union {
-                const char* pReadOnly;
-                char* pReadWrite;
-            } uContent;
-            KBool bIsRef;
+            const char*         szContent;  /* 不一定以 '\0' 结尾，以 iLength 为准 */
+            KbRuntimeString*    pRtString;  /* 持有的缓冲区，常量池中的字符串为 NULL */
+            int                 iLength;
         } sString;
-        KbRuntimeArray  sArray;
-        KbRuntimeArray* pArrRef;
+        KbRuntimeArray* pArray;     /* 持有一个引用 */
         KFloat fNumber;
+        int iNumber;
     } uData;
 } KbRuntimeValue;
 
+/* 局部变量槽位的分段，分段分配后不会移动 */
+typedef struct tagKbFrameChunk {
+    struct tagKbFrameChunk* pNext;
+    int                     iCapacity;
+    int                     iTop;
+    KbRuntimeValue          arrSlots[1];    /* 实际分配 iCapacity 个 */
+} KbFrameChunk;
+
 typedef struct {
     int iPrevOpCodePos;
     int iNumVar;
     int iNumParams;
-    KbRuntimeValue** pArrPtrLocalVars;
+    KbRuntimeValue* pArrLocalVars;          /* 指向所在分段中的一段连续槽位 */
+    KbFrameChunk*   pChunk;                 /* 局部变量所在的分段 */
 } KbCallEnv;
 
+/*
+ * 运行时值的分配器配置
+ * 字符串缓冲区和数组从一整块内存中按大小分级分配，释放的块挂到同级的空闲链表中复用
+ */
+typedef struct {
+    void*   pBuffer;            /* 宿主提供的内存，NULL 时由虚拟机分配 */
+    KDword  dwSize;             /* 内存大小 (字节)，0 表示不使用 arena，直接 malloc */
+} KbArenaConfig;
+
+/*
+ * 放不下或者超过最大分级的分配退回到 malloc，没有退回的分配存活时，
+ * 重置和销毁虚拟机直接丢弃整块内存，不需要逐个释放值
+ */
+typedef struct {
+    KByte*  pBase;              /* 没有使用 arena 时为 NULL */
+    KByte*  pTop;               /* 还没有分配过的位置 */
+    KByte*  pEnd;
+    KBool   bOwned;             /* 内存是否由虚拟机分配 */
+    void*   arrFreeList[KB_RT_ARENA_NUM_CLASS];
+    KDword  dwUsed;             /* 当前已分配的字节数 (按分级大小) */
+    KDword  dwPeak;             /* 已分配字节数的最高值，用于决定 arena 的大小 */
+    KDword  dwNumFallback;      /* 退回到 malloc 的分配次数 */
+    int     iNumLiveFallback;   /* 退回到 malloc 并且还没有释放的分配 */
+} KbArena;
+
+/*
+ * 性能分析数据，只有定义了 KB_RT_PROFILE 编译的运行时才会收集
+ * 耗时的单位是计时器的 tick，x86 上是 CPU 周期
+ */
+typedef struct {
+    KDword* pArrOpCodeCount;    /* 按指令类型统计的执行次数 */
+    double* pArrOpCodeTicks;    /* 按指令类型统计的耗时 */
+    KDword* pArrPosCount;       /* 按指令位置统计的执行次数 */
+    double* pArrPosTicks;       /* 按指令位置统计的耗时 */
+    KDword* pArrFuncCalls;      /* 每个用户函数的调用次数 */
+    int     iLastPos;           /* 正在计时的指令位置，-1 表示没有 */
+    int     iLastOpCodeId;
+    double  fLastTick;
+} KbProfile;
+
+/* 运行时内存的分类 */
+typedef enum tagRuntimeMemKind {
+    RT_MEM_VALUE = 0,       /* 全局变量和操作数栈的槽位，数字直接保存在槽位中，没有单独的分配 */
+    RT_MEM_STRING,          /* 字符串缓冲区 */
+    RT_MEM_ARRAY,           /* 数组结构和元素存储 */
+    RT_MEM_FRAME,           /* 调用帧栈和局部变量分段 */
+    RT_MEM_NUM_KIND
+} RuntimeMemKind;
+
+/*
+ * 内存统计，字节数按申请的大小计算，不含 arena 分级取整和 malloc 的头部
+ * 对象数: 字符串缓冲区和数组各算一个，槽位和调用帧按分配的块计算
+ */
+typedef struct {
+    KDword  arrBytes[RT_MEM_NUM_KIND];      /* 各类当前占用的字节数 */
+    int     arrObjects[RT_MEM_NUM_KIND];    /* 各类当前存活的对象数 */
+    KDword  dwTotal;                        /* 所有分类的字节数之和 */
+    KDword  dwPeak;                         /* dwTotal 的最高值 */
+    KDword  dwLimit;                        /* dwTotal 的上限，0 表示不限制 */
+} KbMemStats;
+
+struct tagKbVirtualMachine;
+
+/*
+ * 拓展函数的宿主回调
+ * pArrArgs 直接指向操作数栈 (寄存器虚拟机中是连续的临时寄存器) 上的参数，只读，
+ * 整数参数在调用前已经转换为浮点数，回调只需要处理 RT_VALUE_NUMBER
+ * 返回值写入 pRtResult (初始为数字 0)，返回 RUNTIME_NONE 以外的值会中止执行
+ */
+typedef RuntimeErrorId (*KbExtFuncCallback)(
+    struct tagKbVirtualMachine* pMachine,
+    const KbRuntimeValue*       pArrArgs,
+    int                         iNumArgs,
+    KbRuntimeValue*             pRtResult,
+    void*                       pUserData
+);
+
+typedef struct {
+    KbExtFuncCallback   fnCallback;
+    void*               pUserData;
+} KbExtFuncBinding;
+
 typedef struct tagKbVirtualMachine {
     const KbBinaryHeader*       pBinHeader;
-    Vlist*                      pStackOperand;      /* <KbRuntimeValue> */
+    KbRuntimeValue*             pStackOperand;      /* 操作数栈，连续数组，值直接保存在栈上 */
+    int                         iStackTop;          /* 栈顶位置 (下一个空位) */
+    int                         iStackCapacity;     /* 当前已分配的容量 */
+    int                         iStackDepthMax;     /* 允许的最大深度 */
     const OpCode *              pOpCodeCur;
+    OpCode*                     pArrOpCodes;        /* 栈字节码指令的私有副本，运行时加速会改写，寄存器字节码为 NULL */
+    const KbRegOpCode*          pRegOpCodeCur;      /* 寄存器虚拟机出错或挂起时的指令 */
     const KByte*                pByteRaw;
-    KbRuntimeValue**            pArrPtrGlobalVars;
-    Vlist*                      pStackCallEnv;      /* <KbCallEnv> */
+    KbRuntimeValue*             pArrGlobalVars;
+    KbCallEnv*                  pArrCallEnv;        /* 调用帧栈，连续数组 */
+    int                         iNumCallEnv;        /* 当前调用深度 */
+    int                         iCallEnvCapacity;   /* 调用帧栈已分配的容量 */
+    KbFrameChunk*               pFrameChunkHead;    /* 局部变量的第一个分段 */
+    KbFrameChunk*               pFrameChunkCur;     /* 当前调用帧所在的分段 */
     const KbBinaryFunctionInfo* pArrFuncInfo;
+    const KbBinaryExtFuncInfo*  pArrExtFuncInfo;    /* 拓展函数表 */
+    KbExtFuncBinding*           pArrExtFuncBindings;/* 和拓展函数表一一对应的回调 */
     int                         iStopValue;
+    int                         iYieldValue;        /* 最近一次 yield 的值 */
+    KBool                       bSuspended;         /* 指令预算用完挂起，操作数栈和调用帧栈保持原样 */
+    KBool                       bVerified;          /* 栈字节码通过了加载时的校验 */
+    KBool                       bRunUnchecked;      /* 本次执行使用去掉检查的执行循环 */
+    KDword                      dwStatOpCodes;      /* 统计: 已执行的指令数 */
+    KDword                      dwStatAllocs;       /* 统计: 运行时堆分配次数 */
+    KbProfile*                  pProfile;           /* 性能分析数据，没有开启时为 NULL */
+    KbArena                     sArena;             /* 字符串和数组的分配器 */
+    KbMemStats                  sMem;               /* 内存统计和上限 */
+    KDword                      dwRandState;        /* rand() 内置函数的状态，每个虚拟机独立 */
 } KbVirtualMachine;
 
 const char*         KRuntimeValue_GetTypeNameById   (RuntimeValueTypeId iRtTypeId);
@@ -73,7 +210,32 @@ const char*         KRuntimeValue_Stringify         (KbRuntimeValue* pRtValue, K
 const char*         KRuntimeError_GetNameById       (RuntimeErrorId iRuntimeErrorId);
 const char*         KRuntimeError_GetMessageById    (RuntimeErrorId iRuntimeErrorId);
 KBool               KRuntime_MachineExecute         (KbVirtualMachine* pMachine, int iStartPos, RuntimeErrorId* pIntRtErrId, const OpCode** ppStopOpCode);
+RuntimeExecStatus   KRuntime_MachineExecuteBudget   (KbVirtualMachine* pMachine, int iStartPos, KDword dwBudget, RuntimeErrorId* pIntRtErrId, const OpCode** ppStopOpCode);
+RuntimeExecStatus   KRuntime_MachineResume          (KbVirtualMachine* pMachine, KDword dwBudget, RuntimeErrorId* pIntRtErrId, const OpCode** ppStopOpCode);
+/*
+ * 字节码在虚拟机中只读，同一份字节码可以被多个虚拟机 (包括不同线程中的) 共享，
+ * 需要在所有使用它的虚拟机销毁之后再释放；单个虚拟机同一时刻只能在一个线程中执行
+ */
 KbVirtualMachine*   KRuntime_CreateMachine          (const KByte* pSerializedRaw);
+KbVirtualMachine*   KRuntime_CreateMachineEx        (const KByte* pSerializedRaw, const KbArenaConfig* pArenaConfig);
+void                KRuntime_ResetMachine           (KbVirtualMachine* pMachine);
 void                KRuntime_DestroyMachine         (KbVirtualMachine* pMachine);
+void                KRuntime_SetStackDepthMax       (KbVirtualMachine* pMachine, int iDepthMax);
+void                KRuntime_SetRandSeed            (KbVirtualMachine* pMachine, KDword dwSeed);
+KBool               KRuntime_EnableProfile          (KbVirtualMachine* pMachine);
+KBool               KRuntime_BindExtFunc            (KbVirtualMachine* pMachine, int iCallId, KbExtFuncCallback fnCallback, void* pUserData);
+KBool               KRuntime_SetStringValue         (KbVirtualMachine* pMachine, KbRuntimeValue* pRtValue, const char* szContent, int iLength);
+/*
+ * 超过上限的分配失败，执行以 RUNTIME_MEMORY_LIMIT 结束；上限小于当前占用时之后的分配都会失败
+ * 创建虚拟机时的槽位和调用帧也计入统计
+ */
+void                KRuntime_SetMemoryLimit         (KbVirtualMachine* pMachine, KDword dwLimit);
+const KbMemStats*   KRuntime_GetMemStats            (const KbVirtualMachine* pMachine);
+/*
+ * 快照保存全局变量、操作数栈、调用帧、执行位置和随机数状态，绑定字节码的哈希值，
+ * 只能恢复到同一份字节码创建的虚拟机中；只能在虚拟机没有执行时保存和恢复
+ */
+KByte*              KRuntime_SaveSnapshot           (KbVirtualMachine* pMachine, KDword* pDwSize);
+KBool               KRuntime_RestoreSnapshot        (KbVirtualMachine* pMachine, const KByte* pSnapshot, KDword dwSize);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,517 @@
+/*
+ * 栈字节码的执行循环，由 krt.c 包含两次:
+ *  - 默认实例 machineExecuteStack 保留所有运行时检查，执行没有通过校验的字节码，
+ *    每次分派前检查 opCode 位置，跳到指令末尾之后时结束执行
+ *  - 定义了 KB_RT_LOOP_UNCHECKED 的实例 machineExecuteStackUnchecked 执行通过了加载时校验的字节码，
+ *    校验已经证明不会发生的错误 (栈下溢、函数外的 RETURN、未知指令、越过指令末尾) 不再检查
+ */
+#ifdef KB_RT_LOOP_UNCHECKED
+/* 条件只做类型检查，常量折叠后整个检查被去掉 */
+#define vmUnverified(bFailed)       (KB_FALSE && (bFailed))
+#define machineExecuteStackLoop     machineExecuteStackUnchecked
+#else
+#define vmUnverified(bFailed)       (bFailed)
+#define machineExecuteStackLoop     machineExecuteStack
+#endif
+
+/* 从 pOpCodeCur 开始执行 */
+static RuntimeExecStatus machineExecuteStackLoop(
+    KbVirtualMachine*   pMachine,
+    KDword              dwBudget,
+    RuntimeErrorId*     pIntRtErrId,
+    const OpCode**      ppStopOpCode
+) {
+    int             iNumOpCode          = pMachine->pBinHeader->dwNumOpCode;
+    const OpCode*   pOpCodeStart        = pMachine->pArrOpCodes;
+    const OpCode*   pOpCode             = NULL;
+    KDword          dwStatStart         = pMachine->dwStatOpCodes;
+    int             iLeft, iRight, iResult;
+    KFloat          fLeft, fRight;
+    RtValue         sRtLiteral;         /* 超级指令的字面量和数值运算结果，不持有资源 */
+    RtValue         sRtNumeric;
+    RtValue         sArrOperands[3];
+#ifdef KB_RT_COMPUTED_GOTO
+    /* 下标为 opCode Id，顺序必须和 OpCodeId 一致 */
+    static const void* const pArrOpCodeLabels[K_NUM_OPCODE] = {
+        &&vm_default,
+        &&vm_K_OPCODE_PUSH_NUM,
+        &&vm_K_OPCODE_PUSH_STR,
+        &&vm_K_OPCODE_BINARY_OPERATOR,
+        &&vm_K_OPCODE_UNARY_OPERATOR,
+        &&vm_K_OPCODE_POP,
+        &&vm_K_OPCODE_PUSH_VAR,
+        &&vm_K_OPCODE_SET_VAR,
+        &&vm_K_OPCODE_SET_VAR_AS_ARRAY,
+        &&vm_K_OPCODE_ARR_GET,
+        &&vm_K_OPCODE_ARR_SET,
+        &&vm_K_OPCODE_CALL_BUILT_IN,
+        &&vm_K_OPCODE_CALL_EXT,
+        &&vm_K_OPCODE_GOTO,
+        &&vm_K_OPCODE_IF_GOTO,
+        &&vm_K_OPCODE_UNLESS_GOTO,
+        &&vm_K_OPCODE_CALL_FUNC,
+        &&vm_K_OPCODE_RETURN,
+        &&vm_K_OPCODE_STOP,
+        &&vm_K_OPCODE_YIELD,
+        &&vm_K_OPCODE_PUSH_INT,
+        &&vm_K_OPCODE_VAR_NUM_BINOP,
+        &&vm_K_OPCODE_NUM_VAR_BINOP,
+        &&vm_K_OPCODE_VAR_VAR_BINOP,
+        &&vm_K_OPCODE_VAR_NUM_CMP_UNLESS_GOTO,
+        &&vm_K_OPCODE_NUM_VAR_CMP_UNLESS_GOTO,
+        &&vm_K_OPCODE_VAR_VAR_CMP_UNLESS_GOTO,
+        &&vm_K_OPCODE_INC_VAR,
+        &&vm_K_OPCODE_INT_VAR_BINOP,
+        &&vm_K_OPCODE_INT_VAR_CMP_UNLESS_GOTO,
+        &&vm_K_OPCODE_INC_VAR_INT,
+        &&vm_K_OPCODE_ADD_NUM_NUM,
+        &&vm_K_OPCODE_SUB_NUM_NUM,
+        &&vm_K_OPCODE_MUL_NUM_NUM,
+        &&vm_K_OPCODE_DIV_NUM_NUM,
+        &&vm_K_OPCODE_EQ_NUM_NUM,
+        &&vm_K_OPCODE_NEQ_NUM_NUM,
+        &&vm_K_OPCODE_GT_NUM_NUM,
+        &&vm_K_OPCODE_LT_NUM_NUM,
+        &&vm_K_OPCODE_GTEQ_NUM_NUM,
+        &&vm_K_OPCODE_LTEQ_NUM_NUM
+    };
+#endif
+
+    sArrOperands[0].iType = sArrOperands[1].iType = sArrOperands[2].iType = RT_VALUE_NIL;
+
+    vmLoopBegin
+        vmDefault {
+            returnExecError(RUNTIME_UNKNOWN_OPCODE);
+        }
+        vmCase(K_OPCODE_PUSH_NUM) {
+            pushNumericOperand(pOpCode->uParam.fLiteral);
+            vmNext;
+        }
+        vmCase(K_OPCODE_PUSH_INT) {
+            pushIntegerOperand(pOpCode->uParam.iLiteral);
+            vmNext;
+        }
+        vmCase(K_OPCODE_PUSH_STR) {
+            reserveRtValue();
+            setStaticStringRtValue(
+                pMachine->pStackOperand + pMachine->iStackTop++,
+                (const char *)pMachine->pBinHeader +
+                pMachine->pBinHeader->dwStringPoolStart +
+                pOpCode->uParam.dwStringPoolPos
+            );
+            vmNext;
+        }
+        vmCase(K_OPCODE_BINARY_OPERATOR) {
+            RuntimeErrorId iRtErrId;
+            popRtValue(pRtOperandRight);
+            popRtValue(pRtOperandLeft);
+            iRtErrId = calcBinaryOperator(pMachine, pOpCode->uParam.dwOperatorId, pRtOperandLeft, pRtOperandRight, pRtOperandResult);
+            if (iRtErrId != RUNTIME_NONE) {
+                returnExecError(iRtErrId);
+            }
+            /* 两边是同一种数字时改写为加速指令，下次执行跳过类型检查和运算符分派 */
+            if (isNumericRtValue(pRtOperandLeft) && pRtOperandLeft->iType == pRtOperandRight->iType) {
+                ((OpCode *)pOpCode)->dwOpCodeId = getQuickenedOpCodeId(pOpCode->uParam.dwOperatorId);
+            }
+            pushRtValue(pRtOperandResult);
+            cleanUpOperands();
+            vmNext;
+        }
+        vmCase(K_OPCODE_UNARY_OPERATOR) {
+            RuntimeErrorId iRtErrId;
+            popRtValue(pRtOperandLeft);
+            iRtErrId = calcUnaryOperator(pOpCode->uParam.dwOperatorId, pRtOperandLeft, pRtOperandResult);
+            if (iRtErrId != RUNTIME_NONE) {
+                returnExecError(iRtErrId);
+            }
+            pushRtValue(pRtOperandResult);
+            cleanUpOperands();
+            vmNext;
+        }
+        vmCase(K_OPCODE_POP) {
+            if (vmUnverified(pMachine->iStackTop <= 0)) {
+                returnExecError(RUNTIME_STACK_UNDERFLOW);
+            }
+            releaseRtValue(pMachine, pMachine->pStackOperand + (--pMachine->iStackTop));
+            vmNext;
+        }
+        vmCase(K_OPCODE_PUSH_VAR) {
+            RtValue* pVar = NULL;
+            getVariable(pVar);
+            pushVarRef(pVar);
+            vmNext;
+        }
+        vmCase(K_OPCODE_SET_VAR) {
+            RtValue* pVar = NULL;
+            /* 获取变量指针 */
+            getVariable(pVar);
+            /* 弹出栈顶的值 */
+            popRtValue(pRtOperandLeft);
+            /* 释放变量旧值 */
+            releaseRtValue(pMachine, pVar);
+            /* 出栈的值写入变量位置 */
+            *pVar = *pRtOperandLeft;
+            /* 不释放弹出的值 */
+            pRtOperandLeft->iType = RT_VALUE_NIL;
+            vmNext;
+        }
+        vmCase(K_OPCODE_SET_VAR_AS_ARRAY) {
+            RtValue* pVar = NULL;
+            int iArraySize = 0;
+            /* 获取变量指针 */
+            getVariable(pVar);
+            /* 弹出数组尺寸 */
+            popRtValue(pRtOperandLeft);
+            /* 检查尺寸是否是数值 */
+            checkRtValueIsNumeric(pRtOperandLeft);
+            /* 检查尺寸是否合法 */
+            iArraySize = getRtValueAsInt(pRtOperandLeft);
+            if (iArraySize <= 0) {
+                returnExecError(RUNTIME_ARRAY_INVALID_SIZE);
+            }
+            /* 释放弹出的值 */
+            cleanUpOperands();
+            /* 释放变量旧值，创建的数组写入变量 */
+            releaseRtValue(pMachine, pVar);
+            if (!setArrayRtValue(pMachine, pVar, iArraySize)) {
+                returnExecError(RUNTIME_MEMORY_LIMIT);
+            }
+            vmNext;
+        }
+        vmCase(K_OPCODE_ARR_GET) {
+            RtValue*        pVar = NULL;
+            int             iSubscript;
+            RuntimeArray*   pArray;
+            /* 获取变量指针 */
+            getVariable(pVar);
+            /* 变量是数组 */
+            if (pVar->iType == RT_VALUE_ARRAY) {
+                pArray = pVar->uData.pArray;
+            }
+            /* 变量不是数组 */
+            else {
+                returnExecError(RUNTIME_NOT_ARRAY);
+            }
+            /* 弹出下标 */
+            popRtValue(pRtOperandLeft);
+            /* 检查下标是否是数值 */
+            checkRtValueIsNumeric(pRtOperandLeft);
+            /* 检查下标是否合法 */
+            iSubscript = getRtValueAsInt(pRtOperandLeft);
+            if (iSubscript < 0 || iSubscript >= pArray->iSize) {
+                returnExecError(RUNTIME_ARRAY_OUT_OF_BOUNDS);
+            }
+            /* 释放弹出的值 */
+            cleanUpOperands();
+            /* 数组元素入栈 */
+            reserveRtValue();
+            getRtArrayElement(pMachine->pStackOperand + pMachine->iStackTop++, pArray, iSubscript);
+            vmNext;
+        }
+        vmCase(K_OPCODE_ARR_SET) {
+            RtValue*        pVar = NULL;
+            int             iSubscript;
+            RuntimeArray*   pArray;
+            /* 获取变量指针 */
+            getVariable(pVar);
+            /* 变量是数组 */
+            if (pVar->iType == RT_VALUE_ARRAY) {
+                pArray = pVar->uData.pArray;
+            }
+            /* 变量不是数组 */
+            else {
+                returnExecError(RUNTIME_NOT_ARRAY);
+            }
+            /* 弹出右值 */
+            popRtValue(pRtOperandRight);
+            /* 弹出下标 */
+            popRtValue(pRtOperandLeft);
+            /* 检查下标是否是数值 */
+            checkRtValueIsNumeric(pRtOperandLeft);
+            /* 检查下标是否合法 */
+            iSubscript = getRtValueAsInt(pRtOperandLeft);
+            if (iSubscript < 0 || iSubscript >= pArray->iSize) {
+                returnExecError(RUNTIME_ARRAY_OUT_OF_BOUNDS);
+            }
+            /* 出栈的值移动到数组元素，不释放右值；转换数组存储超过内存上限时右值仍在操作数中，随操作数释放 */
+            if (!moveRtValueToArray(pMachine, pArray, iSubscript, pRtOperandRight)) {
+                returnExecError(RUNTIME_MEMORY_LIMIT);
+            }
+            /* 释放弹出的值 */
+            cleanUpOperands();
+            vmNext;
+        }
+        vmCase(K_OPCODE_CALL_BUILT_IN) {
+            RuntimeErrorId iRtErrId;
+            /* 弹出参数 */
+            if (getBuiltInFuncNumParams(pOpCode->uParam.dwBuiltFuncId) > 0) {
+                popRtValue(pRtOperandLeft);
+            }
+            iRtErrId = callBuiltInFunc(pMachine, pOpCode->uParam.dwBuiltFuncId, pRtOperandLeft, pRtOperandResult);
+            if (iRtErrId != RUNTIME_NONE) {
+                returnExecError(iRtErrId);
+            }
+            /* 返回值入栈 */
+            pushRtValue(pRtOperandResult);
+            cleanUpOperands();
+            vmNext;
+        }
+        vmCase(K_OPCODE_CALL_EXT) {
+            RuntimeErrorId  iRtErrId;
+            int             iNumArgs = pMachine->pArrExtFuncInfo[pOpCode->uParam.dwExtFuncIndex].dwNumParams;
+            if (vmUnverified(pMachine->iStackTop < iNumArgs)) {
+                returnExecError(RUNTIME_STACK_UNDERFLOW);
+            }
+            /* 参数留在栈上，回调直接读取 */
+            iRtErrId = callExtFunc(
+                pMachine,
+                pOpCode->uParam.dwExtFuncIndex,
+                pMachine->pStackOperand + pMachine->iStackTop - iNumArgs,
+                pRtOperandResult
+            );
+            if (iRtErrId != RUNTIME_NONE) {
+                returnExecError(iRtErrId);
+            }
+            /* 参数出栈，返回值入栈 */
+            while (iNumArgs-- > 0) {
+                releaseRtValue(pMachine, pMachine->pStackOperand + (--pMachine->iStackTop));
+            }
+            pushRtValue(pRtOperandResult);
+            cleanUpOperands();
+            vmNext;
+        }
+        vmCase(K_OPCODE_GOTO) {
+            pMachine->pOpCodeCur = pOpCodeStart + pOpCode->uParam.dwOpCodePos;
+            vmJumpChecked;
+        }
+        vmCase(K_OPCODE_IF_GOTO) {
+            KBool bCondition = KB_FALSE;
+            /* 弹出条件值 */
+            popRtValue(pRtOperandLeft);
+            /* 条件值能否被视为 True */
+            bCondition = canBeConsideredAsTrue(pRtOperandLeft);
+            /* 释放条件值 */
+            cleanUpOperands();
+            /* 跳转 */
+            if (bCondition) {
+                pMachine->pOpCodeCur = pOpCodeStart + pOpCode->uParam.dwOpCodePos;
+                vmJumpChecked;
+            }
+            vmNext;
+        }
+        vmCase(K_OPCODE_UNLESS_GOTO) {
+            KBool bCondition = KB_FALSE;
+            /* 弹出条件值 */
+            popRtValue(pRtOperandLeft);
+            /* 条件值能否被视为 True */
+            bCondition = canBeConsideredAsTrue(pRtOperandLeft);
+            /* 释放条件值 */
+            cleanUpOperands();
+            /* 跳转 */
+            if (!bCondition) {
+                pMachine->pOpCodeCur = pOpCodeStart + pOpCode->uParam.dwOpCodePos;
+                vmJumpChecked;
+            }
+            vmNext;
+        }
+        vmCase(K_OPCODE_CALL_FUNC) {
+            int                 i;
+            int                 iCurrentPos = pMachine->pOpCodeCur - pOpCodeStart;
+            const BinFuncInfo*  pFuncInfo   = pMachine->pArrFuncInfo + pOpCode->uParam.dwFuncIndex;
+            /* 新调用帧入栈 */
+            RuntimeErrorId      iRtErrId;
+            CallEnv*            pCallEnv    = pushCallEnv(pMachine, iCurrentPos, pFuncInfo, &iRtErrId);
+
+            if (!pCallEnv) {
+                returnExecError(iRtErrId);
+            }
+
+            /* 操作数出栈作为函数调用的参数 */
+            for (i = 0; i < pCallEnv->iNumParams; ++i) {
+                RtValue* pRtParam = pCallEnv->pArrLocalVars + (pCallEnv->iNumParams - 1 - i);
+                popRtValue(pRtParam);
+            }
+
+            profileCall(pOpCode->uParam.dwFuncIndex);
+
+            /* opCode 跳转 */
+            pMachine->pOpCodeCur = pOpCodeStart + pFuncInfo->dwOpCodePos;
+            vmJumpChecked;
+        }
+        vmCase(K_OPCODE_RETURN) {
+            CallEnv* pCallEnv;
+            getCurrentCallEnv(pCallEnv);
+
+            /* 回去原来的位置 */
+            pMachine->pOpCodeCur = pOpCodeStart + pCallEnv->iPrevOpCodePos + 1;
+
+            /* 调用帧出栈 */
+            popCallEnv(pMachine);
+            vmJump;
+        }
+        vmCase(K_OPCODE_STOP) {
+            /* 弹出停止数值 */
+            popRtValue(pRtOperandLeft);
+            /* 检查类型是否是数字 */
+            checkRtValueIsNumeric(pRtOperandLeft);
+            /* 停止数值写入机器 */
+            pMachine->iStopValue = getRtValueAsInt(pRtOperandLeft);
+            /* 释放弹出的值 */
+            cleanUpOperands();
+            /* 结束运行 */
+            return RT_EXEC_DONE;
+        }
+        vmCase(K_OPCODE_YIELD) {
+            popRtValue(pRtOperandLeft);
+            checkRtValueIsNumeric(pRtOperandLeft);
+            pMachine->iYieldValue = getRtValueAsInt(pRtOperandLeft);
+            cleanUpOperands();
+            /* 操作数栈和调用帧原样保留，恢复时从下一条指令继续 */
+            pMachine->pOpCodeCur++;
+            pMachine->bSuspended = KB_TRUE;
+            return RT_EXEC_YIELDED;
+        }
+        /*
+         * 超级指令: pOpCode[1..3] 是融合前的原始指令
+         * 操作数不是数字等不能直接处理的情况，只执行第一条原始指令，
+         * 然后从第二条原始指令继续，结果和融合前一致
+         */
+        vmCase(K_OPCODE_VAR_NUM_BINOP) {
+            RtValue* pVar = NULL;
+            getVariable(pVar);
+            setLiteralRtValue(&sRtLiteral, pOpCode + 1, pOpCode[1].dwOpCodeId == K_OPCODE_PUSH_INT);
+            reserveRtValue();
+            if (calcNumericOperator(pOpCode[2].uParam.dwOperatorId, pVar, &sRtLiteral, pMachine->pStackOperand + pMachine->iStackTop)) {
+                pMachine->iStackTop++;
+                pMachine->pOpCodeCur += 3;
+                vmJump;
+            }
+            pushVarRef(pVar);
+            vmNext;
+        }
+        vmCase(K_OPCODE_NUM_VAR_BINOP)
+        vmCase(K_OPCODE_INT_VAR_BINOP) {
+            RtValue* pVar = NULL;
+            getVariableOf(pVar, pOpCode + 1);
+            setLiteralRtValue(&sRtLiteral, pOpCode, pOpCode->dwOpCodeId == K_OPCODE_INT_VAR_BINOP);
+            reserveRtValue();
+            if (calcNumericOperator(pOpCode[2].uParam.dwOperatorId, &sRtLiteral, pVar, pMachine->pStackOperand + pMachine->iStackTop)) {
+                pMachine->iStackTop++;
+                pMachine->pOpCodeCur += 3;
+                vmJump;
+            }
+            pushRtValue(&sRtLiteral);
+            vmNext;
+        }
+        vmCase(K_OPCODE_VAR_VAR_BINOP) {
+            RtValue* pVarLeft = NULL;
+            RtValue* pVarRight = NULL;
+            getVariable(pVarLeft);
+            getVariableOf(pVarRight, pOpCode + 1);
+            reserveRtValue();
+            if (calcNumericOperator(pOpCode[2].uParam.dwOperatorId, pVarLeft, pVarRight, pMachine->pStackOperand + pMachine->iStackTop)) {
+                pMachine->iStackTop++;
+                pMachine->pOpCodeCur += 3;
+                vmJump;
+            }
+            pushVarRef(pVarLeft);
+            vmNext;
+        }
+        vmCase(K_OPCODE_VAR_NUM_CMP_UNLESS_GOTO) {
+            RtValue* pVar = NULL;
+            getVariable(pVar);
+            setLiteralRtValue(&sRtLiteral, pOpCode + 1, pOpCode[1].dwOpCodeId == K_OPCODE_PUSH_INT);
+            if (calcNumericOperator(pOpCode[2].uParam.dwOperatorId, pVar, &sRtLiteral, &sRtNumeric)) {
+                if (isNumericRtValueTrue(&sRtNumeric)) {
+                    pMachine->pOpCodeCur += 4;
+                    vmJump;
+                }
+                pMachine->pOpCodeCur = pOpCodeStart + pOpCode[3].uParam.dwOpCodePos;
+                vmJumpChecked;
+            }
+            pushVarRef(pVar);
+            vmNext;
+        }
+        vmCase(K_OPCODE_NUM_VAR_CMP_UNLESS_GOTO)
+        vmCase(K_OPCODE_INT_VAR_CMP_UNLESS_GOTO) {
+            RtValue* pVar = NULL;
+            getVariableOf(pVar, pOpCode + 1);
+            setLiteralRtValue(&sRtLiteral, pOpCode, pOpCode->dwOpCodeId == K_OPCODE_INT_VAR_CMP_UNLESS_GOTO);
+            if (calcNumericOperator(pOpCode[2].uParam.dwOperatorId, &sRtLiteral, pVar, &sRtNumeric)) {
+                if (isNumericRtValueTrue(&sRtNumeric)) {
+                    pMachine->pOpCodeCur += 4;
+                    vmJump;
+                }
+                pMachine->pOpCodeCur = pOpCodeStart + pOpCode[3].uParam.dwOpCodePos;
+                vmJumpChecked;
+            }
+            pushRtValue(&sRtLiteral);
+            vmNext;
+        }
+        vmCase(K_OPCODE_VAR_VAR_CMP_UNLESS_GOTO) {
+            RtValue* pVarLeft = NULL;
+            RtValue* pVarRight = NULL;
+            getVariable(pVarLeft);
+            getVariableOf(pVarRight, pOpCode + 1);
+            if (calcNumericOperator(pOpCode[2].uParam.dwOperatorId, pVarLeft, pVarRight, &sRtNumeric)) {
+                if (isNumericRtValueTrue(&sRtNumeric)) {
+                    pMachine->pOpCodeCur += 4;
+                    vmJump;
+                }
+                pMachine->pOpCodeCur = pOpCodeStart + pOpCode[3].uParam.dwOpCodePos;
+                vmJumpChecked;
+            }
+            pushVarRef(pVarLeft);
+            vmNext;
+        }
+        vmCase(K_OPCODE_INC_VAR) {
+            RtValue* pVar = NULL;
+            getVariableOf(pVar, pOpCode + 1);
+            if (isNumericRtValue(pVar)) {
+                setNumericRtValue(pVar, pOpCode->uParam.fLiteral + getRtValueAsFloat(pVar));
+                pMachine->pOpCodeCur += 4;
+                vmJump;
+            }
+            pushNumericOperand(pOpCode->uParam.fLiteral);
+            vmNext;
+        }
+        vmCase(K_OPCODE_INC_VAR_INT) {
+            RtValue* pVar = NULL;
+            getVariableOf(pVar, pOpCode + 1);
+            /* 整数溢出时按原始指令执行，由 ADD 提升为浮点数 */
+            if (pVar->iType == RT_VALUE_INTEGER &&
+                addIntegerChecked(pOpCode->uParam.iLiteral, pVar->uData.iNumber, iResult)
+            ) {
+                pVar->uData.iNumber = iResult;
+                pMachine->pOpCodeCur += 4;
+                vmJump;
+            }
+            if (pVar->iType == RT_VALUE_NUMBER) {
+                pVar->uData.fNumber = (KFloat)pOpCode->uParam.iLiteral + pVar->uData.fNumber;
+                pMachine->pOpCodeCur += 4;
+                vmJump;
+            }
+            pushIntegerOperand(pOpCode->uParam.iLiteral);
+            vmNext;
+        }
+        vmCase(K_OPCODE_ADD_NUM_NUM)    vmQuickArith(addIntegerChecked(iLeft, iRight, iResult), iResult, KB_TRUE, fLeft + fRight);
+        vmCase(K_OPCODE_SUB_NUM_NUM)    vmQuickArith(subIntegerChecked(iLeft, iRight, iResult), iResult, KB_TRUE, fLeft - fRight);
+        vmCase(K_OPCODE_MUL_NUM_NUM)    vmQuickArith(mulIntegerChecked(iLeft, iRight, &iResult), iResult, KB_TRUE, fLeft * fRight);
+        vmCase(K_OPCODE_DIV_NUM_NUM)    vmQuickBinary(isIntegerDivisible(iLeft, iRight), setQuickQuotient(pRtTop - 2), fRight != 0, pRtTop[-2].uData.fNumber = fLeft / fRight);
+        vmCase(K_OPCODE_EQ_NUM_NUM)     vmQuickCompare(==);
+        vmCase(K_OPCODE_NEQ_NUM_NUM)    vmQuickCompare(!=);
+        vmCase(K_OPCODE_GT_NUM_NUM)     vmQuickCompare(>);
+        vmCase(K_OPCODE_LT_NUM_NUM)     vmQuickCompare(<);
+        vmCase(K_OPCODE_GTEQ_NUM_NUM)   vmQuickCompare(>=);
+        vmCase(K_OPCODE_LTEQ_NUM_NUM)   vmQuickCompare(<=);
+    vmLoopEnd
+
+    return RT_EXEC_DONE;
+
+vm_suspend:
+    pMachine->bSuspended = KB_TRUE;
+    return RT_EXEC_SUSPENDED;
+}
+
+#undef machineExecuteStackLoop
+#undef vmUnverified
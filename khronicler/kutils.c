@@ -107,6 +107,74 @@ void vlDestroy(Vlist* _self, void (* releaseData)(void *)) {
     free(_self);
 }
 
+/* FNV-1a */
+KDword vhStringHash(const char* key) {
+    KDword hash = 2166136261u;
+    while (*key) {
+        hash = (hash ^ (KByte)*key++) * 16777619u;
+    }
+    return hash;
+}
+
+Vhash* vhNewHash() {
+    Vhash *h = (Vhash *)malloc(sizeof(Vhash));
+    h->capacity = 16;
+    h->size = 0;
+    h->entries = (VhashEntry *)calloc(h->capacity, sizeof(VhashEntry));
+    return h;
+}
+
+/* 开放寻址，线性探测，容量总是 2 的幂 */
+static VhashEntry* vhFindEntry(VhashEntry* entries, int capacity, const char* key, KDword hash) {
+    int i = (int)(hash & (KDword)(capacity - 1));
+    while (entries[i].key != NULL) {
+        if (entries[i].hash == hash && strcmp(entries[i].key, key) == 0) {
+            break;
+        }
+        i = (i + 1) & (capacity - 1);
+    }
+    return entries + i;
+}
+
+void* vhGet(const Vhash* _self, const char* key) {
+    return vhFindEntry(_self->entries, _self->capacity, key, vhStringHash(key))->data;
+}
+
+Vhash* vhPut(Vhash* _self, const char* key, void *data) {
+    KDword hash = vhStringHash(key);
+    VhashEntry *entry;
+
+    /* 装载率超过 3/4 时扩容 */
+    if ((_self->size + 1) * 4 > _self->capacity * 3) {
+        int capacity = _self->capacity * 2;
+        VhashEntry *entries = (VhashEntry *)calloc(capacity, sizeof(VhashEntry));
+        int i;
+        for (i = 0; i < _self->capacity; ++i) {
+            if (_self->entries[i].key != NULL) {
+                *vhFindEntry(entries, capacity, _self->entries[i].key, _self->entries[i].hash) = _self->entries[i];
+            }
+        }
+        free(_self->entries);
+        _self->entries = entries;
+        _self->capacity = capacity;
+    }
+
+    entry = vhFindEntry(_self->entries, _self->capacity, key, hash);
+    if (entry->key == NULL) {
+        entry->key = key;
+        entry->hash = hash;
+        _self->size++;
+    }
+    entry->data = data;
+
+    return _self;
+}
+
+void vhDestroy(Vhash* _self) {
+    free(_self->entries);
+    free(_self);
+}
+
 int KUtils_StringCopy(char *dest, int max, const char *src) {
     int i;
     for (i = 0; i < max - 1 && src[i]; ++i) {
@@ -337,6 +405,7 @@ static void KUtils_ItoaReverse(char str[], int length) {
 char* KUtils_Itoa(int num, char* str, int base) {
     int i = 0;
     int isNegative = 0;
+    unsigned int n = (unsigned int)num;
  
     /* Specifically handle input being 0 */
     if (num == 0) {
@@ -348,14 +417,15 @@ char* KUtils_Itoa(int num, char* str, int base) {
     /* In standard itoa(), negative numbers are only handled for decimal base */
     if (num < 0 && base == 10) {
         isNegative = 1;
-        num = -num;
+        /* INT_MIN has no positive counterpart, negate as unsigned */
+        n = 0u - n;
     }
  
     /* Process individual digits */
-    while (num != 0) {
-        int rem = num % base;
+    while (n != 0) {
+        int rem = (int)(n % base);
         str[i++] = (rem > 9)? (rem-10) + 'a' : rem + '0';
-        num = num/base;
+        n = n/base;
     }
  
     /* If number is negative, append "-" */
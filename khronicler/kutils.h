@@ -35,6 +35,25 @@ void        vlDestroy       (Vlist* _self, void (* releaseData)(void *));
 
 #define vlPeek(_self)       ((_self)->tail->data)
 
+/* 以字符串为键的哈希表，键由调用者保存，生命周期不能短于哈希表 */
+typedef struct {
+    const char* key;
+    KDword hash;
+    void *data;
+} VhashEntry;
+
+typedef struct {
+    VhashEntry *entries;
+    int capacity;
+    int size;
+} Vhash;
+
+KDword      vhStringHash    (const char* key);
+Vhash*      vhNewHash       ();
+void*       vhGet           (const Vhash* _self, const char* key);
+Vhash*      vhPut           (Vhash* _self, const char* key, void *data);
+void        vhDestroy       (Vhash* _self);
+
 typedef Vlist VQueue;
 #define vqNewQueue                  vlNewList
 #define vqPush                      vlPushBack
@@ -5,11 +5,17 @@
 #include "kalias.h"
 #include "test.h"
 
+/* 定义 KB_NO_THREADS 时并行模式在主线程中依次执行 */
+#ifndef KB_NO_THREADS
+#include <pthread.h>
+#endif
+
 #define TARGET_NONE         0
 #define TARGET_COMPILE      1
 #define TARGET_DUMP         2
 #define TARGET_INSPECT      3
 #define TARGET_EXECUTE      4
+#define TARGET_PARALLEL     5
 #define CLI_COMPILE         "--compile"
 #define CLI_COMPILE_S       "-c"
 #define CLI_DUMP            "--dump"
@@ -22,6 +28,26 @@
 #define CLI_OUTPUT_S        "-o"
 #define CLI_EXTENSION       "--extension"
 #define CLI_EXTENSION_S     "-x"
+#define CLI_STATS           "--stats"
+#define CLI_STATS_S         "-s"
+#define CLI_REGISTER        "--register"
+#define CLI_REGISTER_S      "-r"
+#define CLI_OPTIMIZE        "--optimize"
+#define CLI_OPTIMIZE_S      "-O"
+#define CLI_BUDGET          "--budget"
+#define CLI_BUDGET_S        "-b"
+#define CLI_ARENA           "--arena"
+#define CLI_ARENA_S         "-a"
+#define CLI_MEMORY_LIMIT    "--memory-limit"
+#define CLI_MEMORY_LIMIT_S  "-m"
+#define CLI_PROFILE         "--profile"
+#define CLI_PROFILE_S       "-p"
+#define CLI_PARALLEL        "--parallel"
+#define CLI_PARALLEL_S      "-j"
+#define CLI_INSTANCES       "--instances"
+#define CLI_INSTANCES_S     "-N"
+#define CLI_SEED            "--seed"
+#define CLI_INPUT_MAX       256
 #define ARG_IS(param)       (strcmp((param), argv[argIndex]) == 0)
 #define HAVE_ARG()          (argIndex < argc)
 #define NEXT_ARG()          (argIndex++)
@@ -35,13 +61,34 @@ struct {
     const char* szInputPath;
     const char* szOutputPath;
     const char* szExtPath;
-} sCliParams = { TARGET_NONE, NULL, NULL };
+    KBool       bStats;
+    KBool       bRegister;
+    KBool       bOptimize;
+    KDword      dwBudget;
+    KBool       bProfile;
+    KDword      dwArenaSize;
+    KDword      dwMemoryLimit;                      /* 0 表示不限制 */
+    int         iNumThreads;
+    int         iNumInstances;
+    KDword      dwSeed;                             /* 0 表示不指定种子 */
+    int         iNumInputs;                         /* 并行模式可以有多个输入文件 */
+    const char* szArrInputPaths[CLI_INPUT_MAX];
+} sCliParams;
 
 /* 文件工具函数 */
 char*   readTextFile    (const char *fileName);
 KByte*  readBinaryFile  (const char *filename);
 int     writeBinaryFile (const char *fileName, const void * data, int length);
 
+/* 性能分析报告 */
+void    printProfileReport  (const Machine* pMachine);
+
+/* 内存统计 */
+void    printMemStats       (const MemStats* pMem);
+
+/* 并行执行 */
+KBool   runParallel         (void);
+
 void displayUsage(const char* exeName) {
     fprintf(
         stderr,
@@ -53,21 +100,43 @@ void displayUsage(const char* exeName) {
         "  %s, %-12s <file>   Analyze script and dump bytecode\n"
         "  %s, %-12s <file>   Inspect bytecode file\n"
         "  %s, %-12s <file>   Execute bytecode file\n"
+        "  %s, %-12s <file>   Execute bytecode file and print profile report\n"
+        "  %s, %-12s <n>      Execute bytecode files on n threads\n"
+        "  %s, %-12s <n>      Run n instances of each file (use with --parallel)\n"
+        "      %-12s <n>      Seed rand(), job i uses n + i (use with --parallel)\n"
+        "  %s, %-12s          Print runtime statistics (use with --execute)\n"
+        "  %s, %-12s          Generate register-based bytecode (use with --compile or --dump)\n"
+        "  %s, %-12s          Fold constants and remove redundant opcodes (use with --compile or --dump)\n"
+        "  %s, %-12s <n>      Suspend and resume every n instructions (use with --execute)\n"
+        "  %s, %-12s <bytes>  Allocate strings and arrays from an arena (use with --execute)\n"
+        "  %s, %-12s <bytes>  Abort the script when it uses more memory (use with --execute)\n"
         "\n"
         "Examples:\n"
         "  Compile:  %s %s program.kbs -o bytecode.kbn\n"
         "  Dump:     %s %s program.kbs\n"
         "  Inspect:  %s %s bytecode.kbn\n"
-        "  Execute:  %s %s bytecode.kbn\n",
+        "  Execute:  %s %s bytecode.kbn\n"
+        "  Parallel: %s %s 4 a.kbn b.kbn -N 100\n",
         CLI_COMPILE_S, CLI_COMPILE,
         CLI_OUTPUT_S, CLI_OUTPUT,
         CLI_DUMP_S, CLI_DUMP,
         CLI_INSPECT_S, CLI_INSPECT,
         CLI_EXECUTE_S, CLI_EXECUTE,
+        CLI_PROFILE_S, CLI_PROFILE,
+        CLI_PARALLEL_S, CLI_PARALLEL,
+        CLI_INSTANCES_S, CLI_INSTANCES,
+        CLI_SEED,
+        CLI_STATS_S, CLI_STATS,
+        CLI_REGISTER_S, CLI_REGISTER,
+        CLI_OPTIMIZE_S, CLI_OPTIMIZE,
+        CLI_BUDGET_S, CLI_BUDGET,
+        CLI_ARENA_S, CLI_ARENA,
+        CLI_MEMORY_LIMIT_S, CLI_MEMORY_LIMIT,
         exeName, CLI_COMPILE_S,
         exeName, CLI_DUMP_S,
         exeName, CLI_INSPECT_S,
-        exeName, CLI_EXECUTE_S
+        exeName, CLI_EXECUTE_S,
+        exeName, CLI_PARALLEL_S
     );
 }
 
@@ -77,6 +146,17 @@ int parseCommandLineParameters(int argc, char** argv) {
     sCliParams.iTarget = TARGET_NONE;
     sCliParams.szInputPath = NULL;
     sCliParams.szOutputPath = NULL;
+    sCliParams.bStats = KB_FALSE;
+    sCliParams.bRegister = KB_FALSE;
+    sCliParams.bOptimize = KB_FALSE;
+    sCliParams.dwBudget = 0;
+    sCliParams.bProfile = KB_FALSE;
+    sCliParams.dwArenaSize = 0;
+    sCliParams.dwMemoryLimit = 0;
+    sCliParams.iNumThreads = 1;
+    sCliParams.iNumInstances = 1;
+    sCliParams.dwSeed = 0;
+    sCliParams.iNumInputs = 0;
 
     while (HAVE_ARG()) {
         /* 输出文件名 */
@@ -88,8 +168,8 @@ int parseCommandLineParameters(int argc, char** argv) {
             }
             sCliParams.szOutputPath = CURRENT_ARG();
         }
-        /* 输出文件名 */
-        if (ARG_IS(CLI_EXTENSION) || ARG_IS(CLI_EXTENSION_S)) {
+        /* 扩展脚本 */
+        else if (ARG_IS(CLI_EXTENSION) || ARG_IS(CLI_EXTENSION_S)) {
             NEXT_ARG();
             if (!HAVE_ARG()) {
                 fprintf(stderr, "Invalid parameter: missing extension script after -x flag.\n\n");
@@ -97,6 +177,73 @@ int parseCommandLineParameters(int argc, char** argv) {
             }
             sCliParams.szExtPath = CURRENT_ARG();
         }
+        /* 输出运行统计 */
+        else if (ARG_IS(CLI_STATS) || ARG_IS(CLI_STATS_S)) {
+            sCliParams.bStats = KB_TRUE;
+        }
+        /* 生成寄存器字节码 */
+        else if (ARG_IS(CLI_REGISTER) || ARG_IS(CLI_REGISTER_S)) {
+            sCliParams.bRegister = KB_TRUE;
+        }
+        /* 编译前优化 AST */
+        else if (ARG_IS(CLI_OPTIMIZE) || ARG_IS(CLI_OPTIMIZE_S)) {
+            sCliParams.bOptimize = KB_TRUE;
+        }
+        /* 分段执行的指令预算 */
+        else if (ARG_IS(CLI_BUDGET) || ARG_IS(CLI_BUDGET_S)) {
+            NEXT_ARG();
+            if (!HAVE_ARG() || atol(CURRENT_ARG()) <= 0) {
+                fprintf(stderr, "Invalid parameter: missing instruction budget after -b flag.\n\n");
+                return 0;
+            }
+            sCliParams.dwBudget = (KDword)atol(CURRENT_ARG());
+        }
+        /* 运行时值的 arena 大小 */
+        else if (ARG_IS(CLI_ARENA) || ARG_IS(CLI_ARENA_S)) {
+            NEXT_ARG();
+            if (!HAVE_ARG() || atol(CURRENT_ARG()) <= 0) {
+                fprintf(stderr, "Invalid parameter: missing arena size after -a flag.\n\n");
+                return 0;
+            }
+            sCliParams.dwArenaSize = (KDword)atol(CURRENT_ARG());
+        }
+        /* 运行时内存上限 */
+        else if (ARG_IS(CLI_MEMORY_LIMIT) || ARG_IS(CLI_MEMORY_LIMIT_S)) {
+            NEXT_ARG();
+            if (!HAVE_ARG() || atol(CURRENT_ARG()) <= 0) {
+                fprintf(stderr, "Invalid parameter: missing memory limit after -m flag.\n\n");
+                return 0;
+            }
+            sCliParams.dwMemoryLimit = (KDword)atol(CURRENT_ARG());
+        }
+        /* 多线程执行 */
+        else if (ARG_IS(CLI_PARALLEL) || ARG_IS(CLI_PARALLEL_S)) {
+            NEXT_ARG();
+            if (!HAVE_ARG() || atoi(CURRENT_ARG()) <= 0) {
+                fprintf(stderr, "Invalid parameter: missing thread count after -j flag.\n\n");
+                return 0;
+            }
+            sCliParams.iTarget = TARGET_PARALLEL;
+            sCliParams.iNumThreads = atoi(CURRENT_ARG());
+        }
+        /* 每个文件执行的实例数 */
+        else if (ARG_IS(CLI_INSTANCES) || ARG_IS(CLI_INSTANCES_S)) {
+            NEXT_ARG();
+            if (!HAVE_ARG() || atoi(CURRENT_ARG()) <= 0) {
+                fprintf(stderr, "Invalid parameter: missing instance count after -N flag.\n\n");
+                return 0;
+            }
+            sCliParams.iNumInstances = atoi(CURRENT_ARG());
+        }
+        /* 随机数种子 */
+        else if (ARG_IS(CLI_SEED)) {
+            NEXT_ARG();
+            if (!HAVE_ARG()) {
+                fprintf(stderr, "Invalid parameter: missing seed after --seed flag.\n\n");
+                return 0;
+            }
+            sCliParams.dwSeed = (KDword)strtoul(CURRENT_ARG(), NULL, 10);
+        }
         /* 编译字节码模式 */
         else if (ARG_IS(CLI_COMPILE) || ARG_IS(CLI_COMPILE_S)) {
             sCliParams.iTarget = TARGET_COMPILE;
@@ -113,13 +260,18 @@ int parseCommandLineParameters(int argc, char** argv) {
         else if (ARG_IS(CLI_EXECUTE) || ARG_IS(CLI_EXECUTE_S)) {
             sCliParams.iTarget = TARGET_EXECUTE;
         }
+        /* 执行字节码文件并输出性能分析 */
+        else if (ARG_IS(CLI_PROFILE) || ARG_IS(CLI_PROFILE_S)) {
+            sCliParams.iTarget = TARGET_EXECUTE;
+            sCliParams.bProfile = KB_TRUE;
+        }
         /* 输入文件名 */
         else {
-            if (sCliParams.szInputPath != NULL) {
+            if (CURRENT_ARG()[0] == '-' || sCliParams.iNumInputs >= CLI_INPUT_MAX) {
                 fprintf(stderr, "Invalid flag: unrecognized flag '%s'.\n\n", CURRENT_ARG());
                 return 0;
             }
-            sCliParams.szInputPath = CURRENT_ARG();
+            sCliParams.szArrInputPaths[sCliParams.iNumInputs++] = CURRENT_ARG();
         }
         NEXT_ARG();
     }
@@ -129,11 +281,18 @@ int parseCommandLineParameters(int argc, char** argv) {
         return 0;
     }
 
-    if (sCliParams.szInputPath == NULL) {
+    if (sCliParams.iNumInputs == 0) {
         fprintf(stderr, "Missing input file.\n\n");
         return 0;
     }
 
+    /* 只有并行模式接受多个输入文件 */
+    if (sCliParams.iTarget != TARGET_PARALLEL && sCliParams.iNumInputs > 1) {
+        fprintf(stderr, "Invalid flag: unrecognized flag '%s'.\n\n", sCliParams.szArrInputPaths[1]);
+        return 0;
+    }
+    sCliParams.szInputPath = sCliParams.szArrInputPaths[0];
+
     if (sCliParams.iTarget == TARGET_COMPILE && sCliParams.szOutputPath == NULL) {
         fprintf(stderr, "Missing output file.\n\n");
         return 0;
@@ -164,6 +323,11 @@ KBool buildFromScript(const char* szSource, const char* szExtSource, Context** p
         return KB_FALSE;
     }
 
+    /* 折叠常量表达式 */
+    if (sCliParams.bOptimize) {
+        optimizeAst(pAstProgram);
+    }
+
     /* 编译 AST 为上下文 */
     pContext = createContext(pAstProgram);
     /* 尝试解析拓展脚本 */
@@ -193,10 +357,34 @@ KBool buildFromScript(const char* szSource, const char* szExtSource, Context** p
     }
     destroyAst(pAstProgram);
 
+    /* 窥孔优化，输出分析信息时报告优化前后的指令数量 */
+    if (sCliParams.bOptimize) {
+        int iNumBefore = pContext->iNumOpCodes;
+        optimizeContextOpCodes(pContext);
+        if (sCliParams.iTarget == TARGET_DUMP) {
+            printf("[peephole] opcodes: %d -> %d\n", iNumBefore, pContext->iNumOpCodes);
+        }
+    }
+
+    /* 常见指令序列融合为超级指令 */
+    fuseContextOpCodes(pContext);
+
     *pPtrContext = pContext;
     return KB_TRUE;
 }
 
+/* 按命令行参数序列化为栈字节码或寄存器字节码 */
+KBool serializeForTarget(Context* pContext, KByte** pPtrRawSerialized, KDword* pDwRawSize) {
+    if (!sCliParams.bRegister) {
+        return serializeContext(pContext, pPtrRawSerialized, pDwRawSize);
+    }
+    if (!serializeContextReg(pContext, pPtrRawSerialized, pDwRawSize)) {
+        fprintf(stderr, "Too many variables for register-based bytecode.\n");
+        return KB_FALSE;
+    }
+    return KB_TRUE;
+}
+
 int main(int argc, char** argv) {
     KBool   bRunSuccess         = KB_FALSE;
     KBool   bParseSuccess       = KB_FALSE;
@@ -246,7 +434,10 @@ int main(int argc, char** argv) {
             goto dispose;
         }
         /* 序列化上下文 */
-        serializeContext(pContext, &pRawSerialized, &dwRawSize);
+        if (!serializeForTarget(pContext, &pRawSerialized, &dwRawSize)) {
+            destroyContext(pContext);
+            goto dispose;
+        }
         destroyContext(pContext);
         /* 写入文件 */
         bWriteSuccess = writeBinaryFile(sCliParams.szOutputPath, pRawSerialized, dwRawSize);
@@ -265,7 +456,10 @@ int main(int argc, char** argv) {
             goto dispose;
         }
         /* 序列化上下文 */
-        serializeContext(pContext, &pRawSerialized, &dwRawSize);
+        if (!serializeForTarget(pContext, &pRawSerialized, &dwRawSize)) {
+            destroyContext(pContext);
+            goto dispose;
+        }
         destroyContext(pContext);
         /* 输出分析信息 */
         dumpKbasicBinary(NULL, pRawSerialized);
@@ -276,21 +470,73 @@ int main(int argc, char** argv) {
         dumpKbasicBinary(NULL, pByteInputBinary);
         bRunSuccess = KB_TRUE;
     }
+    else if (sCliParams.iTarget == TARGET_PARALLEL) {
+        bRunSuccess = runParallel();
+    }
     else if (sCliParams.iTarget == TARGET_EXECUTE) {
         Machine*        pMachine;               /* 虚拟机实例 */
         KBool           bExecuteSuccess;        /* 执行是否成功结束 */
         RuntimeErrorId  iRuntimeErrorId;        /* 运行时错误 */
         const OpCode*   pStopOpCode;            /* 运行时错误结束的 opCode */
+        RuntimeExecStatus iExecStatus;          /* 执行状态 */
+        KDword          dwNumSlices = 1;        /* 分段执行的次数 */
+        ArenaConfig     sArenaConfig;           /* 运行时值的分配器 */
         
-        /* 执行 opCode */
-        pMachine = createMachine(pByteInputBinary);
-        bExecuteSuccess = executeMachine(pMachine, 0, &iRuntimeErrorId, &pStopOpCode);
+        /* 执行 opCode，指定了预算时每段用完挂起后继续，模拟宿主按帧分段执行，yield 时同样继续 */
+        sArenaConfig.pBuffer = NULL;
+        sArenaConfig.dwSize = sCliParams.dwArenaSize;
+        pMachine = createMachineEx(pByteInputBinary, &sArenaConfig);
+        setMemoryLimit(pMachine, sCliParams.dwMemoryLimit);
+        if (sCliParams.bProfile && !enableProfile(pMachine)) {
+            fprintf(stderr, "Profiler is not available, rebuild the runtime with -DKB_RT_PROFILE (make profile).\n");
+            destroyMachine(pMachine);
+            goto dispose;
+        }
+        iExecStatus = executeMachineBudget(pMachine, 0, sCliParams.dwBudget, &iRuntimeErrorId, &pStopOpCode);
+        while (iExecStatus == RT_EXEC_SUSPENDED || iExecStatus == RT_EXEC_YIELDED) {
+            iExecStatus = resumeMachine(pMachine, sCliParams.dwBudget, &iRuntimeErrorId, &pStopOpCode);
+            dwNumSlices++;
+        }
+        bExecuteSuccess = iExecStatus != RT_EXEC_ERROR;
     
         /* 执行有错误 */
         if (!bExecuteSuccess) {
-            formatRuntimeErrorMessage(szErrorMessage, pStopOpCode, iRuntimeErrorId);
+            if (pStopOpCode) {
+                formatRuntimeErrorMessage(szErrorMessage, pStopOpCode, iRuntimeErrorId);
+            } else {
+                formatRegRuntimeErrorMessage(szErrorMessage, pMachine->pRegOpCodeCur, iRuntimeErrorId);
+            }
             fputs(szErrorMessage, stderr);
         }
+        bRunSuccess = bExecuteSuccess;
+
+        /* 输出运行统计 */
+        if (sCliParams.bStats) {
+            fprintf(
+                stderr,
+                "\n[stats] opcodes: %u, allocs: %u, allocs/opcode: %.4f, slices: %u, verified: %s\n",
+                pMachine->dwStatOpCodes,
+                pMachine->dwStatAllocs,
+                pMachine->dwStatOpCodes ? (double)pMachine->dwStatAllocs / pMachine->dwStatOpCodes : 0.0,
+                dwNumSlices,
+                pMachine->bVerified ? "yes" : "no"
+            );
+            if (pMachine->sArena.pBase) {
+                fprintf(
+                    stderr,
+                    "[arena] size: %u, peak: %u, fallbacks: %u\n",
+                    (KDword)(pMachine->sArena.pEnd - pMachine->sArena.pBase),
+                    pMachine->sArena.dwPeak,
+                    pMachine->sArena.dwNumFallback
+                );
+            }
+            printMemStats(getMemStats(pMachine));
+        }
+
+        /* 输出性能分析报告 */
+        if (sCliParams.bProfile) {
+            printProfileReport(pMachine);
+        }
 
         destroyMachine(pMachine);
     }
@@ -303,6 +549,304 @@ dispose:
     return bRunSuccess ? 0 : -1;
 }
 
+/* 性能分析报告，按耗时降序排列的下标 */
+#define PROFILE_TOP_POS_MAX     20
+
+static const double* pSortTicks = NULL;
+
+static int compareTicksDesc(const void* pA, const void* pB) {
+    double fA = pSortTicks[*(const int *)pA];
+    double fB = pSortTicks[*(const int *)pB];
+    return fA < fB ? 1 : fA > fB ? -1 : 0;
+}
+
+static int* sortByTicks(const double* pArrTicks, int iNum) {
+    int* pArrIndex = (int *)malloc(sizeof(int) * (iNum + 1));
+    int i;
+    for (i = 0; i < iNum; i++) {
+        pArrIndex[i] = i;
+    }
+    pSortTicks = pArrTicks;
+    qsort(pArrIndex, iNum, sizeof(int), compareTicksDesc);
+    return pArrIndex;
+}
+
+#define PROFILE_OPCODE_AT(pMachine, T, iPos) \
+    (&((const T *)((pMachine)->pByteRaw + (pMachine)->pBinHeader->dwOpCodeBlockStart))[iPos])
+
+/* 执行结束时仍然占用的内存 (按分类) 和执行期间的最高值 */
+void printMemStats(const MemStats* pMem) {
+    static const char* SZ_MEM_KIND_NAME[RT_MEM_NUM_KIND] = {
+        "values", "strings", "arrays", "frames"
+    };
+    int i;
+    fprintf(stderr, "[memory]");
+    for (i = 0; i < RT_MEM_NUM_KIND; i++) {
+        fprintf(stderr, " %s: %u B/%d,", SZ_MEM_KIND_NAME[i], pMem->arrBytes[i], pMem->arrObjects[i]);
+    }
+    fprintf(stderr, " total: %u, peak: %u", pMem->dwTotal, pMem->dwPeak);
+    if (pMem->dwLimit) {
+        fprintf(stderr, ", limit: %u\n", pMem->dwLimit);
+    } else {
+        fprintf(stderr, ", limit: none\n");
+    }
+}
+
+static const char* getProfileOpCodeName(const Machine* pMachine, int iOpCodeId) {
+    if (K_IS_REG_BINARY(pMachine->pBinHeader)) {
+        return getRegOpCodeName(iOpCodeId);
+    }
+    return getOpCodeName(iOpCodeId);
+}
+
+void printProfileReport(const Machine* pMachine) {
+    const KbProfile*    pProfile    = pMachine->pProfile;
+    KBool               bIsReg      = K_IS_REG_BINARY(pMachine->pBinHeader);
+    int                 iNumOpCode  = (int)pMachine->pBinHeader->dwNumOpCode;
+    int                 iNumFunc    = (int)pMachine->pBinHeader->dwNumFunc;
+    int                 iNumKind    = bIsReg ? K_NUM_REG_OPCODE : K_NUM_OPCODE;
+    double*             pArrFuncTicks;
+    KDword*             pArrFuncCount;
+    int*                pArrFuncEndPos;
+    int*                pArrIndex;
+    double              fTotal      = 0;
+    int                 i, j;
+
+    for (i = 0; i < iNumOpCode; i++) {
+        fTotal += pProfile->pArrPosTicks[i];
+    }
+    if (fTotal <= 0) {
+        fTotal = 1;
+    }
+
+    fprintf(stderr, "\n[profile] opcodes: %u, ticks: %.0f\n", pMachine->dwStatOpCodes, fTotal);
+
+    /* 按指令类型 */
+    fprintf(stderr, "\n%-24s %12s %16s %8s\n", "OpCode", "Count", "Ticks", "%");
+    pArrIndex = sortByTicks(pProfile->pArrOpCodeTicks, iNumKind);
+    for (i = 0; i < iNumKind; i++) {
+        int iId = pArrIndex[i];
+        if (pProfile->pArrOpCodeCount[iId] == 0) {
+            continue;
+        }
+        fprintf(
+            stderr, "%-24s %12u %16.0f %7.2f%%\n",
+            getProfileOpCodeName(pMachine, iId),
+            pProfile->pArrOpCodeCount[iId],
+            pProfile->pArrOpCodeTicks[iId],
+            pProfile->pArrOpCodeTicks[iId] * 100 / fTotal
+        );
+    }
+    free(pArrIndex);
+
+    /* 按函数，最后一项是函数体以外的主程序 */
+    pArrFuncTicks = (double *)calloc(iNumFunc + 1, sizeof(double));
+    pArrFuncCount = (KDword *)calloc(iNumFunc + 1, sizeof(KDword));
+    pArrFuncEndPos = (int *)malloc(sizeof(int) * (iNumFunc + 1));
+    getFuncEndPositions(
+        pMachine->pByteRaw + pMachine->pBinHeader->dwOpCodeBlockStart,
+        bIsReg,
+        iNumOpCode,
+        pMachine->pArrFuncInfo,
+        iNumFunc,
+        pArrFuncEndPos
+    );
+    for (i = 0; i < iNumOpCode; i++) {
+        int iOwner = iNumFunc;
+        for (j = 0; j < iNumFunc; j++) {
+            if (i >= (int)pMachine->pArrFuncInfo[j].dwOpCodePos && i < pArrFuncEndPos[j]) {
+                iOwner = j;
+                break;
+            }
+        }
+        pArrFuncTicks[iOwner] += pProfile->pArrPosTicks[i];
+        pArrFuncCount[iOwner] += pProfile->pArrPosCount[i];
+    }
+    fprintf(stderr, "\n%-24s %12s %12s %16s %8s\n", "Function", "Calls", "OpCodes", "Self Ticks", "%");
+    pArrIndex = sortByTicks(pArrFuncTicks, iNumFunc + 1);
+    for (i = 0; i <= iNumFunc; i++) {
+        int iFunc = pArrIndex[i];
+        fprintf(
+            stderr, "%-24s %12u %12u %16.0f %7.2f%%\n",
+            iFunc < iNumFunc ? pMachine->pArrFuncInfo[iFunc].szName : "<main>",
+            iFunc < iNumFunc ? pProfile->pArrFuncCalls[iFunc] : 1,
+            pArrFuncCount[iFunc],
+            pArrFuncTicks[iFunc],
+            pArrFuncTicks[iFunc] * 100 / fTotal
+        );
+    }
+    free(pArrIndex);
+    free(pArrFuncTicks);
+    free(pArrFuncCount);
+    free(pArrFuncEndPos);
+
+    /* 热点指令位置 */
+    fprintf(stderr, "\n%-6s %-24s %12s %16s %8s\n", "Pos", "OpCode", "Count", "Ticks", "%");
+    pArrIndex = sortByTicks(pProfile->pArrPosTicks, iNumOpCode);
+    for (i = 0; i < iNumOpCode && i < PROFILE_TOP_POS_MAX; i++) {
+        int iPos = pArrIndex[i];
+        int iId;
+        if (pProfile->pArrPosCount[iPos] == 0) {
+            break;
+        }
+        iId = bIsReg ? PROFILE_OPCODE_AT(pMachine, RegOpCode, iPos)->bOpCodeId : (int)PROFILE_OPCODE_AT(pMachine, OpCode, iPos)->dwOpCodeId;
+        fprintf(
+            stderr, "%06d %-24s %12u %16.0f %7.2f%%\n",
+            iPos,
+            getProfileOpCodeName(pMachine, iId),
+            pProfile->pArrPosCount[iPos],
+            pProfile->pArrPosTicks[iPos],
+            pProfile->pArrPosTicks[iPos] * 100 / fTotal
+        );
+    }
+    free(pArrIndex);
+}
+
+/*
+ * 并行执行: 每个输入文件只加载一次，所有实例共享同一份只读的字节码，
+ * 每个任务使用自己的虚拟机，工作线程从队列中依次领取任务
+ */
+typedef struct {
+    const KByte*    pByteImage;         /* 共享的字节码 */
+    const char*     szPath;
+    int             iInstance;
+    KBool           bSuccess;
+    int             iStopValue;
+    KDword          dwOpCodes;
+    char            szErrorMessage[200];
+} ParallelJob;
+
+static struct {
+    ParallelJob*    pArrJobs;
+    int             iNumJobs;
+    int             iNextJob;           /* 下一个待领取的任务 */
+#ifndef KB_NO_THREADS
+    pthread_mutex_t sMutex;
+#endif
+} sParallelQueue;
+
+static void runParallelJob(ParallelJob* pJob, int iJobIndex) {
+    Machine*        pMachine;
+    ArenaConfig     sArenaConfig;
+    RuntimeErrorId  iRuntimeErrorId;
+    const OpCode*   pStopOpCode;
+
+    sArenaConfig.pBuffer = NULL;
+    sArenaConfig.dwSize = sCliParams.dwArenaSize;
+    pMachine = createMachineEx(pJob->pByteImage, &sArenaConfig);
+    setMemoryLimit(pMachine, sCliParams.dwMemoryLimit);
+    if (sCliParams.dwSeed) {
+        setRandSeed(pMachine, sCliParams.dwSeed + (KDword)iJobIndex);
+    }
+    pJob->bSuccess = executeMachine(pMachine, 0, &iRuntimeErrorId, &pStopOpCode);
+    if (!pJob->bSuccess) {
+        if (pStopOpCode) {
+            formatRuntimeErrorMessage(pJob->szErrorMessage, pStopOpCode, iRuntimeErrorId);
+        } else {
+            formatRegRuntimeErrorMessage(pJob->szErrorMessage, pMachine->pRegOpCodeCur, iRuntimeErrorId);
+        }
+    }
+    pJob->iStopValue = pMachine->iStopValue;
+    pJob->dwOpCodes = pMachine->dwStatOpCodes;
+    destroyMachine(pMachine);
+}
+
+/* 领取下一个任务，没有任务时返回 -1 */
+static int takeParallelJob(void) {
+    int iJobIndex;
+#ifndef KB_NO_THREADS
+    pthread_mutex_lock(&sParallelQueue.sMutex);
+#endif
+    iJobIndex = sParallelQueue.iNextJob < sParallelQueue.iNumJobs ? sParallelQueue.iNextJob++ : -1;
+#ifndef KB_NO_THREADS
+    pthread_mutex_unlock(&sParallelQueue.sMutex);
+#endif
+    return iJobIndex;
+}
+
+static void* parallelWorker(void* pArg) {
+    int iJobIndex;
+    while ((iJobIndex = takeParallelJob()) >= 0) {
+        runParallelJob(sParallelQueue.pArrJobs + iJobIndex, iJobIndex);
+    }
+    return pArg;
+}
+
+KBool runParallel(void) {
+    KByte*  pArrImages[CLI_INPUT_MAX];
+    int     iNumFailed = 0;
+    KBool   bLoaded = KB_TRUE;
+    int     i, j;
+
+    /* 加载所有的字节码 */
+    for (i = 0; i < sCliParams.iNumInputs; i++) {
+        pArrImages[i] = readBinaryFile(sCliParams.szArrInputPaths[i]);
+        if (!pArrImages[i]) {
+            fprintf(stderr, "Failed to load binary file '%s'\n", sCliParams.szArrInputPaths[i]);
+            bLoaded = KB_FALSE;
+        }
+    }
+    if (!bLoaded) {
+        for (i = 0; i < sCliParams.iNumInputs; i++) {
+            if (pArrImages[i]) free(pArrImages[i]);
+        }
+        return KB_FALSE;
+    }
+
+    /* 每个文件展开为 iNumInstances 个任务 */
+    sParallelQueue.iNumJobs = sCliParams.iNumInputs * sCliParams.iNumInstances;
+    sParallelQueue.iNextJob = 0;
+    sParallelQueue.pArrJobs = (ParallelJob *)calloc(sParallelQueue.iNumJobs, sizeof(ParallelJob));
+    for (i = 0; i < sCliParams.iNumInputs; i++) {
+        for (j = 0; j < sCliParams.iNumInstances; j++) {
+            ParallelJob* pJob = sParallelQueue.pArrJobs + i * sCliParams.iNumInstances + j;
+            pJob->pByteImage = pArrImages[i];
+            pJob->szPath = sCliParams.szArrInputPaths[i];
+            pJob->iInstance = j;
+        }
+    }
+
+#ifndef KB_NO_THREADS
+    {
+        pthread_t*  pArrThreads = (pthread_t *)malloc(sizeof(pthread_t) * sCliParams.iNumThreads);
+        int         iNumStarted = 0;
+        pthread_mutex_init(&sParallelQueue.sMutex, NULL);
+        for (i = 0; i < sCliParams.iNumThreads && i < sParallelQueue.iNumJobs; i++) {
+            if (pthread_create(&pArrThreads[iNumStarted], NULL, parallelWorker, NULL) == 0) {
+                iNumStarted++;
+            }
+        }
+        /* 线程创建失败时主线程自己执行剩下的任务 */
+        parallelWorker(NULL);
+        for (i = 0; i < iNumStarted; i++) {
+            pthread_join(pArrThreads[i], NULL);
+        }
+        pthread_mutex_destroy(&sParallelQueue.sMutex);
+        free(pArrThreads);
+    }
+#else
+    parallelWorker(NULL);
+#endif
+
+    /* 按任务顺序输出结果，和线程的调度无关 */
+    for (i = 0; i < sParallelQueue.iNumJobs; i++) {
+        const ParallelJob* pJob = sParallelQueue.pArrJobs + i;
+        if (pJob->bSuccess) {
+            fprintf(stderr, "[job %d] %s #%d: stop %d, opcodes %u\n", i, pJob->szPath, pJob->iInstance, pJob->iStopValue, pJob->dwOpCodes);
+        } else {
+            fprintf(stderr, "[job %d] %s #%d: %s\n", i, pJob->szPath, pJob->iInstance, pJob->szErrorMessage);
+            iNumFailed++;
+        }
+    }
+    fprintf(stderr, "[parallel] jobs: %d, threads: %d, failed: %d\n", sParallelQueue.iNumJobs, sCliParams.iNumThreads, iNumFailed);
+
+    free(sParallelQueue.pArrJobs);
+    for (i = 0; i < sCliParams.iNumInputs; i++) {
+        free(pArrImages[i]);
+    }
+    return iNumFailed == 0;
+}
+
 /* 文件工具函数 */
 char *readTextFile(const char *fileName) {
     FILE *fp;
@@ -24,10 +24,121 @@ static void printStringEscaped(FILE* fp, const unsigned char* szToPrint) {
     fprintf(fp, "\"");
 }
 
+/* 寄存器操作数: G 全局变量, L 局部变量, 立即数直接输出 */
+static void printRegOperand(FILE* fp, KWord wOperand, const RegOpCode* pRegOp, const char* pStrPool) {
+    char szNumBuf[K_NUMERIC_STRINGIFY_BUF_MAX];
+    switch (wOperand & K_REG_KIND_MASK) {
+        case K_REG_KIND_GLOBAL:
+            fprintf(fp, "G%d", wOperand & K_REG_INDEX_MASK);
+            break;
+        case K_REG_KIND_LOCAL:
+            fprintf(fp, "L%d", wOperand & K_REG_INDEX_MASK);
+            break;
+        case K_REG_KIND_IMM_NUM:
+            if (wOperand & K_REG_IMM_INTEGER) {
+                fprintf(fp, "%d", pRegOp->uImm.iLiteral);
+                break;
+            }
+            Ftoa(pRegOp->uImm.fLiteral, szNumBuf, K_DEFAULT_FTOA_PRECISION);
+            fprintf(fp, "%s", szNumBuf);
+            break;
+        case K_REG_KIND_IMM_STR:
+            printStringEscaped(fp, (const unsigned char *)(pStrPool + pRegOp->uImm.dwStringPoolPos));
+            break;
+    }
+}
+
+static void dumpRegOpCodes(FILE* fp, const RegOpCode* pRegOpCodes, int iNumOpCode, const char* pStrPool) {
+    int i;
+    for (i = 0; i < iNumOpCode; ++i) {
+        const RegOpCode* pRegOp = pRegOpCodes + i;
+        fprintf(fp, "%03d | %-23s | ", i, getRegOpCodeName(pRegOp->bOpCodeId));
+        switch (pRegOp->bOpCodeId) {
+            case K_REG_OPCODE_MOVE:
+                printRegOperand(fp, pRegOp->wDst, pRegOp, pStrPool);
+                fprintf(fp, " <- ");
+                printRegOperand(fp, pRegOp->wSrcA, pRegOp, pStrPool);
+                break;
+            case K_REG_OPCODE_BINARY_OPERATOR:
+                printRegOperand(fp, pRegOp->wDst, pRegOp, pStrPool);
+                fprintf(fp, " <- ");
+                printRegOperand(fp, pRegOp->wSrcA, pRegOp, pStrPool);
+                fprintf(fp, " %s ", getOperatorNameById(pRegOp->bOperatorId));
+                printRegOperand(fp, pRegOp->wSrcB, pRegOp, pStrPool);
+                break;
+            case K_REG_OPCODE_UNARY_OPERATOR:
+                printRegOperand(fp, pRegOp->wDst, pRegOp, pStrPool);
+                fprintf(fp, " <- %s ", getOperatorNameById(pRegOp->bOperatorId));
+                printRegOperand(fp, pRegOp->wSrcA, pRegOp, pStrPool);
+                break;
+            case K_REG_OPCODE_SET_VAR_AS_ARRAY:
+                printRegOperand(fp, pRegOp->wDst, pRegOp, pStrPool);
+                fprintf(fp, "[");
+                printRegOperand(fp, pRegOp->wSrcA, pRegOp, pStrPool);
+                fprintf(fp, "]");
+                break;
+            case K_REG_OPCODE_ARR_GET:
+                printRegOperand(fp, pRegOp->wDst, pRegOp, pStrPool);
+                fprintf(fp, " <- ");
+                printRegOperand(fp, pRegOp->wSrcA, pRegOp, pStrPool);
+                fprintf(fp, "[");
+                printRegOperand(fp, pRegOp->wSrcB, pRegOp, pStrPool);
+                fprintf(fp, "]");
+                break;
+            case K_REG_OPCODE_ARR_SET:
+                printRegOperand(fp, pRegOp->wDst, pRegOp, pStrPool);
+                fprintf(fp, "[");
+                printRegOperand(fp, pRegOp->wSrcA, pRegOp, pStrPool);
+                fprintf(fp, "] <- ");
+                printRegOperand(fp, pRegOp->wSrcB, pRegOp, pStrPool);
+                break;
+            case K_REG_OPCODE_CALL_BUILT_IN:
+                printRegOperand(fp, pRegOp->wDst, pRegOp, pStrPool);
+                fprintf(fp, " <- %d(", pRegOp->bOperatorId);
+                printRegOperand(fp, pRegOp->wSrcA, pRegOp, pStrPool);
+                fprintf(fp, ")");
+                break;
+            case K_REG_OPCODE_GOTO:
+                fprintf(fp, "%d", pRegOp->uImm.dwOpCodePos);
+                break;
+            case K_REG_OPCODE_IF_GOTO:
+            case K_REG_OPCODE_UNLESS_GOTO:
+                printRegOperand(fp, pRegOp->wSrcA, pRegOp, pStrPool);
+                fprintf(fp, ", %d", pRegOp->uImm.dwOpCodePos);
+                break;
+            case K_REG_OPCODE_CMP_UNLESS_GOTO:
+                printRegOperand(fp, pRegOp->wSrcA, pRegOp, pStrPool);
+                fprintf(fp, " %s ", getOperatorNameById(pRegOp->bOperatorId));
+                printRegOperand(fp, pRegOp->wSrcB, pRegOp, pStrPool);
+                fprintf(fp, ", %d", pRegOp->wDst);
+                break;
+            case K_REG_OPCODE_CALL_EXT:
+                printRegOperand(fp, pRegOp->wDst, pRegOp, pStrPool);
+                fprintf(fp, " <- ext %d(", pRegOp->uImm.dwExtFuncIndex);
+                printRegOperand(fp, pRegOp->wSrcA, pRegOp, pStrPool);
+                fprintf(fp, "...)");
+                break;
+            case K_REG_OPCODE_CALL_FUNC:
+                printRegOperand(fp, pRegOp->wDst, pRegOp, pStrPool);
+                fprintf(fp, " <- %d(", pRegOp->uImm.dwFuncIndex);
+                printRegOperand(fp, pRegOp->wSrcA, pRegOp, pStrPool);
+                fprintf(fp, "...)");
+                break;
+            case K_REG_OPCODE_RETURN:
+            case K_REG_OPCODE_STOP:
+            case K_REG_OPCODE_YIELD:
+                printRegOperand(fp, pRegOp->wSrcA, pRegOp, pStrPool);
+                break;
+        }
+        fprintf(fp, "\n");
+    }
+}
+
 void dumpKbasicBinary(const char* szOutputFile, const KByte* pRawSerialized) {
     FILE*               fp          = NULL;
     const BinHeader*    pHeader     = (const BinHeader *)pRawSerialized;
     const BinFuncInfo*  pFuncInfo   = (const BinFuncInfo *)(pRawSerialized + pHeader->dwFuncBlockStart);
+    const BinExtFuncInfo* pExtFuncInfo = (const BinExtFuncInfo *)(pRawSerialized + pHeader->dwExtFuncBlockStart);
     const OpCode*       pOpCodes    = (const OpCode *)(pRawSerialized + pHeader->dwOpCodeBlockStart);
     const char*         pStrPool    = (const char *)(pRawSerialized + pHeader->dwStringPoolStart);
     int                 i, s;
@@ -44,6 +155,8 @@ void dumpKbasicBinary(const char* szOutputFile, const KByte* pRawSerialized) {
     fprintf(fp, "Num Variables       = %d\n", pHeader->dwNumVariables);
     fprintf(fp, "Func Block Start    = %d\n", pHeader->dwFuncBlockStart);
     fprintf(fp, "Num Func            = %d\n", pHeader->dwNumFunc);
+    fprintf(fp, "Ext Func Start      = %d\n", pHeader->dwExtFuncBlockStart);
+    fprintf(fp, "Num Ext Func        = %d\n", pHeader->dwNumExtFunc);
     fprintf(fp, "OpCode Block Start  = %d\n", pHeader->dwOpCodeBlockStart);
     fprintf(fp, "Num OpCode          = %d\n", pHeader->dwNumOpCode);
     fprintf(fp, "String Pool Start   = %d\n", pHeader->dwStringPoolStart);
@@ -55,45 +168,71 @@ void dumpKbasicBinary(const char* szOutputFile, const KByte* pRawSerialized) {
         const BinFuncInfo* pFunc = pFuncInfo + i;
         fprintf(fp, "%3d | %-18s | Param=%2d | Var=%2d | Start=%3d\n", i, pFunc->szName, pFunc->dwNumParams, pFunc->dwNumVars, pFunc->dwOpCodePos);
     }
+
+    fprintf(fp, "------------ Ext Function ------------\n");
+    for (i = 0; i < pHeader->dwNumExtFunc; ++i) {
+        fprintf(fp, "%3d | CallId=%5d | Param=%2d\n", i, pExtFuncInfo[i].dwCallId, pExtFuncInfo[i].dwNumParams);
+    }
     
     fprintf(fp, "--------------- OpCode ---------------\n");
-    for (i = 0; i < pHeader->dwNumOpCode; ++i) {
-        const OpCode* pOpCode = pOpCodes + i;
-        fprintf(fp, "%03d | %-18s | ", i, getOpCodeName(pOpCode->dwOpCodeId));
-        switch (pOpCode->dwOpCodeId) {
-            case K_OPCODE_PUSH_NUM:
-                Ftoa(pOpCode->uParam.fLiteral, szNumBuf, K_DEFAULT_FTOA_PRECISION);
-                fprintf(fp, "%s", szNumBuf);
-                break;
-            case K_OPCODE_PUSH_STR:
-                printStringEscaped(fp, (const unsigned char *)(pStrPool + pOpCode->uParam.dwStringPoolPos));
-                break;
-            case K_OPCODE_BINARY_OPERATOR:
-            case K_OPCODE_UNARY_OPERATOR:
-                fprintf(fp, "%s", getOperatorNameById(pOpCode->uParam.dwOperatorId));
-                break;
-            case K_OPCODE_POP:
-                break;
-            case K_OPCODE_PUSH_VAR:
-            case K_OPCODE_SET_VAR:
-            case K_OPCODE_SET_VAR_AS_ARRAY:
-            case K_OPCODE_ARR_GET:
-            case K_OPCODE_ARR_SET:
-                fprintf(fp, "<%s> %d", pOpCode->uParam.sVarAccess.wIsLocal ? "LOCAL" : "GLOBAL", pOpCode->uParam.sVarAccess.wVarIndex);
-                break;
-            case K_OPCODE_CALL_BUILT_IN:
-                fprintf(fp, "%d", pOpCode->uParam.dwBuiltFuncId);
-                break;
-            case K_OPCODE_GOTO:
-            case K_OPCODE_IF_GOTO:
-            case K_OPCODE_UNLESS_GOTO:
-                fprintf(fp, "%d", pOpCode->uParam.dwOpCodePos);
-                break;
-            case K_OPCODE_CALL_FUNC:
-                fprintf(fp, "%d", pOpCode->uParam.dwFuncIndex);
-                break;
+    if (K_IS_REG_BINARY(pHeader)) {
+        dumpRegOpCodes(fp, (const RegOpCode *)pOpCodes, pHeader->dwNumOpCode, pStrPool);
+    }
+    else {
+        for (i = 0; i < pHeader->dwNumOpCode; ++i) {
+            const OpCode* pOpCode = pOpCodes + i;
+            fprintf(fp, "%03d | %-23s | ", i, getOpCodeName(pOpCode->dwOpCodeId));
+            switch (pOpCode->dwOpCodeId) {
+                case K_OPCODE_PUSH_NUM:
+                case K_OPCODE_NUM_VAR_BINOP:
+                case K_OPCODE_NUM_VAR_CMP_UNLESS_GOTO:
+                case K_OPCODE_INC_VAR:
+                    Ftoa(pOpCode->uParam.fLiteral, szNumBuf, K_DEFAULT_FTOA_PRECISION);
+                    fprintf(fp, "%s", szNumBuf);
+                    break;
+                case K_OPCODE_PUSH_INT:
+                case K_OPCODE_INT_VAR_BINOP:
+                case K_OPCODE_INT_VAR_CMP_UNLESS_GOTO:
+                case K_OPCODE_INC_VAR_INT:
+                    fprintf(fp, "%d", pOpCode->uParam.iLiteral);
+                    break;
+                case K_OPCODE_PUSH_STR:
+                    printStringEscaped(fp, (const unsigned char *)(pStrPool + pOpCode->uParam.dwStringPoolPos));
+                    break;
+                case K_OPCODE_BINARY_OPERATOR:
+                case K_OPCODE_UNARY_OPERATOR:
+                    fprintf(fp, "%s", getOperatorNameById(pOpCode->uParam.dwOperatorId));
+                    break;
+                case K_OPCODE_POP:
+                    break;
+                case K_OPCODE_PUSH_VAR:
+                case K_OPCODE_SET_VAR:
+                case K_OPCODE_SET_VAR_AS_ARRAY:
+                case K_OPCODE_ARR_GET:
+                case K_OPCODE_ARR_SET:
+                case K_OPCODE_VAR_NUM_BINOP:
+                case K_OPCODE_VAR_VAR_BINOP:
+                case K_OPCODE_VAR_NUM_CMP_UNLESS_GOTO:
+                case K_OPCODE_VAR_VAR_CMP_UNLESS_GOTO:
+                    fprintf(fp, "<%s> %d", pOpCode->uParam.sVarAccess.wIsLocal ? "LOCAL" : "GLOBAL", pOpCode->uParam.sVarAccess.wVarIndex);
+                    break;
+                case K_OPCODE_CALL_BUILT_IN:
+                    fprintf(fp, "%d", pOpCode->uParam.dwBuiltFuncId);
+                    break;
+                case K_OPCODE_CALL_EXT:
+                    fprintf(fp, "%d", pOpCode->uParam.dwExtFuncIndex);
+                    break;
+                case K_OPCODE_GOTO:
+                case K_OPCODE_IF_GOTO:
+                case K_OPCODE_UNLESS_GOTO:
+                    fprintf(fp, "%d", pOpCode->uParam.dwOpCodePos);
+                    break;
+                case K_OPCODE_CALL_FUNC:
+                    fprintf(fp, "%d", pOpCode->uParam.dwFuncIndex);
+                    break;
+            }
+            fprintf(fp, "\n");
         }
-        fprintf(fp, "\n");
     }
 
     fprintf(fp, "------------ String Pool -------------\n");
@@ -237,6 +376,11 @@ static void printAstNodeAsXml(FILE* fp, AstNode* pAstNode, int iTabLevel) {
                 printAstNodeAsXml(fp, pAstNode->uData.sExit.pAstExpression, iTabLevel + 1);
             }
             break;
+        case AST_YIELD:
+            if (pAstNode->uData.sYield.pAstExpression) {
+                printAstNodeAsXml(fp, pAstNode->uData.sYield.pAstExpression, iTabLevel + 1);
+            }
+            break;
         case AST_RETURN:
             if (pAstNode->uData.sReturn.pAstExpression) {
                 printAstNodeAsXml(fp, pAstNode->uData.sReturn.pAstExpression, iTabLevel + 1);
@@ -501,6 +645,16 @@ static void printAstNodeAsJson(FILE* fp, AstNode* pAstNode, int iTabLevel, KBool
             }
             fprintf(fp, "\n");
             break;
+        case AST_YIELD:
+            printTab(fp, iTabLevel + 1); fprintf(fp, "\"expression\": ");
+            if (pAstNode->uData.sYield.pAstExpression) {
+                printAstNodeAsJson(fp, pAstNode->uData.sYield.pAstExpression, iTabLevel + 1, KB_TRUE);
+            }
+            else {
+                fprintf(fp, "null");
+            }
+            fprintf(fp, "\n");
+            break;
         case AST_RETURN:
             printTab(fp, iTabLevel + 1); fprintf(fp, "\"expression\": ");
             if (pAstNode->uData.sReturn.pAstExpression) {
@@ -640,6 +794,22 @@ void formatRuntimeErrorMessage(char* szBuf, const OpCode* pStopOpCode, RuntimeEr
     }
 }
 
+void formatRegRuntimeErrorMessage(char* szBuf, const RegOpCode* pStopRegOpCode, RuntimeErrorId iRuntimeErrorId) {
+    const char* szRuntimeError = getRuntimeErrMsg(iRuntimeErrorId);
+    const char* szOpCodeName = getRegOpCodeName(pStopRegOpCode->bOpCodeId);
+
+    switch (pStopRegOpCode->bOpCodeId) {
+        case K_REG_OPCODE_UNARY_OPERATOR:
+        case K_REG_OPCODE_BINARY_OPERATOR:
+        case K_REG_OPCODE_CMP_UNLESS_GOTO:
+            sprintf(szBuf, "Runtime error in '%s.%s': %s", szOpCodeName, getOperatorNameById(pStopRegOpCode->bOperatorId), szRuntimeError);
+            break;
+        default:
+            sprintf(szBuf, "Runtime error in '%s': %s", szOpCodeName, szRuntimeError);
+            break;
+    }
+}
+
 void printAsJson(const char* szOutputFile, KbAstNode* pAstNode) {
     FILE* fp = NULL;
     if (szOutputFile == NULL) {
@@ -650,11 +820,141 @@ void printAsJson(const char* szOutputFile, KbAstNode* pAstNode) {
     fprintf(fp, "\n");
 }
 
+/* 测试用的拓展函数，check 系列目标都会加载 */
+static const char* SZ_TEST_EXTENSION =
+    "extension = \"test\"\n"
+    "func 1001 -> xadd      (a, b, c)   return \"num\"\n"
+    "func 1002 -> xwrap     (s)         return \"str\"\n"
+    "func 2001 -> xunbound  ()          return \"num\"\n";
+
+/* 参数求和 */
+static RuntimeErrorId testExtAdd(Machine* pMachine, const RtValue* pArrArgs, int iNumArgs, RtValue* pRtResult, void* pUserData) {
+    int i;
+    for (i = 0; i < iNumArgs; ++i) {
+        if (pArrArgs[i].iType != RT_VALUE_NUMBER) {
+            return RUNTIME_TYPE_MISMATCH;
+        }
+        pRtResult->uData.fNumber += pArrArgs[i].uData.fNumber;
+    }
+    return RUNTIME_NONE;
+}
+
+/* 字符串两边加上 pUserData 中的一对括号 */
+static RuntimeErrorId testExtWrap(Machine* pMachine, const RtValue* pArrArgs, int iNumArgs, RtValue* pRtResult, void* pUserData) {
+    const char* szBrackets = (const char *)pUserData;
+    int         iLength;
+    char*       szBuf;
+    if (pArrArgs[0].iType != RT_VALUE_STRING) {
+        return RUNTIME_TYPE_MISMATCH;
+    }
+    iLength = pArrArgs[0].uData.sString.iLength;
+    szBuf = (char *)malloc(iLength + 2);
+    szBuf[0] = szBrackets[0];
+    memcpy(szBuf + 1, pArrArgs[0].uData.sString.szContent, iLength);
+    szBuf[iLength + 1] = szBrackets[1];
+    if (!setRtStringValue(pMachine, pRtResult, szBuf, iLength + 2)) {
+        free(szBuf);
+        return RUNTIME_MEMORY_LIMIT;
+    }
+    free(szBuf);
+    return RUNTIME_NONE;
+}
+
+/*
+ * 保存 pMachine 的快照，恢复到同一份字节码新创建的虚拟机上并销毁 pMachine
+ * 版本号被改坏的快照必须恢复失败，恢复失败时返回 NULL
+ */
+static Machine* continueOnSnapshot(Machine* pMachine, const KByte* pRawSerialized) {
+    Machine*    pMachineNew = createMachine(pRawSerialized);
+    KDword      dwSize;
+    KByte*      pSnapshot   = saveSnapshot(pMachine, &dwSize);
+    KBool       bRestored;
+
+    bindExtFunc(pMachineNew, 1001, testExtAdd, NULL);
+    bindExtFunc(pMachineNew, 1002, testExtWrap, "[]");
+    destroyMachine(pMachine);
+
+    pSnapshot[4] ^= 0xFF;
+    bRestored = !restoreSnapshot(pMachineNew, pSnapshot, dwSize);
+    pSnapshot[4] ^= 0xFF;
+    bRestored = bRestored && restoreSnapshot(pMachineNew, pSnapshot, dwSize);
+    free(pSnapshot);
+
+    if (!bRestored) {
+        destroyMachine(pMachineNew);
+        return NULL;
+    }
+    return pMachineNew;
+}
+
+/* 改坏的跳转目标，远远超过指令末尾 */
+#define TEST_BAD_JUMP_TARGET    0x4000000
+
+/* 把栈字节码里所有跳转目标和函数开始位置改到指令末尾之后，这样的字节码不能通过加载时校验 */
+static void corruptJumpTargets(KByte* pRawSerialized) {
+    BinHeader*      pHeader         = (BinHeader *)pRawSerialized;
+    OpCode*         pArrOpCodes     = (OpCode *)(pRawSerialized + pHeader->dwOpCodeBlockStart);
+    BinFuncInfo*    pArrFuncInfo    = (BinFuncInfo *)(pRawSerialized + pHeader->dwFuncBlockStart);
+    KDword          i;
+
+    for (i = 0; i < pHeader->dwNumOpCode; ++i) {
+        if (pArrOpCodes[i].dwOpCodeId == K_OPCODE_GOTO ||
+            pArrOpCodes[i].dwOpCodeId == K_OPCODE_IF_GOTO ||
+            pArrOpCodes[i].dwOpCodeId == K_OPCODE_UNLESS_GOTO
+        ) {
+            pArrOpCodes[i].uParam.dwOpCodePos = TEST_BAD_JUMP_TARGET;
+        }
+    }
+    for (i = 0; i < pHeader->dwNumFunc; ++i) {
+        pArrFuncInfo[i].dwOpCodePos = TEST_BAD_JUMP_TARGET;
+    }
+}
+
+/* 检查内存上限时使用的上限，普通的用例都放得下 */
+#define TEST_MEMORY_LIMIT   (1024 * 1024)
+
+/* 重置后只剩下创建时分配的槽位和调用帧，字符串和数组全部释放 */
+static KBool isMemStatsBalanced(const MemStats* pMem) {
+    int     i;
+    KDword  dwTotal = 0;
+    for (i = 0; i < RT_MEM_NUM_KIND; ++i) {
+        dwTotal += pMem->arrBytes[i];
+    }
+    return dwTotal == pMem->dwTotal &&
+        pMem->arrBytes[RT_MEM_STRING] == 0 && pMem->arrObjects[RT_MEM_STRING] == 0 &&
+        pMem->arrBytes[RT_MEM_ARRAY] == 0 && pMem->arrObjects[RT_MEM_ARRAY] == 0 &&
+        pMem->dwPeak >= pMem->dwTotal;
+}
+
 typedef enum tagTestTargetId {
     TEST_CHECK_ERROR = 0,
-    TEST_GENERATE_AST
+    TEST_CHECK_REGISTER,
+    TEST_CHECK_SLICED,
+    TEST_CHECK_REGISTER_SLICED,
+    TEST_CHECK_ARENA,
+    TEST_CHECK_SNAPSHOT,
+    TEST_CHECK_REGISTER_SNAPSHOT,
+    TEST_CHECK_MEMORY,
+    TEST_CHECK_REGISTER_MEMORY,
+    TEST_CHECK_OPTIMIZED,
+    TEST_CHECK_REGISTER_OPTIMIZED,
+    TEST_CHECK_REGISTER_OPTIMIZED_SNAPSHOT,
+    TEST_CHECK_BAD_JUMP,
+    TEST_GENERATE_AST,
+    TEST_GENERATE_OPTIMIZED_AST
 } TestTargetId;
 
+/* 生成寄存器字节码的测试目标 */
+#define isRegisterTarget(iTestTargetId) \
+    ((iTestTargetId) == TEST_CHECK_REGISTER || (iTestTargetId) == TEST_CHECK_REGISTER_SLICED || \
+     (iTestTargetId) == TEST_CHECK_REGISTER_SNAPSHOT || (iTestTargetId) == TEST_CHECK_REGISTER_MEMORY || \
+     (iTestTargetId) == TEST_CHECK_REGISTER_OPTIMIZED || (iTestTargetId) == TEST_CHECK_REGISTER_OPTIMIZED_SNAPSHOT)
+
+/* 编译时开启优化的测试目标 */
+#define isOptimizedTarget(iTestTargetId) \
+    ((iTestTargetId) == TEST_CHECK_OPTIMIZED || (iTestTargetId) == TEST_CHECK_REGISTER_OPTIMIZED || \
+     (iTestTargetId) == TEST_CHECK_REGISTER_OPTIMIZED_SNAPSHOT)
+
 
 int testMain(int argc, char** argv) {
     const char*     szInputTarget;          /* 命令行传入的测试目标 */
@@ -670,6 +970,7 @@ int testMain(int argc, char** argv) {
     Context*        pContext;               /* 编译上下文 */
     const AstNode*  pAstSemStop;            /* 编译解析 AST 遇到错误停止时的节点 */
     SemanticErrorId iSemanticErrorId;       /* 语义错误 ID */
+    ExtensionErrorId iExtErrId;             /* 拓展脚本错误 ID */
     KByte*          pRawSerialized;         /* 序列化后的字节 */
     KDword          dwRawSize;              /* 序列化的字节长度 */
     /* Runtime 部分 */
@@ -677,12 +978,31 @@ int testMain(int argc, char** argv) {
     KBool           bExecuteSuccess;        /* 执行是否成功结束 */
     RuntimeErrorId  iRuntimeErrorId;        /* 运行时错误 */
     const OpCode*   pStopOpCode;            /* 运行时错误结束的 opCode */
+    RuntimeExecStatus iExecStatus;          /* 分段执行的状态 */
+    ArenaConfig     sArenaConfig;           /* 测试用的 arena，故意取得很小，覆盖退回 malloc 的情况 */
+    static KByte    arrArenaBuffer[1024 + 3];
+    KByte*          pSnapshot;              /* 检查内存统计时暂存执行结果 */
+    KDword          dwSnapshotSize;
+    KBool           bBalanced;
 
     if (argc != 3) {
         fprintf(stderr, "Usage: %s 'TestTarget' 'SourceCode'\n", argv[0]);
         fprintf(stderr, "Available targets:\n");
         fprintf(stderr, "  check   - Check syntax, semantic or runtime error.\n");
+        fprintf(stderr, "  checkreg - Same as check, but runs register-based bytecode.\n");
+        fprintf(stderr, "  checkslice - Same as check, but suspends and resumes at every jump.\n");
+        fprintf(stderr, "  checkregslice - Same as checkreg, but suspends and resumes at every jump.\n");
+        fprintf(stderr, "  checkarena - Same as check, but allocates from an arena and runs again after reset.\n");
+        fprintf(stderr, "  checksnapshot - Same as checkslice, but continues on a new machine restored from a snapshot.\n");
+        fprintf(stderr, "  checkregsnapshot - Same as checksnapshot, but runs register-based bytecode.\n");
+        fprintf(stderr, "  checkmem - Same as check, but with a memory limit, and checks the accounting after reset.\n");
+        fprintf(stderr, "  checkregmem - Same as checkmem, but runs register-based bytecode.\n");
+        fprintf(stderr, "  checkopt - Same as check, but folds constants and removes redundant opcodes.\n");
+        fprintf(stderr, "  checkregopt - Same as checkopt, but runs register-based bytecode.\n");
+        fprintf(stderr, "  checkregoptsnapshot - Same as checkregsnapshot, but folds constants and removes redundant opcodes.\n");
+        fprintf(stderr, "  checkbadjump - Same as check, but every jump target is past the last opcode.\n");
         fprintf(stderr, "  ast     - Generates an abstract expression tree in JSON format.\n");
+        fprintf(stderr, "  astopt  - Same as ast, but folds constant expressions first.\n");
         return -1;
     }
     szInputTarget = argv[1];
@@ -690,9 +1010,48 @@ int testMain(int argc, char** argv) {
     if (IsStringEqual(szInputTarget, "check")) {
         iTestTargetId = TEST_CHECK_ERROR;
     }
+    else if (IsStringEqual(szInputTarget, "checkreg")) {
+        iTestTargetId = TEST_CHECK_REGISTER;
+    }
+    else if (IsStringEqual(szInputTarget, "checkslice")) {
+        iTestTargetId = TEST_CHECK_SLICED;
+    }
+    else if (IsStringEqual(szInputTarget, "checkregslice")) {
+        iTestTargetId = TEST_CHECK_REGISTER_SLICED;
+    }
+    else if (IsStringEqual(szInputTarget, "checkarena")) {
+        iTestTargetId = TEST_CHECK_ARENA;
+    }
+    else if (IsStringEqual(szInputTarget, "checksnapshot")) {
+        iTestTargetId = TEST_CHECK_SNAPSHOT;
+    }
+    else if (IsStringEqual(szInputTarget, "checkregsnapshot")) {
+        iTestTargetId = TEST_CHECK_REGISTER_SNAPSHOT;
+    }
+    else if (IsStringEqual(szInputTarget, "checkmem")) {
+        iTestTargetId = TEST_CHECK_MEMORY;
+    }
+    else if (IsStringEqual(szInputTarget, "checkregmem")) {
+        iTestTargetId = TEST_CHECK_REGISTER_MEMORY;
+    }
+    else if (IsStringEqual(szInputTarget, "checkopt")) {
+        iTestTargetId = TEST_CHECK_OPTIMIZED;
+    }
+    else if (IsStringEqual(szInputTarget, "checkregopt")) {
+        iTestTargetId = TEST_CHECK_REGISTER_OPTIMIZED;
+    }
+    else if (IsStringEqual(szInputTarget, "checkregoptsnapshot")) {
+        iTestTargetId = TEST_CHECK_REGISTER_OPTIMIZED_SNAPSHOT;
+    }
+    else if (IsStringEqual(szInputTarget, "checkbadjump")) {
+        iTestTargetId = TEST_CHECK_BAD_JUMP;
+    }
     else if (IsStringEqual(szInputTarget, "ast")) {
         iTestTargetId = TEST_GENERATE_AST;
     }
+    else if (IsStringEqual(szInputTarget, "astopt")) {
+        iTestTargetId = TEST_GENERATE_OPTIMIZED_AST;
+    }
     else {
         fprintf(stderr, "Unrecognized target: '%s'\n", szInputTarget);
         return -1;
@@ -701,7 +1060,8 @@ int testMain(int argc, char** argv) {
     szSource = argv[2];
 
     switch (iTestTargetId) {
-        case TEST_GENERATE_AST: {
+        case TEST_GENERATE_AST:
+        case TEST_GENERATE_OPTIMIZED_AST: {
             /* 解析源代码为 AST */
             pAstProgram = parseAsAst(szSource, &iSyntaxErrorId, &iStopStatement, &iStopLineNumber);
             /* 有语法错误 */
@@ -715,11 +1075,26 @@ int testMain(int argc, char** argv) {
                 destroyAst(pAstProgram);
                 return 0;
             }
+            if (iTestTargetId == TEST_GENERATE_OPTIMIZED_AST) {
+                optimizeAst(pAstProgram);
+            }
             /* 打印 AST 为 JSON */
             printAsJson(NULL, pAstProgram);
             break;
         }
-        case TEST_CHECK_ERROR: {
+        case TEST_CHECK_ERROR:
+        case TEST_CHECK_REGISTER:
+        case TEST_CHECK_SLICED:
+        case TEST_CHECK_REGISTER_SLICED:
+        case TEST_CHECK_ARENA:
+        case TEST_CHECK_SNAPSHOT:
+        case TEST_CHECK_REGISTER_SNAPSHOT:
+        case TEST_CHECK_MEMORY:
+        case TEST_CHECK_REGISTER_MEMORY:
+        case TEST_CHECK_OPTIMIZED:
+        case TEST_CHECK_REGISTER_OPTIMIZED:
+        case TEST_CHECK_REGISTER_OPTIMIZED_SNAPSHOT:
+        case TEST_CHECK_BAD_JUMP: {
             /* 解析源代码为 AST */
             pAstProgram = parseAsAst(szSource, &iSyntaxErrorId, &iStopStatement, &iStopLineNumber);
             /* 有语法错误 */
@@ -735,8 +1110,13 @@ int testMain(int argc, char** argv) {
                 destroyAst(pAstProgram);
                 return 0;
             }
-            /* 编译 AST 为上下文 */
+            /* 折叠常量表达式，结果必须和不折叠时相同 */
+            if (isOptimizedTarget(iTestTargetId)) {
+                optimizeAst(pAstProgram);
+            }
+            /* 编译 AST 为上下文，加载测试用的拓展函数 */
             pContext = createContext(pAstProgram);
+            KExtension_Parse(pContext->szExtensionId, pContext->pListExtFuncs, SZ_TEST_EXTENSION, &iExtErrId, &iStopLineNumber);
             buildContext(pContext, pAstProgram, &iSemanticErrorId, &pAstSemStop);
             /* 有语义错误 */
             if (iSemanticErrorId != SEM_NO_ERROR) {
@@ -754,17 +1134,133 @@ int testMain(int argc, char** argv) {
             }
             destroyAst(pAstProgram);
 
+            if (isOptimizedTarget(iTestTargetId)) {
+                optimizeContextOpCodes(pContext);
+            }
+
+            /* 常见指令序列融合为超级指令 */
+            fuseContextOpCodes(pContext);
+
             /* 序列化上下文 */
-            serializeContext(pContext, &pRawSerialized, &dwRawSize);
+            if (isRegisterTarget(iTestTargetId)) {
+                serializeContextReg(pContext, &pRawSerialized, &dwRawSize);
+            } else {
+                serializeContext(pContext, &pRawSerialized, &dwRawSize);
+            }
             destroyContext(pContext);
+            if (iTestTargetId == TEST_CHECK_BAD_JUMP) {
+                corruptJumpTargets(pRawSerialized);
+            }
 
             /* 执行 opCode */
-            pMachine = createMachine(pRawSerialized);
-            bExecuteSuccess = executeMachine(pMachine, 0, &iRuntimeErrorId, &pStopOpCode);
+            if (iTestTargetId == TEST_CHECK_ARENA) {
+                /* 缓冲区故意不对齐，检查 arena 的对齐处理 */
+                sArenaConfig.pBuffer = arrArenaBuffer + 3;
+                sArenaConfig.dwSize = 1024;
+                pMachine = createMachineEx(pRawSerialized, &sArenaConfig);
+            } else {
+                pMachine = createMachine(pRawSerialized);
+            }
+            bindExtFunc(pMachine, 1001, testExtAdd, NULL);
+            bindExtFunc(pMachine, 1002, testExtWrap, "[]");
+            /* 改坏跳转目标的字节码必须校验失败，由带检查的执行循环执行，跳到指令末尾之后时结束 */
+            if (iTestTargetId == TEST_CHECK_BAD_JUMP && pMachine->bVerified) {
+                printf("{\n");
+                printf("  \"error\": true,\n");
+                printf("  \"errorId\": \"BAD_JUMP_VERIFIED\",\n");
+                printf("  \"errorMessage\": \"Bytecode with out-of-range jump targets passed load-time verification\"\n");
+                printf("}\n");
+                destroyMachine(pMachine);
+                free(pRawSerialized);
+                return 0;
+            }
+            /* 编译器生成的栈字节码必须能通过加载时校验，寄存器字节码不做校验 */
+            if (pMachine->pArrOpCodes && !pMachine->bVerified && iTestTargetId != TEST_CHECK_BAD_JUMP) {
+                printf("{\n");
+                printf("  \"error\": true,\n");
+                printf("  \"errorId\": \"BYTECODE_NOT_VERIFIED\",\n");
+                printf("  \"errorMessage\": \"Compiled bytecode failed load-time verification\"\n");
+                printf("}\n");
+                destroyMachine(pMachine);
+                free(pRawSerialized);
+                return 0;
+            }
+            /* 分段执行时使用带检查的执行循环，两种执行循环都被测试覆盖 */
+            if (iTestTargetId == TEST_CHECK_SLICED) {
+                pMachine->bVerified = KB_FALSE;
+            }
+            if (iTestTargetId == TEST_CHECK_ARENA) {
+                /* 执行一次后重置，第二次执行的结果必须和第一次相同 */
+                executeMachine(pMachine, 0, &iRuntimeErrorId, &pStopOpCode);
+                resetMachine(pMachine);
+                bExecuteSuccess = executeMachine(pMachine, 0, &iRuntimeErrorId, &pStopOpCode);
+            }
+            else if (iTestTargetId == TEST_CHECK_SLICED || iTestTargetId == TEST_CHECK_REGISTER_SLICED) {
+                /* 预算为 1，每次跳转和 yield 都挂起再继续，结果必须和一次执行完相同 */
+                iExecStatus = executeMachineBudget(pMachine, 0, 1, &iRuntimeErrorId, &pStopOpCode);
+                while (iExecStatus == RT_EXEC_SUSPENDED || iExecStatus == RT_EXEC_YIELDED) {
+                    iExecStatus = resumeMachine(pMachine, 1, &iRuntimeErrorId, &pStopOpCode);
+                }
+                bExecuteSuccess = iExecStatus != RT_EXEC_ERROR;
+            }
+            else if (iTestTargetId == TEST_CHECK_SNAPSHOT || iTestTargetId == TEST_CHECK_REGISTER_SNAPSHOT ||
+                iTestTargetId == TEST_CHECK_REGISTER_OPTIMIZED_SNAPSHOT
+            ) {
+                /* 每次挂起都保存快照，恢复到新的虚拟机上继续执行，结果必须和一次执行完相同 */
+                iExecStatus = executeMachineBudget(pMachine, 0, 1, &iRuntimeErrorId, &pStopOpCode);
+                while (iExecStatus == RT_EXEC_SUSPENDED || iExecStatus == RT_EXEC_YIELDED) {
+                    pMachine = continueOnSnapshot(pMachine, pRawSerialized);
+                    if (!pMachine) {
+                        printf("{\n");
+                        printf("  \"error\": true,\n");
+                        printf("  \"errorId\": \"SNAPSHOT_NOT_RESTORED\",\n");
+                        printf("  \"errorMessage\": \"Snapshot could not be restored, or a corrupted one was accepted\"\n");
+                        printf("}\n");
+                        free(pRawSerialized);
+                        return 0;
+                    }
+                    iExecStatus = resumeMachine(pMachine, 1, &iRuntimeErrorId, &pStopOpCode);
+                }
+                bExecuteSuccess = iExecStatus != RT_EXEC_ERROR;
+            }
+            else if (iTestTargetId == TEST_CHECK_MEMORY || iTestTargetId == TEST_CHECK_REGISTER_MEMORY) {
+                /* 限制内存执行一次，重置后字符串和数组必须全部释放，统计回到零 */
+                setMemoryLimit(pMachine, TEST_MEMORY_LIMIT);
+                bExecuteSuccess = executeMachine(pMachine, 0, &iRuntimeErrorId, &pStopOpCode);
+                if (bExecuteSuccess) {
+                    pSnapshot = saveSnapshot(pMachine, &dwSnapshotSize);
+                    resetMachine(pMachine);
+                    bBalanced = isMemStatsBalanced(getMemStats(pMachine));
+                    restoreSnapshot(pMachine, pSnapshot, dwSnapshotSize);
+                    free(pSnapshot);
+                } else {
+                    /* 重置会清除出错的位置，输出错误信息时还需要 */
+                    const RegOpCode* pRegOpCodeStop = pMachine->pRegOpCodeCur;
+                    resetMachine(pMachine);
+                    bBalanced = isMemStatsBalanced(getMemStats(pMachine));
+                    pMachine->pRegOpCodeCur = pRegOpCodeStop;
+                }
+                if (!bBalanced) {
+                    printf("{\n");
+                    printf("  \"error\": true,\n");
+                    printf("  \"errorId\": \"MEMORY_NOT_BALANCED\",\n");
+                    printf("  \"errorMessage\": \"Memory accounting is not zero after the machine was reset\"\n");
+                    printf("}\n");
+                    destroyMachine(pMachine);
+                    free(pRawSerialized);
+                    return 0;
+                }
+            } else {
+                bExecuteSuccess = executeMachine(pMachine, 0, &iRuntimeErrorId, &pStopOpCode);
+            }
     
             /* 执行有错误 */
             if (!bExecuteSuccess) {
-                formatRuntimeErrorMessage(szErrorMessage, pStopOpCode, iRuntimeErrorId);
+                if (pStopOpCode) {
+                    formatRuntimeErrorMessage(szErrorMessage, pStopOpCode, iRuntimeErrorId);
+                } else {
+                    formatRegRuntimeErrorMessage(szErrorMessage, pMachine->pRegOpCodeCur, iRuntimeErrorId);
+                }
                 printf("{\n");
                 printf("  \"error\": true,\n");
                 printf("  \"errorId\": \"%s\",\n", getRuntimeErrName(iRuntimeErrorId));
@@ -784,7 +1280,7 @@ int testMain(int argc, char** argv) {
                 else {
                     const char* szValueStringified;
                     KBool       bNeedDispose;
-                    RtValue*    pRtValue = pMachine->pArrPtrGlobalVars[0];
+                    RtValue*    pRtValue = &pMachine->pArrGlobalVars[0];
 
                     szValueStringified = stringifyRtValue(pRtValue, &bNeedDispose);
 
@@ -9,4 +9,5 @@ void dumpKbasicBinary           (const char* szOutputFile, const KByte* pRawSeri
 void formatSyntaxErrorMessage   (char* szBuf, int iStopLineNumber, StatementId iStopStatement, SyntaxErrorId iSyntaxErrorId);
 void formatSemanticErrorMessage (char* szBuf, const AstNode* pAstSemStop, SemanticErrorId iSemanticErrorId);
 void formatRuntimeErrorMessage  (char* szBuf, const OpCode* pStopOpCode, RuntimeErrorId iRuntimeErrorId);
+void formatRegRuntimeErrorMessage(char* szBuf, const KbRegOpCode* pStopRegOpCode, RuntimeErrorId iRuntimeErrorId);
 #endif
\ No newline at end of file
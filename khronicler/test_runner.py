@@ -403,6 +403,11 @@ SyntaxTestCases = [
     "source": "exit 1 notEnd",
     "expected": "SYN_EXPECT_LINE_END",
   },
+  {
+    "caseId": "YieldNotEnd",
+    "source": "yield 1 notEnd",
+    "expected": "SYN_EXPECT_LINE_END",
+  },
   {
     "caseId": "ReturnOutsideFunction",
     "source": "if 1=1\n  return",
@@ -813,6 +818,175 @@ AstTestCases = [
   },
 ]
 
+# 常量折叠后的抽象语法树测试用例，只在 astopt 下运行
+OptimizedAstTestCases = [
+  {
+    "caseId": "OptFoldArithmetic",
+    "source": "dim a = 1 + 2 * 3",
+    "expected": {
+      "astType": "Program",
+      "numOfControl": 0,
+      "statements": [
+        {
+          "astType": "Dim",
+          "lineNumber": 1,
+          "variable": "a",
+          "initializer": {
+            "astType": "LiteralNumeric",
+            "value": 7
+          }
+        }
+      ]
+    }
+  },
+  {
+    "caseId": "OptFoldConcat",
+    "source": "dim a = \"a\" & (1 + 1) & \"b\"",
+    "expected": {
+      "astType": "Program",
+      "numOfControl": 0,
+      "statements": [
+        {
+          "astType": "Dim",
+          "lineNumber": 1,
+          "variable": "a",
+          "initializer": {
+            "astType": "LiteralString",
+            "value": "a2b"
+          }
+        }
+      ]
+    }
+  },
+  {
+    "caseId": "OptKeepDivisionByZero",
+    "source": "dim a = 1 / 0",
+    "expected": {
+      "astType": "Program",
+      "numOfControl": 0,
+      "statements": [
+        {
+          "astType": "Dim",
+          "lineNumber": 1,
+          "variable": "a",
+          "initializer": {
+            "astType": "BinaryOperator",
+            "operator": "DIV",
+            "leftOperand": {
+              "astType": "LiteralNumeric",
+              "value": 1
+            },
+            "rightOperand": {
+              "astType": "LiteralNumeric",
+              "value": 0
+            }
+          }
+        }
+      ]
+    }
+  },
+  {
+    "caseId": "OptIdentity",
+    "source": "dim a\na = (a > 0) * 1 + 0",
+    "expected": {
+      "astType": "Program",
+      "numOfControl": 0,
+      "statements": [
+        {
+          "astType": "Dim",
+          "lineNumber": 1,
+          "variable": "a",
+          "initializer": None
+        },
+        {
+          "astType": "Assign",
+          "lineNumber": 2,
+          "variable": "a",
+          "value": {
+            "astType": "BinaryOperator",
+            "operator": "GT",
+            "leftOperand": {
+              "astType": "Variable",
+              "variable": "a"
+            },
+            "rightOperand": {
+              "astType": "LiteralNumeric",
+              "value": 0
+            }
+          }
+        }
+      ]
+    }
+  },
+  {
+    "caseId": "OptKeepUnknownAddZero",
+    "source": "dim a\na = a + 0",
+    "expected": {
+      "astType": "Program",
+      "numOfControl": 0,
+      "statements": [
+        {
+          "astType": "Dim",
+          "lineNumber": 1,
+          "variable": "a",
+          "initializer": None
+        },
+        {
+          "astType": "Assign",
+          "lineNumber": 2,
+          "variable": "a",
+          "value": {
+            "astType": "BinaryOperator",
+            "operator": "ADD",
+            "leftOperand": {
+              "astType": "Variable",
+              "variable": "a"
+            },
+            "rightOperand": {
+              "astType": "LiteralNumeric",
+              "value": 0
+            }
+          }
+        }
+      ]
+    }
+  },
+  {
+    "caseId": "OptConditionNotNot",
+    "source": "dim a\nwhile !!(a < 1)\nend while",
+    "expected": {
+      "astType": "Program",
+      "numOfControl": 1,
+      "statements": [
+        {
+          "astType": "Dim",
+          "lineNumber": 1,
+          "variable": "a",
+          "initializer": None
+        },
+        {
+          "astType": "While",
+          "lineNumber": 2,
+          "controlId": 1,
+          "condition": {
+            "astType": "BinaryOperator",
+            "operator": "LT",
+            "leftOperand": {
+              "astType": "Variable",
+              "variable": "a"
+            },
+            "rightOperand": {
+              "astType": "LiteralNumeric",
+              "value": 1
+            }
+          },
+          "statements": []
+        }
+      ]
+    }
+  },
+]
+
 # 语义错误测试用例
 SemanticTestCases = [
   {
@@ -1004,6 +1178,67 @@ RuntimeTestCases = [
      "source": "func accessArrEl(a[])\n  p(a[0])\nend func\naccessArrEl(0)",
      "expected": "RUNTIME_NOT_ARRAY",
   },
+  {
+     "caseId": "StackOverflow",
+     "source": "func deep(n)\n  if n = 0\n    return 0\n  end if\n  return 1 + deep(n - 1)\nend func\ndeep(5000)",
+     "expected": "RUNTIME_STACK_OVERFLOW",
+  },
+  {
+     "caseId": "DivisionByZero3",
+     "source": "dim a = 1\ndim b = a / 0",
+     "expected": "RUNTIME_DIVISION_BY_ZERO",
+  },
+  {
+     "caseId": "ExtFuncUnbound",
+     "source": "dim a = xadd(1, 2, 3)\na = xunbound()",
+     "expected": "RUNTIME_EXT_FUNC_UNBOUND",
+  },
+  {
+     "caseId": "ExtFuncError",
+     "source": "dim a = xadd(1, \"2\", 3)",
+     "expected": "RUNTIME_TYPE_MISMATCH",
+  },
+  {
+     "caseId": "YieldNotNumber",
+     "source": "dim a = 1\nyield \"a\"",
+     "expected": "RUNTIME_TYPE_MISMATCH",
+  },
+  {
+     "caseId": "QuickenedDivisionByZero",
+     "source": "func dv(a, b)\n  return (a + 0) / (b + 0)\nend func\ndim i\nfor i = 1 to 3\n  dv(i, i)\nnext i\ndv(1, 0)",
+     "expected": "RUNTIME_DIVISION_BY_ZERO",
+  },
+]
+
+# 超过内存上限的用例，只在 checkmem 和 checkregmem 下运行
+MemoryLimitTestCases = [
+  {
+     "caseId": "MemoryLimitArray",
+     "source": "dim a[1000000]",
+     "expected": "RUNTIME_MEMORY_LIMIT",
+  },
+  {
+     "caseId": "MemoryLimitConcat",
+     "source": "dim s = \"ab\"\nwhile 1\n  s = s & s\nend while",
+     "expected": "RUNTIME_MEMORY_LIMIT",
+  },
+  {
+     "caseId": "MemoryLimitUnpackArray",
+     "source": "dim a[100000]\na[1] = 1.5\na[2] = \"x\"",
+     "expected": "RUNTIME_MEMORY_LIMIT",
+  },
+  {
+     "caseId": "MemoryLimitFrames",
+     # 深度不超过栈深度限制，局部变量多，先达到内存上限
+     "source": "func deep(n)\n" + "".join("  dim v%d = n\n" % i for i in range(32)) +
+               "  if n = 0\n    return 0\n  end if\n  return 1 + deep(n - 1)\nend func\ndeep(3000)",
+     "expected": "RUNTIME_MEMORY_LIMIT",
+  },
+  {
+     "caseId": "MemoryLimitExtFunc",
+     "source": "dim s = \"ab\"\nwhile 1\n  s = xwrap(s & s)\nend while",
+     "expected": "RUNTIME_MEMORY_LIMIT",
+  },
 ]
 
 # 运算值测试用例
@@ -1121,12 +1356,300 @@ for i = 0 to len(array) - 1
 next i
 """
 
+SourceStringOwnership = """
+dim result = ""
+func decorate(s)
+  dim t = "<" & s & ">"
+  return t
+end func
+dim arr[3]
+dim i
+for i = 0 to 2
+  arr[i] = decorate(i)
+next i
+arr[0] = arr[2]
+result = arr[0]
+result = result & arr[1] & result
+"""
+
+SourceFusedOpCodes = """
+dim result = 0
+dim s = "x"
+dim i
+for i = 1 to 10 step 3
+  result = result + i * 2
+next i
+while s <> 5
+  result = result + 1
+  if result >= 50
+    s = 5
+  end if
+end while
+"""
+
+SourceSharedStringBuffer = """
+dim result
+dim s = "a"
+dim t
+dim v = "4" & ""
+dim w = v & "5"
+dim i
+for i = 1 to 3
+  s = s & i
+  if i = 1
+    t = s
+  end if
+next i
+result = t & "|" & s & "|" & len(t) & "|" & (t = "a1") & "|" & val(v) & asc(v)
+"""
+
+SourceFrameChunks = """
+dim result
+func fill(a[], n)
+  dim local[8]
+  dim i
+  for i = 0 to 7
+    local[i] = n
+  next i
+  if n > 0
+    fill(local, n - 1)
+  end if
+  a[0] = local[0] + local[1]
+  return a[0]
+end func
+dim top[1]
+result = fill(top, 300) & "|" & top[0] & "|" & fill(top, 2)
+"""
+
+SourceRandRange = """
+dim result
+dim i
+dim r
+dim bad = 0
+dim low = 0
+for i = 1 to 2000
+  r = rand()
+  if r < 0 || r >= 1
+    bad = bad + 1
+  end if
+  if r < 0.5
+    low = low + 1
+  end if
+next i
+result = bad & "|" & (low > 800 && low < 1200)
+"""
+
+SourcePackedArray = """
+dim result
+dim a[5]
+dim b[2]
+dim i
+for i = 0 to 4
+  a[i] = i * 2
+next i
+dim s = a[1] + a[4]
+a[2] = "x"
+a[3] = a[3] + 1
+b[0] = 7
+b[1] = a
+result = s & "|" & a[2] & a[3] & "|" & len(a) & "|" & a[0] & b[0]
+"""
+
+SourceSharedArray = """
+dim result
+func make(n)
+  dim t[n]
+  t[n - 1] = "m" & n
+  return t
+end func
+func at(a[], i)
+  return a[i]
+end func
+func stash(box[])
+  dim t[3]
+  t[2] = "s"
+  box[1] = t
+end func
+dim a[3]
+dim box[3]
+a[1] = "x"
+box[0] = a
+redim a[2]
+stash(box)
+box[2] = make(4)
+result = len(box[0]) & at(box[0], 1) & "|" & len(box[1]) & at(box[1], 2) & "|" & len(box[2]) & at(box[2], 3)
+"""
+
+SourceQuickening = """
+dim result = ""
+func id(x)
+  return x
+end func
+func same(a, b)
+  return id(a) = id(b)
+end func
+dim i
+for i = 1 to 3
+  result = result & same(i, 2) & (id(i) * id(i) - id(1)) / id(2)
+next i
+result = result & "|" & same("x", "x") & same("x", "y") & same(1, "1") & same(4, 4)
+"""
+
+SourceYield = """
+dim result = ""
+func tick(n)
+  dim k = n * 10
+  yield k
+  result = result & "a" & k
+  yield
+  return k + 1
+end func
+dim i
+dim r
+for i = 1 to 3
+  r = tick(i)
+  result = result & r & ","
+  yield i
+next i
+"""
+
+SourceExtFunctions = """
+dim result = ""
+func addLocal(n)
+  dim m = n * 2
+  return xadd(n, m, 1 + xadd(0, 0, 1))
+end func
+dim i
+for i = 1 to 3
+  result = result & xwrap("" & xadd(i, i * 10, 100))
+next i
+result = result & xwrap(xwrap("k")) & addLocal(4)
+"""
+
+SourceIntegers = """
+dim result
+dim big = 2147483647
+dim a[3]
+dim i
+dim n = 0
+for i = 0 to 2
+  a[i] = i * 3
+next i
+a[1] = a[1] / 2
+big = big + 1
+for i = 2147483646 to 2147483647
+  n = n + 1
+next i
+result = (7 / 2) & "," & (6 / 2) & "," & ((0 - 7) % 3) & "," & (7 \ 2) & "," & a[0] & a[1] & a[2] & "," & (big > 2147483647) & n & (i > 2147483647) & "," & (0 - 2147483647 - 1) & "," & (46341 * 46341 > 2147483647) & (2 * 3)
+"""
+
+SourceConstantFolding = """
+dim result
+dim x = 2.5
+dim n = 7
+result = (1 + 2 * 3) & "," & (7 / 2) & "," & (7 \ 2) & "," & (0 - 7) % 3 & "," & 2 ^ 10 & "," & (2147483647 + 1) & ","
+result = result & ("ab" = "ab") & ("a" <> 1) & (0.1 + 0.2 ~= 0.3) & ("" || 2) & (!"") & (!!0.5) & ","
+result = result & x * 1 & ((0 - 0.0) + 0) & (n / 1 - 0) & ((n > 1) + 0) & ","
+if !!(n > 1) && !!"s"
+  result = result & "T"
+end if
+"""
+
+SourcePeephole = """
+dim r = ""
+dim i
+func f(x)
+  if x > 1
+    return x
+  else
+    return 0
+  end if
+  r = r & "dead"
+end func
+i = 0
+while i < 3
+  if i = 1
+  else
+    r = r & i
+  end if
+  i = i + 1
+  1
+end while
+goto a
+r = r & "skip"
+a:
+goto b
+b:
+r = r & f(5)
+i = 0
+do
+  i = i + 1
+  if i = 2 goto c
+  r = r & "d" & i
+  c:
+  if !!(i > 3)
+    r = r & "e"
+  end if
+while i < 4
+for i = 1 to 3
+  if i = 2
+    continue
+  end if
+  r = r & "f" & i
+next i
+"""
+
+# 符号数量超过哈希表的初始容量，检查扩容后的查找
+SourceManySymbols = "dim result = 0\n" \
+  + "".join("dim g%d = %d\n" % (i, i) for i in range(40)) \
+  + "".join(
+    "func f%d(a)\n" % k
+    + "".join("  dim l%d = a + %d\n" % (j, j) for j in range(25))
+    + "  return l24 + %d\nend func\n" % k
+    for k in range(20)) \
+  + "".join("result = result + f%d(g%d)\n" % (k, k) for k in range(20)) \
+  + "".join("result = result + g%d\n" % i for i in range(20, 40)) \
+  + "goto L19\n" \
+  + "".join("L%d:\nresult = result + 1000\n" % k for k in range(19)) \
+  + "L19:\n"
+
+# 字符串常量超过原来 500 字节的常量池限制，包含重复的字面值和互为后缀的字面值
+SourceStringPool = """
+dim result = ""
+dim s = ""
+dim i
+for i = 1 to 2
+  s = s & "The old lighthouse keeper has not spoken to anyone in years."
+  s = s & "They say the lamp still burns every night, though no ship has come."
+  s = s & "Bring him the letter from the harbor master, and mind the stairs."
+  s = s & "The stairs creak, the wind howls, and the sea keeps its own counsel."
+  s = s & "Hello, traveler."
+  s = s & "traveler."
+  s = s & "The lamp flickers as you step inside the cold stone tower."
+  s = s & "A voice calls down from above: who climbs my stairs tonight?"
+  s = s & "You hold up the letter and the voice falls silent for a moment."
+  s = s & "Then footsteps, slow and heavy, coming down the spiral steps."
+next i
+result = len(s) & "|" & "traveler." & "|" & "Hello, traveler." & "|" & "" & "stairs."
+"""
+
+SourceAdjacentFuncs = """
+dim result
+func f(x)
+  return x * 2
+end func
+func g(x)
+  return x + 1
+end func
+result = f(1) + g(3)
+"""
+
 ValueTestCases = [
   {
     "caseId": "FloatRelEqual",
     "source": SourceFloatRelEqual,
     "expected": {
-      "type": "number",
+      "type": "integer",
       "stringified": "1"
     }
   },
@@ -1134,7 +1657,7 @@ ValueTestCases = [
     "caseId": "Factorial",
     "source": SourceFactorial,
     "expected": {
-      "type": "number",
+      "type": "integer",
       "stringified": "120"
     }
   },
@@ -1142,7 +1665,7 @@ ValueTestCases = [
     "caseId": "Fibonacci",
     "source": SourceFibonacci,
     "expected": {
-      "type": "number",
+      "type": "integer",
       "stringified": "55"
     }
   },
@@ -1150,7 +1673,7 @@ ValueTestCases = [
     "caseId": "MutualPrime",
     "source": SourceMutualPrime,
     "expected": {
-      "type": "number",
+      "type": "integer",
       "stringified": "1"
     }
   },
@@ -1158,7 +1681,7 @@ ValueTestCases = [
     "caseId": "FastPower",
     "source": SourceFastPower,
     "expected": {
-      "type": "number",
+      "type": "integer",
       "stringified": "1024"
     }
   },
@@ -1174,7 +1697,7 @@ ValueTestCases = [
     "caseId": "StringFunctions",
     "source": SourceStringFunctions,
     "expected": {
-      "type": "number",
+      "type": "integer",
       "stringified": "1"
     }
   },
@@ -1186,6 +1709,179 @@ ValueTestCases = [
       "stringified": "5040302010"
     }
   },
+  {
+    "caseId": "StringOwnership",
+    "source": SourceStringOwnership,
+    "expected": {
+      "type": "string",
+      "stringified": "<2><1><2>"
+    }
+  },
+  {
+    "caseId": "FusedOpCodes",
+    "source": SourceFusedOpCodes,
+    "expected": {
+      "type": "integer",
+      "stringified": "50"
+    }
+  },
+  {
+    "caseId": "SharedStringBuffer",
+    "source": SourceSharedStringBuffer,
+    "expected": {
+      "type": "string",
+      "stringified": "a1|a123|2|1|452"
+    }
+  },
+  {
+    "caseId": "FrameChunks",
+    "source": SourceFrameChunks,
+    "expected": {
+      "type": "string",
+      "stringified": "45150|45150|3"
+    }
+  },
+  {
+    "caseId": "RandRange",
+    "source": SourceRandRange,
+    "expected": {
+      "type": "string",
+      "stringified": "0|1"
+    }
+  },
+  {
+    "caseId": "PackedArray",
+    "source": SourcePackedArray,
+    "expected": {
+      "type": "string",
+      "stringified": "10|x7|5|07"
+    }
+  },
+  {
+    "caseId": "SharedArray",
+    "source": SourceSharedArray,
+    "expected": {
+      "type": "string",
+      "stringified": "3x|3s|4m4"
+    }
+  },
+  {
+    "caseId": "Quickening",
+    "source": SourceQuickening,
+    "expected": {
+      "type": "string",
+      "stringified": "0011.504|1001"
+    }
+  },
+  {
+    "caseId": "Yield",
+    "source": SourceYield,
+    "expected": {
+      "type": "string",
+      "stringified": "a1011,a2021,a3031,"
+    }
+  },
+  {
+    "caseId": "ExtFunctions",
+    "source": SourceExtFunctions,
+    "expected": {
+      "type": "string",
+      "stringified": "[111][122][133][[k]]14"
+    }
+  },
+  {
+    "caseId": "Integers",
+    "source": SourceIntegers,
+    "expected": {
+      "type": "string",
+      "stringified": "3.5,3,-1,3,01.56,121,-2147483648,16"
+    }
+  },
+  {
+    "caseId": "ConstantFolding",
+    "source": SourceConstantFolding,
+    "expected": {
+      "type": "string",
+      "stringified": "7,3.5,3,-1,1024,2147483648,111110,2.5071,T"
+    }
+  },
+  {
+    "caseId": "Peephole",
+    "source": SourcePeephole,
+    "expected": {
+      "type": "string",
+      "stringified": "025d1d3d4ef1f3"
+    }
+  },
+  {
+    "caseId": "ManySymbols",
+    "source": SourceManySymbols,
+    "expected": {
+      "type": "integer",
+      "stringified": "1450"
+    }
+  },
+  {
+    "caseId": "StringPool",
+    "source": SourceStringPool,
+    "expected": {
+      "type": "string",
+      "stringified": "1054|traveler.|Hello, traveler.|stairs."
+    }
+  },
+  {
+    "caseId": "AdjacentFuncs",
+    "source": SourceAdjacentFuncs,
+    "expected": {
+      "type": "integer",
+      "stringified": "6"
+    }
+  },
+]
+
+# 跳转目标和函数开始位置被改到指令末尾之后，字节码不能通过校验
+# 带检查的执行循环执行到第一次跳转时结束，不能崩溃
+BadJumpTestCases = [
+  {
+    "caseId": "BadGoto",
+    "source": "dim result = 1\ngoto skip\nresult = 2\nskip:\nresult = result + 10",
+    "expected": {
+      "type": "integer",
+      "stringified": "1"
+    }
+  },
+  {
+    "caseId": "BadUnlessGoto",
+    "source": "dim result = 1\nif result > 2\n  result = 7\nelse\n  result = 9\nend if",
+    "expected": {
+      "type": "integer",
+      "stringified": "1"
+    }
+  },
+  {
+    "caseId": "BadLoopJump",
+    "source": "dim result = 0\nwhile result < 5\n  result = result + 1\nend while",
+    "expected": {
+      "type": "integer",
+      "stringified": "1"
+    }
+  },
+  {
+    "caseId": "BadFusedCmpJump",
+    "source": "dim result = 0\ndim i\nfor i = 1 to 10\n  result = result + i\nnext i",
+    "expected": {
+      "type": "integer",
+      "stringified": "1"
+    }
+  },
+  {
+    "caseId": "BadFuncStart",
+    "source": "dim result = 5\nfunc f(a)\n  return a * 2\nend func\nresult = f(result)",
+    "expected": {
+      "type": "integer",
+      "stringified": "5"
+    }
+  },
 ]
 
 # 测试结果合集
@@ -1193,13 +1889,18 @@ testResults = []
 numCases = 0
 numPassed = 0
 
-def runErrorCheckingCase(cases):
+# 寄存器字节码的用例 ID 加上后缀区分
+def caseIdOfTarget(caseId, target):
+  return caseId if target == "check" else caseId + "@" + target
+
+def runErrorCheckingCase(cases, target="check"):
   global numCases
   global numPassed
   for testCase in cases:
+    caseId = caseIdOfTarget(testCase["caseId"], target)
     # 进行测试
     result = subprocess.check_output(
-        [TestProgram, "check", testCase["source"]],
+        [TestProgram, target, testCase["source"]],
         stderr=subprocess.STDOUT
     )
     # 解析获得的 JSON 格式的命令行输出
@@ -1210,11 +1911,11 @@ def runErrorCheckingCase(cases):
     if isPassed:
         numPassed = numPassed + 1
     # 输出结果到命令行
-    print(("PASSED" if isPassed else "FAILED") + " - " + testCase["caseId"])
+    print(("PASSED" if isPassed else "FAILED") + " - " + caseId)
     # 测试结果添加到合集
     testResults.append(
       {
-        "caseId": testCase["caseId"],
+        "caseId": caseId,
         "source": renderSource(testCase["source"]),
         "passed": isPassed,
         "expected": testCase["expected"],
@@ -1222,13 +1923,13 @@ def runErrorCheckingCase(cases):
       }
     )
 
-def runAstCheckingCase(cases):
+def runAstCheckingCase(cases, target="ast"):
   global numCases
   global numPassed
   for testCase in cases:
     # 进行测试
     result = subprocess.check_output(
-        [TestProgram, "ast", testCase["source"]],
+        [TestProgram, target, testCase["source"]],
         stderr=subprocess.STDOUT
     )
     # 解析获得的 JSON 格式的命令行 AST 输出
@@ -1257,13 +1958,14 @@ def runAstCheckingCase(cases):
       }
     )
 
-def runValueCheckingCase(cases):
+def runValueCheckingCase(cases, target="check"):
   global numCases
   global numPassed
   for testCase in cases:
+    caseId = caseIdOfTarget(testCase["caseId"], target)
     # 进行测试
     result = subprocess.check_output(
-        [TestProgram, "check", testCase["source"]],
+        [TestProgram, target, testCase["source"]],
         stderr=subprocess.STDOUT
     )
     # 解析获得的 JSON 格式的命令行输出
@@ -1274,11 +1976,11 @@ def runValueCheckingCase(cases):
     if isPassed:
         numPassed = numPassed + 1
     # 输出结果到命令行
-    print(("PASSED" if isPassed else "FAILED") + " - " + testCase["caseId"])
+    print(("PASSED" if isPassed else "FAILED") + " - " + caseId)
     # 测试结果添加到合集
     testResults.append(
       {
-        "caseId": testCase["caseId"],
+        "caseId": caseId,
         "source": renderSource(testCase["source"]),
         "passed": isPassed,
         "expected": testCase["expected"],
@@ -1288,9 +1990,41 @@ def runValueCheckingCase(cases):
 
 runErrorCheckingCase(SyntaxTestCases)
 runAstCheckingCase(AstTestCases)
+runAstCheckingCase(OptimizedAstTestCases, "astopt")
 runErrorCheckingCase(SemanticTestCases)
 runErrorCheckingCase(RuntimeTestCases)
 runValueCheckingCase(ValueTestCases)
+# 同样的用例在寄存器虚拟机上运行一遍
+runErrorCheckingCase(RuntimeTestCases, "checkreg")
+runValueCheckingCase(ValueTestCases, "checkreg")
+# 每次跳转都挂起再继续执行
+runErrorCheckingCase(RuntimeTestCases, "checkslice")
+runValueCheckingCase(ValueTestCases, "checkslice")
+runErrorCheckingCase(RuntimeTestCases, "checkregslice")
+runValueCheckingCase(ValueTestCases, "checkregslice")
+runErrorCheckingCase(RuntimeTestCases, "checkarena")
+runValueCheckingCase(ValueTestCases, "checkarena")
+# 每次挂起都从快照恢复到新的虚拟机上继续执行
+runErrorCheckingCase(RuntimeTestCases, "checksnapshot")
+runValueCheckingCase(ValueTestCases, "checksnapshot")
+runErrorCheckingCase(RuntimeTestCases, "checkregsnapshot")
+runValueCheckingCase(ValueTestCases, "checkregsnapshot")
+# 限制内存执行，重置后检查内存统计
+runErrorCheckingCase(RuntimeTestCases, "checkmem")
+runValueCheckingCase(ValueTestCases, "checkmem")
+runErrorCheckingCase(MemoryLimitTestCases, "checkmem")
+runErrorCheckingCase(RuntimeTestCases, "checkregmem")
+runValueCheckingCase(ValueTestCases, "checkregmem")
+runErrorCheckingCase(MemoryLimitTestCases, "checkregmem")
+# 折叠常量表达式、窥孔优化后执行，结果必须和不优化时相同
+runErrorCheckingCase(RuntimeTestCases, "checkopt")
+runValueCheckingCase(ValueTestCases, "checkopt")
+runErrorCheckingCase(RuntimeTestCases, "checkregopt")
+runValueCheckingCase(ValueTestCases, "checkregopt")
+runErrorCheckingCase(RuntimeTestCases, "checkregoptsnapshot")
+runValueCheckingCase(ValueTestCases, "checkregoptsnapshot")
+# 没有通过校验的字节码由带检查的执行循环执行
+runValueCheckingCase(BadJumpTestCases, "checkbadjump")
 
 htmlTemplate = """
 <!DOCTYPE html>